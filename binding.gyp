@@ -4,7 +4,8 @@
       "target_name": "mongo-dbx",
       "defines": [
                     "MONGO_STATIC_BUILD",
-                    "MONGO_HAVE_STDINT"
+                    "MONGO_HAVE_STDINT",
+                    "MONGO_HAVE_ZLIB"
                  ],
       "include_dirs": [
                          "src/mongo"
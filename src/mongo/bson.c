@@ -25,6 +25,24 @@
 #include <time.h>
 #include <limits.h>
 
+#ifdef _WIN32
+#include <process.h>
+#include <intrin.h>
+#define bson_getpid() _getpid()
+#define bson_atomic_add( p, n ) _InterlockedExchangeAdd( ( volatile long * )( p ), ( long )( n ) )
+#define bson_atomic_cas( p, o, n ) _InterlockedCompareExchange( ( volatile long * )( p ), ( long )( n ), ( long )( o ) )
+#else
+#include <unistd.h>
+#define bson_getpid() getpid()
+#define bson_atomic_add( p, n ) __sync_fetch_and_add( ( p ), ( n ) )
+#define bson_atomic_cas( p, o, n ) __sync_val_compare_and_swap( ( p ), ( o ), ( n ) )
+#endif
+
+#if defined( __SSE2__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 2 )
+#include <emmintrin.h>
+#define BSON_HAVE_SSE2
+#endif
+
 #include "bson.h"
 #include "encoding.h"
 
@@ -58,6 +76,10 @@ static size_t _bson_position( const bson *b );
 static int ( *oid_fuzz_func )( void ) = NULL;
 static int ( *oid_inc_func )( void )  = NULL;
 
+/* ObjectId generator state: the fuzz is chosen once per process and the counter is shared by all threads. */
+static volatile int oid_fuzz = 0;
+static volatile int oid_incr = 0;
+
 /* ----------------------------
    READING
    ------------------------------ */
@@ -98,13 +120,118 @@ int bson_init_finished_data_with_copy( bson *b, const char *data ) {
     return BSON_OK;
 }
 
+#define BSON_CHECK_MAX_DEPTH 100
+
+static int bson_check_data( bson *b, const char *data, int size, int depth ) {
+    const char *p, *end, *name;
+    int len, sublen;
+    bson_type type;
+
+    if ( size < 5 || depth > BSON_CHECK_MAX_DEPTH ) return BSON_ERROR;
+    bson_little_endian32( &len, data );
+    if ( len != size || data[size - 1] != '\0' ) return BSON_ERROR;
+
+    p = data + 4;
+    end = data + size - 1;
+    while ( p < end ) {
+        type = ( bson_type )( unsigned char )*p++;
+        name = p;
+        p = ( const char * )memchr( p, '\0', end - p );
+        if ( !p ) return BSON_ERROR;
+        bson_check_field_name( b, name, p - name );
+        p ++;
+
+        switch ( type ) {
+        case BSON_UNDEFINED:
+        case BSON_NULL:
+        case BSON_MAXKEY:
+        case BSON_MINKEY:
+            len = 0;
+            break;
+        case BSON_BOOL:
+            len = 1;
+            break;
+        case BSON_INT:
+            len = 4;
+            break;
+        case BSON_DOUBLE:
+        case BSON_DATE:
+        case BSON_TIMESTAMP:
+        case BSON_LONG:
+            len = 8;
+            break;
+        case BSON_OID:
+            len = 12;
+            break;
+        case BSON_STRING:
+        case BSON_CODE:
+        case BSON_SYMBOL:
+        case BSON_DBREF:
+            if ( end - p < 4 ) return BSON_ERROR;
+            bson_little_endian32( &sublen, p );
+            if ( sublen < 1 || sublen > end - p - 4 || p[4 + sublen - 1] != '\0' ) return BSON_ERROR;
+            bson_check_string( b, p + 4, sublen - 1 );
+            len = 4 + sublen + ( type == BSON_DBREF ? 12 : 0 );
+            break;
+        case BSON_OBJECT:
+        case BSON_ARRAY:
+            if ( end - p < 5 ) return BSON_ERROR;
+            bson_little_endian32( &len, p );
+            if ( len < 5 || len > end - p ) return BSON_ERROR;
+            if ( bson_check_data( b, p, len, depth + 1 ) == BSON_ERROR ) return BSON_ERROR;
+            break;
+        case BSON_BINDATA:
+            if ( end - p < 5 ) return BSON_ERROR;
+            bson_little_endian32( &sublen, p );
+            if ( sublen < 0 || sublen > end - p - 5 ) return BSON_ERROR;
+            len = 5 + sublen;
+            break;
+        case BSON_REGEX:
+            name = ( const char * )memchr( p, '\0', end - p );
+            if ( !name ) return BSON_ERROR;
+            name = ( const char * )memchr( name + 1, '\0', end - name - 1 );
+            if ( !name ) return BSON_ERROR;
+            len = ( int )( name + 1 - p );
+            break;
+        case BSON_CODEWSCOPE:
+            if ( end - p < 14 ) return BSON_ERROR;
+            bson_little_endian32( &len, p );
+            bson_little_endian32( &sublen, p + 4 );
+            if ( len < 14 || len > end - p || sublen < 1 || sublen > len - 13 || p[8 + sublen - 1] != '\0' ) return BSON_ERROR;
+            if ( bson_check_data( b, p + 8 + sublen, len - 8 - sublen, depth + 1 ) == BSON_ERROR ) return BSON_ERROR;
+            break;
+        default:
+            return BSON_ERROR;
+        }
+
+        if ( len > end - p ) return BSON_ERROR;
+        p += len;
+    }
+
+    return p == end ? BSON_OK : BSON_ERROR;
+}
+
+MONGO_EXPORT int bson_init_finished_data_checked( bson *b, char *data, int size ) {
+    int err;
+
+    _bson_zero( b );
+    if ( !data || bson_check_data( b, data, size, 0 ) == BSON_ERROR ) {
+        _bson_zero( b );
+        return BSON_ERROR;
+    }
+    err = b->err;
+    bson_init_finished_data( b, data, 0 );
+    b->err = err;
+    return BSON_OK;
+}
+
 MONGO_EXPORT bson_bool_t bson_init_empty( bson *obj ) {
     bson_init_finished_data( obj, bson_shared_empty_data, 0 );
     return BSON_OK;
 }
 
 MONGO_EXPORT const bson *bson_shared_empty( void ) {
-    static const bson shared_empty = { bson_shared_empty_data, bson_shared_empty_data, 128, 1, 0, 0, 0, 0, NULL, {0} };
+    static const bson shared_empty = { bson_shared_empty_data, bson_shared_empty_data, 128, 1, 0, 0, 0, 0, 0, NULL, {0} };
     return &shared_empty;
 }
 
@@ -139,6 +266,25 @@ MONGO_EXPORT int bson_has_data( const bson *b ) {
     return b->data != NULL;
 }
 
+#ifdef BSON_HAVE_SSE2
+/* Classify 16 characters: digits and a-f map to 0xff in *canonical, A-F only decode. */
+static __m128i bson_hex_nibbles( __m128i c, __m128i *canonical ) {
+    __m128i digit = _mm_and_si128( _mm_cmpgt_epi8( c, _mm_set1_epi8( '0' - 1 ) ), _mm_cmplt_epi8( c, _mm_set1_epi8( '9' + 1 ) ) );
+    __m128i lower = _mm_and_si128( _mm_cmpgt_epi8( c, _mm_set1_epi8( 'a' - 1 ) ), _mm_cmplt_epi8( c, _mm_set1_epi8( 'f' + 1 ) ) );
+    __m128i upper = _mm_and_si128( _mm_cmpgt_epi8( c, _mm_set1_epi8( 'A' - 1 ) ), _mm_cmplt_epi8( c, _mm_set1_epi8( 'F' + 1 ) ) );
+
+    *canonical = _mm_or_si128( digit, lower );
+    return _mm_or_si128( _mm_or_si128(
+        _mm_and_si128( digit, _mm_sub_epi8( c, _mm_set1_epi8( '0' ) ) ),
+        _mm_and_si128( lower, _mm_sub_epi8( c, _mm_set1_epi8( 'a' - 10 ) ) ) ),
+        _mm_and_si128( upper, _mm_sub_epi8( c, _mm_set1_epi8( 'A' - 10 ) ) ) );
+}
+
+/* Pack pairs of nibbles (high nibble first) into bytes. */
+static __m128i bson_hex_pack( __m128i n ) {
+    return _mm_or_si128( _mm_slli_epi16( _mm_and_si128( n, _mm_set1_epi16( 0x00ff ) ), 4 ), _mm_srli_epi16( n, 8 ) );
+}
+#else
 static char hexbyte( char hex ) {
     if (hex >= '0' && hex <= '9')
         return (hex - '0');
@@ -149,24 +295,84 @@ static char hexbyte( char hex ) {
     else
         return 0x0;
 }
+#endif
 
-MONGO_EXPORT void bson_oid_from_string( bson_oid_t *oid, const char *str ) {
-    int i;
+/* Decode exactly 24 hex characters (invalid characters decode as 0).  Returns
+   non-zero if they were all digits or lower case a-f, the form bson_oid_to_string( ) produces. */
+static int bson_oid_hex_decode( bson_oid_t *oid, const char *str ) {
+#ifdef BSON_HAVE_SSE2
+    __m128i c0, c1, v0, v1, out;
+    int tail;
+
+    c0 = bson_hex_nibbles( _mm_loadu_si128( ( const __m128i * )str ), &v0 );
+    c1 = bson_hex_nibbles( _mm_loadl_epi64( ( const __m128i * )( str + 16 ) ), &v1 );
+    out = _mm_packus_epi16( bson_hex_pack( c0 ), bson_hex_pack( c1 ) );
+
+    _mm_storel_epi64( ( __m128i * )oid->bytes, out );
+    tail = _mm_cvtsi128_si32( _mm_srli_si128( out, 8 ) );
+    memcpy( oid->bytes + 8, &tail, 4 );
+
+    return _mm_movemask_epi8( v0 ) == 0xffff && ( _mm_movemask_epi8( v1 ) & 0xff ) == 0xff;
+#else
+    int i, canonical = 1;
+    for ( i=0; i<24; i++ ) {
+        if ( !( ( str[i] >= '0' && str[i] <= '9' ) || ( str[i] >= 'a' && str[i] <= 'f' ) ) )
+            canonical = 0;
+    }
     for ( i=0; i<12; i++ ) {
         oid->bytes[i] = ( hexbyte( str[2*i] ) << 4 ) | hexbyte( str[2*i + 1] );
     }
+    return canonical;
+#endif
+}
+
+MONGO_EXPORT void bson_oid_from_string( bson_oid_t *oid, const char *str ) {
+    bson_oid_hex_decode( oid, str );
+}
+
+MONGO_EXPORT int bson_oid_from_hex( bson_oid_t *oid, const char *str, size_t len ) {
+    if ( len != 24 )
+        return BSON_ERROR;
+    return bson_oid_hex_decode( oid, str ) ? BSON_OK : BSON_ERROR;
 }
 
 MONGO_EXPORT void bson_oid_to_string( const bson_oid_t *oid, char *str ) {
+#ifdef BSON_HAVE_SSE2
+    __m128i in, hi, lo, c0, c1, nine, alpha;
+    int tail;
+
+    memcpy( &tail, oid->bytes + 8, 4 );
+    in = _mm_unpacklo_epi64( _mm_loadl_epi64( ( const __m128i * )oid->bytes ), _mm_cvtsi32_si128( tail ) );
+
+    /* Interleave the high and low nibbles, then map 0-9 to '0'-'9' and 10-15 to 'a'-'f' */
+    hi = _mm_and_si128( _mm_srli_epi16( in, 4 ), _mm_set1_epi8( 0x0f ) );
+    lo = _mm_and_si128( in, _mm_set1_epi8( 0x0f ) );
+    c0 = _mm_unpacklo_epi8( hi, lo );
+    c1 = _mm_unpackhi_epi8( hi, lo );
+    nine = _mm_set1_epi8( 9 );
+    alpha = _mm_set1_epi8( 'a' - '0' - 10 );
+    c0 = _mm_add_epi8( _mm_add_epi8( c0, _mm_set1_epi8( '0' ) ), _mm_and_si128( _mm_cmpgt_epi8( c0, nine ), alpha ) );
+    c1 = _mm_add_epi8( _mm_add_epi8( c1, _mm_set1_epi8( '0' ) ), _mm_and_si128( _mm_cmpgt_epi8( c1, nine ), alpha ) );
+
+    _mm_storeu_si128( ( __m128i * )str, c0 );
+    _mm_storel_epi64( ( __m128i * )( str + 16 ), c1 );
+#else
     static const char hex[16] = {'0','1','2','3','4','5','6','7','8','9','a','b','c','d','e','f'};
     int i;
     for ( i=0; i<12; i++ ) {
         str[2*i]     = hex[( oid->bytes[i] & 0xf0 ) >> 4];
         str[2*i + 1] = hex[ oid->bytes[i] & 0x0f      ];
     }
+#endif
     str[24] = '\0';
 }
 
+MONGO_EXPORT void bson_oid_to_string_n( const bson_oid_t *oids, char *str, int n ) {
+    int k;
+    for ( k = 0; k < n; k++ )
+        bson_oid_to_string( &oids[k], str + k * 25 );
+}
+
 MONGO_EXPORT void bson_set_oid_fuzz( int ( *func )( void ) ) {
     oid_fuzz_func = func;
 }
@@ -175,29 +381,80 @@ MONGO_EXPORT void bson_set_oid_inc( int ( *func )( void ) ) {
     oid_inc_func = func;
 }
 
-MONGO_EXPORT void bson_oid_gen( bson_oid_t *oid ) {
-    static int incr = 0;
-    static int fuzz = 0;
-    int i;
-    time_t t = time( NULL );
+static unsigned int bson_oid_mix( unsigned int h ) {
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
 
-    if( oid_inc_func )
-        i = oid_inc_func();
-    else
-        i = incr++;
+/* Choose the fuzz (the second four bytes) for this process.  The time alone is not enough:
+   processes started within the same second would generate the same ids. */
+static int bson_oid_get_fuzz( void ) {
+    int fuzz = oid_fuzz;
+    unsigned int h, r = 0;
+#ifndef _WIN32
+    FILE *fp;
+#endif
 
-    if ( !fuzz ) {
-        if ( oid_fuzz_func )
-            fuzz = oid_fuzz_func();
-        else {
-            srand( ( int )t );
-            fuzz = rand();
+    if ( fuzz )
+        return fuzz;
+
+    if ( oid_fuzz_func )
+        fuzz = oid_fuzz_func();
+    else {
+#ifndef _WIN32
+        fp = fopen( "/dev/urandom", "rb" );
+        if ( fp ) {
+            if ( fread( &r, sizeof( r ), 1, fp ) != 1 )
+                r = 0;
+            fclose( fp );
         }
+#endif
+        h = bson_oid_mix( r ^ ( unsigned int )time( NULL ) );
+        h = bson_oid_mix( h ^ ( unsigned int )bson_getpid() );
+        h = bson_oid_mix( h ^ ( unsigned int )clock() );
+        h = bson_oid_mix( h ^ ( unsigned int )( size_t )&h );
+        fuzz = ( int )h;
     }
+    if ( !fuzz )
+        fuzz = 1;
 
-    bson_big_endian32( &oid->ints[0], &t );
-    oid->ints[1] = fuzz;
-    bson_big_endian32( &oid->ints[2], &i );
+    /* The first thread to get here decides */
+    bson_atomic_cas( &oid_fuzz, 0, fuzz );
+    return oid_fuzz;
+}
+
+MONGO_EXPORT void bson_oid_gen( bson_oid_t *oid ) {
+    bson_oid_gen_n( oid, 1 );
+}
+
+MONGO_EXPORT void bson_oid_gen_n( bson_oid_t *oids, int n ) {
+    unsigned int i = 0;
+    int fuzz, k;
+    time_t t;
+
+    if ( n < 1 )
+        return;
+
+    fuzz = bson_oid_get_fuzz();
+    t = time( NULL );
+
+    /* Reserve n consecutive counter values.  The counter starts at a point derived from the fuzz. */
+    if ( !oid_inc_func )
+        i = ( unsigned int )bson_atomic_add( &oid_incr, n ) + bson_oid_mix( ( unsigned int )fuzz ^ 0x9e3779b9 );
+
+    for ( k = 0; k < n; k++ ) {
+        if ( oid_inc_func )
+            i = ( unsigned int )oid_inc_func();
+
+        bson_big_endian32( &oids[k].ints[0], &t );
+        oids[k].ints[1] = fuzz;
+        bson_big_endian32( &oids[k].ints[2], &i );
+        i++;
+    }
 }
 
 MONGO_EXPORT time_t bson_oid_generated_time( bson_oid_t *oid ) {
@@ -632,6 +889,24 @@ int bson_init_size( bson *b, int size ) {
     return BSON_OK;
 }
 
+MONGO_EXPORT int bson_init_buffer( bson *b, char *buffer, int size ) {
+    _bson_zero( b );
+    if ( !buffer || size < 5 ) return BSON_ERROR;
+    b->data = buffer;
+    b->dataSize = size;
+    b->ownsData = 0;
+    b->flags = BSON_FLAG_GROWABLE;
+    b->cur = b->data + 4;
+    return BSON_OK;
+}
+
+MONGO_EXPORT void bson_set_trusted_utf8( bson *b, bson_bool_t trusted ) {
+    if ( trusted )
+        b->flags |= BSON_FLAG_TRUSTED_UTF8;
+    else
+        b->flags &= ~BSON_FLAG_TRUSTED_UTF8;
+}
+
 int bson_init_unfinished_data( bson *b, char *data, int dataSize, bson_bool_t ownsData ) {
     _bson_zero( b );
     b->data = data;
@@ -716,14 +991,22 @@ int bson_ensure_space( bson *b, const size_t bytesNeeded ) {
         }
     }
 
-    if ( ! b->ownsData ) {
+    if ( ! b->ownsData && ( b->flags & BSON_FLAG_GROWABLE ) ) {
+        /* Move out of the caller's buffer into a block of our own */
+        b->data = (char *) bson_malloc( new_size );
+        memcpy( b->data, orig, pos );
+        b->ownsData = 1;
+        b->flags &= ~BSON_FLAG_GROWABLE;
+    }
+    else if ( ! b->ownsData ) {
         b->err = BSON_DOES_NOT_OWN_DATA;
         return BSON_ERROR;
     }
-
-    b->data = bson_realloc( b->data, new_size );
-    if ( !b->data )
-        bson_fatal_msg( !!b->data, "realloc() failed" );
+    else {
+        b->data = bson_realloc( b->data, new_size );
+        if ( !b->data )
+            bson_fatal_msg( !!b->data, "realloc() failed" );
+    }
 
     b->dataSize = new_size;
     b->cur += b->data - orig;
@@ -887,6 +1170,25 @@ MONGO_EXPORT int bson_append_string_n( bson *b, const char *name, const char *va
     return bson_append_string_base( b, name, value, len, BSON_STRING );
 }
 
+MONGO_EXPORT char *bson_append_string_reserve( bson *b, const char *name, size_t max_len ) {
+    if ( max_len + 1 > INT32_MAX ) {
+        b->err = BSON_SIZE_OVERFLOW;
+        return NULL;
+    }
+    if ( bson_append_estart( b, BSON_STRING, name, 4 + max_len + 1 ) == BSON_ERROR )
+        return NULL;
+    return b->cur + 4;
+}
+
+MONGO_EXPORT int bson_append_string_finish( bson *b, size_t len ) {
+    /* The element is completed even if the check fails: the error is recorded in b->err so bson_finish( ) will fail */
+    int res = bson_check_string( b, b->cur + 4, len );
+    bson_append32_as_int( b , ( int )( len + 1 ) );
+    b->cur += len;
+    bson_append_byte( b , 0 );
+    return res;
+}
+
 MONGO_EXPORT int bson_append_symbol_n( bson *b, const char *name, const char *value, size_t len ) {
     return bson_append_string_base( b, name, value, len, BSON_SYMBOL );
 }
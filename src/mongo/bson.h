@@ -95,6 +95,11 @@ enum bson_validity_t {
     BSON_FIELD_INIT_DOLLAR = (1 << 3)   /**< Warning: key starts with '$' character. */
 };
 
+enum bson_flags_t {
+    BSON_FLAG_GROWABLE =     (1 << 0),  /**< The data block is not owned but may be replaced by an owned copy when it needs to grow. */
+    BSON_FLAG_TRUSTED_UTF8 = (1 << 1)   /**< Strings and field names are known to be valid UTF-8 and are not checked again. */
+};
+
 enum bson_binary_subtype_t {
     BSON_BIN_BINARY = 0,
     BSON_BIN_FUNC = 1,
@@ -142,6 +147,7 @@ typedef struct {
     bson_bool_t finished; /**< When finished, the BSON object can no longer be modified. */
     bson_bool_t ownsData; /**< Whether destroying this object will deallocate its data block */
     int err;              /**< Bitfield representing errors or warnings on this buffer */
+    int flags;            /**< Bitfield of bson_flags_t */
     int stackSize;        /**< Number of elements in the current stack */
     int stackPos;         /**< Index of current stack position. */
     size_t* stackPtr;     /**< Pointer to the current stack */
@@ -226,6 +232,22 @@ MONGO_EXPORT int bson_init_finished_data( bson *b, char *data, bson_bool_t ownsD
  */
 MONGO_EXPORT int bson_init_finished_data_with_copy( bson *b, const char *data );
 
+/**
+ * Initialize a BSON object for reading from finalized BSON data
+ * supplied by the caller (for example, from another process) after
+ * checking that it is well formed. Field names and strings are checked
+ * as they would be by the append functions, so the usual error flags
+ * (BSON_NOT_UTF8, BSON_FIELD_HAS_DOT and BSON_FIELD_INIT_DOLLAR) are
+ * set in b->err. The data is not copied and is not freed by bson_destroy( ).
+ *
+ * @param b the BSON object to initialize.
+ * @param data the finalized raw BSON data.
+ * @param size the number of bytes available at data.
+ *
+ * @return BSON_OK or BSON_ERROR if the data is not a complete, well formed BSON document.
+ */
+MONGO_EXPORT int bson_init_finished_data_checked( bson *b, char *data, int size );
+
 /**
  * Size of a BSON object.
  *
@@ -612,6 +634,19 @@ MONGO_EXPORT void bson_iterator_subiterator( const bson_iterator *i, bson_iterat
  */
 MONGO_EXPORT void bson_oid_from_string( bson_oid_t *oid, const char *str );
 
+/**
+ * Create a bson_oid_t from a string, checking that the string is a
+ * valid id in the form produced by bson_oid_to_string( ): exactly 24
+ * hex digits, in lower case.
+ *
+ * @param oid the bson_oid_t destination.
+ * @param str the string.
+ * @param len the length of the string.
+ *
+ * @return BSON_OK or BSON_ERROR if the string is not a valid id.
+ */
+MONGO_EXPORT int bson_oid_from_hex( bson_oid_t *oid, const char *str, size_t len );
+
 /**
  * Create a string representation of the bson_oid_t.
  *
@@ -620,6 +655,16 @@ MONGO_EXPORT void bson_oid_from_string( bson_oid_t *oid, const char *str );
  */
 MONGO_EXPORT void bson_oid_to_string( const bson_oid_t *oid, char *str );
 
+/**
+ * Create the string representations of a number of bson_oid_t objects.
+ *
+ * @param oids the bson_oid_t sources.
+ * @param str the destination: n null terminated strings of 24 hex chars,
+ *     one every 25 bytes.
+ * @param n the number of objects.
+ */
+MONGO_EXPORT void bson_oid_to_string_n( const bson_oid_t *oids, char *str, int n );
+
 /**
  * Create a bson_oid object.
  *
@@ -627,6 +672,17 @@ MONGO_EXPORT void bson_oid_to_string( const bson_oid_t *oid, char *str );
  */
 MONGO_EXPORT void bson_oid_gen( bson_oid_t *oid );
 
+/**
+ * Create a number of bson_oid objects at once.  The ids share the
+ * same time and have consecutive counters.  Unless a function has been
+ * set with bson_set_oid_inc( ), this is safe to call from several
+ * threads at once.
+ *
+ * @param oids the destination for the newly created bson_oid_t objects.
+ * @param n the number of objects to create.
+ */
+MONGO_EXPORT void bson_oid_gen_n( bson_oid_t *oids, int n );
+
 /**
  * Set a function to be used to generate the second four bytes
  * of an object id.
@@ -637,8 +693,8 @@ MONGO_EXPORT void bson_set_oid_fuzz( int ( *func )( void ) );
 
 /**
  * Set a function to be used to generate the incrementing part
- * of an object id (last four bytes). If you need thread-safety
- * in generating object ids, you should set this function.
+ * of an object id (last four bytes). The built-in counter is
+ * thread-safe; a function set here must be thread-safe itself.
  *
  * @param func a pointer to a function that returns an int.
  */
@@ -682,6 +738,36 @@ MONGO_EXPORT int bson_init( bson *b );
  */
 int bson_init_size( bson *b, int size );
 
+/**
+ * Initialize a BSON object for building in a buffer supplied by the
+ * caller (for example, from a memory pool). The buffer is never freed
+ * or reallocated by the BSON object: if more space is needed, the data
+ * is moved to a newly allocated block which is then owned by the object.
+ *
+ * @note When done using the bson object, you must pass it
+ *  to bson_destroy( ).
+ *
+ * @param b the BSON object to initialize.
+ * @param buffer the initial data buffer.
+ * @param size the size of the buffer (at least 5 bytes).
+ *
+ * @return BSON_OK or BSON_ERROR.
+ */
+MONGO_EXPORT int bson_init_buffer( bson *b, char *buffer, int size );
+
+/**
+ * Declare that the strings and field names appended to a BSON object
+ * under construction are known to be valid UTF-8 (for example, because
+ * they were produced by a JavaScript engine), so that they are not
+ * checked again. Field names are still checked for '.' and a leading
+ * '$', and BSON_FIELD_HAS_DOT and BSON_FIELD_INIT_DOLLAR are set as usual.
+ * Call this after the object has been initialized.
+ *
+ * @param b the BSON object.
+ * @param trusted true to skip the UTF-8 checks, false to restore them.
+ */
+MONGO_EXPORT void bson_set_trusted_utf8( bson *b, bson_bool_t trusted );
+
 /**
  * Initialize a BSON object for building, using the provided char*
  * of the given size. When ownsData is true, the BSON object may
@@ -841,6 +927,31 @@ MONGO_EXPORT int bson_append_string( bson *b, const char *name, const char *str
  */
 MONGO_EXPORT int bson_append_string_n( bson *b, const char *name, const char *str, size_t len );
 
+/**
+ * Start appending a string whose value is to be written directly
+ * into the bson's buffer, avoiding an intermediate copy. Space for
+ * up to max_len bytes (not including the terminating null) is
+ * reserved. The element must be completed with
+ * bson_append_string_finish( ) before anything else is appended.
+ *
+ * @param b the bson to append to.
+ * @param name the key for the string.
+ * @param max_len the maximum number of bytes that will be written.
+ *
+ * @return a pointer to the space reserved for the string, or NULL on error.
+ */
+MONGO_EXPORT char *bson_append_string_reserve( bson *b, const char *name, size_t max_len );
+
+/**
+ * Complete a string started with bson_append_string_reserve( ).
+ *
+ * @param b the bson to append to.
+ * @param len the number of bytes actually written (at most max_len).
+ *
+ * @return BSON_OK or BSON_ERROR.
+ */
+MONGO_EXPORT int bson_append_string_finish( bson *b, size_t len );
+
 /**
  * Append a symbol to a bson.
  *
@@ -36,6 +36,13 @@
  * remains attached.
  */
 
+#if defined( __SSE2__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 2 )
+#include <emmintrin.h>
+#define BSON_HAVE_SSE2
+#endif
+
+#include <string.h>
+
 #include "bson.h"
 #include "encoding.h"
 
@@ -176,28 +183,64 @@ static int bson_validate_string( bson *b, const unsigned char *string,
                                  const char check_dollar ) {
 
     size_t position = 0;
-    int sequence_length = 1;
+    int sequence_length;
+#ifdef BSON_HAVE_SSE2
+    __m128i c0, c1, dot = _mm_set1_epi8( '.' );
+#endif
 
     if( check_dollar && string[0] == '$' ) {
         if( !bson_string_is_db_ref( string, length ) )
             b->err |= BSON_FIELD_INIT_DOLLAR;
     }
 
+    if ( !check_utf8 ) {
+        if ( check_dot && memchr( string, '.', length ) )
+            b->err |= BSON_FIELD_HAS_DOT;
+        return BSON_OK;
+    }
+
     while ( position < length ) {
+#ifdef BSON_HAVE_SSE2
+        /* ASCII fast path: skip runs of bytes below 0x80, 32 or 16 at a time, checking for '.' in the same pass */
+        while ( length - position >= 32 ) {
+            c0 = _mm_loadu_si128( ( const __m128i * )( string + position ) );
+            c1 = _mm_loadu_si128( ( const __m128i * )( string + position + 16 ) );
+            if ( _mm_movemask_epi8( _mm_or_si128( c0, c1 ) ) )
+                break;
+            if ( check_dot && _mm_movemask_epi8( _mm_or_si128( _mm_cmpeq_epi8( c0, dot ), _mm_cmpeq_epi8( c1, dot ) ) ) )
+                b->err |= BSON_FIELD_HAS_DOT;
+            position += 32;
+        }
+        if ( length - position >= 16 ) {
+            c0 = _mm_loadu_si128( ( const __m128i * )( string + position ) );
+            if ( !_mm_movemask_epi8( c0 ) ) {
+                if ( check_dot && _mm_movemask_epi8( _mm_cmpeq_epi8( c0, dot ) ) )
+                    b->err |= BSON_FIELD_HAS_DOT;
+                position += 16;
+                continue;
+            }
+            /* There is a multi-byte sequence in this block: step over the ASCII bytes before it */
+            while ( *( string + position ) < 0x80 ) {
+                if ( check_dot && *( string + position ) == '.' )
+                    b->err |= BSON_FIELD_HAS_DOT;
+                position ++;
+            }
+        }
+        else if ( position == length )
+            break;
+#endif
         if ( check_dot && *( string + position ) == '.' ) {
             b->err |= BSON_FIELD_HAS_DOT;
         }
 
-        if ( check_utf8 ) {
-            sequence_length = trailingBytesForUTF8[*( string + position )] + 1;
-            if ( ( position + sequence_length ) > length ) {
-                b->err |= BSON_NOT_UTF8;
-                return BSON_ERROR;
-            }
-            if ( !isLegalUTF8( string + position, sequence_length ) ) {
-                b->err |= BSON_NOT_UTF8;
-                return BSON_ERROR;
-            }
+        sequence_length = trailingBytesForUTF8[*( string + position )] + 1;
+        if ( ( position + sequence_length ) > length ) {
+            b->err |= BSON_NOT_UTF8;
+            return BSON_ERROR;
+        }
+        if ( !isLegalUTF8( string + position, sequence_length ) ) {
+            b->err |= BSON_NOT_UTF8;
+            return BSON_ERROR;
         }
         position += sequence_length;
     }
@@ -209,11 +252,13 @@ static int bson_validate_string( bson *b, const unsigned char *string,
 int bson_check_string( bson *b, const char *string,
                        const size_t length ) {
 
+    if ( b->flags & BSON_FLAG_TRUSTED_UTF8 )
+        return BSON_OK;
     return bson_validate_string( b, ( const unsigned char * )string, length, 1, 0, 0 );
 }
 
 int bson_check_field_name( bson *b, const char *string,
                            const size_t length ) {
 
-    return bson_validate_string( b, ( const unsigned char * )string, length, 1, 1, 1 );
+    return bson_validate_string( b, ( const unsigned char * )string, length, !( b->flags & BSON_FLAG_TRUSTED_UTF8 ), 1, 1 );
 }
@@ -32,7 +32,8 @@ MONGO_EXTERN_C_START
  * @return BSON_OK if valid UTF8 and BSON_ERROR if not. All BSON strings must be
  *     valid UTF8. This function will also check whether the string
  *     contains '.' or starts with '$', since the validity of this depends on context.
- *     Set the value of b->err appropriately.
+ *     Set the value of b->err appropriately.  If the object has
+ *     BSON_FLAG_TRUSTED_UTF8 set, only the '.' and '$' checks are made.
  */
 int bson_check_field_name( bson *b, const char *string,
                            const size_t length );
@@ -45,7 +46,8 @@ int bson_check_field_name( bson *b, const char *string,
  * @param length The length of the string.
  *
  * @return BSON_OK if valid UTF-8; otherwise, BSON_ERROR.
- *     Sets b->err on error.
+ *     Sets b->err on error.  Always BSON_OK if the object has
+ *     BSON_FLAG_TRUSTED_UTF8 set.
  */
 bson_bool_t bson_check_string( bson *b, const char *string,
                                const size_t length );
@@ -56,6 +56,45 @@ int mongo_env_write_socket( mongo *conn, const void *buf, size_t len ) {
     return MONGO_OK;
 }
 
+/* Send the buffers, less the first skip bytes, with a single WSASend( ). */
+static int mongo_env_wsasend( SOCKET sock, const mongo_iovec *iov, int count, size_t skip, DWORD *sent ) {
+    WSABUF buf[MONGO_IOV_MAX];
+    int n;
+
+    while ( count && skip >= iov->len ) {
+        skip -= iov->len;
+        iov++;
+        count--;
+    }
+    for ( n = 0; n < count && n < MONGO_IOV_MAX; n++ ) {
+        buf[n].buf = ( char * )iov[n].data + skip;
+        buf[n].len = ( ULONG )( iov[n].len - skip );
+        skip = 0;
+    }
+
+    return WSASend( sock, buf, ( DWORD )n, sent, 0, NULL, NULL );
+}
+
+int mongo_env_writev_socket( mongo *conn, const mongo_iovec *iov, int count ) {
+    size_t len = 0, done = 0;
+    DWORD sent;
+    int i;
+
+    for ( i = 0; i < count; i++ )
+        len += iov[i].len;
+
+    while ( done < len ) {
+        if ( mongo_env_wsasend( conn->sock, iov, count, done, &sent ) == SOCKET_ERROR ) {
+            __mongo_set_error( conn, MONGO_IO_ERROR, NULL, WSAGetLastError() );
+            conn->connected = 0;
+            return MONGO_ERROR;
+        }
+        done += sent;
+    }
+
+    return MONGO_OK;
+}
+
 int mongo_env_read_socket( mongo *conn, void *buf, size_t len ) {
     char *cbuf = (char*)buf;
 
@@ -72,6 +111,57 @@ int mongo_env_read_socket( mongo *conn, void *buf, size_t len ) {
     return MONGO_OK;
 }
 
+int mongo_env_set_socket_blocking( mongo *conn, int blocking ) {
+    u_long mode = blocking ? 0 : 1;
+
+    if ( ioctlsocket( conn->sock, FIONBIO, &mode ) != 0 ) {
+        __mongo_set_error( conn, MONGO_IO_ERROR, "ioctlsocket FIONBIO failed.", WSAGetLastError() );
+        return MONGO_ERROR;
+    }
+
+    return MONGO_OK;
+}
+
+int mongo_env_send_socket( mongo *conn, const void *buf, size_t len ) {
+    int sent = send( conn->sock, (const char*)buf, (int) len, 0 );
+    if ( sent == SOCKET_ERROR ) {
+        if ( WSAGetLastError() == WSAEWOULDBLOCK )
+            return 0;
+        __mongo_set_error( conn, MONGO_IO_ERROR, NULL, WSAGetLastError() );
+        conn->connected = 0;
+        return -1;
+    }
+
+    return sent;
+}
+
+int mongo_env_sendv_socket( mongo *conn, const mongo_iovec *iov, int count ) {
+    DWORD sent;
+
+    if ( mongo_env_wsasend( conn->sock, iov, count, 0, &sent ) == SOCKET_ERROR ) {
+        if ( WSAGetLastError() == WSAEWOULDBLOCK )
+            return 0;
+        __mongo_set_error( conn, MONGO_IO_ERROR, NULL, WSAGetLastError() );
+        conn->connected = 0;
+        return -1;
+    }
+
+    return ( int ) sent;
+}
+
+int mongo_env_recv_socket( mongo *conn, void *buf, size_t len ) {
+    int got = recv( conn->sock, (char*)buf, (int) len, 0 );
+    if ( got == SOCKET_ERROR && WSAGetLastError() == WSAEWOULDBLOCK )
+        return 0;
+    if ( got == 0 || got == SOCKET_ERROR ) {
+        __mongo_set_error( conn, MONGO_IO_ERROR, NULL, WSAGetLastError() );
+        conn->connected = 0;
+        return -1;
+    }
+
+    return got;
+}
+
 int mongo_env_set_socket_op_timeout( mongo *conn, int millis ) {
     if ( setsockopt( conn->sock, SOL_SOCKET, SO_RCVTIMEO, (const char *)&millis,
                      sizeof( millis ) ) == -1 ) {
@@ -206,6 +296,7 @@ MONGO_EXPORT int mongo_env_sock_init( void ) {
 #include <arpa/inet.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #include <netdb.h>
 #include <netinet/in.h>
@@ -248,6 +339,59 @@ int mongo_env_write_socket( mongo *conn, const void *buf, size_t len ) {
     return MONGO_OK;
 }
 
+/* Send the buffers, less the first skip bytes, with a single sendmsg( ). */
+static ssize_t mongo_env_sendmsg( SOCKET sock, const mongo_iovec *iov, int count, size_t skip ) {
+#ifdef __APPLE__
+    int flags = 0;
+#else
+    int flags = MSG_NOSIGNAL;
+#endif
+    struct iovec vec[MONGO_IOV_MAX];
+    struct msghdr msg;
+    int n;
+
+    while ( count && skip >= iov->len ) {
+        skip -= iov->len;
+        iov++;
+        count--;
+    }
+    for ( n = 0; n < count && n < MONGO_IOV_MAX; n++ ) {
+        vec[n].iov_base = ( char * )iov[n].data + skip;
+        vec[n].iov_len = iov[n].len - skip;
+        skip = 0;
+    }
+
+    memset( &msg, 0, sizeof( msg ) );
+    msg.msg_iov = vec;
+    msg.msg_iovlen = n;
+
+    return sendmsg( sock, &msg, flags );
+}
+
+int mongo_env_writev_socket( mongo *conn, const mongo_iovec *iov, int count ) {
+    size_t len = 0, done = 0;
+    ssize_t sent;
+    int i;
+
+    for ( i = 0; i < count; i++ )
+        len += iov[i].len;
+
+    while ( done < len ) {
+        sent = mongo_env_sendmsg( conn->sock, iov, count, done );
+        if ( sent == -1 ) {
+            if ( errno == EINTR )
+                continue;
+            if (errno == EPIPE)
+                conn->connected = 0;
+            __mongo_set_error( conn, MONGO_IO_ERROR, strerror( errno ), errno );
+            return MONGO_ERROR;
+        }
+        done += sent;
+    }
+
+    return MONGO_OK;
+}
+
 int mongo_env_read_socket( mongo *conn, void *buf, size_t len ) {
     char *cbuf = buf;
     while ( len ) {
@@ -263,6 +407,62 @@ int mongo_env_read_socket( mongo *conn, void *buf, size_t len ) {
     return MONGO_OK;
 }
 
+int mongo_env_set_socket_blocking( mongo *conn, int blocking ) {
+    int flags = fcntl( conn->sock, F_GETFL, 0 );
+
+    if ( flags == -1 ||
+         fcntl( conn->sock, F_SETFL, blocking ? ( flags & ~O_NONBLOCK ) : ( flags | O_NONBLOCK ) ) == -1 ) {
+        __mongo_set_error( conn, MONGO_IO_ERROR, "fcntl O_NONBLOCK failed.", errno );
+        return MONGO_ERROR;
+    }
+
+    return MONGO_OK;
+}
+
+int mongo_env_send_socket( mongo *conn, const void *buf, size_t len ) {
+#ifdef __APPLE__
+    int flags = 0;
+#else
+    int flags = MSG_NOSIGNAL;
+#endif
+    ssize_t sent = send( conn->sock, buf, len, flags );
+    if ( sent == -1 ) {
+        if ( errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR )
+            return 0;
+        __mongo_set_error( conn, MONGO_IO_ERROR, strerror( errno ), errno );
+        conn->connected = 0;
+        return -1;
+    }
+
+    return ( int ) sent;
+}
+
+int mongo_env_sendv_socket( mongo *conn, const mongo_iovec *iov, int count ) {
+    ssize_t sent = mongo_env_sendmsg( conn->sock, iov, count, 0 );
+    if ( sent == -1 ) {
+        if ( errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR )
+            return 0;
+        __mongo_set_error( conn, MONGO_IO_ERROR, strerror( errno ), errno );
+        conn->connected = 0;
+        return -1;
+    }
+
+    return ( int ) sent;
+}
+
+int mongo_env_recv_socket( mongo *conn, void *buf, size_t len ) {
+    ssize_t got = recv( conn->sock, buf, len, 0 );
+    if ( got == -1 && ( errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ) )
+        return 0;
+    if ( got == 0 || got == -1 ) {
+        __mongo_set_error( conn, MONGO_IO_ERROR, got ? strerror( errno ) : "Connection closed by server.", got ? errno : 0 );
+        conn->connected = 0;
+        return -1;
+    }
+
+    return ( int ) got;
+}
+
 int mongo_env_set_socket_op_timeout( mongo *conn, int millis ) {
     struct timeval tv;
     tv.tv_sec = millis / 1000;
@@ -422,6 +622,7 @@ typedef int socklen_t;
 #include <arpa/inet.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netdb.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
@@ -468,6 +669,63 @@ int mongo_env_write_socket( mongo *conn, const void *buf, size_t len ) {
     return MONGO_OK;
 }
 
+/* Send the buffers, less the first skip bytes: with a single sendmsg( ) where there is
+   one, otherwise from the first buffer only. */
+static int mongo_env_sendmsg( SOCKET sock, const mongo_iovec *iov, int count, size_t skip ) {
+#if defined(_WIN32) || defined(__APPLE__)
+    int flags = 0;
+#else
+    int flags = MSG_NOSIGNAL;
+#endif
+#ifndef _WIN32
+    struct iovec vec[MONGO_IOV_MAX];
+    struct msghdr msg;
+    int n;
+#endif
+
+    while ( count && skip >= iov->len ) {
+        skip -= iov->len;
+        iov++;
+        count--;
+    }
+#ifdef _WIN32
+    return ( int ) send( sock, iov->data + skip, ( int )( iov->len - skip ), flags );
+#else
+    for ( n = 0; n < count && n < MONGO_IOV_MAX; n++ ) {
+        vec[n].iov_base = ( char * )iov[n].data + skip;
+        vec[n].iov_len = iov[n].len - skip;
+        skip = 0;
+    }
+
+    memset( &msg, 0, sizeof( msg ) );
+    msg.msg_iov = vec;
+    msg.msg_iovlen = n;
+
+    return ( int ) sendmsg( sock, &msg, flags );
+#endif
+}
+
+int mongo_env_writev_socket( mongo *conn, const mongo_iovec *iov, int count ) {
+    size_t len = 0, done = 0;
+    int i, sent;
+
+    for ( i = 0; i < count; i++ )
+        len += iov[i].len;
+
+    while ( done < len ) {
+        sent = mongo_env_sendmsg( conn->sock, iov, count, done );
+        if ( sent == -1 ) {
+            if (errno == EPIPE)
+                conn->connected = 0;
+            conn->err = MONGO_IO_ERROR;
+            return MONGO_ERROR;
+        }
+        done += sent;
+    }
+
+    return MONGO_OK;
+}
+
 int mongo_env_read_socket( mongo *conn, void *buf, size_t len ) {
     char *cbuf = buf;
     while ( len ) {
@@ -483,6 +741,80 @@ int mongo_env_read_socket( mongo *conn, void *buf, size_t len ) {
     return MONGO_OK;
 }
 
+int mongo_env_set_socket_blocking( mongo *conn, int blocking ) {
+#ifdef _WIN32
+    u_long mode = blocking ? 0 : 1;
+
+    if ( ioctlsocket( conn->sock, FIONBIO, &mode ) != 0 ) {
+#else
+    int flags = fcntl( conn->sock, F_GETFL, 0 );
+
+    if ( flags == -1 ||
+         fcntl( conn->sock, F_SETFL, blocking ? ( flags & ~O_NONBLOCK ) : ( flags | O_NONBLOCK ) ) == -1 ) {
+#endif
+        conn->err = MONGO_IO_ERROR;
+        return MONGO_ERROR;
+    }
+
+    return MONGO_OK;
+}
+
+int mongo_env_send_socket( mongo *conn, const void *buf, size_t len ) {
+#if defined(_WIN32) || defined(__APPLE__)
+    int flags = 0;
+#else
+    int flags = MSG_NOSIGNAL;
+#endif
+    int sent = ( int ) send( conn->sock, buf, len, flags );
+    if ( sent == -1 ) {
+#ifdef _WIN32
+        if ( WSAGetLastError() == WSAEWOULDBLOCK )
+#else
+        if ( errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR )
+#endif
+            return 0;
+        conn->err = MONGO_IO_ERROR;
+        conn->connected = 0;
+        return -1;
+    }
+
+    return sent;
+}
+
+int mongo_env_sendv_socket( mongo *conn, const mongo_iovec *iov, int count ) {
+    int sent = mongo_env_sendmsg( conn->sock, iov, count, 0 );
+    if ( sent == -1 ) {
+#ifdef _WIN32
+        if ( WSAGetLastError() == WSAEWOULDBLOCK )
+#else
+        if ( errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR )
+#endif
+            return 0;
+        conn->err = MONGO_IO_ERROR;
+        conn->connected = 0;
+        return -1;
+    }
+
+    return sent;
+}
+
+int mongo_env_recv_socket( mongo *conn, void *buf, size_t len ) {
+    int got = ( int ) recv( conn->sock, buf, len, 0 );
+#ifdef _WIN32
+    if ( got == -1 && WSAGetLastError() == WSAEWOULDBLOCK )
+#else
+    if ( got == -1 && ( errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ) )
+#endif
+        return 0;
+    if ( got == 0 || got == -1 ) {
+        conn->err = MONGO_IO_ERROR;
+        conn->connected = 0;
+        return -1;
+    }
+
+    return got;
+}
+
 /* This is a no-op in the generic implementation. */
 int mongo_env_set_socket_op_timeout( mongo *conn, int millis ) {
     return MONGO_OK;
@@ -31,8 +31,17 @@ MONGO_EXTERN_C_START
 int mongo_env_set_socket_op_timeout( mongo *conn, int millis );
 int mongo_env_read_socket( mongo *conn, void *buf, size_t len );
 int mongo_env_write_socket( mongo *conn, const void *buf, size_t len );
+int mongo_env_writev_socket( mongo *conn, const mongo_iovec *iov, int count );
 int mongo_env_socket_connect( mongo *conn, const char *host, int port );
 
+/* Non-blocking socket I/O for callers that drive the connection from an event loop.
+   send/recv return the number of bytes transferred, 0 if the call would block
+   or -1 on error (including the connection being closed by the server). */
+MONGO_EXPORT int mongo_env_set_socket_blocking( mongo *conn, int blocking );
+MONGO_EXPORT int mongo_env_send_socket( mongo *conn, const void *buf, size_t len );
+MONGO_EXPORT int mongo_env_sendv_socket( mongo *conn, const mongo_iovec *iov, int count );
+MONGO_EXPORT int mongo_env_recv_socket( mongo *conn, void *buf, size_t len );
+
 /* Initialize socket services */
 MONGO_EXPORT int mongo_env_sock_init( void );
 
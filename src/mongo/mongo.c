@@ -41,6 +41,12 @@
 
 #include <string.h>
 #include <assert.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#ifdef MONGO_HAVE_ZLIB
+#include <zlib.h>
+#endif
 
 MONGO_EXPORT mongo* mongo_alloc( void ) {
     return ( mongo* )bson_malloc( sizeof( mongo ) );
@@ -161,23 +167,6 @@ MONGO_EXPORT void mongo_clear_errors( mongo *conn ) {
     conn->lasterrstr[0] = 0;
 }
 
-/* Note: this function returns a char* which must be freed. */
-static char *mongo_ns_to_cmd_db( const char *ns ) {
-    char *current = NULL;
-    char *cmd_db_name = NULL;
-    int len = 0;
-
-    for( current = (char *)ns; *current != '.'; current++ ) {
-        len++;
-    }
-
-    cmd_db_name = (char *)bson_malloc( len + 6 );
-    strncpy( cmd_db_name, ns, len );
-    strncpy( cmd_db_name + len, ".$cmd", 6 );
-
-    return cmd_db_name;
-}
-
 MONGO_EXPORT int mongo_validate_ns( mongo *conn, const char *ns ) {
     char *last = NULL;
     char *current = NULL;
@@ -294,302 +283,931 @@ static void mongo_set_last_error( mongo *conn, bson_iterator *it, bson *obj ) {
 
 static const int ZERO = 0;
 static const int ONE = 1;
-static mongo_message *mongo_message_create( size_t len , int id , int responseTo , int op ) {
-    mongo_message *mm;
 
-    if( len >= INT32_MAX) {
-        return NULL;
-    }
-    mm = ( mongo_message * )bson_malloc( len );
-    if ( !id )
-        id = rand();
+/* Request ids are unique across all connections and threads so that a reply can always be matched
+   to its request by responseTo, even when several requests are in flight on one connection. */
+static volatile long mongo_request_id = 0;
 
-    /* native endian (converted on send) */
-    mm->head.len = ( int )len;
-    mm->head.id = id;
-    mm->head.responseTo = responseTo;
-    mm->head.op = op;
+static int mongo_next_request_id( void ) {
+#if defined(_MSC_VER)
+    return ( int )( _InterlockedIncrement( &mongo_request_id ) & 0x7fffffff );
+#else
+    return ( int )( __sync_add_and_fetch( &mongo_request_id, 1 ) & 0x7fffffff );
+#endif
+}
 
-    return mm;
+static char *mongo_data_append( char *start , const void *data , size_t len ) {
+    memcpy( start , data , len );
+    return start + len;
 }
 
-/* Always calls bson_free(mm) */
-static int mongo_message_send( mongo *conn, mongo_message *mm ) {
-    mongo_header head; /* little endian */
-    int res;
-    bson_little_endian32( &head.len, &mm->head.len );
-    bson_little_endian32( &head.id, &mm->head.id );
-    bson_little_endian32( &head.responseTo, &mm->head.responseTo );
-    bson_little_endian32( &head.op, &mm->head.op );
+static char *mongo_data_append32( char *start , const void *data ) {
+    bson_little_endian32( start , data );
+    return start + 4;
+}
 
-    res = mongo_env_write_socket( conn, &head, sizeof( head ) );
-    if( res != MONGO_OK ) {
-        bson_free( mm );
-        return res;
-    }
+static char *mongo_data_append64( char *start , const void *data ) {
+    bson_little_endian64( start , data );
+    return start + 8;
+}
 
-    res = mongo_env_write_socket( conn, &mm->data, mm->head.len - sizeof( head ) );
-    if( res != MONGO_OK ) {
-        bson_free( mm );
-        return res;
-    }
+static char *mongo_message_vec_prefix( const mongo_message_vec *mv ) {
+    return mv->prefix_ext ? mv->prefix_ext : ( char * )mv->prefix;
+}
 
-    bson_free( mm );
-    return MONGO_OK;
+static const bson *mongo_message_vec_doc( const mongo_message_vec *mv, int i ) {
+    return mv->docs ? mv->docs[i] : mv->doc[i];
 }
 
-static int mongo_read_response( mongo *conn, mongo_reply **reply ) {
-    mongo_header head; /* header from network */
-    mongo_reply_fields fields; /* header from network */
-    mongo_reply *out;  /* native endian */
-    unsigned int len;
-    int res;
+/* Start a message whose fixed fields (after the header) take up to size bytes:
+   returns where to build them. */
+static char *mongo_message_vec_init( mongo_message_vec *mv, size_t size ) {
+    mv->id = mongo_next_request_id();
+    mv->len = 0;
+    mv->prefix_len = 0;
+    mv->prefix_ext = NULL;
+    mv->count = 0;
+    mv->reply = 0;
+    mv->docs = NULL;
 
-    if ( ( res = mongo_env_read_socket( conn, &head, sizeof( head ) ) ) != MONGO_OK ||
-         ( res = mongo_env_read_socket( conn, &fields, sizeof( fields ) ) ) != MONGO_OK ) {
-        return res;
-    }
+    if( sizeof( mongo_header ) + size > sizeof( mv->prefix ) )
+        mv->prefix_ext = ( char * )bson_malloc( sizeof( mongo_header ) + size );
 
-    bson_little_endian32( &len, &head.len );
+    return mongo_message_vec_prefix( mv ) + sizeof( mongo_header );
+}
 
-    if ( len < sizeof( head )+sizeof( fields ) || len > 64*1024*1024 )
-        return MONGO_READ_SIZE_ERROR;  /* most likely corruption */
+#ifdef MONGO_HAVE_ZLIB
 
-    /*
-     * mongo_reply matches the wire for observed environments (MacOS, Linux, Windows VC), but
-     * the following incorporates possible differences with type sizes and padding/packing
-     *
-     * assert( sizeof(mongo_reply) - sizeof(char) - 16 - 20 + len >= len );
-     * printf( "sizeof(mongo_reply) - sizeof(char) - 16 - 20 = %ld\n", sizeof(mongo_reply) - sizeof(char) - 16 - 20 );
-     */
-    out = ( mongo_reply * )bson_malloc( sizeof(mongo_reply) - sizeof(char) + len - 16 - 20 );
+/* Commands that must never be compressed: the handshake and those carrying credentials. */
+static const char *mongo_uncompressible_commands[] = {
+    "ismaster", "isMaster", "hello", "saslStart", "saslContinue", "getnonce", "authenticate",
+    "createUser", "updateUser", "copydbSaslStart", "copydbgetnonce", "copydb", NULL
+};
 
-    out->head.len = len;
-    bson_little_endian32( &out->head.id, &head.id );
-    bson_little_endian32( &out->head.responseTo, &head.responseTo );
-    bson_little_endian32( &out->head.op, &head.op );
+static int mongo_message_vec_compressible( const mongo_message_vec *mv, int op ) {
+    const char *prefix = mongo_message_vec_prefix( mv );
+    const char *ns, *name;
+    int i;
 
-    bson_little_endian32( &out->fields.flag, &fields.flag );
-    bson_little_endian64( &out->fields.cursorID, &fields.cursorID );
-    bson_little_endian32( &out->fields.start, &fields.start );
-    bson_little_endian32( &out->fields.num, &fields.num );
+    if( op == MONGO_OP_MSG )
+        name = prefix + sizeof( mongo_header ) + 4 + 1 + 4 + 1; /* first element of the command */
+    else if( op == MONGO_OP_QUERY ) {
+        ns = prefix + sizeof( mongo_header ) + 4;
+        name = strchr( ns, '.' );
+        if( !name || strcmp( name + 1, "$cmd" ) != 0 )
+            return 1;
+        /* The query document is either in the prefix, after skip and limit, or the first document */
+        name = ns + strlen( ns ) + 1 + 4 + 4;
+        if( name >= prefix + mv->prefix_len )
+            name = mongo_message_vec_doc( mv, 0 )->data;
+        name += 4 + 1;
+    }
+    else
+        return 1;
 
-    res = mongo_env_read_socket( conn, &out->objs, len - 16 - 20 ); /* was len-sizeof( head )-sizeof( fields ) */
-    if( res != MONGO_OK ) {
-        bson_free( out );
-        return res;
+    for( i = 0; mongo_uncompressible_commands[i]; i++ ) {
+        if( strcmp( name, mongo_uncompressible_commands[i] ) == 0 )
+            return 0;
     }
+    return 1;
+}
 
-    *reply = out;
+/* Replace a finished message with its OP_COMPRESSED form, unless that saves nothing. */
+static void mongo_message_vec_compress( mongo *conn, mongo_message_vec *mv, int op ) {
+    mongo_iovec iov[MONGO_IOV_MAX];
+    z_stream zs;
+    char *out, *data;
+    int i, n, offset, size = mv->len - ( int )sizeof( mongo_header ), res = Z_OK, len;
+    uLong bound;
 
-    return MONGO_OK;
-}
+    memset( &zs, 0, sizeof( zs ) );
+    if( deflateInit( &zs, conn->compression_level ) != Z_OK )
+        return;
 
+    /* header, originalOpcode, uncompressedSize, compressorId */
+    len = ( int )sizeof( mongo_header ) + 4 + 4 + 1;
+    bound = deflateBound( &zs, ( uLong )size );
+    out = ( char * )bson_malloc( len + bound );
+    zs.next_out = ( Bytef * )out + len;
+    zs.avail_out = ( uInt )bound;
+
+    /* The body is compressed from the same pieces that would otherwise be written */
+    for( offset = ( int )sizeof( mongo_header ); offset < mv->len && res == Z_OK; ) {
+        n = mongo_message_vec_iov( mv, offset, iov, MONGO_IOV_MAX );
+        for( i = 0; i < n && res == Z_OK; i++ ) {
+            zs.next_in = ( Bytef * )iov[i].data;
+            zs.avail_in = ( uInt )iov[i].len;
+            res = deflate( &zs, Z_NO_FLUSH );
+            offset += ( int )iov[i].len;
+        }
+    }
+    if( res == Z_OK )
+        res = deflate( &zs, Z_FINISH );
+    len += ( int )zs.total_out;
+    deflateEnd( &zs );
 
-static char *mongo_data_append( char *start , const void *data , size_t len ) {
-    memcpy( start , data , len );
-    return start + len;
-}
+    if( res != Z_STREAM_END || len >= mv->len ) {
+        bson_free( out );
+        return;
+    }
 
-static char *mongo_data_append32( char *start , const void *data ) {
-    bson_little_endian32( start , data );
-    return start + 4;
-}
+    data = mongo_data_append32( out, &len );
+    data = mongo_data_append32( data, &mv->id );
+    data = mongo_data_append32( data, &ZERO );
+    i = MONGO_OP_COMPRESSED;
+    data = mongo_data_append32( data, &i );
+    data = mongo_data_append32( data, &op );
+    data = mongo_data_append32( data, &size );
+    *data = MONGO_COMPRESSOR_ZLIB;
 
-static char *mongo_data_append64( char *start , const void *data ) {
-    bson_little_endian64( start , data );
-    return start + 8;
+    mongo_message_vec_destroy( mv );
+    mv->prefix_ext = out;
+    mv->prefix_len = len;
+    mv->len = len;
+    mv->count = 0;
+    mv->docs = NULL;
 }
 
-/* Connection API */
+#endif
 
-static int mongo_check_is_master( mongo *conn ) {
-    bson out;
-    bson_iterator it;
-    bson_bool_t ismaster = 0;
-    int max_bson_size = MONGO_DEFAULT_MAX_BSON_SIZE;
+/* Complete the header once the fixed fields, which end at end, and the documents are in place. */
+static int mongo_message_vec_finish( mongo *conn, mongo_message_vec *mv, int op, char *end ) {
+    char *prefix = mongo_message_vec_prefix( mv );
+    size_t len = end - prefix;
+    int i;
 
-    if ( mongo_simple_int_command( conn, "admin", "ismaster", 1, &out ) != MONGO_OK )
+    for( i = 0; i < mv->count; i++ )
+        len += bson_size( mongo_message_vec_doc( mv, i ) );
+
+    if( len >= INT32_MAX ) {
+        conn->err = MONGO_BSON_TOO_LARGE;
+        mongo_message_vec_destroy( mv );
         return MONGO_ERROR;
+    }
 
-    if( bson_find( &it, &out, "ismaster" ) )
-        ismaster = bson_iterator_bool( &it );
-    if( bson_find( &it, &out, "maxBsonObjectSize" ) )
-        max_bson_size = bson_iterator_int( &it );
-    conn->max_bson_size = max_bson_size;
+    mv->prefix_len = ( int )( end - prefix );
+    mv->len = ( int )len;
+    mv->reply = ( op == MONGO_OP_QUERY || op == MONGO_OP_GET_MORE );
 
-    bson_destroy( &out );
+    prefix = mongo_data_append32( prefix, &mv->len );
+    prefix = mongo_data_append32( prefix, &mv->id );
+    prefix = mongo_data_append32( prefix, &ZERO );
+    mongo_data_append32( prefix, &op );
 
-    if( ismaster )
-        return MONGO_OK;
-    else {
-        conn->err = MONGO_CONN_NOT_MASTER;
-        return MONGO_ERROR;
-    }
-}
+#ifdef MONGO_HAVE_ZLIB
+    if( conn->compressor && mv->len >= conn->compression_threshold && mongo_message_vec_compressible( mv, op ) )
+        mongo_message_vec_compress( conn, mv, op );
+#endif
 
-MONGO_EXPORT void mongo_init_sockets( void ) {
-    mongo_env_sock_init();
+    return MONGO_OK;
 }
 
-/* WC1 is completely static */
-static char WC1_data[] = {23,0,0,0,16,103,101,116,108,97,115,116,101,114,114,111,114,0,1,0,0,0,0,0,0,0,0,0,0,0,0,0};
-static bson WC1_cmd = {
-    WC1_data, WC1_data, 128, 1, 0, 0, 0, 0, NULL, {0}
-};
-static mongo_write_concern WC1 = { 1, 0, 0, 0, 0, &WC1_cmd}; /* w = 1 */
+MONGO_EXPORT int mongo_message_vec_iov( const mongo_message_vec *mv, int offset, mongo_iovec *iov, int max ) {
+    const bson *doc;
+    int i, n = 0, size;
 
-MONGO_EXPORT void mongo_init( mongo *conn ) {
-    memset( conn, 0, sizeof( mongo ) );
-    conn->max_bson_size = MONGO_DEFAULT_MAX_BSON_SIZE;
-    mongo_set_write_concern( conn, &WC1 );
+    if( offset < mv->prefix_len ) {
+        iov[n].data = mongo_message_vec_prefix( mv ) + offset;
+        iov[n].len = mv->prefix_len - offset;
+        n++;
+        offset = 0;
+    }
+    else
+        offset -= mv->prefix_len;
+
+    for( i = 0; i < mv->count && n < max; i++ ) {
+        doc = mongo_message_vec_doc( mv, i );
+        size = bson_size( doc );
+        if( offset >= size ) {
+            offset -= size;
+            continue;
+        }
+        iov[n].data = doc->data + offset;
+        iov[n].len = size - offset;
+        n++;
+        offset = 0;
+    }
+
+    return n;
 }
 
-MONGO_EXPORT int mongo_client( mongo *conn , const char *host, int port ) {
-    mongo_init( conn );
+MONGO_EXPORT void mongo_message_vec_destroy( mongo_message_vec *mv ) {
+    if( mv->prefix_ext ) {
+        bson_free( mv->prefix_ext );
+        mv->prefix_ext = NULL;
+    }
+}
 
-    conn->primary = (mongo_host_port*)bson_malloc( sizeof( mongo_host_port ) );
-    snprintf( conn->primary->host, MAXHOSTNAMELEN, "%s", host);
-    conn->primary->port = port;
-    conn->primary->next = NULL;
+/* Write the messages, back to back, with as few vectored sends as possible.
+   Always calls mongo_message_vec_destroy() for each message. */
+static int mongo_message_send_all( mongo *conn, mongo_message_vec **mvs, int count ) {
+    mongo_iovec iov[MONGO_IOV_MAX];
+    int i = 0, j, n, sent = 0, res = MONGO_OK;
+    size_t len;
 
-    if( mongo_env_socket_connect( conn, host, port ) != MONGO_OK )
-        return MONGO_ERROR;
+    while( res == MONGO_OK && i < count ) {
+        /* sent bytes of message i have been written already */
+        n = mongo_message_vec_iov( mvs[i], sent, iov, MONGO_IOV_MAX );
+        for( j = i + 1; j < count && n < MONGO_IOV_MAX; j++ )
+            n += mongo_message_vec_iov( mvs[j], 0, iov + n, MONGO_IOV_MAX - n );
 
-    return mongo_check_is_master( conn );
+        res = mongo_env_writev_socket( conn, iov, n );
+
+        for( len = 0, j = 0; j < n; j++ )
+            len += iov[j].len;
+        while( len && i < count ) {
+            if( len >= ( size_t )( mvs[i]->len - sent ) ) {
+                len -= mvs[i]->len - sent;
+                sent = 0;
+                i++;
+            }
+            else {
+                sent += ( int )len;
+                len = 0;
+            }
+        }
+    }
+
+    for( j = 0; j < count; j++ )
+        mongo_message_vec_destroy( mvs[j] );
+    return res;
 }
 
-MONGO_EXPORT int mongo_connect( mongo *conn , const char *host, int port ) {
-    int ret;
-    bson_errprintf("WARNING: mongo_connect() is deprecated, please use mongo_client()\n");
-    ret = mongo_client( conn, host, port );
-    mongo_set_write_concern( conn, 0 );
-    return ret;
+/* Always calls mongo_message_vec_destroy(mv) */
+static int mongo_message_send( mongo *conn, mongo_message_vec *mv ) {
+    return mongo_message_send_all( conn, &mv, 1 );
 }
 
-MONGO_EXPORT void mongo_replica_set_init( mongo *conn, const char *name ) {
-    mongo_init( conn );
+/* OP_MSG (MongoDB 3.6 and later) carries a command document, optionally followed by a sequence
+   of documents which, like those of the legacy messages, are sent from the caller's buffers.
+   The command is built in the message prefix unless it outgrows it. */
 
-    conn->replica_set = (mongo_replica_set*)bson_malloc( sizeof( mongo_replica_set ) );
-    conn->replica_set->primary_connected = 0;
-    conn->replica_set->seeds = NULL;
-    conn->replica_set->hosts = NULL;
-    conn->replica_set->name = ( char * )bson_malloc( strlen( name ) + 1 );
-    memcpy( conn->replica_set->name, name, strlen( name ) + 1  );
+#define MONGO_MSG_SEQUENCE_MAX 16 /* kind, size and identifier of a document sequence */
 
-    conn->primary = (mongo_host_port*)bson_malloc( sizeof( mongo_host_port ) );
-    conn->primary->host[0] = '\0';
-    conn->primary->next = NULL;
+static int mongo_use_op_msg( mongo *conn ) {
+    return conn->max_wire_version >= MONGO_WIRE_VERSION_OP_MSG;
 }
 
-MONGO_EXPORT void mongo_replset_init( mongo *conn, const char *name ) {
-    bson_errprintf("WARNING: mongo_replset_init() is deprecated, please use mongo_replica_set_init()\n");
-    mongo_replica_set_init( conn, name );
+/* The collection part of ns, with the length of the database part in db_len. */
+static const char *mongo_ns_collection( const char *ns, size_t *db_len ) {
+    const char *dot = strchr( ns, '.' );
+
+    *db_len = dot ? ( size_t )( dot - ns ) : strlen( ns );
+    return dot ? dot + 1 : ns + *db_len;
 }
 
-static void mongo_replica_set_add_node( mongo_host_port **list, const char *host, int port ) {
-    mongo_host_port *host_port = (mongo_host_port*)bson_malloc( sizeof( mongo_host_port ) );
-    host_port->port = port;
-    host_port->next = NULL;
-    snprintf( host_port->host, MAXHOSTNAMELEN, "%s", host);
+static void mongo_command_message_init( mongo_message_vec *mv, bson *cmd ) {
+    char *data = mongo_message_vec_init( mv, 4 + 1 ); /* flagBits, section kind */
 
-    if( *list == NULL )
-        *list = host_port;
-    else {
-        mongo_host_port *p = *list;
-        while( p->next != NULL )
-            p = p->next;
-        p->next = host_port;
-    }
+    bson_init_buffer( cmd, data + 4 + 1, ( int )( sizeof( mv->prefix ) - sizeof( mongo_header ) - 4 - 1 - MONGO_MSG_SEQUENCE_MAX ) );
 }
 
-static void mongo_replica_set_free_list( mongo_host_port **list ) {
-    mongo_host_port *node = *list;
-    mongo_host_port *prev;
+/* Complete the command with the database of ns and the message around it, adding count
+   documents as the sequence named seq if seq is not NULL.  Always destroys cmd. */
+static int mongo_command_message_finish( mongo *conn, mongo_message_vec *mv, bson *cmd, const char *ns,
+                                         int flags, const char *seq, const bson **docs, int count ) {
+    char *data;
+    size_t db_len, size, seq_len = 0, seq_size;
+    int i, n;
 
-    while( node != NULL ) {
-        prev = node;
-        node = node->next;
-        bson_free( prev );
+    mongo_ns_collection( ns, &db_len );
+    bson_append_string_n( cmd, "$db", ns, db_len );
+    if( bson_finish( cmd ) != BSON_OK ) {
+        bson_destroy( cmd );
+        conn->err = MONGO_BSON_INVALID;
+        return MONGO_ERROR;
     }
 
-    *list = NULL;
+    size = bson_size( cmd );
+    if( seq )
+        seq_len = 1 + 4 + strlen( seq ) + 1;
+
+    data = mongo_message_vec_prefix( mv ) + sizeof( mongo_header );
+    if( cmd->data != data + 4 + 1 ) {
+        /* The command outgrew the prefix */
+        mv->prefix_ext = ( char * )bson_malloc( sizeof( mongo_header ) + 4 + 1 + size + seq_len );
+        data = mv->prefix_ext + sizeof( mongo_header );
+        memcpy( data + 4 + 1, cmd->data, size );
+    }
+    bson_destroy( cmd );
+
+    data = mongo_data_append32( data, &flags );
+    *data++ = 0;
+    data += size;
+
+    if( seq ) {
+        for( seq_size = seq_len - 1, i = 0; i < count; i++ )
+            seq_size += bson_size( docs[i] );
+        n = ( int )seq_size; /* mongo_message_vec_finish( ) rejects a message too large for this */
+        *data++ = 1;
+        data = mongo_data_append32( data, &n );
+        data = mongo_data_append( data, seq, seq_len - 1 - 4 );
+
+        mv->docs = docs;
+        mv->count = count;
+    }
+
+    if( mongo_message_vec_finish( conn, mv, MONGO_OP_MSG, data ) != MONGO_OK )
+        return MONGO_ERROR;
+
+    mv->reply = !( flags & MONGO_MSG_MORE_TO_COME );
+    return MONGO_OK;
 }
 
-MONGO_EXPORT void mongo_replica_set_add_seed( mongo *conn, const char *host, int port ) {
-    mongo_replica_set_add_node( &conn->replica_set->seeds, host, port );
+/* Reply buffers are recycled through a pool, shared by all connections, of power-of-two
+   size classes from 4KB to 1MB.  The size class is stored ahead of the reply, followed by
+   a count of the references to it (see mongo_reply_retain( )). */
+#define MONGO_REPLY_POOL_SHIFT 12
+#define MONGO_REPLY_POOL_CLASSES 9
+#define MONGO_REPLY_POOL_DEPTH 4
+#define MONGO_REPLY_POOL_PAD 8
+
+static char *mongo_reply_pool[MONGO_REPLY_POOL_CLASSES][MONGO_REPLY_POOL_DEPTH];
+static int mongo_reply_pool_count[MONGO_REPLY_POOL_CLASSES];
+static volatile long mongo_reply_pool_lock = 0;
+
+static void mongo_reply_pool_acquire( void ) {
+#if defined(_MSC_VER)
+    while( _InterlockedExchange( &mongo_reply_pool_lock, 1 ) )
+        ;
+#else
+    while( __sync_lock_test_and_set( &mongo_reply_pool_lock, 1 ) )
+        ;
+#endif
 }
 
-MONGO_EXPORT void mongo_replset_add_seed( mongo *conn, const char *host, int port ) {
-    bson_errprintf("WARNING: mongo_replset_add_seed() is deprecated, please use mongo_replica_set_add_seed()\n");
-    mongo_replica_set_add_node( &conn->replica_set->seeds, host, port );
+static void mongo_reply_pool_release( void ) {
+#if defined(_MSC_VER)
+    _InterlockedExchange( &mongo_reply_pool_lock, 0 );
+#else
+    __sync_lock_release( &mongo_reply_pool_lock );
+#endif
 }
 
-void mongo_parse_host( const char *host_string, mongo_host_port *host_port ) {
-    int len, idx, split;
-    len = split = idx = 0;
+static mongo_reply *mongo_reply_new( size_t size ) {
+    char *p = NULL;
+    int size_class = 0;
 
-    /* Split the host_port string at the ':' */
-    while( 1 ) {
-        if( *( host_string + len ) == '\0' )
-            break;
-        if( *( host_string + len ) == ':' )
-            split = len;
+    while( size_class < MONGO_REPLY_POOL_CLASSES && ( ( size_t )1 << ( size_class + MONGO_REPLY_POOL_SHIFT ) ) < size )
+        size_class++;
 
-        len++;
+    if( size_class < MONGO_REPLY_POOL_CLASSES ) {
+        mongo_reply_pool_acquire();
+        if( mongo_reply_pool_count[size_class] )
+            p = mongo_reply_pool[size_class][--mongo_reply_pool_count[size_class]];
+        mongo_reply_pool_release();
+        if( !p )
+            p = ( char * )bson_malloc( MONGO_REPLY_POOL_PAD + ( ( size_t )1 << ( size_class + MONGO_REPLY_POOL_SHIFT ) ) );
     }
-
-    /* If 'split' is set, we know the that port exists;
-     * Otherwise, we set the default port. */
-    idx = split ? split : len;
-    memcpy( host_port->host, host_string, idx );
-    memcpy( host_port->host + idx, "\0", 1 );
-    if( split )
-        host_port->port = atoi( host_string + idx + 1 );
     else
-        host_port->port = MONGO_DEFAULT_PORT;
-}
-
-static void mongo_replica_set_check_seed( mongo *conn ) {
-    bson out[1];
-    const char *data;
-    bson_iterator it[1];
-    bson_iterator it_sub[1];
-    const char *host_string;
-    mongo_host_port *host_port = NULL;
-
-    if( mongo_simple_int_command( conn, "admin", "ismaster", 1, out ) == MONGO_OK ) {
+        p = ( char * )bson_malloc( MONGO_REPLY_POOL_PAD + size );
 
-        if( bson_find( it, out, "hosts" ) ) {
-            data = bson_iterator_value( it );
-            bson_iterator_from_buffer( it_sub, data );
+    *( int * )p = size_class;
+    *( int * )( p + 4 ) = 1;
+    return ( mongo_reply * )( p + MONGO_REPLY_POOL_PAD );
+}
 
-            /* Iterate over host list, adding each host to the
-             * connection's host list. */
-            while( bson_iterator_next( it_sub ) ) {
-                host_string = bson_iterator_string( it_sub );
+MONGO_EXPORT void mongo_reply_retain( mongo_reply *reply ) {
+    volatile int *refs = ( volatile int * )( ( char * )reply - MONGO_REPLY_POOL_PAD + 4 );
+#if defined(_MSC_VER)
+    _InterlockedIncrement( ( volatile long * )refs );
+#else
+    __sync_add_and_fetch( refs, 1 );
+#endif
+}
 
-                host_port = (mongo_host_port*)bson_malloc( sizeof( mongo_host_port ) );
+MONGO_EXPORT void mongo_reply_free( mongo_reply *reply ) {
+    char *p;
+    int size_class;
 
-                if( host_port ) {
-                    mongo_parse_host( host_string, host_port );
-                    mongo_replica_set_add_node( &conn->replica_set->hosts,
-                                                host_port->host, host_port->port );
+    if( !reply )
+        return;
 
-                    bson_free( host_port );
-                    host_port = NULL;
-                }
-            }
+    p = ( char * )reply - MONGO_REPLY_POOL_PAD;
+#if defined(_MSC_VER)
+    if( _InterlockedDecrement( ( volatile long * )( p + 4 ) ) > 0 )
+        return;
+#else
+    if( __sync_sub_and_fetch( ( volatile int * )( p + 4 ), 1 ) > 0 )
+        return;
+#endif
+    size_class = *( int * )p;
+    if( size_class < MONGO_REPLY_POOL_CLASSES ) {
+        mongo_reply_pool_acquire();
+        if( mongo_reply_pool_count[size_class] < MONGO_REPLY_POOL_DEPTH ) {
+            mongo_reply_pool[size_class][mongo_reply_pool_count[size_class]++] = p;
+            p = NULL;
         }
+        mongo_reply_pool_release();
     }
 
-    bson_destroy(out);
-    mongo_env_close_socket( conn->sock );
-    conn->sock = 0;
-    conn->connected = 0;
+    if( p )
+        bson_free( p );
 }
 
-/* Find out whether the current connected node is master, and
+static int mongo_reply_alloc( mongo *conn, const char *wire, mongo_reply **reply ) {
+    mongo_header head; /* header from network */
+    mongo_reply *out;  /* native endian */
+    unsigned int len;
+    int op;
+
+    memcpy( &head, wire, sizeof( head ) );
+
+    bson_little_endian32( &len, &head.len );
+    bson_little_endian32( &op, &head.op );
+
+    if ( len > 64*1024*1024 ||
+         ( op == MONGO_OP_REPLY && len < sizeof( head )+sizeof( mongo_reply_fields ) ) ||
+         ( op == MONGO_OP_MSG && len < sizeof( head )+4+1+5 ) ||
+         ( op == MONGO_OP_COMPRESSED && len < sizeof( head )+4+4+1 ) ||
+         ( op != MONGO_OP_REPLY && op != MONGO_OP_MSG && op != MONGO_OP_COMPRESSED ) ) {
+        conn->err = MONGO_READ_SIZE_ERROR;  /* most likely corruption */
+        return MONGO_ERROR;
+    }
+
+    /*
+     * mongo_reply matches the wire (it is packed), so the message is received into it as is and
+     * the fields are converted once it is complete.  The extra room is for mongo_reply_from_msg( ).
+     */
+    out = mongo_reply_new( len + sizeof( mongo_reply_fields ) );
+
+    out->head.len = len;
+    bson_little_endian32( &out->head.id, &head.id );
+    bson_little_endian32( &out->head.responseTo, &head.responseTo );
+    out->head.op = op;
+
+    *reply = out;
+
+    return MONGO_OK;
+}
+
+/* An OP_MSG reply is reshaped as an OP_REPLY returning its body document, so that cursors and
+   commands process the replies to either kind of request in the same way. */
+static int mongo_reply_from_msg( mongo *conn, mongo_reply *reply ) {
+    char *section = ( char * )reply + sizeof( mongo_header ) + 4;
+    char *end = ( char * )reply + reply->head.len;
+    unsigned int flags;
+    int size;
+
+    bson_little_endian32( &flags, ( char * )reply + sizeof( mongo_header ) );
+    if( flags & MONGO_MSG_CHECKSUM_PRESENT )
+        end -= 4;
+
+    while( section + 1 + 4 <= end ) {
+        bson_little_endian32( &size, section + 1 );
+        if( size < 5 || size > end - section - 1 )
+            break;
+        if( *section == 0 ) {
+            memmove( &reply->objs, section + 1, size );
+            reply->head.len = ( int )( sizeof( mongo_header ) + sizeof( mongo_reply_fields ) ) + size;
+            reply->fields.flag = 0;
+            reply->fields.cursorID = 0;
+            reply->fields.start = 0;
+            reply->fields.num = 1;
+            return MONGO_OK;
+        }
+        section += 1 + size; /* a document sequence */
+    }
+
+    conn->err = MONGO_READ_SIZE_ERROR;  /* most likely corruption */
+    return MONGO_ERROR;
+}
+
+#ifdef MONGO_HAVE_ZLIB
+
+/* Replace an OP_COMPRESSED reply with the message it contains. */
+static int mongo_reply_decompress( mongo *conn, mongo_reply **reply ) {
+    const char *data = ( const char * )*reply + sizeof( mongo_header );
+    mongo_reply *out;
+    uLongf out_len;
+    unsigned int size;
+    int op;
+
+    bson_little_endian32( &op, data );
+    bson_little_endian32( &size, data + 4 );
+
+    if( data[8] != MONGO_COMPRESSOR_ZLIB ) {
+        __mongo_set_error( conn, MONGO_IO_ERROR, "Unsupported compressor in reply.", 0 );
+        return MONGO_ERROR;
+    }
+    if ( size > 64*1024*1024 ||
+         ( op == MONGO_OP_REPLY && size < sizeof( mongo_reply_fields ) ) ||
+         ( op == MONGO_OP_MSG && size < 4+1+5 ) ||
+         ( op != MONGO_OP_REPLY && op != MONGO_OP_MSG ) ) {
+        conn->err = MONGO_READ_SIZE_ERROR;  /* most likely corruption */
+        return MONGO_ERROR;
+    }
+
+    out = mongo_reply_new( sizeof( mongo_header ) + size + sizeof( mongo_reply_fields ) );
+    out_len = size;
+    if( uncompress( ( Bytef * )out + sizeof( mongo_header ), &out_len, ( const Bytef * )data + 9,
+                    ( uLong )( ( *reply )->head.len - sizeof( mongo_header ) - 9 ) ) != Z_OK || out_len != size ) {
+        mongo_reply_free( out );
+        conn->err = MONGO_READ_SIZE_ERROR;
+        return MONGO_ERROR;
+    }
+
+    out->head.len = ( int )( sizeof( mongo_header ) + size );
+    out->head.id = ( *reply )->head.id;
+    out->head.responseTo = ( *reply )->head.responseTo;
+    out->head.op = op;
+
+    mongo_reply_free( *reply );
+    *reply = out;
+    return MONGO_OK;
+}
+
+#endif
+
+/* Convert a completely received reply to native form, replacing a compressed one with its content */
+static int mongo_reply_finish( mongo *conn, mongo_reply **reply ) {
+    mongo_reply_fields fields;
+
+    if( ( *reply )->head.op == MONGO_OP_COMPRESSED ) {
+#ifdef MONGO_HAVE_ZLIB
+        if( mongo_reply_decompress( conn, reply ) != MONGO_OK )
+            return MONGO_ERROR;
+#else
+        __mongo_set_error( conn, MONGO_IO_ERROR, "Compressed reply without compression support.", 0 );
+        return MONGO_ERROR;
+#endif
+    }
+
+    if( ( *reply )->head.op == MONGO_OP_MSG )
+        return mongo_reply_from_msg( conn, *reply );
+
+    memcpy( &fields, &( *reply )->fields, sizeof( fields ) );
+    bson_little_endian32( &( *reply )->fields.flag, &fields.flag );
+    bson_little_endian64( &( *reply )->fields.cursorID, &fields.cursorID );
+    bson_little_endian32( &( *reply )->fields.start, &fields.start );
+    bson_little_endian32( &( *reply )->fields.num, &fields.num );
+
+    return MONGO_OK;
+}
+
+/* Receive what is available into buf: returns the number of bytes, 0 if a non-blocking
+   socket has nothing to read, or -1 on error. */
+static int mongo_read_available( mongo *conn, char *buf, int len, int blocking ) {
+    int n = mongo_env_recv_socket( conn, buf, len );
+
+    if( n == 0 && blocking ) {
+        __mongo_set_error( conn, MONGO_IO_ERROR, "Timed out waiting for a reply.", 0 );
+        return -1;
+    }
+
+    return n;
+}
+
+/* Replies are parsed out of the connection's read buffer, which is filled with as much as the
+   socket has available: a small reply typically arrives in a single recv().  The remainder of a
+   reply too large for the buffer is received directly into the reply. */
+static int mongo_read_reply( mongo *conn, mongo_reply **reply, int blocking ) {
+    char *body;
+    int n, want;
+
+    *reply = NULL;
+
+    if( !conn->read_buf ) {
+        conn->read_buf = ( char * )bson_malloc( MONGO_READ_BUFFER_SIZE );
+        conn->read_pos = 0;
+        conn->read_len = 0;
+    }
+
+    if( !conn->read_reply ) {
+        while( conn->read_len - conn->read_pos < ( int )sizeof( mongo_header ) ) {
+            if( conn->read_pos ) {
+                memmove( conn->read_buf, conn->read_buf + conn->read_pos, conn->read_len - conn->read_pos );
+                conn->read_len -= conn->read_pos;
+                conn->read_pos = 0;
+            }
+            n = mongo_read_available( conn, conn->read_buf + conn->read_len, MONGO_READ_BUFFER_SIZE - conn->read_len, blocking );
+            if( n <= 0 )
+                return n < 0 ? MONGO_ERROR : MONGO_OK;
+            conn->read_len += n;
+        }
+
+        if( mongo_reply_alloc( conn, conn->read_buf + conn->read_pos, &conn->read_reply ) != MONGO_OK )
+            return MONGO_ERROR;
+        conn->read_pos += ( int )sizeof( mongo_header );
+        conn->read_reply_len = ( int )sizeof( mongo_header );
+    }
+
+    for( ;; ) {
+        body = ( char * )conn->read_reply + conn->read_reply_len;
+        want = conn->read_reply->head.len - conn->read_reply_len;
+
+        n = conn->read_len - conn->read_pos;
+        if( n > want )
+            n = want;
+        memcpy( body, conn->read_buf + conn->read_pos, n );
+        conn->read_pos += n;
+        conn->read_reply_len += n;
+        want -= n;
+        if( conn->read_pos == conn->read_len )
+            conn->read_pos = conn->read_len = 0;
+
+        if( want == 0 )
+            break;
+
+        /* The read buffer is empty at this point */
+        if( want >= MONGO_READ_BUFFER_SIZE ) {
+            n = mongo_read_available( conn, body + n, want, blocking );
+            if( n > 0 )
+                conn->read_reply_len += n;
+        }
+        else {
+            n = mongo_read_available( conn, conn->read_buf, MONGO_READ_BUFFER_SIZE, blocking );
+            if( n > 0 )
+                conn->read_len = n;
+        }
+        if( n <= 0 )
+            return n < 0 ? MONGO_ERROR : MONGO_OK;
+    }
+
+    *reply = conn->read_reply;
+    conn->read_reply = NULL;
+
+    if( mongo_reply_finish( conn, reply ) != MONGO_OK ) {
+        mongo_reply_free( *reply );
+        *reply = NULL;
+        return MONGO_ERROR;
+    }
+
+    return MONGO_OK;
+}
+
+/* Forget any input buffered for the connection's previous socket */
+static void mongo_read_reset( mongo *conn ) {
+    mongo_reply_free( conn->read_reply );
+    conn->read_reply = NULL;
+    conn->read_pos = 0;
+    conn->read_len = 0;
+}
+
+static int mongo_read_response( mongo *conn, mongo_reply **reply ) {
+    if( mongo_read_reply( conn, reply, 1 ) != MONGO_OK ) {
+        /* Whatever was partly received is of no use once the exchange has failed */
+        mongo_read_reset( conn );
+        return conn->err == MONGO_READ_SIZE_ERROR ? MONGO_READ_SIZE_ERROR : MONGO_ERROR;
+    }
+
+    return MONGO_OK;
+}
+
+MONGO_EXPORT int mongo_recv_reply( mongo *conn, mongo_reply **reply ) {
+    return mongo_read_reply( conn, reply, 0 );
+}
+
+/* Connection API */
+
+/* Run the ismaster handshake, offering the compressors the connection is to use, and note
+   the one that the server accepts. */
+static int mongo_is_master_command( mongo *conn, bson *out ) {
+    bson cmd[1];
+    bson_iterator it[1], sub[1];
+    int res;
+
+    /* The handshake itself is always an uncompressed OP_QUERY */
+    conn->max_wire_version = 0;
+    conn->compressor = 0;
+
+    bson_init( cmd );
+    bson_append_int( cmd, "ismaster", 1 );
+#ifdef MONGO_HAVE_ZLIB
+    if( conn->compression_level ) {
+        bson_append_start_array( cmd, "compression" );
+        bson_append_string( cmd, "0", "zlib" );
+        bson_append_finish_array( cmd );
+    }
+#endif
+    bson_finish( cmd );
+
+    res = mongo_run_command( conn, "admin", cmd, out );
+    bson_destroy( cmd );
+
+    if( res == MONGO_OK && conn->compression_level && bson_find( it, out, "compression" ) == BSON_ARRAY ) {
+        bson_iterator_subiterator( it, sub );
+        while( bson_iterator_next( sub ) ) {
+            if( bson_iterator_type( sub ) == BSON_STRING && strcmp( bson_iterator_string( sub ), "zlib" ) == 0 )
+                conn->compressor = MONGO_COMPRESSOR_ZLIB;
+        }
+    }
+
+    return res;
+}
+
+/* Take the server's limits from its reply to ismaster. */
+static void mongo_set_server_limits( mongo *conn, const bson *out ) {
+    bson_iterator it;
+
+    conn->max_bson_size = MONGO_DEFAULT_MAX_BSON_SIZE;
+    conn->max_message_size = MONGO_DEFAULT_MAX_MESSAGE_SIZE;
+    conn->max_write_batch_size = MONGO_DEFAULT_MAX_WRITE_BATCH_SIZE;
+
+    if( bson_find( &it, out, "maxBsonObjectSize" ) )
+        conn->max_bson_size = bson_iterator_int( &it );
+    if( bson_find( &it, out, "maxMessageSizeBytes" ) )
+        conn->max_message_size = bson_iterator_int( &it );
+    if( bson_find( &it, out, "maxWriteBatchSize" ) )
+        conn->max_write_batch_size = bson_iterator_int( &it );
+    if( bson_find( &it, out, "maxWireVersion" ) )
+        conn->max_wire_version = bson_iterator_int( &it );
+}
+
+static int mongo_check_is_master( mongo *conn ) {
+    bson out;
+    bson_iterator it;
+    bson_bool_t ismaster = 0;
+
+    if ( mongo_is_master_command( conn, &out ) != MONGO_OK )
+        return MONGO_ERROR;
+
+    if( bson_find( &it, &out, "ismaster" ) )
+        ismaster = bson_iterator_bool( &it );
+    mongo_set_server_limits( conn, &out );
+
+    bson_destroy( &out );
+
+    if( ismaster )
+        return MONGO_OK;
+    else {
+        conn->err = MONGO_CONN_NOT_MASTER;
+        return MONGO_ERROR;
+    }
+}
+
+MONGO_EXPORT void mongo_init_sockets( void ) {
+    mongo_env_sock_init();
+}
+
+/* WC1 is completely static */
+static char WC1_data[] = {23,0,0,0,16,103,101,116,108,97,115,116,101,114,114,111,114,0,1,0,0,0,0,0,0,0,0,0,0,0,0,0};
+static bson WC1_cmd = {
+    WC1_data, WC1_data, 128, 1, 0, 0, 0, 0, 0, NULL, {0}
+};
+static mongo_write_concern WC1 = { 1, 0, 0, 0, 0, &WC1_cmd}; /* w = 1 */
+
+MONGO_EXPORT void mongo_init( mongo *conn ) {
+    memset( conn, 0, sizeof( mongo ) );
+    conn->max_bson_size = MONGO_DEFAULT_MAX_BSON_SIZE;
+    conn->max_message_size = MONGO_DEFAULT_MAX_MESSAGE_SIZE;
+    conn->max_write_batch_size = MONGO_DEFAULT_MAX_WRITE_BATCH_SIZE;
+    mongo_set_write_concern( conn, &WC1 );
+}
+
+MONGO_EXPORT void mongo_set_compression( mongo *conn, int level, int threshold ) {
+    conn->compression_level = level;
+    conn->compression_threshold = threshold;
+}
+
+MONGO_EXPORT int mongo_client( mongo *conn , const char *host, int port ) {
+    mongo_init( conn );
+    return mongo_client_connect( conn, host, port );
+}
+
+MONGO_EXPORT int mongo_client_connect( mongo *conn , const char *host, int port ) {
+    conn->primary = (mongo_host_port*)bson_malloc( sizeof( mongo_host_port ) );
+    snprintf( conn->primary->host, MAXHOSTNAMELEN, "%s", host);
+    conn->primary->port = port;
+    conn->primary->next = NULL;
+
+    if( mongo_env_socket_connect( conn, host, port ) != MONGO_OK )
+        return MONGO_ERROR;
+
+    return mongo_check_is_master( conn );
+}
+
+MONGO_EXPORT int mongo_connect( mongo *conn , const char *host, int port ) {
+    int ret;
+    bson_errprintf("WARNING: mongo_connect() is deprecated, please use mongo_client()\n");
+    ret = mongo_client( conn, host, port );
+    mongo_set_write_concern( conn, 0 );
+    return ret;
+}
+
+MONGO_EXPORT void mongo_replica_set_init( mongo *conn, const char *name ) {
+    mongo_init( conn );
+
+    conn->replica_set = (mongo_replica_set*)bson_malloc( sizeof( mongo_replica_set ) );
+    conn->replica_set->primary_connected = 0;
+    conn->replica_set->seeds = NULL;
+    conn->replica_set->hosts = NULL;
+    conn->replica_set->name = ( char * )bson_malloc( strlen( name ) + 1 );
+    memcpy( conn->replica_set->name, name, strlen( name ) + 1  );
+
+    conn->primary = (mongo_host_port*)bson_malloc( sizeof( mongo_host_port ) );
+    conn->primary->host[0] = '\0';
+    conn->primary->next = NULL;
+}
+
+MONGO_EXPORT void mongo_replset_init( mongo *conn, const char *name ) {
+    bson_errprintf("WARNING: mongo_replset_init() is deprecated, please use mongo_replica_set_init()\n");
+    mongo_replica_set_init( conn, name );
+}
+
+static void mongo_replica_set_add_node( mongo_host_port **list, const char *host, int port ) {
+    mongo_host_port *host_port = (mongo_host_port*)bson_malloc( sizeof( mongo_host_port ) );
+    host_port->port = port;
+    host_port->next = NULL;
+    snprintf( host_port->host, MAXHOSTNAMELEN, "%s", host);
+
+    if( *list == NULL )
+        *list = host_port;
+    else {
+        mongo_host_port *p = *list;
+        while( p->next != NULL )
+            p = p->next;
+        p->next = host_port;
+    }
+}
+
+static void mongo_replica_set_free_list( mongo_host_port **list ) {
+    mongo_host_port *node = *list;
+    mongo_host_port *prev;
+
+    while( node != NULL ) {
+        prev = node;
+        node = node->next;
+        bson_free( prev );
+    }
+
+    *list = NULL;
+}
+
+MONGO_EXPORT void mongo_replica_set_add_seed( mongo *conn, const char *host, int port ) {
+    mongo_replica_set_add_node( &conn->replica_set->seeds, host, port );
+}
+
+MONGO_EXPORT void mongo_replset_add_seed( mongo *conn, const char *host, int port ) {
+    bson_errprintf("WARNING: mongo_replset_add_seed() is deprecated, please use mongo_replica_set_add_seed()\n");
+    mongo_replica_set_add_node( &conn->replica_set->seeds, host, port );
+}
+
+void mongo_parse_host( const char *host_string, mongo_host_port *host_port ) {
+    int len, idx, split;
+    len = split = idx = 0;
+
+    /* Split the host_port string at the ':' */
+    while( 1 ) {
+        if( *( host_string + len ) == '\0' )
+            break;
+        if( *( host_string + len ) == ':' )
+            split = len;
+
+        len++;
+    }
+
+    /* If 'split' is set, we know the that port exists;
+     * Otherwise, we set the default port. */
+    idx = split ? split : len;
+    memcpy( host_port->host, host_string, idx );
+    memcpy( host_port->host + idx, "\0", 1 );
+    if( split )
+        host_port->port = atoi( host_string + idx + 1 );
+    else
+        host_port->port = MONGO_DEFAULT_PORT;
+}
+
+static void mongo_replica_set_check_seed( mongo *conn ) {
+    bson out[1];
+    const char *data;
+    bson_iterator it[1];
+    bson_iterator it_sub[1];
+    const char *host_string;
+    mongo_host_port *host_port = NULL;
+
+    if( mongo_simple_int_command( conn, "admin", "ismaster", 1, out ) == MONGO_OK ) {
+
+        if( bson_find( it, out, "hosts" ) ) {
+            data = bson_iterator_value( it );
+            bson_iterator_from_buffer( it_sub, data );
+
+            /* Iterate over host list, adding each host to the
+             * connection's host list. */
+            while( bson_iterator_next( it_sub ) ) {
+                host_string = bson_iterator_string( it_sub );
+
+                host_port = (mongo_host_port*)bson_malloc( sizeof( mongo_host_port ) );
+
+                if( host_port ) {
+                    mongo_parse_host( host_string, host_port );
+                    mongo_replica_set_add_node( &conn->replica_set->hosts,
+                                                host_port->host, host_port->port );
+
+                    bson_free( host_port );
+                    host_port = NULL;
+                }
+            }
+        }
+    }
+
+    bson_destroy(out);
+    mongo_env_close_socket( conn->sock );
+    conn->sock = 0;
+    conn->connected = 0;
+}
+
+/* Find out whether the current connected node is master, and
  * verify that the node's replica set name matched the provided name
  */
 static int mongo_replica_set_check_host( mongo *conn ) {
@@ -598,15 +1216,12 @@ static int mongo_replica_set_check_host( mongo *conn ) {
     bson_iterator it[1];
     bson_bool_t ismaster = 0;
     const char *set_name;
-    int max_bson_size = MONGO_DEFAULT_MAX_BSON_SIZE;
 
-    if ( mongo_simple_int_command( conn, "admin", "ismaster", 1, out ) == MONGO_OK ) {
+    if ( mongo_is_master_command( conn, out ) == MONGO_OK ) {
         if( bson_find( it, out, "ismaster" ) )
             ismaster = bson_iterator_bool( it );
 
-        if( bson_find( it, out, "maxBsonObjectSize" ) )
-            max_bson_size = bson_iterator_int( it );
-        conn->max_bson_size = max_bson_size;
+        mongo_set_server_limits( conn, out );
 
         if( bson_find( it, out, "setName" ) ) {
             set_name = bson_iterator_string( it );
@@ -689,361 +1304,1033 @@ MONGO_EXPORT int mongo_replica_set_client( mongo *conn ) {
     }
 
 
-    conn->err = MONGO_CONN_NO_PRIMARY;
-    return MONGO_ERROR;
+    conn->err = MONGO_CONN_NO_PRIMARY;
+    return MONGO_ERROR;
+}
+
+MONGO_EXPORT int mongo_replset_connect( mongo *conn ) {
+    int ret;
+    bson_errprintf("WARNING: mongo_replset_connect() is deprecated, please use mongo_replica_set_client()\n");
+    ret = mongo_replica_set_client( conn );
+    mongo_set_write_concern( conn, 0 );
+    return ret;
+}
+
+MONGO_EXPORT int mongo_set_op_timeout( mongo *conn, int millis ) {
+    conn->op_timeout_ms = millis;
+    if( conn->sock && conn->connected )
+        mongo_env_set_socket_op_timeout( conn, millis );
+
+    return MONGO_OK;
+}
+
+MONGO_EXPORT int mongo_reconnect( mongo *conn ) {
+    int res;
+    mongo_disconnect( conn );
+
+    if( conn->replica_set ) {
+        conn->replica_set->primary_connected = 0;
+        mongo_replica_set_free_list( &conn->replica_set->hosts );
+        conn->replica_set->hosts = NULL;
+        res = mongo_replica_set_client( conn );
+        return res;
+    }
+    else
+        return mongo_env_socket_connect( conn, conn->primary->host, conn->primary->port );
+}
+
+MONGO_EXPORT int mongo_check_connection( mongo *conn ) {
+    if( ! conn->connected )
+        return MONGO_ERROR;
+
+    return mongo_simple_int_command( conn, "admin", "ping", 1, NULL );
+}
+
+MONGO_EXPORT void mongo_disconnect( mongo *conn ) {
+    /* A socket that failed (and so is no longer connected) must still be closed. */
+    if( ! conn->connected && ! conn->sock )
+        return;
+
+    if( conn->replica_set ) {
+        conn->replica_set->primary_connected = 0;
+        mongo_replica_set_free_list( &conn->replica_set->hosts );
+        conn->replica_set->hosts = NULL;
+    }
+
+    mongo_env_close_socket( conn->sock );
+
+    conn->sock = 0;
+    conn->connected = 0;
+
+    mongo_read_reset( conn );
+}
+
+MONGO_EXPORT void mongo_destroy( mongo *conn ) {
+    mongo_disconnect( conn );
+
+    if( conn->replica_set ) {
+        mongo_replica_set_free_list( &conn->replica_set->seeds );
+        mongo_replica_set_free_list( &conn->replica_set->hosts );
+        bson_free( conn->replica_set->name );
+        bson_free( conn->replica_set );
+        conn->replica_set = NULL;
+    }
+
+    bson_free( conn->primary );
+
+    mongo_read_reset( conn );
+    bson_free( conn->read_buf );
+    conn->read_buf = NULL;
+
+    mongo_clear_errors( conn );
+}
+
+/* Determine whether this BSON object is valid for the given operation.  */
+static int mongo_bson_valid( mongo *conn, const bson *bson, int write ) {
+    int size;
+
+    if( ! bson->finished ) {
+        conn->err = MONGO_BSON_NOT_FINISHED;
+        return MONGO_ERROR;
+    }
+
+    size = bson_size( bson );
+    if( size > conn->max_bson_size ) {
+        conn->err = MONGO_BSON_TOO_LARGE;
+        return MONGO_ERROR;
+    }
+
+    if( bson->err & BSON_NOT_UTF8 ) {
+        conn->err = MONGO_BSON_INVALID;
+        return MONGO_ERROR;
+    }
+
+    if( write ) {
+        if( ( bson->err & BSON_FIELD_HAS_DOT ) ||
+                ( bson->err & BSON_FIELD_INIT_DOLLAR ) ) {
+
+            conn->err = MONGO_BSON_INVALID;
+            return MONGO_ERROR;
+
+        }
+    }
+
+    conn->err = MONGO_CONN_SUCCESS;
+
+    return MONGO_OK;
+}
+
+/* Determine whether this BSON object is valid for the given operation.  */
+static int mongo_cursor_bson_valid( mongo_cursor *cursor, const bson *bson ) {
+    if( ! bson->finished ) {
+        cursor->err = MONGO_CURSOR_BSON_ERROR;
+        cursor->conn->err = MONGO_BSON_NOT_FINISHED;
+        return MONGO_ERROR;
+    }
+
+    if( bson->err & BSON_NOT_UTF8 ) {
+        cursor->err = MONGO_CURSOR_BSON_ERROR;
+        cursor->conn->err = MONGO_BSON_INVALID;
+        return MONGO_ERROR;
+    }
+
+    return MONGO_OK;
+}
+
+static int mongo_check_last_error_response( mongo *conn, bson *response ) {
+    bson_iterator it[1];
+
+    if (bson_find( it, response, "$err" ) == BSON_STRING ||
+        bson_find( it, response, "err" ) == BSON_STRING) {
+
+        __mongo_set_error( conn, MONGO_WRITE_ERROR,
+                           "See conn->lasterrstr for details.", 0 );
+        mongo_set_last_error( conn, it, response );
+        return MONGO_ERROR;
+    }
+
+    return MONGO_OK;
+}
+
+static int mongo_choose_write_concern( mongo *conn,
+                                       mongo_write_concern *custom_write_concern,
+                                       mongo_write_concern **write_concern ) {
+
+    if( custom_write_concern ) {
+        *write_concern = custom_write_concern;
+    }
+    else if( conn->write_concern ) {
+        *write_concern = conn->write_concern;
+    }
+    if ( *write_concern && (*write_concern)->w < 1 ) {
+        *write_concern = 0; /* do not generate getLastError request */
+    }
+    if( *write_concern && !((*write_concern)->cmd) ) {
+        __mongo_set_error( conn, MONGO_WRITE_CONCERN_INVALID,
+                           "Must call mongo_write_concern_finish() before using *write_concern.", 0 );
+        return MONGO_ERROR;
+    }
+    else
+        return MONGO_OK;
+}
+
+
+/*********************************************************************
+CRUD API
+**********************************************************************/
+
+/* The write concern for a message built by mongo_*_message( ): only a write command carries one. */
+static int mongo_message_write_concern( mongo *conn, mongo_write_concern **write_concern ) {
+    *write_concern = NULL;
+    if( !mongo_use_op_msg( conn ) )
+        return MONGO_OK;
+
+    return mongo_choose_write_concern( conn, NULL, write_concern );
+}
+
+/* Start an OP_MSG write command (insert, update or delete) on the collection of ns. */
+static void mongo_write_command_init( mongo *conn, const char *name, const char *ns,
+                                      mongo_write_concern *write_concern, mongo_message_vec *mv, bson *cmd ) {
+    size_t db_len;
+
+    if( write_concern )
+        mongo_clear_errors( conn );
+
+    mongo_command_message_init( mv, cmd );
+    bson_append_string( cmd, name, mongo_ns_collection( ns, &db_len ) );
+}
+
+/* Complete a write command with its write concern: the options of the getlasterror command,
+   or w:0 for an unacknowledged write, which has no reply. */
+static int mongo_write_command_finish( mongo *conn, mongo_message_vec *mv, bson *cmd, const char *ns,
+                                       mongo_write_concern *write_concern, const char *seq, const bson **docs, int count ) {
+    bson_iterator it[1];
+
+    bson_append_start_object( cmd, "writeConcern" );
+    if( !write_concern )
+        bson_append_int( cmd, "w", 0 );
+    else {
+        if( !write_concern->mode && write_concern->w <= 1 )
+            bson_append_int( cmd, "w", 1 );
+        bson_iterator_init( it, write_concern->cmd );
+        while( bson_iterator_next( it ) ) {
+            if( strcmp( bson_iterator_key( it ), "getlasterror" ) )
+                bson_append_element( cmd, NULL, it );
+        }
+    }
+    bson_append_finish_object( cmd );
+
+    return mongo_command_message_finish( conn, mv, cmd, ns, write_concern ? 0 : MONGO_MSG_MORE_TO_COME,
+                                         seq, docs, count );
+}
+
+/* The outcome of an acknowledged write command: its first write error, or its write concern error. */
+static int mongo_check_write_command_response( mongo *conn, bson *response ) {
+    bson_iterator it[1], sub[1];
+    bson error_obj[1];
+    bson *error = response;
+
+    if( bson_find( it, response, "ok" ) && bson_iterator_bool( it ) ) {
+        if( bson_find( it, response, "writeErrors" ) == BSON_ARRAY ) {
+            bson_iterator_subiterator( it, sub );
+            if( bson_iterator_next( sub ) != BSON_OBJECT )
+                return MONGO_OK;
+            bson_iterator_subobject_init( sub, error_obj, 0 );
+        }
+        else if( bson_find( it, response, "writeConcernError" ) == BSON_OBJECT )
+            bson_iterator_subobject_init( it, error_obj, 0 );
+        else
+            return MONGO_OK;
+        error = error_obj;
+    }
+
+    __mongo_set_error( conn, MONGO_WRITE_ERROR,
+                       "See conn->lasterrstr for details.", 0 );
+    if( bson_find( it, error, "errmsg" ) == BSON_STRING )
+        mongo_set_last_error( conn, it, error );
+    return MONGO_ERROR;
+}
+
+/* Build the getlasterror query for a write to ns.  The command namespace ("<db>.$cmd") is
+   formed in the message itself, so nothing is allocated. */
+static int mongo_write_concern_query( mongo *conn, const char *ns,
+                                      mongo_write_concern *write_concern, mongo_message_vec *mv ) {
+    char *data;
+    const char *dot = strchr( ns, '.' );
+    size_t db_len = dot ? ( size_t )( dot - ns ) : strlen( ns );
+
+    mongo_clear_errors( conn );
+
+    data = mongo_message_vec_init( mv, 4 + /* options */
+                                   db_len + 6 + /* ns */
+                                   4 + 4 /* skip,return */ );
+    data = mongo_data_append32( data, &ZERO );
+    data = mongo_data_append( data, ns, db_len );
+    data = mongo_data_append( data, ".$cmd", 6 );
+    data = mongo_data_append32( data, &ZERO );
+    data = mongo_data_append32( data, &ONE );
+
+    mv->doc[0] = write_concern->cmd;
+    mv->doc[1] = bson_shared_empty( );
+    mv->count = 2;
+
+    return mongo_message_vec_finish( conn, mv, MONGO_OP_QUERY, data );
+}
+
+/* An acknowledged write and its getlasterror query are written together, in a single vectored
+   send, so the write costs one round trip and no further allocation beyond the reply. */
+static int mongo_message_send_and_check_write_concern( mongo *conn, const char *ns, mongo_message_vec *mv, mongo_write_concern *write_concern ) {
+   mongo_message_vec query[1];
+   mongo_message_vec *mvs[2];
+   mongo_reply *reply;
+   int res;
+
+    if( !write_concern )
+        return mongo_message_send( conn, mv );
+
+    if( mongo_use_op_msg( conn ) ) {
+        /* A write command carries its write concern itself */
+        res = mongo_message_send( conn, mv );
+    }
+    else {
+        if( mongo_write_concern_query( conn, ns, write_concern, query ) != MONGO_OK ) {
+            mongo_message_vec_destroy( mv );
+            return MONGO_ERROR;
+        }
+
+        mvs[0] = mv;
+        mvs[1] = query;
+        res = mongo_message_send_all( conn, mvs, 2 );
+    }
+    if( res == MONGO_ERROR ) {
+        return MONGO_ERROR;
+    }
+
+    if( mongo_read_response( conn, &reply ) != MONGO_OK ) {
+        return MONGO_ERROR;
+    }
+
+    res = mongo_check_last_error_reply( conn, reply );
+    mongo_reply_free( reply );
+    return res;
+}
+
+MONGO_EXPORT int mongo_write_concern_message( mongo *conn, const char *ns,
+                                              mongo_write_concern *custom_write_concern, mongo_message_vec *mv ) {
+    mongo_write_concern *write_concern = NULL;
+
+    mv->len = 0;
+    mv->prefix_ext = NULL;
+    if( mongo_choose_write_concern( conn, custom_write_concern,
+                                    &write_concern ) == MONGO_ERROR ) {
+        return MONGO_ERROR;
+    }
+    if( !write_concern || mongo_use_op_msg( conn ) )
+        return MONGO_OK; /* a write command carries its write concern itself */
+
+    return mongo_write_concern_query( conn, ns, write_concern, mv );
 }
 
-MONGO_EXPORT int mongo_replset_connect( mongo *conn ) {
-    int ret;
-    bson_errprintf("WARNING: mongo_replset_connect() is deprecated, please use mongo_replica_set_client()\n");
-    ret = mongo_replica_set_client( conn );
-    mongo_set_write_concern( conn, 0 );
-    return ret;
-}
+MONGO_EXPORT int mongo_check_last_error_reply( mongo *conn, mongo_reply *reply ) {
+    bson response[1];
 
-MONGO_EXPORT int mongo_set_op_timeout( mongo *conn, int millis ) {
-    conn->op_timeout_ms = millis;
-    if( conn->sock && conn->connected )
-        mongo_env_set_socket_op_timeout( conn, millis );
+    if( reply->fields.num < 1 ) {
+        __mongo_set_error( conn, MONGO_WRITE_ERROR, "No response to getlasterror.", 0 );
+        return MONGO_ERROR;
+    }
 
-    return MONGO_OK;
+    bson_init_finished_data( response, &reply->objs, 0 );
+    if( reply->head.op == MONGO_OP_MSG )
+        return mongo_check_write_command_response( conn, response );
+    return mongo_check_last_error_response( conn, response );
 }
 
-MONGO_EXPORT int mongo_reconnect( mongo *conn ) {
-    int res;
-    mongo_disconnect( conn );
+#define MONGO_MESSAGE_OVERHEAD 16 * 1024 /* room for the header, namespace and write command around a message's documents */
+#define MONGO_WRITE_WINDOW 32             /* write messages sent together before their replies are read */
 
-    if( conn->replica_set ) {
-        conn->replica_set->primary_connected = 0;
-        mongo_replica_set_free_list( &conn->replica_set->hosts );
-        conn->replica_set->hosts = NULL;
-        res = mongo_replica_set_client( conn );
-        return res;
+MONGO_EXPORT int mongo_insert_batch_split( mongo *conn, const bson **bsons, int count ) {
+    int i, size;
+    size_t total = 0;
+    size_t limit = ( size_t )conn->max_message_size - MONGO_MESSAGE_OVERHEAD;
+
+    if( mongo_use_op_msg( conn ) && count > conn->max_write_batch_size )
+        count = conn->max_write_batch_size;
+
+    for( i = 0; i < count; i++ ) {
+        size = bson_size( bsons[i] );
+        if( size > conn->max_bson_size || ( i > 0 && total + size > limit ) )
+            break;
+        total += size;
     }
-    else
-        return mongo_env_socket_connect( conn, conn->primary->host, conn->primary->port );
+    if( i == 0 ) {
+        conn->err = MONGO_BSON_TOO_LARGE;
+        return MONGO_ERROR;
+    }
+
+    return i;
 }
 
-MONGO_EXPORT int mongo_check_connection( mongo *conn ) {
-    if( ! conn->connected )
+static int mongo_insert_build( mongo *conn, const char *ns, const bson **bsons, int count, int flags,
+                               mongo_write_concern *write_concern, mongo_message_vec *mv ) {
+
+    int i;
+    bson cmd[1];
+    char *data;
+    size_t ns_len = strlen( ns ) + 1;
+
+    if( mongo_validate_ns( conn, ns ) != MONGO_OK )
         return MONGO_ERROR;
 
-    return mongo_simple_int_command( conn, "admin", "ping", 1, NULL );
-}
+    for( i=0; i<count; i++ ) {
+        if( mongo_bson_valid( conn, bsons[i], 1 ) != MONGO_OK )
+            return MONGO_ERROR;
+    }
 
-MONGO_EXPORT void mongo_disconnect( mongo *conn ) {
-    if( ! conn->connected )
-        return;
+    /* A batch too large for one message is split by the caller (mongo_insert_batch_split) */
+    if( mongo_insert_batch_split( conn, bsons, count ) != count ) {
+        conn->err = MONGO_BSON_TOO_LARGE;
+        return MONGO_ERROR;
+    }
 
-    if( conn->replica_set ) {
-        conn->replica_set->primary_connected = 0;
-        mongo_replica_set_free_list( &conn->replica_set->hosts );
-        conn->replica_set->hosts = NULL;
+    if( mongo_use_op_msg( conn ) ) {
+        mongo_write_command_init( conn, "insert", ns, write_concern, mv, cmd );
+        bson_append_bool( cmd, "ordered", !( flags & MONGO_CONTINUE_ON_ERROR ) );
+
+        /* The documents are sent from the caller's buffers, as a document sequence. */
+        return mongo_write_command_finish( conn, mv, cmd, ns, write_concern, "documents", bsons, count );
     }
 
-    mongo_env_close_socket( conn->sock );
+    data = mongo_message_vec_init( mv, 4 + ns_len );
+    if( flags & MONGO_CONTINUE_ON_ERROR )
+        data = mongo_data_append32( data, &ONE );
+    else
+        data = mongo_data_append32( data, &ZERO );
+    data = mongo_data_append( data, ns, ns_len );
 
-    conn->sock = 0;
-    conn->connected = 0;
+    /* The documents are sent from the caller's buffers. */
+    mv->docs = bsons;
+    mv->count = count;
+
+    return mongo_message_vec_finish( conn, mv, MONGO_OP_INSERT, data );
 }
 
-MONGO_EXPORT void mongo_destroy( mongo *conn ) {
-    mongo_disconnect( conn );
+MONGO_EXPORT int mongo_insert_message( mongo *conn, const char *ns,
+                                       const bson **bsons, int count, int flags, mongo_message_vec *mv ) {
 
-    if( conn->replica_set ) {
-        mongo_replica_set_free_list( &conn->replica_set->seeds );
-        mongo_replica_set_free_list( &conn->replica_set->hosts );
-        bson_free( conn->replica_set->name );
-        bson_free( conn->replica_set );
-        conn->replica_set = NULL;
-    }
+    mongo_write_concern *write_concern;
 
-    bson_free( conn->primary );
+    if( mongo_message_write_concern( conn, &write_concern ) != MONGO_OK )
+        return MONGO_ERROR;
 
-    mongo_clear_errors( conn );
+    return mongo_insert_build( conn, ns, bsons, count, flags, write_concern, mv );
 }
 
-/* Determine whether this BSON object is valid for the given operation.  */
-static int mongo_bson_valid( mongo *conn, const bson *bson, int write ) {
-    int size;
+MONGO_EXPORT int mongo_insert( mongo *conn, const char *ns,
+                               const bson *bson, mongo_write_concern *custom_write_concern ) {
 
-    if( ! bson->finished ) {
-        conn->err = MONGO_BSON_NOT_FINISHED;
+    mongo_message_vec mv[1];
+    mongo_write_concern *write_concern = NULL;
+
+    if( mongo_choose_write_concern( conn, custom_write_concern,
+                                    &write_concern ) == MONGO_ERROR ) {
         return MONGO_ERROR;
     }
 
-    size = bson_size( bson );
-    if( size > conn->max_bson_size ) {
-        conn->err = MONGO_BSON_TOO_LARGE;
+    if( mongo_insert_build( conn, ns, &bson, 1, 0, write_concern, mv ) != MONGO_OK )
         return MONGO_ERROR;
-    }
 
-    if( bson->err & BSON_NOT_UTF8 ) {
-        conn->err = MONGO_BSON_INVALID;
+    return mongo_message_send_and_check_write_concern( conn, ns, mv, write_concern ); 
+}
+
+MONGO_EXPORT int mongo_insert_batch( mongo *conn, const char *ns,
+                                     const bson **bsons, int count, mongo_write_concern *custom_write_concern,
+                                     int flags ) {
+
+    mongo_message_vec mv[MONGO_WRITE_WINDOW * 2];
+    mongo_message_vec *mvs[MONGO_WRITE_WINDOW * 2];
+    mongo_write_concern *write_concern = NULL;
+    mongo_reply *reply;
+    char lasterrstr[MONGO_ERR_LEN];
+    int lasterrcode = 0, failed = 0;
+    int i, j, n, sent, window, res = MONGO_OK;
+
+    if( mongo_choose_write_concern( conn, custom_write_concern,
+                                    &write_concern ) == MONGO_ERROR ) {
         return MONGO_ERROR;
     }
 
-    if( write ) {
-        if( ( bson->err & BSON_FIELD_HAS_DOT ) ||
-                ( bson->err & BSON_FIELD_INIT_DOLLAR ) ) {
+    /* Nothing is sent unless the whole batch is valid */
+    for( i = 0; i < count; i++ ) {
+        if( bson_size( bsons[i] ) > conn->max_bson_size ) {
+            conn->err = MONGO_BSON_TOO_LARGE;
+            return MONGO_ERROR;
+        }
+        if( mongo_bson_valid( conn, bsons[i], 1 ) != MONGO_OK )
+            return MONGO_ERROR;
+    }
 
-            conn->err = MONGO_BSON_INVALID;
+    /* The messages of an ordered, acknowledged, batch are sent one at a time so that it can stop
+       at the first failure: otherwise a window of them is written before their replies are read. */
+    window = write_concern && !( flags & MONGO_CONTINUE_ON_ERROR ) ? 1 : MONGO_WRITE_WINDOW;
+
+    for( sent = 0; sent < count; ) {
+        for( n = 0, j = 0; n < window && sent < count; n++ ) {
+            i = mongo_insert_batch_split( conn, bsons + sent, count - sent );
+            if( i == MONGO_ERROR )
+                res = MONGO_ERROR;
+            else
+                res = mongo_insert_build( conn, ns, bsons + sent, i, flags, write_concern, &mv[j] );
+            if( res != MONGO_OK )
+                break;
+            mvs[j] = &mv[j];
+            j++;
+            sent += i;
+            if( write_concern && !mongo_use_op_msg( conn ) ) {
+                res = mongo_write_concern_query( conn, ns, write_concern, &mv[j] );
+                if( res != MONGO_OK )
+                    break;
+                mvs[j] = &mv[j];
+                j++;
+            }
+        }
+        if( res != MONGO_OK ) {
+            while( j-- )
+                mongo_message_vec_destroy( &mv[j] );
+            return MONGO_ERROR;
+        }
+
+        if( mongo_message_send_all( conn, mvs, j ) != MONGO_OK )
             return MONGO_ERROR;
+        if( !write_concern )
+            continue;
 
+        for( i = 0; i < n; i++ ) {
+            if( mongo_read_response( conn, &reply ) != MONGO_OK )
+                return MONGO_ERROR;
+            if( !failed && mongo_check_last_error_reply( conn, reply ) != MONGO_OK ) {
+                /* Keep the first failure: building the next messages clears the connection's errors */
+                failed = 1;
+                lasterrcode = conn->lasterrcode;
+                memcpy( lasterrstr, conn->lasterrstr, MONGO_ERR_LEN );
+            }
+            mongo_reply_free( reply );
         }
+        if( failed && !( flags & MONGO_CONTINUE_ON_ERROR ) )
+            break;
     }
 
-    conn->err = MONGO_CONN_SUCCESS;
+    if( failed ) {
+        __mongo_set_error( conn, MONGO_WRITE_ERROR, "See conn->lasterrstr for details.", 0 );
+        conn->lasterrcode = lasterrcode;
+        memcpy( conn->lasterrstr, lasterrstr, MONGO_ERR_LEN );
+        return MONGO_ERROR;
+    }
 
     return MONGO_OK;
 }
 
-/* Determine whether this BSON object is valid for the given operation.  */
-static int mongo_cursor_bson_valid( mongo_cursor *cursor, const bson *bson ) {
-    if( ! bson->finished ) {
-        cursor->err = MONGO_CURSOR_BSON_ERROR;
-        cursor->conn->err = MONGO_BSON_NOT_FINISHED;
+static int mongo_update_build( mongo *conn, const char *ns, const bson *cond, const bson *op, int flags,
+                               mongo_write_concern *write_concern, mongo_message_vec *mv ) {
+
+    bson cmd[1];
+    char *data;
+    size_t ns_len = strlen( ns ) + 1;
+
+    /* Make sure that the op BSON is valid UTF-8.
+     * TODO: decide whether to check cond as well.
+     * */
+    if( mongo_bson_valid( conn, ( bson * )op, 0 ) != MONGO_OK ) {
         return MONGO_ERROR;
     }
 
-    if( bson->err & BSON_NOT_UTF8 ) {
-        cursor->err = MONGO_CURSOR_BSON_ERROR;
-        cursor->conn->err = MONGO_BSON_INVALID;
-        return MONGO_ERROR;
+    if( mongo_use_op_msg( conn ) ) {
+        mongo_write_command_init( conn, "update", ns, write_concern, mv, cmd );
+        bson_append_start_array( cmd, "updates" );
+        bson_append_start_object( cmd, "0" );
+        bson_append_bson( cmd, "q", cond );
+        bson_append_bson( cmd, "u", op );
+        if( flags & MONGO_UPDATE_UPSERT )
+            bson_append_bool( cmd, "upsert", 1 );
+        if( flags & MONGO_UPDATE_MULTI )
+            bson_append_bool( cmd, "multi", 1 );
+        bson_append_finish_object( cmd );
+        bson_append_finish_array( cmd );
+
+        return mongo_write_command_finish( conn, mv, cmd, ns, write_concern, NULL, NULL, 0 );
     }
 
-    return MONGO_OK;
-}
+    data = mongo_message_vec_init( mv, 4 /* ZERO */
+                                   + ns_len
+                                   + 4 /* flags */ );
+    data = mongo_data_append32( data, &ZERO );
+    data = mongo_data_append( data, ns, ns_len );
+    data = mongo_data_append32( data, &flags );
 
-static int mongo_check_last_error( mongo *conn, const char *ns,
-                                   mongo_write_concern *write_concern ) {
-    bson response[1];
-    bson_iterator it[1];
-    int res = 0;
-    char *cmd_ns = mongo_ns_to_cmd_db( ns );
+    mv->doc[0] = cond;
+    mv->doc[1] = op;
+    mv->count = 2;
 
-    res = mongo_find_one( conn, cmd_ns, write_concern->cmd, bson_shared_empty( ), response );
-    bson_free( cmd_ns );
+    return mongo_message_vec_finish( conn, mv, MONGO_OP_UPDATE, data );
+}
 
-    if (res == MONGO_OK &&
-        (bson_find( it, response, "$err" ) == BSON_STRING ||
-         bson_find( it, response, "err" ) == BSON_STRING)) {
+MONGO_EXPORT int mongo_update_message( mongo *conn, const char *ns, const bson *cond,
+                                       const bson *op, int flags, mongo_message_vec *mv ) {
 
-        __mongo_set_error( conn, MONGO_WRITE_ERROR,
-                           "See conn->lasterrstr for details.", 0 );
-        mongo_set_last_error( conn, it, response );
-        res = MONGO_ERROR;
-    }
+    mongo_write_concern *write_concern;
 
-    bson_destroy( response );
-    return res;
+    if( mongo_message_write_concern( conn, &write_concern ) != MONGO_OK )
+        return MONGO_ERROR;
+
+    return mongo_update_build( conn, ns, cond, op, flags, write_concern, mv );
 }
 
-static int mongo_choose_write_concern( mongo *conn,
-                                       mongo_write_concern *custom_write_concern,
-                                       mongo_write_concern **write_concern ) {
+MONGO_EXPORT int mongo_update( mongo *conn, const char *ns, const bson *cond,
+                               const bson *op, int flags, mongo_write_concern *custom_write_concern ) {
 
-    if( custom_write_concern ) {
-        *write_concern = custom_write_concern;
-    }
-    else if( conn->write_concern ) {
-        *write_concern = conn->write_concern;
-    }
-    if ( *write_concern && (*write_concern)->w < 1 ) {
-        *write_concern = 0; /* do not generate getLastError request */
-    }
-    if( *write_concern && !((*write_concern)->cmd) ) {
-        __mongo_set_error( conn, MONGO_WRITE_CONCERN_INVALID,
-                           "Must call mongo_write_concern_finish() before using *write_concern.", 0 );
+    mongo_message_vec mv[1];
+    mongo_write_concern *write_concern = NULL;
+
+    if( mongo_choose_write_concern( conn, custom_write_concern,
+                                    &write_concern ) == MONGO_ERROR ) {
         return MONGO_ERROR;
     }
-    else
-        return MONGO_OK;
-}
 
+    if( mongo_update_build( conn, ns, cond, op, flags, write_concern, mv ) != MONGO_OK )
+        return MONGO_ERROR;
 
-/*********************************************************************
-CRUD API
-**********************************************************************/
+    return mongo_message_send_and_check_write_concern( conn, ns, mv, write_concern ); 
+}
 
-static int mongo_message_send_and_check_write_concern( mongo *conn, const char *ns, mongo_message *mm, mongo_write_concern *write_concern ) {
-   if( write_concern ) {
-        if( mongo_message_send( conn, mm ) == MONGO_ERROR ) {
-            return MONGO_ERROR;
-        }
+static int mongo_remove_build( mongo *conn, const char *ns, const bson *cond,
+                               mongo_write_concern *write_concern, mongo_message_vec *mv ) {
 
-        return mongo_check_last_error( conn, ns, write_concern );
+    bson cmd[1];
+    char *data;
+    size_t ns_len = strlen( ns ) + 1;
+
+    /* Make sure that the BSON is valid UTF-8.
+     * TODO: decide whether to check cond as well.
+     * */
+    if( mongo_bson_valid( conn, ( bson * )cond, 0 ) != MONGO_OK ) {
+        return MONGO_ERROR;
     }
-    else {
-        return mongo_message_send( conn, mm );
+
+    if( mongo_use_op_msg( conn ) ) {
+        mongo_write_command_init( conn, "delete", ns, write_concern, mv, cmd );
+        bson_append_start_array( cmd, "deletes" );
+        bson_append_start_object( cmd, "0" );
+        bson_append_bson( cmd, "q", cond );
+        bson_append_int( cmd, "limit", 0 );
+        bson_append_finish_object( cmd );
+        bson_append_finish_array( cmd );
+
+        return mongo_write_command_finish( conn, mv, cmd, ns, write_concern, NULL, NULL, 0 );
     }
+
+    data = mongo_message_vec_init( mv, 4 /* ZERO */
+                                   + ns_len
+                                   + 4 /* ZERO */ );
+    data = mongo_data_append32( data, &ZERO );
+    data = mongo_data_append( data, ns, ns_len );
+    data = mongo_data_append32( data, &ZERO );
+
+    mv->doc[0] = cond;
+    mv->count = 1;
+
+    return mongo_message_vec_finish( conn, mv, MONGO_OP_DELETE, data );
 }
 
-MONGO_EXPORT int mongo_insert( mongo *conn, const char *ns,
-                               const bson *bson, mongo_write_concern *custom_write_concern ) {
+MONGO_EXPORT int mongo_remove_message( mongo *conn, const char *ns, const bson *cond,
+                                       mongo_message_vec *mv ) {
 
-    char *data;
-    mongo_message *mm;
-    mongo_write_concern *write_concern = NULL;
+    mongo_write_concern *write_concern;
 
-    if( mongo_validate_ns( conn, ns ) != MONGO_OK )
+    if( mongo_message_write_concern( conn, &write_concern ) != MONGO_OK )
         return MONGO_ERROR;
 
-    if( mongo_bson_valid( conn, bson, 1 ) != MONGO_OK ) {
-        return MONGO_ERROR;
-    }
+    return mongo_remove_build( conn, ns, cond, write_concern, mv );
+}
+
+MONGO_EXPORT int mongo_remove( mongo *conn, const char *ns, const bson *cond,
+                               mongo_write_concern *custom_write_concern ) {
+
+    mongo_message_vec mv[1];
+    mongo_write_concern *write_concern = NULL;
 
     if( mongo_choose_write_concern( conn, custom_write_concern,
                                     &write_concern ) == MONGO_ERROR ) {
         return MONGO_ERROR;
     }
 
-    mm = mongo_message_create( 16 /* header */
-                               + 4 /* ZERO */
-                               + strlen( ns )
-                               + 1 + bson_size( bson )
-                               , 0, 0, MONGO_OP_INSERT );
-    if( mm == NULL ) {
-        conn->err = MONGO_BSON_TOO_LARGE;
+    if( mongo_remove_build( conn, ns, cond, write_concern, mv ) != MONGO_OK )
         return MONGO_ERROR;
+
+    return mongo_message_send_and_check_write_concern( conn, ns, mv, write_concern ); 
+}
+
+
+/*********************************************************************
+Bulk Write API
+**********************************************************************/
+
+/* A run of operations, in the order in which they are sent, that make up one write command
+   (OP_MSG), or a single operation (legacy wire protocol). */
+typedef struct {
+    int start;
+    int count;
+} mongo_bulk_batch;
+
+/* The space an operation takes in a write command. */
+static size_t mongo_bulk_op_size( const mongo_bulk_op *op ) {
+    size_t size = 32; /* the statement's keys and the array index */
+
+    if( op->cond )
+        size += bson_size( op->cond );
+    if( op->doc )
+        size += bson_size( op->doc );
+    return size;
+}
+
+/* Split the operations, taken in the order given, into batches of the same type within the server's
+   limits: inserted documents are sent as a document sequence, the other statements within the command. */
+static int mongo_bulk_batches( mongo *conn, mongo_bulk_op *ops, const int *order, int count,
+                               mongo_bulk_batch *batches ) {
+    int i, n = 0;
+    size_t size = 0, op_size, limit;
+
+    for( i = 0; i < count; i++ ) {
+        op_size = mongo_bulk_op_size( &ops[order[i]] );
+        if( ops[order[i]].type == MONGO_BULK_INSERT )
+            limit = ( size_t )conn->max_message_size - MONGO_MESSAGE_OVERHEAD;
+        else
+            limit = ( size_t )conn->max_bson_size;
+        if( n == 0 || !mongo_use_op_msg( conn ) ||
+            ops[order[i]].type != ops[order[batches[n - 1].start]].type ||
+            batches[n - 1].count == conn->max_write_batch_size ||
+            size + op_size > limit ) {
+            batches[n].start = i;
+            batches[n].count = 0;
+            size = 0;
+            n++;
+        }
+        batches[n - 1].count++;
+        size += op_size;
     }
 
-    data = &mm->data;
-    data = mongo_data_append32( data, &ZERO );
-    data = mongo_data_append( data, ns, strlen( ns ) + 1 );
-    mongo_data_append( data, bson->data, bson_size( bson ) );
+    return n;
+}
+
+/* Build the write command for a batch of operations (OP_MSG). */
+static int mongo_bulk_command_build( mongo *conn, const char *ns, mongo_bulk_op *ops, const int *order,
+                                     const bson **docs, int count, int ordered,
+                                     mongo_write_concern *write_concern, mongo_message_vec *mv ) {
+    bson cmd[1];
+    char key[16];
+    mongo_bulk_op *op;
+    int i, type = ops[order[0]].type;
+
+    for( i = 0; i < count; i++ ) {
+        op = &ops[order[i]];
+        if( mongo_bson_valid( conn, op->type == MONGO_BULK_REMOVE ? op->cond : op->doc, op->type == MONGO_BULK_INSERT ) != MONGO_OK )
+            return MONGO_ERROR;
+        docs[i] = op->doc;
+    }
+
+    if( type == MONGO_BULK_INSERT ) {
+        mongo_write_command_init( conn, "insert", ns, write_concern, mv, cmd );
+        bson_append_bool( cmd, "ordered", ordered );
+        return mongo_write_command_finish( conn, mv, cmd, ns, write_concern, "documents", docs, count );
+    }
+
+    mongo_write_command_init( conn, type == MONGO_BULK_UPDATE ? "update" : "delete", ns, write_concern, mv, cmd );
+    bson_append_bool( cmd, "ordered", ordered );
+    bson_append_start_array( cmd, type == MONGO_BULK_UPDATE ? "updates" : "deletes" );
+    for( i = 0; i < count; i++ ) {
+        op = &ops[order[i]];
+        bson_numstr( key, i );
+        bson_append_start_object( cmd, key );
+        bson_append_bson( cmd, "q", op->cond );
+        if( type == MONGO_BULK_UPDATE ) {
+            bson_append_bson( cmd, "u", op->doc );
+            if( op->flags & MONGO_UPDATE_UPSERT )
+                bson_append_bool( cmd, "upsert", 1 );
+            if( op->flags & MONGO_UPDATE_MULTI )
+                bson_append_bool( cmd, "multi", 1 );
+        }
+        else
+            bson_append_int( cmd, "limit", 0 );
+        bson_append_finish_object( cmd );
+    }
+    bson_append_finish_array( cmd );
 
-    return mongo_message_send_and_check_write_concern( conn, ns, mm, write_concern ); 
+    return mongo_write_command_finish( conn, mv, cmd, ns, write_concern, NULL, NULL, 0 );
 }
 
-MONGO_EXPORT int mongo_insert_batch( mongo *conn, const char *ns,
-                                     const bson **bsons, int count, mongo_write_concern *custom_write_concern,
-                                     int flags ) {
+/* Build the message for a single operation (legacy wire protocol). */
+static int mongo_bulk_op_build( mongo *conn, const char *ns, mongo_bulk_op *op, const bson **doc,
+                                mongo_write_concern *write_concern, mongo_message_vec *mv ) {
+    *doc = op->doc;
+    if( op->type == MONGO_BULK_INSERT )
+        return mongo_insert_build( conn, ns, doc, 1, 0, write_concern, mv );
+    if( op->type == MONGO_BULK_UPDATE )
+        return mongo_update_build( conn, ns, op->cond, op->doc, op->flags, write_concern, mv );
+    return mongo_remove_build( conn, ns, op->cond, write_concern, mv );
+}
+
+static void mongo_bulk_op_failed( mongo_bulk_op *op, bson *error, const char *msg_key ) {
+    bson_iterator it[1];
+
+    op->err = bson_find( it, error, "code" ) && bson_iterator_int( it ) ? bson_iterator_int( it ) : 1;
+    op->errstr[0] = '\0';
+    if( bson_find( it, error, msg_key ) == BSON_STRING ) {
+        strncpy( op->errstr, bson_iterator_string( it ), MONGO_ERR_LEN - 1 );
+        op->errstr[MONGO_ERR_LEN - 1] = '\0';
+    }
+}
 
-    mongo_message *mm;
-    mongo_write_concern *write_concern = NULL;
-    int i;
-    char *data;
-    size_t overhead =  16 + 4 + strlen( ns ) + 1;
-    size_t size = overhead;
+static void mongo_bulk_op_upserted( mongo_bulk_op *op, bson_iterator *id ) {
+    bson_init( &op->upserted );
+    bson_append_element( &op->upserted, "_id", id );
+    bson_finish( &op->upserted );
+}
 
-    if( mongo_validate_ns( conn, ns ) != MONGO_OK )
-        return MONGO_ERROR;
+/* Apply the reply to a write command to its batch of operations. */
+static void mongo_bulk_command_reply( mongo_bulk_op *ops, const int *order, int count, int ordered,
+                                      bson *response, mongo_bulk_result *result, mongo_bulk_op *concern ) {
+    bson_iterator it[1], sub[1], field[1];
+    bson error[1];
+    int i, n = 0, upserted = 0, first_error = count, type = ops[order[0]].type;
 
-    for( i=0; i<count; i++ ) {
-        size += bson_size( bsons[i] );
-        if( mongo_bson_valid( conn, bsons[i], 1 ) != MONGO_OK )
-            return MONGO_ERROR;
+    if( !bson_find( it, response, "ok" ) || !bson_iterator_bool( it ) ) {
+        for( i = 0; i < count; i++ )
+            mongo_bulk_op_failed( &ops[order[i]], response, "errmsg" );
+        result->errors += count;
+        return;
     }
 
-    if( ( size - overhead ) > (size_t)conn->max_bson_size ) {
-        conn->err = MONGO_BSON_TOO_LARGE;
-        return MONGO_ERROR;
+    if( bson_find( it, response, "writeErrors" ) == BSON_ARRAY ) {
+        bson_iterator_subiterator( it, sub );
+        while( bson_iterator_next( sub ) == BSON_OBJECT ) {
+            bson_iterator_subobject_init( sub, error, 0 );
+            i = bson_find( field, error, "index" ) ? bson_iterator_int( field ) : 0;
+            if( i < 0 || i >= count )
+                continue;
+            mongo_bulk_op_failed( &ops[order[i]], error, "errmsg" );
+            result->errors++;
+            if( i < first_error )
+                first_error = i;
+        }
+    }
+    if( bson_find( it, response, "upserted" ) == BSON_ARRAY ) {
+        bson_iterator_subiterator( it, sub );
+        while( bson_iterator_next( sub ) == BSON_OBJECT ) {
+            bson_iterator_subobject_init( sub, error, 0 );
+            i = bson_find( field, error, "index" ) ? bson_iterator_int( field ) : -1;
+            if( i >= 0 && i < count && bson_find( field, error, "_id" ) )
+                mongo_bulk_op_upserted( &ops[order[i]], field );
+            upserted++;
+        }
+    }
+    if( bson_find( it, response, "writeConcernError" ) == BSON_OBJECT && concern->err <= 0 ) {
+        bson_iterator_subobject_init( it, error, 0 );
+        mongo_bulk_op_failed( concern, error, "errmsg" );
     }
 
-    if( mongo_choose_write_concern( conn, custom_write_concern,
-                                    &write_concern ) == MONGO_ERROR ) {
-        return MONGO_ERROR;
+    /* An ordered command stops at its first failure */
+    for( i = 0; i < ( ordered ? first_error : count ); i++ ) {
+        if( ops[order[i]].err == MONGO_BULK_NOT_EXECUTED )
+            ops[order[i]].err = 0;
     }
 
-    mm = mongo_message_create( size , 0 , 0 , MONGO_OP_INSERT );
-    if( mm == NULL ) {
-        conn->err = MONGO_BSON_TOO_LARGE;
-        return MONGO_ERROR;
+    if( bson_find( it, response, "n" ) )
+        n = bson_iterator_int( it );
+    if( type == MONGO_BULK_INSERT )
+        result->inserted += n;
+    else if( type == MONGO_BULK_REMOVE )
+        result->removed += n;
+    else {
+        result->upserted += upserted;
+        result->matched += n - upserted;
+        if( result->modified >= 0 && bson_find( it, response, "nModified" ) )
+            result->modified += bson_iterator_int( it );
     }
+}
 
-    data = &mm->data;
-    if( flags & MONGO_CONTINUE_ON_ERROR )
-        data = mongo_data_append32( data, &ONE );
-    else
-        data = mongo_data_append32( data, &ZERO );
-    data = mongo_data_append( data, ns, strlen( ns ) + 1 );
+/* Apply the reply to the getlasterror query that followed an operation (legacy wire protocol). */
+static void mongo_bulk_last_error_reply( mongo_bulk_op *op, bson *response, mongo_bulk_result *result ) {
+    bson_iterator it[1];
+    bson_type type;
+    int n = 0;
 
-    for( i=0; i<count; i++ ) {
-        data = mongo_data_append( data, bsons[i]->data, bson_size( bsons[i] ) );
+    if( bson_find( it, response, "$err" ) == BSON_STRING ) {
+        mongo_bulk_op_failed( op, response, "$err" );
+        result->errors++;
+        return;
+    }
+    if( bson_find( it, response, "err" ) == BSON_STRING ) {
+        mongo_bulk_op_failed( op, response, "err" );
+        result->errors++;
+        return;
     }
 
-    return mongo_message_send_and_check_write_concern( conn, ns, mm, write_concern ); 
+    op->err = 0;
+    if( bson_find( it, response, "n" ) )
+        n = bson_iterator_int( it );
+    if( op->type == MONGO_BULK_INSERT )
+        result->inserted++;
+    else if( op->type == MONGO_BULK_REMOVE )
+        result->removed += n;
+    else if( ( type = bson_find( it, response, "upserted" ) ) != BSON_EOO && type != BSON_NULL && type != BSON_UNDEFINED ) {
+        mongo_bulk_op_upserted( op, it );
+        result->upserted++;
+    }
+    else
+        result->matched += n;
 }
 
-MONGO_EXPORT int mongo_update( mongo *conn, const char *ns, const bson *cond,
-                               const bson *op, int flags, mongo_write_concern *custom_write_concern ) {
-
-    char *data;
-    mongo_message *mm;
+MONGO_EXPORT int mongo_bulk_write( mongo *conn, const char *ns, mongo_bulk_op *ops, int count, int ordered,
+                                   mongo_write_concern *custom_write_concern, mongo_bulk_result *result ) {
     mongo_write_concern *write_concern = NULL;
+    mongo_bulk_result totals;
+    mongo_bulk_op concern; /* the first write concern error */
+    mongo_bulk_batch *batches;
+    mongo_message_vec mv[MONGO_WRITE_WINDOW * 2];
+    mongo_message_vec *mvs[MONGO_WRITE_WINDOW * 2];
+    mongo_reply *reply;
+    const bson **docs;
+    bson response[1];
+    int *order;
+    int i, j, b, n, nb, window, type, res = MONGO_OK, stop = 0;
 
-    /* Make sure that the op BSON is valid UTF-8.
-     * TODO: decide whether to check cond as well.
-     * */
-    if( mongo_bson_valid( conn, ( bson * )op, 0 ) != MONGO_OK ) {
-        return MONGO_ERROR;
-    }
+    if( !result )
+        result = &totals;
+    concern.err = 0;
+    memset( result, 0, sizeof( *result ) );
+    result->modified = mongo_use_op_msg( conn ) ? 0 : -1;
 
-    if( mongo_choose_write_concern( conn, custom_write_concern,
-                                    &write_concern ) == MONGO_ERROR ) {
-        return MONGO_ERROR;
+    for( i = 0; i < count; i++ ) {
+        ops[i].err = MONGO_BULK_NOT_EXECUTED;
+        ops[i].errstr[0] = '\0';
+        bson_init_zero( &ops[i].upserted );
     }
+    if( count < 1 )
+        return MONGO_OK;
 
-    mm = mongo_message_create( 16 /* header */
-                               + 4  /* ZERO */
-                               + strlen( ns ) + 1
-                               + 4  /* flags */
-                               + bson_size( cond )
-                               + bson_size( op )
-                               , 0 , 0 , MONGO_OP_UPDATE );
-    if( mm == NULL ) {
-        conn->err = MONGO_BSON_TOO_LARGE;
+    if( mongo_validate_ns( conn, ns ) != MONGO_OK )
         return MONGO_ERROR;
+    if( mongo_choose_write_concern( conn, custom_write_concern, &write_concern ) == MONGO_ERROR )
+        return MONGO_ERROR;
+    mongo_clear_errors( conn );
+
+    /* An unordered bulk write sends the operations of each type together (with OP_MSG) */
+    order = ( int * )bson_malloc( count * ( sizeof( int ) + sizeof( bson * ) + sizeof( mongo_bulk_batch ) ) );
+    docs = ( const bson ** )( order + count );
+    batches = ( mongo_bulk_batch * )( docs + count );
+    if( ordered || !mongo_use_op_msg( conn ) ) {
+        for( i = 0; i < count; i++ )
+            order[i] = i;
+    }
+    else {
+        for( n = 0, type = MONGO_BULK_INSERT; type <= MONGO_BULK_REMOVE; type++ ) {
+            for( i = 0; i < count; i++ ) {
+                if( ops[i].type == type )
+                    order[n++] = i;
+            }
+        }
     }
+    nb = mongo_bulk_batches( conn, ops, order, count, batches );
 
-    data = &mm->data;
-    data = mongo_data_append32( data, &ZERO );
-    data = mongo_data_append( data, ns, strlen( ns ) + 1 );
-    data = mongo_data_append32( data, &flags );
-    data = mongo_data_append( data, cond->data, bson_size( cond ) );
-    mongo_data_append( data, op->data, bson_size( op ) );
+    /* The messages of an ordered, acknowledged, bulk write are sent one at a time so that it can stop
+       at the first failure: otherwise a window of them is written before their replies are read. */
+    window = ordered && write_concern ? 1 : MONGO_WRITE_WINDOW;
 
-    return mongo_message_send_and_check_write_concern( conn, ns, mm, write_concern ); 
-}
+    for( b = 0; b < nb && res == MONGO_OK && !stop; b += n ) {
+        n = nb - b < window ? nb - b : window;
 
-MONGO_EXPORT int mongo_remove( mongo *conn, const char *ns, const bson *cond,
-                               mongo_write_concern *custom_write_concern ) {
+        for( i = 0, j = 0; i < n && res == MONGO_OK; i++ ) {
+            mongo_bulk_batch *batch = &batches[b + i];
 
-    char *data;
-    mongo_message *mm;
-    mongo_write_concern *write_concern = NULL;
+            if( mongo_use_op_msg( conn ) )
+                res = mongo_bulk_command_build( conn, ns, ops, order + batch->start, docs + batch->start,
+                                                batch->count, ordered, write_concern, &mv[j] );
+            else
+                res = mongo_bulk_op_build( conn, ns, &ops[order[batch->start]], docs + batch->start,
+                                           write_concern, &mv[j] );
+            if( res != MONGO_OK )
+                break;
+            mvs[j] = &mv[j];
+            j++;
+            if( write_concern && !mongo_use_op_msg( conn ) ) {
+                res = mongo_write_concern_query( conn, ns, write_concern, &mv[j] );
+                if( res != MONGO_OK )
+                    break;
+                mvs[j] = &mv[j];
+                j++;
+            }
+        }
+        if( res != MONGO_OK ) {
+            while( j-- )
+                mongo_message_vec_destroy( &mv[j] );
+            break;
+        }
 
-    /* Make sure that the BSON is valid UTF-8.
-     * TODO: decide whether to check cond as well.
-     * */
-    if( mongo_bson_valid( conn, ( bson * )cond, 0 ) != MONGO_OK ) {
-        return MONGO_ERROR;
-    }
+        if( mongo_message_send_all( conn, mvs, j ) != MONGO_OK ) {
+            res = MONGO_ERROR;
+            break;
+        }
+        if( !write_concern )
+            continue;
 
-    if( mongo_choose_write_concern( conn, custom_write_concern,
-                                    &write_concern ) == MONGO_ERROR ) {
-        return MONGO_ERROR;
+        for( i = 0; i < n; i++ ) {
+            mongo_bulk_batch *batch = &batches[b + i];
+
+            if( mongo_read_response( conn, &reply ) != MONGO_OK ) {
+                res = MONGO_ERROR;
+                break;
+            }
+            if( reply->fields.num < 1 ) {
+                mongo_reply_free( reply );
+                __mongo_set_error( conn, MONGO_READ_SIZE_ERROR, "No response to a bulk write.", 0 );
+                res = MONGO_ERROR;
+                break;
+            }
+            bson_init_finished_data( response, &reply->objs, 0 );
+            j = result->errors;
+            if( reply->head.op == MONGO_OP_MSG )
+                mongo_bulk_command_reply( ops, order + batch->start, batch->count, ordered, response, result, &concern );
+            else
+                mongo_bulk_last_error_reply( &ops[order[batch->start]], response, result );
+            mongo_reply_free( reply );
+            if( ordered && result->errors > j )
+                stop = 1;
+        }
     }
 
-    mm = mongo_message_create( 16  /* header */
-                               + 4  /* ZERO */
-                               + strlen( ns ) + 1
-                               + 4  /* ZERO */
-                               + bson_size( cond )
-                               , 0 , 0 , MONGO_OP_DELETE );
-    if( mm == NULL ) {
-        conn->err = MONGO_BSON_TOO_LARGE;
+    bson_free( order );
+
+    if( res != MONGO_OK )
         return MONGO_ERROR;
-    }
 
-    data = &mm->data;
-    data = mongo_data_append32( data, &ZERO );
-    data = mongo_data_append( data, ns, strlen( ns ) + 1 );
-    data = mongo_data_append32( data, &ZERO );
-    mongo_data_append( data, cond->data, bson_size( cond ) );
+    /* Report the first operation that failed, or else a write concern error */
+    for( i = 0; i < count && ops[i].err <= 0; i++ )
+        ;
+    if( i == count && concern.err <= 0 )
+        return MONGO_OK;
+
+    __mongo_set_error( conn, MONGO_WRITE_ERROR, "See conn->lasterrstr for details.", 0 );
+    conn->lasterrcode = i < count ? ops[i].err : concern.err;
+    memcpy( conn->lasterrstr, i < count ? ops[i].errstr : concern.errstr, MONGO_ERR_LEN );
+    return MONGO_ERROR;
+}
 
-    return mongo_message_send_and_check_write_concern( conn, ns, mm, write_concern ); 
+MONGO_EXPORT void mongo_bulk_op_destroy( mongo_bulk_op *ops, int count ) {
+    int i;
+
+    for( i = 0; i < count; i++ ) {
+        if( ops[i].upserted.data )
+            bson_destroy( &ops[i].upserted );
+        bson_init_zero( &ops[i].upserted );
+    }
 }
 
 
@@ -1169,12 +2456,165 @@ MONGO_EXPORT void mongo_write_concern_set_mode( mongo_write_concern *write_conce
     write_concern->mode = mode;
 }
 
-static int mongo_cursor_op_query( mongo_cursor *cursor ) {
-    int res;
+/* Number of documents to request in the next OP_QUERY or OP_GET_MORE: both requests ask for no
+   more than the documents remaining under a positive limit, capped by the batch size.  A negative
+   limit (a single batch) is only sent with the OP_QUERY. */
+static int mongo_cursor_number_to_return( mongo_cursor *cursor ) {
+    int n = ( cursor->flags & MONGO_CURSOR_QUERY_SENT ) ? 0 : cursor->limit;
+
+    if( cursor->limit > 0 )
+        n = cursor->limit - cursor->seen;
+
+    if( cursor->batch_size > 0 && ( n == 0 || ( n > 0 && cursor->batch_size < n ) ) ) {
+        /* A request for one document would close the cursor on the server. */
+        n = ( cursor->batch_size == 1 ) ? 2 : cursor->batch_size;
+    }
+
+    return n;
+}
+
+/* Whether the cursor is the result of a command (a query on "<db>.$cmd") */
+static int mongo_cursor_is_command( mongo_cursor *cursor ) {
+    size_t len = strlen( cursor->ns );
+
+    return len >= 5 && !strcmp( cursor->ns + len - 5, ".$cmd" );
+}
+
+/* Legacy query modifiers and the find command options that replace them */
+static const char *mongo_find_modifiers[][2] = {
+    { "$orderby", "sort" },
+    { "$hint", "hint" },
+    { "$comment", "comment" },
+    { "$maxTimeMS", "maxTimeMS" },
+    { "$max", "max" },
+    { "$min", "min" },
+    { "$returnKey", "returnKey" },
+    { "$showDiskLoc", "showRecordId" },
+    { NULL, NULL }
+};
+
+/* With OP_MSG, a query is sent as the find command, and a query on "<db>.$cmd" as the command itself. */
+static int mongo_cursor_command_message( mongo_cursor *cursor, mongo_message_vec *mv ) {
+    bson cmd[1], filter[1];
+    bson_iterator it[1];
+    const bson *query = cursor->query;
+    const char *key;
+    size_t db_len;
+    int i;
+
+    if( bson_find( it, query, "$query" ) == BSON_OBJECT ) {
+        bson_iterator_subobject_init( it, filter, 0 );
+        query = filter;
+    }
+
+    mongo_command_message_init( mv, cmd );
+
+    if( mongo_cursor_is_command( cursor ) ) {
+        bson_iterator_init( it, query );
+        while( bson_iterator_next( it ) )
+            bson_append_element( cmd, NULL, it );
+    }
+    else {
+        bson_append_string( cmd, "find", mongo_ns_collection( cursor->ns, &db_len ) );
+        bson_append_bson( cmd, "filter", query );
+        if( query != cursor->query ) {
+            bson_iterator_init( it, cursor->query );
+            while( bson_iterator_next( it ) ) {
+                key = bson_iterator_key( it );
+                for( i = 0; mongo_find_modifiers[i][0]; i++ ) {
+                    if( !strcmp( key, mongo_find_modifiers[i][0] ) ) {
+                        bson_append_element( cmd, mongo_find_modifiers[i][1], it );
+                        break;
+                    }
+                }
+            }
+        }
+        if( bson_size( cursor->fields ) > 5 ) /* not empty */
+            bson_append_bson( cmd, "projection", cursor->fields );
+        if( cursor->skip )
+            bson_append_int( cmd, "skip", cursor->skip );
+        if( cursor->limit )
+            bson_append_int( cmd, "limit", cursor->limit < 0 ? -cursor->limit : cursor->limit );
+        if( cursor->limit < 0 )
+            bson_append_bool( cmd, "singleBatch", 1 );
+        if( cursor->batch_size > 0 )
+            bson_append_int( cmd, "batchSize", cursor->batch_size );
+        if( cursor->options & MONGO_TAILABLE )
+            bson_append_bool( cmd, "tailable", 1 );
+        if( cursor->options & MONGO_AWAIT_DATA )
+            bson_append_bool( cmd, "awaitData", 1 );
+        if( cursor->options & MONGO_NO_CURSOR_TIMEOUT )
+            bson_append_bool( cmd, "noCursorTimeout", 1 );
+        if( cursor->options & MONGO_PARTIAL )
+            bson_append_bool( cmd, "allowPartialResults", 1 );
+    }
+
+    if( cursor->options & MONGO_SLAVE_OK ) {
+        bson_append_start_object( cmd, "$readPreference" );
+        bson_append_string( cmd, "mode", "secondaryPreferred" );
+        bson_append_finish_object( cmd );
+    }
+
+    return mongo_command_message_finish( cursor->conn, mv, cmd, cursor->ns, 0, NULL, NULL, 0 );
+}
+
+/* The reply to a find or getMore command holds the batch as an array in its cursor document.  The
+   documents are moved, in place, down over the array keys that precede them, so that the reply is
+   then processed exactly like one to OP_QUERY or OP_GET_MORE. */
+static int mongo_cursor_command_reply( mongo_cursor *cursor ) {
+    mongo_reply *reply = cursor->reply;
+    bson response[1], sub[1];
+    bson_iterator it[1];
+    int64_t id = 0;
+    char *data, *next, *out;
+    int size, num = 0;
+
+    if( reply->head.op != MONGO_OP_MSG || mongo_cursor_is_command( cursor ) )
+        return MONGO_OK;
+
+    bson_init_finished_data( response, &reply->objs, 0 );
+    if( !bson_find( it, response, "ok" ) || !bson_iterator_bool( it ) ) {
+        if( bson_find( it, response, "errmsg" ) == BSON_STRING )
+            mongo_set_last_error( cursor->conn, it, response );
+        cursor->err = MONGO_CURSOR_QUERY_FAIL;
+        return MONGO_ERROR;
+    }
+
+    if( bson_find( it, response, "cursor" ) != BSON_OBJECT ) {
+        cursor->err = MONGO_CURSOR_INVALID;
+        return MONGO_ERROR;
+    }
+    bson_iterator_subobject_init( it, sub, 0 );
+    if( bson_find( it, sub, "id" ) )
+        id = bson_iterator_long( it );
+    if( bson_find( it, sub, "firstBatch" ) != BSON_ARRAY && bson_find( it, sub, "nextBatch" ) != BSON_ARRAY ) {
+        cursor->err = MONGO_CURSOR_INVALID;
+        return MONGO_ERROR;
+    }
+
+    data = ( char * )bson_iterator_value( it ) + 4;
+    out = &reply->objs;
+    while( *data == BSON_OBJECT ) {
+        data += 1 + strlen( data + 1 ) + 1; /* type and key */
+        bson_little_endian32( &size, data );
+        next = data + size;
+        memmove( out, data, size );
+        out += size;
+        data = next;
+        num++;
+    }
+
+    reply->head.len = ( int )( out - ( char * )reply );
+    reply->fields.cursorID = id;
+    reply->fields.num = num;
+
+    return MONGO_OK;
+}
+
+static int mongo_cursor_query_message( mongo_cursor *cursor, mongo_message_vec *mv ) {
+    int limit;
     char *data;
-    mongo_message *mm;
-    bson temp;
-    bson_iterator it;
+    size_t ns_len = strlen( cursor->ns ) + 1;
 
     /* Clear any errors. */
     mongo_clear_errors( cursor->conn );
@@ -1190,37 +2630,32 @@ static int mongo_cursor_op_query( mongo_cursor *cursor ) {
     else if( mongo_cursor_bson_valid( cursor, cursor->fields ) != MONGO_OK )
         return MONGO_ERROR;
 
-    mm = mongo_message_create( 16 + /* header */
-                               4 + /*  options */
-                               strlen( cursor->ns ) + 1 + /* ns */
-                               4 + 4 + /* skip,return */
-                               bson_size( cursor->query ) +
-                               bson_size( cursor->fields ) ,
-                               0 , 0 , MONGO_OP_QUERY );
-    if( mm == NULL ) {
-        return MONGO_ERROR;
-    }
+    if( mongo_use_op_msg( cursor->conn ) )
+        return mongo_cursor_command_message( cursor, mv );
 
-    data = &mm->data;
+    data = mongo_message_vec_init( mv, 4 + /*  options */
+                                   ns_len + /* ns */
+                                   4 + 4 /* skip,return */ );
     data = mongo_data_append32( data , &cursor->options );
-    data = mongo_data_append( data , cursor->ns , strlen( cursor->ns ) + 1 );
+    data = mongo_data_append( data , cursor->ns , ns_len );
     data = mongo_data_append32( data , &cursor->skip );
-    data = mongo_data_append32( data , &cursor->limit );
-    data = mongo_data_append( data , cursor->query->data , bson_size( cursor->query ) );
-    if ( cursor->fields )
-        data = mongo_data_append( data , cursor->fields->data , bson_size( cursor->fields ) );
+    limit = mongo_cursor_number_to_return( cursor );
+    data = mongo_data_append32( data , &limit );
 
-    bson_fatal_msg( ( data == ( ( char * )mm ) + mm->head.len ), "query building fail!" );
+    mv->doc[0] = cursor->query;
+    mv->doc[1] = cursor->fields;
+    mv->count = 2;
 
-    res = mongo_message_send( cursor->conn , mm );
-    if( res != MONGO_OK ) {
-        return MONGO_ERROR;
-    }
+    return mongo_message_vec_finish( cursor->conn, mv, MONGO_OP_QUERY, data );
+}
 
-    res = mongo_read_response( cursor->conn, ( mongo_reply ** )&( cursor->reply ) );
-    if( res != MONGO_OK ) {
+/* Process the reply to the initial OP_QUERY, which has been stored in cursor->reply. */
+static int mongo_cursor_query_reply( mongo_cursor *cursor ) {
+    bson temp;
+    bson_iterator it;
+
+    if( mongo_cursor_command_reply( cursor ) != MONGO_OK )
         return MONGO_ERROR;
-    }
 
     if( cursor->reply->fields.num == 1 ) {
         bson_init_finished_data( &temp, &cursor->reply->objs, 0 );
@@ -1236,9 +2671,28 @@ static int mongo_cursor_op_query( mongo_cursor *cursor ) {
     return MONGO_OK;
 }
 
-static int mongo_cursor_get_more( mongo_cursor *cursor ) {
+static int mongo_cursor_op_query( mongo_cursor *cursor ) {
     int res;
+    mongo_message_vec mv[1];
+
+    if( mongo_cursor_query_message( cursor, mv ) != MONGO_OK ) {
+        return MONGO_ERROR;
+    }
+
+    res = mongo_message_send( cursor->conn , mv );
+    if( res != MONGO_OK ) {
+        return MONGO_ERROR;
+    }
+
+    res = mongo_read_response( cursor->conn, ( mongo_reply ** )&( cursor->reply ) );
+    if( res != MONGO_OK ) {
+        return MONGO_ERROR;
+    }
+
+    return mongo_cursor_query_reply( cursor );
+}
 
+static int mongo_cursor_get_more_message( mongo_cursor *cursor, mongo_message_vec *mv ) {
     if( cursor->limit > 0 && cursor->seen >= cursor->limit ) {
         cursor->err = MONGO_CURSOR_EXHAUSTED;
         return MONGO_ERROR;
@@ -1255,43 +2709,59 @@ static int mongo_cursor_get_more( mongo_cursor *cursor ) {
         char *data;
         size_t sl = strlen( cursor->ns )+1;
         int limit = 0;
-        mongo_message *mm;
-
-        if( cursor->limit > 0 )
-            limit = cursor->limit - cursor->seen;
-
-        mm = mongo_message_create( 16 /*header*/
-                                   +4 /*ZERO*/
-                                   +sl
-                                   +4 /*numToReturn*/
-                                   +8 /*cursorID*/
-                                   , 0, 0, MONGO_OP_GET_MORE );
-        if( mm == NULL ) {
-            return MONGO_ERROR;
+
+        limit = mongo_cursor_number_to_return( cursor );
+
+        if( mongo_use_op_msg( cursor->conn ) ) {
+            bson cmd[1];
+            size_t db_len;
+
+            mongo_command_message_init( mv, cmd );
+            bson_append_long( cmd, "getMore", cursor->reply->fields.cursorID );
+            bson_append_string( cmd, "collection", mongo_ns_collection( cursor->ns, &db_len ) );
+            if( limit > 0 )
+                bson_append_int( cmd, "batchSize", limit );
+            return mongo_command_message_finish( cursor->conn, mv, cmd, cursor->ns, 0, NULL, NULL, 0 );
         }
 
-        data = &mm->data;
+        data = mongo_message_vec_init( mv, 4 /*ZERO*/
+                                       +sl
+                                       +4 /*numToReturn*/
+                                       +8 /*cursorID*/ );
         data = mongo_data_append32( data, &ZERO );
         data = mongo_data_append( data, cursor->ns, sl );
         data = mongo_data_append32( data, &limit );
-        mongo_data_append64( data, &cursor->reply->fields.cursorID );
+        data = mongo_data_append64( data, &cursor->reply->fields.cursorID );
 
-        bson_free( cursor->reply );
-        res = mongo_message_send( cursor->conn, mm );
-        if( res != MONGO_OK ) {
-            mongo_cursor_destroy( cursor );
-            return MONGO_ERROR;
-        }
+        return mongo_message_vec_finish( cursor->conn, mv, MONGO_OP_GET_MORE, data );
+    }
+}
 
-        res = mongo_read_response( cursor->conn, &( cursor->reply ) );
-        if( res != MONGO_OK )
-            return MONGO_ERROR;
+static int mongo_cursor_get_more( mongo_cursor *cursor ) {
+    int res;
+    mongo_message_vec mv[1];
 
-        cursor->current.data = NULL;
-        cursor->seen += cursor->reply->fields.num;
+    if( mongo_cursor_get_more_message( cursor, mv ) != MONGO_OK ) {
+        return MONGO_ERROR;
+    }
 
-        return MONGO_OK;
+    mongo_reply_free( cursor->reply );
+    cursor->reply = NULL;
+    res = mongo_message_send( cursor->conn, mv );
+    if( res != MONGO_OK ) {
+        return MONGO_ERROR;
     }
+
+    res = mongo_read_response( cursor->conn, &( cursor->reply ) );
+    if( res != MONGO_OK )
+        return MONGO_ERROR;
+
+    cursor->current.data = NULL;
+    if( mongo_cursor_command_reply( cursor ) != MONGO_OK )
+        return MONGO_ERROR;
+    cursor->seen += cursor->reply->fields.num;
+
+    return MONGO_OK;
 }
 
 MONGO_EXPORT mongo_cursor *mongo_find( mongo *conn, const char *ns, const bson *query,
@@ -1360,6 +2830,10 @@ MONGO_EXPORT void mongo_cursor_set_limit( mongo_cursor *cursor, int limit ) {
     cursor->limit = limit;
 }
 
+MONGO_EXPORT void mongo_cursor_set_batch_size( mongo_cursor *cursor, int batch_size ) {
+    cursor->batch_size = batch_size;
+}
+
 MONGO_EXPORT void mongo_cursor_set_options( mongo_cursor *cursor, int options ) {
     cursor->options = options;
 }
@@ -1434,32 +2908,118 @@ MONGO_EXPORT int mongo_cursor_next( mongo_cursor *cursor ) {
     return MONGO_OK;
 }
 
+/* Hand the reply to the caller and keep a copy of its header so that the
+   cursor can still issue OP_GET_MORE and OP_KILL_CURSORS. */
+static int mongo_cursor_detach_reply( mongo_cursor *cursor, mongo_reply **reply ) {
+    mongo_reply *stub;
+    size_t stub_len;
+
+    stub_len = sizeof( mongo_reply ) - sizeof( char );
+    stub = mongo_reply_new( stub_len );
+    memcpy( stub, cursor->reply, stub_len );
+    stub->head.len = ( int )stub_len;
+    stub->fields.num = 0;
+
+    *reply = cursor->reply;
+    cursor->reply = stub;
+    cursor->current.data = NULL;
+
+    return MONGO_OK;
+}
+
+MONGO_EXPORT int mongo_cursor_next_batch( mongo_cursor *cursor, mongo_reply **reply ) {
+    *reply = NULL;
+
+    if( cursor == NULL ) return MONGO_ERROR;
+
+    if( ! ( cursor->flags & MONGO_CURSOR_QUERY_SENT ) ) {
+        if( mongo_cursor_op_query( cursor ) != MONGO_OK )
+            return MONGO_ERROR;
+    }
+    else if( ! cursor->reply || cursor->reply->fields.num == 0 || cursor->current.data != NULL ) {
+        if( mongo_cursor_get_more( cursor ) != MONGO_OK )
+            return MONGO_ERROR;
+    }
+
+    return mongo_cursor_detach_reply( cursor, reply );
+}
+
+MONGO_EXPORT int mongo_cursor_message( mongo_cursor *cursor, mongo_message_vec *mv ) {
+    if( ! ( cursor->flags & MONGO_CURSOR_QUERY_SENT ) )
+        return mongo_cursor_query_message( cursor, mv );
+    else
+        return mongo_cursor_get_more_message( cursor, mv );
+}
+
+MONGO_EXPORT int mongo_cursor_batch( mongo_cursor *cursor, mongo_reply *in, mongo_reply **reply ) {
+    *reply = NULL;
+
+    mongo_reply_free( cursor->reply );
+    cursor->reply = in;
+
+    if( ! ( cursor->flags & MONGO_CURSOR_QUERY_SENT ) ) {
+        if( mongo_cursor_query_reply( cursor ) != MONGO_OK )
+            return MONGO_ERROR;
+    }
+    else {
+        cursor->current.data = NULL;
+        if( mongo_cursor_command_reply( cursor ) != MONGO_OK )
+            return MONGO_ERROR;
+        cursor->seen += cursor->reply->fields.num;
+    }
+
+    return mongo_cursor_detach_reply( cursor, reply );
+}
+
+MONGO_EXPORT int mongo_cursor_kill_message( mongo_cursor *cursor, mongo_message_vec *mv ) {
+    char *data;
+
+    if ( !cursor->reply || !cursor->reply->fields.cursorID )
+        return MONGO_ERROR;
+
+    if( mongo_use_op_msg( cursor->conn ) ) {
+        bson cmd[1];
+        size_t db_len;
+
+        mongo_command_message_init( mv, cmd );
+        bson_append_string( cmd, "killCursors", mongo_ns_collection( cursor->ns, &db_len ) );
+        bson_append_start_array( cmd, "cursors" );
+        bson_append_long( cmd, "0", cursor->reply->fields.cursorID );
+        bson_append_finish_array( cmd );
+        cursor->reply->fields.cursorID = 0;
+
+        /* Like OP_KILL_CURSORS, this has no reply */
+        return mongo_command_message_finish( cursor->conn, mv, cmd, cursor->ns, MONGO_MSG_MORE_TO_COME, NULL, NULL, 0 );
+    }
+
+    data = mongo_message_vec_init( mv, 4 /*ZERO*/
+                                   +4 /*numCursors*/
+                                   +8 /*cursorID*/ );
+    data = mongo_data_append32( data, &ZERO );
+    data = mongo_data_append32( data, &ONE );
+    data = mongo_data_append64( data, &cursor->reply->fields.cursorID );
+
+    /* The cursor is dead once the message is sent: don't kill it again on destroy. */
+    cursor->reply->fields.cursorID = 0;
+
+    return mongo_message_vec_finish( cursor->conn, mv, MONGO_OP_KILL_CURSORS, data );
+}
+
 MONGO_EXPORT int mongo_cursor_destroy( mongo_cursor *cursor ) {
     int result = MONGO_OK;
-    char *data;
+    mongo_message_vec mv[1];
 
     if ( !cursor ) return result;
 
     /* Kill cursor if live. */
     if ( cursor->reply && cursor->reply->fields.cursorID ) {
-        mongo *conn = cursor->conn;
-        mongo_message *mm = mongo_message_create( 16 /*header*/
-                            +4 /*ZERO*/
-                            +4 /*numCursors*/
-                            +8 /*cursorID*/
-                            , 0, 0, MONGO_OP_KILL_CURSORS );
-        if( mm == NULL ) {
+        if( mongo_cursor_kill_message( cursor, mv ) != MONGO_OK ) {
             return MONGO_ERROR;
         }
-        data = &mm->data;
-        data = mongo_data_append32( data, &ZERO );
-        data = mongo_data_append32( data, &ONE );
-        mongo_data_append64( data, &cursor->reply->fields.cursorID );
-
-        result = mongo_message_send( conn, mm );
+        result = mongo_message_send( cursor->conn, mv );
     }
 
-    bson_free( cursor->reply );
+    mongo_reply_free( cursor->reply );
     bson_free( ( void * )cursor->ns );
 
     if( cursor->flags & MONGO_CURSOR_MUST_FREE )
@@ -43,6 +43,16 @@ MONGO_EXTERN_C_START
 
 #define MONGO_DEFAULT_MAX_BSON_SIZE 4 * 1024 * 1024
 
+/* Limits assumed for servers that do not report maxMessageSizeBytes or maxWriteBatchSize. */
+#define MONGO_DEFAULT_MAX_MESSAGE_SIZE 48000000
+#define MONGO_DEFAULT_MAX_WRITE_BATCH_SIZE 1000
+
+/* The wire version from which the server accepts OP_MSG (MongoDB 3.6). */
+#define MONGO_WIRE_VERSION_OP_MSG 6
+
+/* Compressor id of zlib in OP_COMPRESSED messages. */
+#define MONGO_COMPRESSOR_ZLIB 2
+
 #define MONGO_ERR_LEN 128
 
 #ifndef MAXHOSTNAMELEN
@@ -102,6 +112,15 @@ enum mongo_insert_opts {
     MONGO_CONTINUE_ON_ERROR = 0x1
 };
 
+enum mongo_bulk_op_types {
+    MONGO_BULK_INSERT = 1,
+    MONGO_BULK_UPDATE = 2,
+    MONGO_BULK_REMOVE = 3
+};
+
+/* The outcome (mongo_bulk_op.err) of an operation of a bulk write that was never attempted. */
+#define MONGO_BULK_NOT_EXECUTED -1
+
 enum mongo_cursor_opts {
     MONGO_TAILABLE = ( 1<<1 ),        /**< Create a tailable cursor. */
     MONGO_SLAVE_OK = ( 1<<2 ),        /**< Allow queries on a non-primary node. */
@@ -112,13 +131,20 @@ enum mongo_cursor_opts {
 };
 
 enum mongo_operations {
-    MONGO_OP_MSG = 1000,
+    MONGO_OP_REPLY = 1,
     MONGO_OP_UPDATE = 2001,
     MONGO_OP_INSERT = 2002,
     MONGO_OP_QUERY = 2004,
     MONGO_OP_GET_MORE = 2005,
     MONGO_OP_DELETE = 2006,
-    MONGO_OP_KILL_CURSORS = 2007
+    MONGO_OP_KILL_CURSORS = 2007,
+    MONGO_OP_COMPRESSED = 2012,
+    MONGO_OP_MSG = 2013
+};
+
+enum mongo_msg_flags {
+    MONGO_MSG_CHECKSUM_PRESENT = ( 1<<0 ),
+    MONGO_MSG_MORE_TO_COME = ( 1<<1 ) /**< The receiver does not reply. */
 };
 
 #pragma pack(1)
@@ -148,6 +174,34 @@ typedef struct {
 } mongo_reply;
 #pragma pack()
 
+#define MONGO_MESSAGE_PREFIX_SIZE 192
+#define MONGO_IOV_MAX 256
+#define MONGO_READ_BUFFER_SIZE 16384
+
+/** One buffer of a gathered (vectored) socket write. */
+typedef struct {
+    const char *data;
+    size_t len;
+} mongo_iovec;
+
+/**
+ * A request message gathered from several buffers, so that documents are
+ * written straight from the caller's bson buffers instead of being copied
+ * into the message. Only the header (in wire byte order) and the fixed
+ * fields preceding the documents are built, in prefix.
+ */
+typedef struct {
+    int id;                 /**< Request id. */
+    int len;                /**< Length of the whole message in bytes. */
+    int prefix_len;         /**< Length of the header and fixed fields. */
+    char *prefix_ext;       /**< Used instead of prefix if a long namespace doesn't fit. */
+    int count;              /**< Number of documents following the prefix. */
+    int reply;              /**< Non-zero if the server replies to the message. */
+    const bson **docs;      /**< The caller's documents (insert), or NULL to use doc. */
+    const bson *doc[2];     /**< The documents of any other message. */
+    char prefix[MONGO_MESSAGE_PREFIX_SIZE];
+} mongo_message_vec;
+
 typedef struct mongo_host_port {
     char host[MAXHOSTNAMELEN];
     int port;
@@ -164,6 +218,28 @@ typedef struct mongo_write_concern {
     bson *cmd; /**< The BSON object representing the getlasterror command. */
 } mongo_write_concern;
 
+/** One operation of a bulk write (see mongo_bulk_write( )), and its outcome. */
+typedef struct mongo_bulk_op {
+    int type;          /**< MONGO_BULK_INSERT, MONGO_BULK_UPDATE or MONGO_BULK_REMOVE. */
+    const bson *cond;  /**< The query selecting the documents to update or remove. */
+    const bson *doc;   /**< The document to insert, or the update data. */
+    int flags;         /**< MONGO_UPDATE_UPSERT and MONGO_UPDATE_MULTI for an update. */
+
+    int err;           /**< 0 if written, the server's error code, or MONGO_BULK_NOT_EXECUTED. */
+    char errstr[MONGO_ERR_LEN]; /**< The server's error message if err is non-zero. */
+    bson upserted;     /**< {_id: ...} of the document inserted by an upsert (data is NULL otherwise). */
+} mongo_bulk_op;
+
+/** The totals of a bulk write. */
+typedef struct mongo_bulk_result {
+    int inserted;      /**< Documents inserted. */
+    int matched;       /**< Documents selected by updates (other than upserts). */
+    int modified;      /**< Documents changed by updates, or -1 if the server does not say. */
+    int upserted;      /**< Documents inserted by upserts. */
+    int removed;       /**< Documents removed. */
+    int errors;        /**< Operations that failed. */
+} mongo_bulk_result;
+
 typedef struct {
     mongo_host_port *seeds;        /**< List of seeds provided by the user. */
     mongo_host_port *hosts;        /**< List of host/ports given by the replica set */
@@ -179,6 +255,12 @@ typedef struct mongo {
     int conn_timeout_ms;       /**< Connection timeout in milliseconds. */
     int op_timeout_ms;         /**< Read and write timeout in milliseconds. */
     int max_bson_size;         /**< Largest BSON object allowed on this connection. */
+    int max_message_size;      /**< Largest message the server accepts (maxMessageSizeBytes). */
+    int max_write_batch_size;  /**< Most documents, or statements, in one write command (maxWriteBatchSize). */
+    int max_wire_version;      /**< Wire protocol version of the server: OP_MSG is used from MONGO_WIRE_VERSION_OP_MSG. */
+    int compression_level;     /**< zlib level (-1 for the default) if compression is to be negotiated, otherwise 0. */
+    int compression_threshold; /**< Messages shorter than this (in bytes) are not compressed. */
+    int compressor;            /**< Compressor agreed with the server (MONGO_COMPRESSOR_ZLIB), or 0. */
     bson_bool_t connected;     /**< Connection status. */
     mongo_write_concern *write_concern; /**< The default write concern. */
 
@@ -187,6 +269,12 @@ typedef struct mongo {
     char errstr[MONGO_ERR_LEN]; /**< String version of error. */
     int lasterrcode;            /**< getlasterror code from the server. */
     char lasterrstr[MONGO_ERR_LEN]; /**< getlasterror string from the server. */
+
+    char *read_buf;            /**< Bytes received from the socket (MONGO_READ_BUFFER_SIZE). */
+    int read_pos;              /**< Offset of the first byte in read_buf not yet parsed. */
+    int read_len;              /**< Number of bytes in read_buf. */
+    mongo_reply *read_reply;   /**< Reply partly received by mongo_recv_reply( ). */
+    int read_reply_len;        /**< Bytes of read_reply received so far. */
 } mongo;
 
 typedef struct {
@@ -202,6 +290,7 @@ typedef struct {
     int options;       /**< Bitfield containing cursor options. */
     int limit;         /**< Bitfield containing cursor options. */
     int skip;          /**< Bitfield containing cursor options. */
+    int batch_size;    /**< Number of documents to request per batch (0 for the server default). */
 } mongo_cursor;
 
 /*********************************************************************
@@ -236,6 +325,29 @@ MONGO_EXPORT void mongo_init( mongo *conn );
  */
 MONGO_EXPORT int mongo_client( mongo *conn , const char *host, int port );
 
+/**
+ * Connect to a single MongoDB server with a mongo object that has already
+ * been initialized with mongo_init( ), keeping any options set since (for
+ * example, with mongo_set_compression( )).
+ *
+ * @return MONGO_OK or MONGO_ERROR on failure, as for mongo_client( ).
+ */
+MONGO_EXPORT int mongo_client_connect( mongo *conn , const char *host, int port );
+
+/**
+ * Ask for the messages on a connection to be compressed (OP_COMPRESSED,
+ * with zlib). Compression is negotiated when the connection is made, so
+ * call this before mongo_client_connect( ) or mongo_replica_set_client( ).
+ * It has no effect if the driver is built without zlib (MONGO_HAVE_ZLIB)
+ * or the server does not support compression.
+ *
+ * @param level the zlib compression level (1 to 9, or -1 for the zlib
+ *     default). Zero disables compression.
+ * @param threshold messages shorter than this (in bytes) are sent
+ *     uncompressed. Replies are compressed as the server sees fit.
+ */
+MONGO_EXPORT void mongo_set_compression( mongo *conn, int level, int threshold );
+
 /**
  * DEPRECATED - use mongo_client.
  * Connect to a single MongoDB server.
@@ -453,6 +565,11 @@ MONGO_EXPORT int mongo_insert( mongo *conn, const char *ns, const bson *data,
  * Insert a batch of BSON documents into a MongoDB server. This function
  * will fail if any of the documents to be inserted is invalid.
  *
+ * The batch is split into as many messages as the server's limits
+ * (maxMessageSizeBytes and maxWriteBatchSize) call for. Unless the batch
+ * is ordered and acknowledged, in which case each message waits for the
+ * reply to the one before, the messages are written back to back.
+ *
  * The default write concern set on the conn object will be used.
  *
  * @param conn a mongo object.
@@ -507,6 +624,139 @@ MONGO_EXPORT int mongo_update( mongo *conn, const char *ns, const bson *cond,
 MONGO_EXPORT int mongo_remove( mongo *conn, const char *ns, const bson *cond,
                                mongo_write_concern *custom_write_concern );
 
+/**
+ * Perform a list of inserts, updates and removes on the collection ns with
+ * as few messages, and round trips, as possible.
+ *
+ * With a server that supports OP_MSG, consecutive operations of the same
+ * type are sent as a single write command.  An ordered bulk write stops at
+ * the first operation that fails.  An unordered one groups all the
+ * operations of each type together and writes all its messages before
+ * reading any of the replies.  Older servers are sent each operation as a
+ * message of its own, followed by a getlasterror query: these are written
+ * together if the bulk write is unordered.
+ *
+ * @param conn a mongo object.
+ * @param ns the namespace.
+ * @param ops the operations: their outcomes are filled in.
+ * @param count the number of operations.
+ * @param ordered non-zero to stop at the first failure.
+ * @param custom_write_concern a write concern object that will
+ *     override any write concern set on the conn object.  Nothing is
+ *     known of the outcome of an unacknowledged bulk write.
+ * @param result set to the totals of the bulk write (may be NULL).
+ *
+ * @return MONGO_OK, or MONGO_ERROR with the error stored in the conn
+ *     object: MONGO_WRITE_ERROR if one or more of the operations failed
+ *     (conn->lasterrstr is that of the first), or if the write concern
+ *     was not satisfied.  Release the operations with mongo_bulk_op_destroy( ).
+ */
+MONGO_EXPORT int mongo_bulk_write( mongo *conn, const char *ns, mongo_bulk_op *ops, int count, int ordered,
+                                   mongo_write_concern *custom_write_concern, mongo_bulk_result *result );
+
+/**
+ * Release the outcome of bulk write operations (the _id of an upserted document).
+ */
+MONGO_EXPORT void mongo_bulk_op_destroy( mongo_bulk_op *ops, int count );
+
+/**
+ * Build, but do not send, the wire messages used by mongo_insert_batch( ),
+ * mongo_update( ) and mongo_remove( ). These are for callers that do their
+ * own (for example, non-blocking) socket I/O. The documents are validated
+ * exactly as they are by the sending functions.
+ *
+ * The documents are referenced rather than copied: they (and, for an
+ * insert, the data array) must not change until the message is written.
+ *
+ * With a server that supports OP_MSG, each is a write command carrying the
+ * connection's write concern, and mv->reply is set if it is acknowledged.
+ * An insert's documents are sent as a document sequence.
+ *
+ * @return MONGO_OK, in which case the message must be released with
+ *     mongo_message_vec_destroy( ), or MONGO_ERROR with the error
+ *     stored in the conn object.
+ */
+MONGO_EXPORT int mongo_insert_message( mongo *conn, const char *ns,
+                                       const bson **data, int num, int flags, mongo_message_vec *mv );
+MONGO_EXPORT int mongo_update_message( mongo *conn, const char *ns, const bson *cond,
+                                       const bson *op, int flags, mongo_message_vec *mv );
+MONGO_EXPORT int mongo_remove_message( mongo *conn, const char *ns, const bson *cond,
+                                       mongo_message_vec *mv );
+
+/**
+ * The number of documents, from the start of data, that fit into a single
+ * insert message within the server's limits: a larger batch is sent as
+ * several messages by mongo_insert_batch( ).
+ *
+ * @return the number of documents, or MONGO_ERROR if the first is larger
+ *     than the server allows.
+ */
+MONGO_EXPORT int mongo_insert_batch_split( mongo *conn, const bson **data, int num );
+
+/**
+ * Build the getlasterror query that should follow a write message for
+ * the write concern in effect.
+ *
+ * @param mv set to the query message, with mv->len zero if the write
+ *     concern does not call for one, or if the write is an OP_MSG command
+ *     (which carries its own write concern).
+ *
+ * @return MONGO_OK or MONGO_ERROR with error stored in conn object.
+ */
+MONGO_EXPORT int mongo_write_concern_message( mongo *conn, const char *ns,
+                                              mongo_write_concern *custom_write_concern, mongo_message_vec *mv );
+
+/**
+ * Check the reply to a getlasterror query built by mongo_write_concern_message( ),
+ * or to an acknowledged OP_MSG write command.
+ *
+ * @return MONGO_OK or MONGO_ERROR with error stored in conn object.
+ */
+MONGO_EXPORT int mongo_check_last_error_reply( mongo *conn, mongo_reply *reply );
+
+/**
+ * Describe the bytes of a built message from offset onwards as a list of
+ * buffers to be written with a single vectored send.
+ *
+ * @param iov the array to fill.
+ * @param max the size of iov: a message with more buffers than this is
+ *     described by successive calls.
+ *
+ * @return the number of buffers filled in.
+ */
+MONGO_EXPORT int mongo_message_vec_iov( const mongo_message_vec *mv, int offset, mongo_iovec *iov, int max );
+
+/**
+ * Release a message built by one of the mongo_*_message( ) functions.
+ */
+MONGO_EXPORT void mongo_message_vec_destroy( mongo_message_vec *mv );
+
+/**
+ * Receive the next reply on a non-blocking connection. Input is received
+ * through the connection's read buffer, and a reply that has only partly
+ * arrived is kept on the connection until the rest of it does.
+ *
+ * @param reply set to the reply, which must be released with
+ *     mongo_reply_free( ), or to NULL if no complete reply is available yet.
+ *
+ * @return MONGO_OK or MONGO_ERROR with error stored in conn object.
+ */
+MONGO_EXPORT int mongo_recv_reply( mongo *conn, mongo_reply **reply );
+
+/**
+ * Release a reply returned by the driver (for example, by
+ * mongo_cursor_next_batch( )). Reply buffers are recycled for later replies
+ * once every reference taken with mongo_reply_retain( ) has also been released.
+ */
+MONGO_EXPORT void mongo_reply_free( mongo_reply *reply );
+
+/**
+ * Take an additional reference to a reply, so that its data stays in place
+ * until a matching call to mongo_reply_free( ). References may be taken and
+ * released from any thread.
+ */
+MONGO_EXPORT void mongo_reply_retain( mongo_reply *reply );
+
 
 /*********************************************************************
 Write Concern API
@@ -603,6 +853,16 @@ MONGO_EXPORT void mongo_cursor_set_skip( mongo_cursor *cursor, int skip );
  */
 MONGO_EXPORT void mongo_cursor_set_limit( mongo_cursor *cursor, int limit );
 
+/**
+ * Set the number of documents to request from the server in each
+ *   batch (OP_QUERY and OP_GET_MORE). The overall limit, if any,
+ *   still applies. A batch size of zero lets the server decide.
+ *
+ * @param cursor
+ * @param batch_size
+ */
+MONGO_EXPORT void mongo_cursor_set_batch_size( mongo_cursor *cursor, int batch_size );
+
 /**
  * Set any of the available query options (e.g., MONGO_TAILABLE).
  *
@@ -639,6 +899,52 @@ MONGO_EXPORT const bson *mongo_cursor_bson( mongo_cursor *cursor );
  */
 MONGO_EXPORT int mongo_cursor_next( mongo_cursor *cursor );
 
+/**
+ * Fetch the next batch of results for a cursor and detach it from
+ *   the cursor. If the reply to the initial query has not yet been
+ *   iterated it is returned first; otherwise an OP_GET_MORE is issued.
+ *   The documents in the batch are stored contiguously, starting at
+ *   reply->objs, and reply->fields.num gives their number.
+ *
+ * @note The caller owns the returned reply and must release it
+ *   with bson_free( ). Do not mix with mongo_cursor_next( ).
+ *
+ * @param cursor
+ * @param reply set to the detached reply.
+ *
+ * @return MONGO_OK. Returns MONGO_ERROR once the cursor is exhausted
+ *   or on error, in which case check cursor->conn->err.
+ */
+MONGO_EXPORT int mongo_cursor_next_batch( mongo_cursor *cursor, mongo_reply **reply );
+
+/**
+ * Build, but do not send, the message that fetches the cursor's next
+ *   batch: the initial OP_QUERY or an OP_GET_MORE. Pass the reply read
+ *   for it to mongo_cursor_batch( ).
+ *
+ * @return MONGO_OK, in which case the message must be released with
+ *   mongo_message_vec_destroy( ), or MONGO_ERROR once the cursor is
+ *   exhausted or on error (check cursor->err).
+ */
+MONGO_EXPORT int mongo_cursor_message( mongo_cursor *cursor, mongo_message_vec *mv );
+
+/**
+ * Take ownership of the reply to a message built by mongo_cursor_message( )
+ *   and detach it from the cursor as mongo_cursor_next_batch( ) does.
+ *
+ * @return MONGO_OK or MONGO_ERROR if the query failed, in which case
+ *   cursor->err is MONGO_CURSOR_QUERY_FAIL.
+ */
+MONGO_EXPORT int mongo_cursor_batch( mongo_cursor *cursor, mongo_reply *in, mongo_reply **reply );
+
+/**
+ * Build the OP_KILL_CURSORS message for a live cursor and mark the cursor
+ *   dead, so that mongo_cursor_destroy( ) does no further I/O.
+ *
+ * @return MONGO_OK, or MONGO_ERROR if the server-side cursor is not open.
+ */
+MONGO_EXPORT int mongo_cursor_kill_message( mongo_cursor *cursor, mongo_message_vec *mv );
+
 /**
  * Destroy a cursor object. When finished with a cursor, you
  * must pass it to this function.
@@ -97,6 +97,41 @@ Version 1.4.15 29 May 2025:
 Version 1.4.16 24 May 2026:
    Verify that the code base works with Node.js v26.x.x.
 
+Version 1.5.17 17 October 2026:
+   Introduce a per-server connection pool for asynchronous operations.
+   - open() accepts min_connections, max_connections and idle_timeout.
+   Correct a fault whereby a successful asynchronous open() did not mark the server object as connected.
+   Retrieve all batches of a result set (OP_GET_MORE) in the worker thread for asynchronous find() operations.
+   Introduce the cursor() method and cursor object for streaming large result sets one batch at a time.
+   - cursor.next([batch_size]) and cursor[Symbol.asyncIterator]() (Node.js v12 and later).
+   Introduce the MGX_RAW_BSON option for find() and command() to return results as Node.js Buffers holding the raw (undecoded) BSON.
+   Cache the (internalized) V8 strings created for BSON field names, per isolate, and reuse them when decoding documents.
+   Create decoded arrays in one step from their gathered elements and define object properties with CreateDataProperty().
+   Rewrite the JavaScript to BSON encoder to work in a single pass: strings are written directly into the BSON buffer and embedded documents are built in place.
+   Allocate the memory used by each request (baton, BSON objects and buffers, reply list) from an arena that is released in one step and recycled.
+   Synchronous calls draw their per-request memory from an arena in the caller's stack frame.
+   Correct a memory leak whereby the request block was not released if a method's arguments could not be processed.
+   Accept pre-encoded BSON Documents (Node.js Buffers) in insert(), insert_batch(), update() and remove().
+   - Introduce the module-level encode() function to convert a JavaScript object to a BSON Buffer in any thread.
+   Introduce an event loop transport for asynchronous operations: pooled connections use non-blocking sockets driven from the Node.js event loop.
+   - open() accepts transport: "event_loop" (the default remains "thread_pool").
+   Pipeline event loop requests: up to 32 requests may be in flight on a pooled connection, with each reply routed to its request by responseTo.
+   - Request ids are drawn from an atomic counter rather than rand().
+   Write each request message with a single vectored send: documents are sent from their own BSON buffers rather than copied into the message.
+   Receive replies through a per-connection read buffer, typically in a single recv() call, and recycle reply buffers through a size-classed pool.
+   - Correct a socket leak when a connection used by the event loop transport failed.
+   Send an acknowledged write and its getlasterror query together in a single vectored send; the command namespace is formed in the message prefix without allocation.
+   Use the OP_MSG wire protocol with servers that support it (maxWireVersion 6 and later): writes are sent as insert, update and delete commands carrying their write concern, with inserted documents as a document sequence, and queries as find, getMore and killCursors commands.
+   Compress messages (OP_COMPRESSED, with the zlib built into Node.js) if the compression property of open() asks for it and the server agrees to it; compression_level and compression_threshold tune it.
+   Add bulk_write() for a mixed list of inserts, updates and removes: consecutive operations of a kind share a write command, unordered lists are grouped by kind and their commands pipelined.
+   Split insert_batch() into as many messages as the server's limits (maxMessageSizeBytes, maxWriteBatchSize) call for; pipeline them if the MONGO_CONTINUE_ON_ERROR option is given.
+   Optionally coalesce asynchronous insert() calls made within coalesce_window milliseconds into one bulk write per collection.
+   Make Object ID generation thread-safe and unique across processes, and introduce the object_ids() method for generating many ids in one call.
+   Convert Object IDs to and from hex with SSE2 where available, and validate Object ID strings in the same pass as decoding them.
+   Validate the UTF-8 of strings and field names with an SSE2 fast path for runs of ASCII text.
+   Skip the UTF-8 checks on strings and field names written by V8 when converting JavaScript objects to BSON.
+   Expose large ASCII string values in retrieved documents as external strings that point into the reply, and create all other strings with their known length.
+
 */
 
 
@@ -152,14 +187,16 @@ DISABLE_WCAST_FUNCTION_TYPE
 #include <node_version.h>
 
 #define MGX_VERSION_MAJOR        1
-#define MGX_VERSION_MINOR        4
-#define MGX_VERSION_BUILD        16
+#define MGX_VERSION_MINOR        5
+#define MGX_VERSION_BUILD        17
 #define MGX_VERSION              MGX_VERSION_MAJOR "." MGX_VERSION_MINOR "." MGX_VERSION_BUILD
 
 #define MGX_NODE_VERSION         (NODE_MAJOR_VERSION * 10000) + (NODE_MINOR_VERSION * 100) + NODE_PATCH_VERSION
 
 #include <uv.h>
 #include <node_object_wrap.h>
+#include <node_buffer.h>
+#include <new>
 
 #if !defined(_WIN32)
 #include <pthread.h>
@@ -167,9 +204,40 @@ DISABLE_WCAST_FUNCTION_TYPE
 #endif
 
 #include "mongo.h"
+#include "env.h" /* v1.5.17 */
 
 #define MGX_ERROR_SIZE              512
 
+#define MGX_POOL_MIN_CONNECTIONS    1
+#define MGX_POOL_MAX_CONNECTIONS    4
+#define MGX_POOL_IDLE_TIMEOUT       60
+#define MGX_POOL_PIPELINE_DEPTH     32
+
+#define MGX_TRANSPORT_THREAD_POOL   0
+#define MGX_TRANSPORT_EVENT_LOOP    1
+
+#define MGX_COMPRESSION_DEFAULT     -1 /* zlib's default level */
+#define MGX_COMPRESSION_THRESHOLD   1024
+
+#define MGX_COALESCE_MAX_DOCUMENTS  1000
+#define MGX_COALESCE_MAX_BYTES      (1024 * 1024)
+
+#define MGX_OBJECT_IDS_MAX          1000000
+
+#define MGX_EXTERNAL_STRING_MIN     8192
+#define MGX_EXTERNAL_STRING_SHARE   4
+
+#define MGX_KEY_CACHE_SIZE          512
+#define MGX_KEY_CACHE_MAX_KEY       64
+
+#define MGX_ARRAY_CHUNK             32
+#define MGX_NAME_BUFFER             256
+
+#define MGX_ARENA_SIZE              16384
+#define MGX_ARENA_BSON_SIZE         512
+#define MGX_ARENA_FREE_MAX          16
+#define MGX_ARENA_STACK_SIZE        8192
+
 #if MGX_NODE_VERSION >= 120000
 #define MGX_GET(a,b)                a->Get(icontext,b).ToLocalChecked()
 #define MGX_SET(a,b,c)              a->Set(icontext,b,c).FromJust()
@@ -178,6 +246,7 @@ DISABLE_WCAST_FUNCTION_TYPE
 #define MGX_TOUINT32(a)             a->Uint32Value(icontext).FromJust()
 #define MGX_TOOBJECT(a)             a->ToObject(icontext).ToLocalChecked()
 #define MGX_TOSTRING(a)             a->ToString(icontext).ToLocalChecked()
+#define MGX_DATA_SET(a,b,c)         a->CreateDataProperty(icontext,b,c).FromJust()
 #elif MGX_NODE_VERSION >= 100000
 #define MGX_GET(a,b)                a->Get(icontext,b).ToLocalChecked()
 #define MGX_SET(a,b,c)              a->Set(icontext,b,c).FromJust()
@@ -186,6 +255,7 @@ DISABLE_WCAST_FUNCTION_TYPE
 #define MGX_TOUINT32(a)             a->Uint32Value(icontext).FromJust()
 #define MGX_TOOBJECT(a)             a->ToObject(icontext).ToLocalChecked()
 #define MGX_TOSTRING(a)             a->ToString(icontext).ToLocalChecked()
+#define MGX_DATA_SET(a,b,c)         a->CreateDataProperty(icontext,b,c).FromJust()
 #elif MGX_NODE_VERSION >= 70000
 #define MGX_GET(a,b)                a->Get(b)
 #define MGX_SET(a,b,c)              a->Set(b,c)
@@ -194,6 +264,7 @@ DISABLE_WCAST_FUNCTION_TYPE
 #define MGX_TONUMBER(a)             a->NumberValue()
 #define MGX_TOOBJECT(a)             a->ToObject()
 #define MGX_TOSTRING(a)             a->ToString()
+#define MGX_DATA_SET(a,b,c)         a->Set(b,c)
 #else
 #define MGX_GET(a,b)                a->Get(b)
 #define MGX_SET(a,b,c)              a->Set(b,c)
@@ -202,6 +273,7 @@ DISABLE_WCAST_FUNCTION_TYPE
 #define MGX_TONUMBER(a)             a->ToNumber()->Value()
 #define MGX_TOOBJECT(a)             a->ToObject()
 #define MGX_TOSTRING(a)             a->ToString()
+#define MGX_DATA_SET(a,b,c)         a->Set(b,c)
 #endif
 
 #define MGX_INTEGER_NEW(a)          Integer::New(isolate, a)
@@ -211,6 +283,15 @@ DISABLE_WCAST_FUNCTION_TYPE
 #define MGX_BOOLEAN_NEW(a)          Boolean::New(isolate, a)
 #define MGX_NULL()                  Null(isolate)
 
+/* v1.5.17 */
+#if MGX_NODE_VERSION >= 40000
+#define MGX_BUFFER_NEW(a,b,c,d)     node::Buffer::New(isolate, a, b, c, d).ToLocalChecked()
+#define MGX_BUFFER_COPY(a,b)        node::Buffer::Copy(isolate, a, b).ToLocalChecked()
+#else
+#define MGX_BUFFER_NEW(a,b,c,d)     node::Buffer::New(isolate, a, b, c, d)
+#define MGX_BUFFER_COPY(a,b)        node::Buffer::New(isolate, a, b)
+#endif
+
 #if MGX_NODE_VERSION >= 120000
 #define MGX_DATE(a)                 Date::New(icontext, a).ToLocalChecked()
 #else
@@ -240,7 +321,9 @@ DISABLE_WCAST_FUNCTION_TYPE
       return; \
    } \
    if (baton->p_mgxapi->error[0]) { \
-      isolate->ThrowException(Exception::Error(mongox_new_string8(isolate, (char *) baton->p_mgxapi->error, 1))); \
+      Local<String> error = mongox_new_string8(isolate, (char *) baton->p_mgxapi->error, 1); \
+      server::mongox_destroy_baton(baton); /* v1.5.17 */ \
+      isolate->ThrowException(Exception::Error(error)); \
       return; \
    } \
 
@@ -279,6 +362,10 @@ DISABLE_WCAST_FUNCTION_TYPE
 #define MGX_METHOD_CREATE_INDEX        11
 #define MGX_METHOD_OBJECT_ID           12
 #define MGX_METHOD_OBJECT_ID_DATE      13
+#define MGX_METHOD_CURSOR              14
+#define MGX_METHOD_CURSOR_NEXT         15
+#define MGX_METHOD_ENCODE              16
+#define MGX_METHOD_BULK_WRITE          17
 
 static const char * mgx_methods[] = {
       "unknown",
@@ -295,6 +382,10 @@ static const char * mgx_methods[] = {
       "create_index",
       "object_id",
       "object_id_date",
+      "cursor",
+      "next",
+      "encode",
+      "bulk_write",
       NULL
    };
 
@@ -317,13 +408,48 @@ typedef struct tagMGXJSON {
 } MGXJSON, *PMGXJSON;
 
 
+/* v1.5.17 */
+/* A bson drawn from an arena: chained so that it can be destroyed when the arena is released */
 typedef struct tagMGXBSON {
-   short    id;
-   bson     *bobj;
+   bson     bobj;
    struct tagMGXBSON *p_next;
 } MGXBSON, *PMGXBSON;
 
 
+/* v1.5.17 */
+typedef struct tagMGXARENABLOCK {
+   struct tagMGXARENABLOCK *p_next;
+   size_t   size;
+} MGXARENABLOCK, *PMGXARENABLOCK;
+
+
+/* Per-request memory: allocations are carved from the inline block (then from overflow blocks) and released in one step */
+typedef struct tagMGXARENA {
+   char           *p_cur;
+   char           *p_end;
+   MGXARENABLOCK  *p_blocks;
+   MGXBSON        *p_mgxbson;
+   struct tagMGXARENA *p_next;
+   size_t         size;
+   short          recycle;
+} MGXARENA, *PMGXARENA;
+
+
+/* An arena for synchronous calls: it lives in the caller's stack frame so a small request makes no heap allocations */
+typedef struct tagMGXARENASTACK {
+   MGXARENA       arena;
+   double         buffer[MGX_ARENA_STACK_SIZE / sizeof(double)];
+} MGXARENASTACK, *PMGXARENASTACK;
+
+
+/* v1.5.17 */
+typedef struct tagMGXREPLY {
+   short          id;
+   mongo_reply    *reply;
+   struct tagMGXREPLY *p_next;
+} MGXREPLY, *PMGXREPLY;
+
+
 typedef struct tagMGXAPI {
    int            level;
    int            bobj_main_list_no;
@@ -334,11 +460,15 @@ typedef struct tagMGXAPI {
    bson           *bobj_fields;
    bson           **bobj_main_list;
    MGXJSON        *jobj_main_list;
+   mongo_bulk_op  *bulk_ops; /* v1.5.17 */
+   mongo_bulk_result bulk_result;
+   int            batch_sent; /* v1.5.17 */
    char           file_name[128];
    char           index_name[128];
    int            context;
    int            output_integer;
    int            options;
+   short          raw_bson;
    int            limit;
    int            skip;
    unsigned long  margin;
@@ -350,11 +480,47 @@ typedef struct tagMGXAPI {
    char           method[32];
    int            error_code;
    char           error[MGX_ERROR_SIZE];
-   MGXBSON        *p_mgxbson_head;
-   MGXBSON        *p_mgxbson_tail;
+   MGXARENA       *p_arena;
+   MGXREPLY       *p_mgxreply_head;
+   MGXREPLY       *p_mgxreply_tail;
 } MGXAPI, *PMGXAPI;
 
 
+/* v1.5.17 */
+/* Wire message queued for writing by the event loop transport (and then, if a reply is expected, awaiting its reply) */
+typedef struct tagMGXOUT {
+   mongo_message_vec mv;   /* the documents are written from the request's own bson buffers */
+   int            done;
+   short          expect_reply;
+   void           *baton;  /* request to notify once the message is written and its reply received (NULL if none) */
+   struct tagMGXOUT *p_next;
+} MGXOUT, *PMGXOUT;
+
+
+/* v1.5.17 */
+/* Non-blocking I/O state of a connection served by the event loop transport */
+typedef struct tagMGXIO {
+   uv_poll_t      *p_poll;
+   int            events;
+   MGXOUT         *p_out_head;   /* messages to write */
+   MGXOUT         *p_out_tail;
+   MGXOUT         *p_wait_head;  /* messages written and awaiting a reply, in the order sent */
+   MGXOUT         *p_wait_tail;
+} MGXIO, *PMGXIO;
+
+
+/* v1.5.17 */
+typedef struct tagMGXCONN {
+   short       in_use;  /* number of requests using the connection: more than one only for the event loop transport */
+   short       connected;
+   int         generation;
+   time_t      last_used;
+   mongo       mongo_connection;
+   MGXIO       *p_io;
+   struct tagMGXCONN *p_next;
+} MGXCONN, *PMGXCONN;
+
+
 #if !defined(_WIN32)
 extern int errno;
 #endif
@@ -365,11 +531,23 @@ CRITICAL_SECTION  mgx_async_mutex;
 pthread_mutex_t   mgx_async_mutex        = PTHREAD_MUTEX_INITIALIZER;
 #endif
 
+/* v1.5.17 */
+MGXARENA          *mgx_arena_free_list   = NULL;
+int               mgx_arena_free_no      = 0;
+
 
 void *                  mgx_malloc                    (int size, short id);
 int                     mgx_free                      (void *p, short id);
+int                     mgx_mutex_lock                (void);
+int                     mgx_mutex_unlock              (void);
+MGXARENA *              mgx_arena_get                 (void);
+MGXARENA *              mgx_arena_stack               (MGXARENASTACK *p_stack);
+void *                  mgx_arena_alloc               (MGXARENA *p_arena, size_t size);
+int                     mgx_arena_release             (MGXARENA *p_arena);
 bson *                  mgx_bson_alloc                (MGXAPI * p_mgxapi, int init, short id);
-int                     mgx_bson_free                 (MGXAPI * p_mgxapi);
+int                     mgx_reply_add                 (MGXAPI * p_mgxapi, mongo_reply *reply, short id);
+int                     mgx_reply_free                (MGXAPI * p_mgxapi);
+int                     mgx_is_ascii                  (const char *buffer, size_t len);
 int                     mgx_ucase                     (char *string);
 int                     mgx_lcase                     (char *string);
 int                     mgx_buffer_dump               (char *buffer, unsigned int len, short mode);
@@ -382,6 +560,58 @@ using namespace node;
 using namespace v8;
 
 
+/* v1.5.17 */
+/* Cache of internalized V8 strings for BSON field names: direct-mapped on a hash of the name */
+typedef struct tagMGXKEY {
+   int                  len;
+   char                 key[MGX_KEY_CACHE_MAX_KEY];
+   Persistent<String>   str;
+} MGXKEY, *PMGXKEY;
+
+
+typedef struct tagMGXKEYS {
+   MGXKEY               keys[MGX_KEY_CACHE_SIZE];
+} MGXKEYS, *PMGXKEYS;
+
+
+/* v1.5.17 */
+/* A large ASCII string value left in place in the reply that holds it: the reply is kept until V8 disposes of the string */
+/* The whole reply is reported to V8 as external memory so that the garbage collector knows what the string pins */
+class mgx_reply_string : public String::ExternalOneByteStringResource
+{
+public:
+
+   mgx_reply_string(Isolate *isolate, mongo_reply *reply, const char *data, size_t length) : isolate(isolate), reply(reply), string_data(data), string_length(length)
+   {
+      mongo_reply_retain(reply);
+      reply_size = (int64_t) reply->head.len;
+      isolate->AdjustAmountOfExternalAllocatedMemory(reply_size);
+   }
+
+   ~mgx_reply_string()
+   {
+      mongo_reply_free(reply);
+   }
+
+   void Dispose() override
+   {
+      isolate->AdjustAmountOfExternalAllocatedMemory(-reply_size);
+      delete this;
+   }
+
+   const char * data() const { return string_data; }
+   size_t length() const { return string_length; }
+
+private:
+
+   Isolate              *isolate;
+   mongo_reply          *reply;
+   int64_t              reply_size;
+   const char           *string_data;
+   size_t               string_length;
+};
+
+
 #if defined(_WIN32)
 BOOL WINAPI DllMain(HINSTANCE hinstDLL, DWORD fdwReason, LPVOID lpReserved)
 {
@@ -403,9 +633,13 @@ BOOL WINAPI DllMain(HINSTANCE hinstDLL, DWORD fdwReason, LPVOID lpReserved)
 #endif
 
 
+class cursor;
+
 class server : public node::ObjectWrap
 {
 
+friend class cursor; /* v1.5.17 */
+
 private:
 
    short open;
@@ -413,6 +647,37 @@ private:
    int   mongo_port;
    char  mongo_address[64];
    mongo mongo_connection;
+
+   /* v1.5.17 */
+   struct mongo_baton_t;
+
+   int                  pool_min;
+   int                  pool_max;
+   int                  pool_idle_timeout;
+   int                  pool_size;
+   int                  pool_generation;
+   int                  transport;
+   int                  compression_level;
+   int                  compression_threshold;
+   int                  coalesce_window;
+   int                  coalesce_max_documents;
+   int                  coalesce_max_bytes;
+   uv_timer_t           *p_coalesce_timer;
+   uv_timer_t           *p_idle_timer;
+   struct mongo_baton_t *p_coalesce_head;
+   MGXCONN              *p_pool;
+   struct mongo_baton_t *p_pending_head;
+   struct mongo_baton_t *p_pending_tail;
+   MGXKEYS              *p_keys;
+#if MGX_NODE_VERSION >= 140800
+   node::AsyncCleanupHookHandle env_hook;
+   void                 (*env_done)(void *);
+   void                 *env_done_arg;
+   int                  env_closing;
+   short                env_teardown;
+   short                env_work_wait;
+#endif
+   int                  work_pending;
 #if defined(_WIN32)
    WORD              wVersionRequested;
    WSADATA           wsaData;
@@ -432,6 +697,22 @@ struct mongo_baton_t {
       Persistent<Function>    cb;
       Isolate                 *isolate;
       MGXAPI * p_mgxapi;
+      MGXCONN                 *p_conn; /* v1.5.17 */
+      cursor                  *c;
+      short                   cursor_fetch;
+#if MGX_NODE_VERSION >= 120000
+      Persistent<Promise::Resolver> resolver;
+#endif
+      void                    *work_cb;
+      void                    *after_work_cb;
+      int                     io_pending; /* v1.5.17 */
+      short                   queued; /* counted in work_pending */
+      struct mongo_baton_t    *p_coalesced; /* v1.5.17 */
+      struct mongo_baton_t    *p_coalesced_tail;
+      int                     coalesced_no;
+      int                     coalesced_size;
+      int                     coalesced_flushed;
+      struct mongo_baton_t    *p_next;
    };
 
 
@@ -461,7 +742,9 @@ struct mongo_baton_t {
       }
 #endif
 
-      ret = mongo_client(&(s->mongo_connection), s->mongo_address, s->mongo_port);
+      mongo_init(&(s->mongo_connection));
+      mongo_set_compression(&(s->mongo_connection), s->compression_level, s->compression_threshold);
+      ret = mongo_client_connect(&(s->mongo_connection), s->mongo_address, s->mongo_port);
 
       if (ret != MONGO_OK) {
          mongox_error_message(s, baton);
@@ -480,12 +763,126 @@ struct mongo_baton_t {
    }
 
 
+   /* v1.5.17 */
+   mongo * mongox_connection(server *s, mongo_baton_t * baton)
+   {
+      if (baton->p_conn) {
+         return &(baton->p_conn->mongo_connection);
+      }
+      return &(s->mongo_connection);
+   }
+
+
+   /* v1.5.17 */
+   int mongox_pool_connect(server *s, mongo_baton_t * baton)
+   {
+      int ret;
+
+      if (baton->p_mgxapi->error[0]) {
+         return MONGO_ERROR;
+      }
+      if (!baton->p_conn || baton->p_conn->connected) {
+         return MONGO_OK;
+      }
+
+      mongo_init(&(baton->p_conn->mongo_connection));
+      mongo_set_compression(&(baton->p_conn->mongo_connection), s->compression_level, s->compression_threshold);
+      ret = mongo_client_connect(&(baton->p_conn->mongo_connection), s->mongo_address, s->mongo_port);
+
+      if (ret != MONGO_OK) {
+         mongox_error_message(s, baton);
+         mongo_destroy(&(baton->p_conn->mongo_connection));
+         return ret;
+      }
+      baton->p_conn->connected = 1;
+
+      return ret;
+   }
+
+
    int mongox_retrieve(server *s, mongo_baton_t * baton)
    {
+      int ret;
+      mongo *conn;
+      mongo_reply *reply;
 
-      baton->p_mgxapi->cursor = mongo_find(&(s->mongo_connection), baton->p_mgxapi->file_name, baton->p_mgxapi->bobj_ref, baton->p_mgxapi->bobj_fields, baton->p_mgxapi->limit, baton->p_mgxapi->skip, baton->p_mgxapi->options);
+      if (mongox_pool_connect(s, baton) != MONGO_OK) {
+         return MONGO_ERROR;
+      }
+      conn = mongox_connection(s, baton);
 
-      return 0;
+      baton->p_mgxapi->cursor = mongo_find(conn, baton->p_mgxapi->file_name, baton->p_mgxapi->bobj_ref, baton->p_mgxapi->bobj_fields, baton->p_mgxapi->limit, baton->p_mgxapi->skip, baton->p_mgxapi->options);
+
+      if (!baton->p_mgxapi->cursor) {
+         mongox_error_message(s, baton);
+         return MONGO_ERROR;
+      }
+
+      /* v1.5.17 */
+      /* Fetch all batches here (in the worker thread for asynchronous calls) so that mongox_result_object only has to decode them */
+      ret = MONGO_OK;
+      while (mongo_cursor_next_batch(baton->p_mgxapi->cursor, &reply) == MONGO_OK) {
+         if (reply->fields.num == 0) { /* tailable cursor with no more data available */
+            mongo_reply_free(reply);
+            break;
+         }
+         mgx_reply_add(baton->p_mgxapi, reply, 0);
+      }
+      if (conn->err != MONGO_CONN_SUCCESS) {
+         mongox_error_message(s, baton);
+         ret = MONGO_ERROR;
+      }
+
+      mongo_cursor_destroy(baton->p_mgxapi->cursor);
+      baton->p_mgxapi->cursor = NULL;
+
+      return ret;
+   }
+
+
+   /* v1.5.17 */
+   int mongox_cursor_next(server *s, mongo_baton_t * baton)
+   {
+      int ret;
+      mongo *conn;
+      mongo_cursor *cursor;
+      mongo_reply *reply;
+
+      cursor = baton->p_mgxapi->cursor;
+      if (!cursor) {
+         return MONGO_OK;
+      }
+      if (mongox_pool_connect(s, baton) != MONGO_OK) {
+         return MONGO_ERROR;
+      }
+      conn = mongox_connection(s, baton);
+      mongo_clear_errors(conn);
+
+      /* The server-side cursor is not tied to a connection so each batch may be fetched through a different one */
+      cursor->conn = conn;
+
+      ret = mongo_cursor_next_batch(cursor, &reply);
+      if (ret == MONGO_OK) {
+         mgx_reply_add(baton->p_mgxapi, reply, 0);
+      }
+      else if (conn->err != MONGO_CONN_SUCCESS) {
+         mongox_error_message(s, baton);
+         return MONGO_ERROR;
+      }
+      else if (cursor->err == MONGO_CURSOR_QUERY_FAIL) {
+         strncpy(baton->p_mgxapi->error, conn->lasterrstr, MGX_ERROR_SIZE - 1);
+         baton->p_mgxapi->error[MGX_ERROR_SIZE - 1] = '\0';
+         baton->p_mgxapi->error_code = conn->lasterrcode;
+         return MONGO_ERROR;
+      }
+
+      /* Release the server-side cursor as soon as it is exhausted */
+      if (ret != MONGO_OK || !cursor->reply || !cursor->reply->fields.cursorID || (cursor->limit > 0 && cursor->seen >= cursor->limit)) {
+         mongo_cursor_destroy(cursor);
+         baton->p_mgxapi->cursor = NULL;
+      }
+
+      return MONGO_OK;
    }
 
 
@@ -493,7 +890,11 @@ struct mongo_baton_t {
    {
       int ret;
 
-      ret = mongo_insert(&(s->mongo_connection), baton->p_mgxapi->file_name, baton->p_mgxapi->bobj_main, 0);
+      if (mongox_pool_connect(s, baton) != MONGO_OK) {
+         return MONGO_ERROR;
+      }
+
+      ret = mongo_insert(mongox_connection(s, baton), baton->p_mgxapi->file_name, baton->p_mgxapi->bobj_main, 0);
 
       if (ret != MONGO_OK) {
          mongox_error_message(s, baton);
@@ -507,17 +908,55 @@ struct mongo_baton_t {
    {
       int ret;
 
-      ret = mongo_insert_batch(&(s->mongo_connection), baton->p_mgxapi->file_name, (const bson **) baton->p_mgxapi->bobj_main_list, baton->p_mgxapi->bobj_main_list_no, 0, 0);
+      if (mongox_pool_connect(s, baton) != MONGO_OK) {
+         return MONGO_ERROR;
+      }
+
+      /* v1.5.17 */
+      ret = mongo_insert_batch(mongox_connection(s, baton), baton->p_mgxapi->file_name, (const bson **) baton->p_mgxapi->bobj_main_list, baton->p_mgxapi->bobj_main_list_no, 0, baton->p_mgxapi->options);
+
+      if (ret != MONGO_OK) {
+         mongox_error_message(s, baton);
+      }
 
       return ret;
    }
 
 
+   /* v1.5.17 */
+   /* The failure of individual operations is reported in the result: only a failure of the call as a whole is an error */
+   int mongox_bulk_write(server *s, mongo_baton_t * baton)
+   {
+      int ret;
+      mongo *conn;
+
+      if (mongox_pool_connect(s, baton) != MONGO_OK) {
+         return MONGO_ERROR;
+      }
+
+      conn = mongox_connection(s, baton);
+      ret = mongo_bulk_write(conn, baton->p_mgxapi->file_name, baton->p_mgxapi->bulk_ops, baton->p_mgxapi->bobj_main_list_no, !(baton->p_mgxapi->options & MONGO_CONTINUE_ON_ERROR), 0, &(baton->p_mgxapi->bulk_result));
+
+      /* MONGO_WRITE_ERROR: the outcome of each operation is in bulk_ops; anything else is a failure of the whole call */
+      if (ret != MONGO_OK && conn->err != MONGO_WRITE_ERROR) {
+         mongox_error_message(s, baton);
+         return ret;
+      }
+      baton->p_mgxapi->output_integer = baton->p_mgxapi->bulk_result.inserted + baton->p_mgxapi->bulk_result.matched + baton->p_mgxapi->bulk_result.upserted + baton->p_mgxapi->bulk_result.removed;
+
+      return MONGO_OK;
+   }
+
+
    int mongox_update(server *s, mongo_baton_t * baton)
    {
       int ret;
 
-      ret = mongo_update(&(s->mongo_connection), baton->p_mgxapi->file_name, baton->p_mgxapi->bobj_ref, baton->p_mgxapi->bobj_main, MONGO_UPDATE_BASIC, 0);
+      if (mongox_pool_connect(s, baton) != MONGO_OK) {
+         return MONGO_ERROR;
+      }
+
+      ret = mongo_update(mongox_connection(s, baton), baton->p_mgxapi->file_name, baton->p_mgxapi->bobj_ref, baton->p_mgxapi->bobj_main, MONGO_UPDATE_BASIC, 0);
 
       if (ret != MONGO_OK) {
          mongox_error_message(s, baton);
@@ -531,7 +970,11 @@ struct mongo_baton_t {
    {
       int ret;
 
-      ret = mongo_remove(&(s->mongo_connection), baton->p_mgxapi->file_name, baton->p_mgxapi->bobj_ref, 0);
+      if (mongox_pool_connect(s, baton) != MONGO_OK) {
+         return MONGO_ERROR;
+      }
+
+      ret = mongo_remove(mongox_connection(s, baton), baton->p_mgxapi->file_name, baton->p_mgxapi->bobj_ref, 0);
 
       if (ret != MONGO_OK) {
          mongox_error_message(s, baton);
@@ -544,9 +987,15 @@ struct mongo_baton_t {
    {
       int ret;
 
-      baton->p_mgxapi->bobj_main = mgx_bson_alloc(baton->p_mgxapi, 1, 0);
+      if (mongox_pool_connect(s, baton) != MONGO_OK) {
+         return MONGO_ERROR;
+      }
+
+      /* v1.5.17 */
+      /* mongo_run_command() overwrites the whole bson structure so there's no need to allocate an initial buffer */
+      baton->p_mgxapi->bobj_main = mgx_bson_alloc(baton->p_mgxapi, 0, 0);
 
-      ret = mongo_run_command(&(s->mongo_connection), baton->p_mgxapi->file_name, baton->p_mgxapi->bobj_ref, baton->p_mgxapi->bobj_main);
+      ret = mongo_run_command(mongox_connection(s, baton), baton->p_mgxapi->file_name, baton->p_mgxapi->bobj_ref, baton->p_mgxapi->bobj_main);
 
       if (ret != MONGO_OK) {
          mongox_error_message(s, baton);
@@ -560,12 +1009,16 @@ struct mongo_baton_t {
    {
       int ret;
 
+      if (mongox_pool_connect(s, baton) != MONGO_OK) {
+         return MONGO_ERROR;
+      }
+
       baton->p_mgxapi->bobj_main = mgx_bson_alloc(baton->p_mgxapi, 1, 0);
 
       if (baton->p_mgxapi->index_name[0])
-         ret = mongo_create_index(&(s->mongo_connection), baton->p_mgxapi->file_name, baton->p_mgxapi->bobj_ref, baton->p_mgxapi->index_name, 0, 0, baton->p_mgxapi->bobj_main);
+         ret = mongo_create_index(mongox_connection(s, baton), baton->p_mgxapi->file_name, baton->p_mgxapi->bobj_ref, baton->p_mgxapi->index_name, 0, 0, baton->p_mgxapi->bobj_main);
       else
-         ret = mongo_create_index(&(s->mongo_connection), baton->p_mgxapi->file_name, baton->p_mgxapi->bobj_ref, NULL, 0, 0, baton->p_mgxapi->bobj_main);
+         ret = mongo_create_index(mongox_connection(s, baton), baton->p_mgxapi->file_name, baton->p_mgxapi->bobj_ref, NULL, 0, 0, baton->p_mgxapi->bobj_main);
 
       if (ret != MONGO_OK) {
          mongox_error_message(s, baton);
@@ -619,20 +1072,11 @@ struct mongo_baton_t {
    }
 
 
-   int mongox_is_object_id(server *s, mongo_baton_t * baton, char *oid_str, bson_oid_t *oid)
+   static int mongox_is_object_id(server *s, mongo_baton_t * baton, char *oid_str, bson_oid_t *oid)
    {
-      int len;
-      char oid_str1[128];
-
-      len = (int) strlen(oid_str);
-
-      if (len != 24) {
-         return -1;
-      }
-      bson_oid_from_string(oid, oid_str);
-      bson_oid_to_string(oid, oid_str1);
-
-      if (strcmp(oid_str, oid_str1)) {
+      /* v1.5.17: decode and validate in one pass rather than comparing against a round trip */
+      if (bson_oid_from_hex(oid, oid_str, strlen(oid_str)) != BSON_OK) {
+         memset((void *) oid, 0, sizeof(bson_oid_t));
          return -1;
       }
 
@@ -643,14 +1087,25 @@ struct mongo_baton_t {
    int mongox_error_message(server *s, mongo_baton_t * baton)
    {
       int size, error_code, len;
+      mongo *conn;
 
       size = MGX_ERROR_SIZE;
-      error_code = s->mongo_connection.err;
-      len = (int) strlen(s->mongo_connection.errstr);
+      conn = mongox_connection(s, baton); /* v1.5.17 */
+      error_code = conn->err;
+      len = (int) strlen(conn->errstr);
 
       baton->p_mgxapi->error_code = error_code;
+
+      /* v1.5.17 */
+      if (error_code == MONGO_WRITE_ERROR && conn->lasterrstr[0]) {
+         strncpy(baton->p_mgxapi->error, conn->lasterrstr, size - 1);
+         baton->p_mgxapi->error[size - 1] = '\0';
+         baton->p_mgxapi->error_code = conn->lasterrcode;
+         return 0;
+      }
+
       if (len && len < size) {
-         strcpy(baton->p_mgxapi->error, s->mongo_connection.errstr);
+         strcpy(baton->p_mgxapi->error, conn->errstr);
          return 0;
       }
 
@@ -728,14 +1183,20 @@ public:
    static Persistent<Function> s_ct;
 
 #if MGX_NODE_VERSION >= 100000
-   static void Init(Local<Object> exports)
+   static void Init(Local<Object> exports, MGXKEYS *p_keys)
 #else
-   static void Init(Handle<Object> exports)
+   static void Init(Handle<Object> exports, MGXKEYS *p_keys)
 #endif
    {
       Isolate* isolate = Isolate::GetCurrent();
 
-      Local<FunctionTemplate> t = FunctionTemplate::New(isolate, New);
+      /* v1.5.17 */
+      /* The field name cache belongs to the isolate: it is passed to each server object through the constructor's data */
+      if (!p_keys) {
+         p_keys = mongox_keys_alloc(); /* single isolate: lives for as long as the process */
+      }
+
+      Local<FunctionTemplate> t = FunctionTemplate::New(isolate, New, External::New(isolate, (void *) p_keys));
       t->InstanceTemplate()->SetInternalFieldCount(1);
       t->SetClassName(mongox_new_string8(isolate, (char *) "server",1));
 
@@ -747,20 +1208,28 @@ public:
       MGX_NODE_SET_PROTOTYPE_METHOD("find", Retrieve);
       MGX_NODE_SET_PROTOTYPE_METHOD("insert", Insert);
       MGX_NODE_SET_PROTOTYPE_METHOD("insert_batch", Insert_Batch);
+      MGX_NODE_SET_PROTOTYPE_METHOD("bulk_write", Bulk_Write); /* v1.5.17 */
       MGX_NODE_SET_PROTOTYPE_METHOD("update", Update);
       MGX_NODE_SET_PROTOTYPE_METHOD("remove", Remove);
       MGX_NODE_SET_PROTOTYPE_METHOD("command", Command);
       MGX_NODE_SET_PROTOTYPE_METHOD("create_index", Create_Index);
       MGX_NODE_SET_PROTOTYPE_METHOD("object_id", Object_ID);
+      MGX_NODE_SET_PROTOTYPE_METHOD("object_ids", Object_IDs); /* v1.5.17 */
       MGX_NODE_SET_PROTOTYPE_METHOD("object_id_date", Object_ID_Date);
 
+      /* v1.5.17 */
+      /* The cursor constructor is passed as data to server.cursor() so that each isolate (worker thread) uses its own */
+      t->PrototypeTemplate()->Set(mongox_new_string8(isolate, (char *) "cursor", 1), FunctionTemplate::New(isolate, Cursor, mongox_cursor_constructor(isolate)));
+
 #if MGX_NODE_VERSION >= 120000
       Local<Context> icontext = isolate->GetCurrentContext();
       s_ct.Reset(isolate, t->GetFunction(icontext).ToLocalChecked());
       exports->Set(icontext, mongox_new_string8(isolate, (char *) "server", 1), t->GetFunction(icontext).ToLocalChecked()).FromJust();
+      exports->Set(icontext, mongox_new_string8(isolate, (char *) "encode", 1), FunctionTemplate::New(isolate, Encode)->GetFunction(icontext).ToLocalChecked()).FromJust(); /* v1.5.17 */
 #else
       s_ct.Reset(isolate, t->GetFunction());
       exports->Set(mongox_new_string8(isolate, (char *) "server", 1), t->GetFunction());
+      exports->Set(mongox_new_string8(isolate, (char *) "encode", 1), FunctionTemplate::New(isolate, Encode)->GetFunction()); /* v1.5.17 */
 #endif
 
       return;
@@ -775,6 +1244,18 @@ public:
 
    ~server()
    {
+#if MGX_NODE_VERSION >= 140800
+      if (env_hook) {
+         node::RemoveEnvironmentCleanupHook(std::move(env_hook));
+      }
+#endif
+      mongox_pool_close(this); /* v1.5.17 */
+      if (p_coalesce_timer) {
+         uv_close((uv_handle_t *) p_coalesce_timer, mongox_timer_closed);
+      }
+      if (p_idle_timer) {
+         uv_close((uv_handle_t *) p_idle_timer, mongox_timer_closed);
+      }
    }
 
 
@@ -790,12 +1271,138 @@ public:
       s->mongo_port = 0;
       strcpy(s->mongo_address, "");
 
+      /* v1.5.17 */
+      s->pool_min = MGX_POOL_MIN_CONNECTIONS;
+      s->pool_max = MGX_POOL_MAX_CONNECTIONS;
+      s->pool_idle_timeout = MGX_POOL_IDLE_TIMEOUT;
+      s->pool_size = 0;
+      s->pool_generation = 0;
+      s->transport = MGX_TRANSPORT_THREAD_POOL;
+      s->compression_level = 0;
+      s->compression_threshold = MGX_COMPRESSION_THRESHOLD;
+      s->coalesce_window = 0;
+      s->coalesce_max_documents = MGX_COALESCE_MAX_DOCUMENTS;
+      s->coalesce_max_bytes = MGX_COALESCE_MAX_BYTES;
+      s->p_coalesce_timer = NULL;
+      s->p_coalesce_head = NULL;
+      s->p_idle_timer = NULL;
+      s->p_pool = NULL;
+      s->p_pending_head = NULL;
+      s->p_pending_tail = NULL;
+      s->p_keys = (MGXKEYS *) Local<External>::Cast(args.Data())->Value();
+      s->work_pending = 0;
+#if MGX_NODE_VERSION >= 140800
+      s->env_done = NULL;
+      s->env_done_arg = NULL;
+      s->env_closing = 0;
+      s->env_teardown = 0;
+      s->env_work_wait = 0;
+      s->env_hook = node::AddEnvironmentCleanupHook(isolate, mongox_env_cleanup, (void *) s);
+#endif
+
       args.GetReturnValue().Set(args.This());
       return;
    }
 
 
-   static mongo_baton_t * mongox_make_baton(server *s, int js_narg, const FunctionCallbackInfo<Value>& args, int context)
+   /* v1.5.17 */
+   /* Pre-encoded BSON supplied as a Buffer (see encode()): asynchronous calls take a copy since the Buffer may change before the worker runs */
+   static bson * mongox_buffer_bson(mongo_baton_t *baton, Local<Value> value, short copy)
+   {
+      char *data;
+      size_t len;
+      bson *bobj;
+
+      data = node::Buffer::Data(value);
+      len = node::Buffer::Length(value);
+      if (len > (size_t) INT_MAX) {
+         return NULL;
+      }
+      if (copy && data) {
+         data = (char *) mgx_arena_alloc(baton->p_mgxapi->p_arena, len);
+         if (!data) {
+            return NULL;
+         }
+         memcpy((void *) data, (void *) node::Buffer::Data(value), len);
+      }
+
+      bobj = mgx_bson_alloc(baton->p_mgxapi, 0, 0);
+      if (!bobj || bson_init_finished_data_checked(bobj, data, (int) len) != BSON_OK) {
+         return NULL;
+      }
+
+      return bobj;
+   }
+
+
+   /* v1.5.17 */
+   /* Report the _id of a pre-encoded document to be inserted, adding one (as the first field) if it has none */
+   static bson * mongox_buffer_oid(mongo_baton_t *baton, bson *bobj, int jobj_no)
+   {
+      bson *bobj_oid;
+      bson_iterator iterator;
+      bson_type type;
+      MGXJSON *p_mgxjson;
+
+      p_mgxjson = &(baton->p_mgxapi->jobj_main_list[jobj_no]);
+      p_mgxjson->oid_value[0] = '\0';
+
+      type = bson_find(&iterator, bobj, p_mgxjson->oid_name);
+      if (type == BSON_OID) {
+         bson_oid_to_string(bson_iterator_oid(&iterator), p_mgxjson->oid_value);
+      }
+      else if (type == BSON_STRING) {
+         strncpy(p_mgxjson->oid_value, bson_iterator_string(&iterator), sizeof(p_mgxjson->oid_value) - 1);
+         p_mgxjson->oid_value[sizeof(p_mgxjson->oid_value) - 1] = '\0';
+      }
+      else if (type == BSON_EOO) {
+         bobj_oid = mgx_bson_alloc(baton->p_mgxapi, 1, 0);
+         bson_oid_gen(&(p_mgxjson->oid));
+         bson_oid_to_string(&(p_mgxjson->oid), p_mgxjson->oid_value);
+         bson_append_oid(bobj_oid, p_mgxjson->oid_name, &(p_mgxjson->oid));
+         bson_iterator_init(&iterator, bobj);
+         while (bson_iterator_next(&iterator)) {
+            bson_append_element(bobj_oid, NULL, &iterator);
+         }
+         bson_finish(bobj_oid);
+         bobj_oid->err |= bobj->err;
+         return bobj_oid;
+      }
+
+      return bobj;
+   }
+
+
+   /* v1.5.17 */
+   /* A document of a bulk write operation: an object or pre-encoded BSON (a document to be inserted is given an _id if it has none) */
+   static bson * mongox_bulk_bson(server *s, mongo_baton_t *baton, Local<Value> value, int jobj_no, short insert, MGXARENASTACK *p_stack)
+   {
+      bson *bobj;
+
+      if (node::Buffer::HasInstance(value)) {
+         bobj = mongox_buffer_bson(baton, value, p_stack ? 0 : 1);
+         if (bobj && insert) {
+            bobj = mongox_buffer_oid(baton, bobj, jobj_no);
+         }
+         return bobj;
+      }
+      if (!value->IsObject()) {
+         return NULL;
+      }
+
+      baton->p_mgxapi->level = 0;
+      bobj = mgx_bson_alloc(baton->p_mgxapi, 1, 0);
+      if (!bobj) {
+         return NULL;
+      }
+      mongox_parse_json_object(s, baton, Local<Object>::Cast(value), NULL, bobj, jobj_no, MGX_JSON_OBJECT, insert ? MGX_METHOD_INSERT : 0);
+      bson_finish(bobj);
+
+      return bobj;
+   }
+
+
+   static mongo_baton_t * mongox_make_baton(server *s, int js_narg, const FunctionCallbackInfo<Value>& args, int context, MGXARENASTACK *p_stack)
    {
       Isolate* isolate = args.GetIsolate();
 #if MGX_NODE_VERSION >= 100000
@@ -803,6 +1410,8 @@ public:
 #endif
       HandleScope scope(isolate);
       int ret, obj_argn, n;
+      int pool_min, pool_max, pool_idle_timeout, transport, compression_level, compression_threshold;
+      int coalesce_window, coalesce_max_documents, coalesce_max_bytes;
       char oid_name[64];
       char buffer[256];
       Local<Object> obj;
@@ -811,34 +1420,64 @@ public:
       Local<String> value;
       Local<Array> jobj_array;
       bson *bobj;
-
-      mongo_baton_t *baton = new mongo_baton_t();
-
-      if (!baton)
+      MGXARENA *p_arena;
+      MGXAPI *p_mgxapi;
+      void *p;
+
+      /* v1.5.17 */
+      /* The baton and everything that it refers to are drawn from an arena which is released in one step */
+      /* Synchronous calls supply an arena in their own stack frame since nothing outlives the call */
+      if (p_stack)
+         p_arena = mgx_arena_stack(p_stack);
+      else
+         p_arena = mgx_arena_get();
+      if (!p_arena)
+         return NULL;
+      p = mgx_arena_alloc(p_arena, sizeof(mongo_baton_t));
+      p_mgxapi = (MGXAPI *) mgx_arena_alloc(p_arena, sizeof(MGXAPI));
+      if (!p || !p_mgxapi) {
+         mgx_arena_release(p_arena);
          return NULL;
+      }
+
+      mongo_baton_t *baton = new (p) mongo_baton_t();
 
       *oid_name = '\0';
 
       baton->increment_by = 2;
       baton->sleep_for = 1;
-
-      baton->p_mgxapi = (MGXAPI *) mgx_malloc(sizeof(MGXAPI), 101);
-      if (!baton->p_mgxapi)
-         return NULL;
+      baton->p_conn = NULL; /* v1.5.17 */
+      baton->queued = 0;
+      baton->p_coalesced = NULL;
+      baton->p_coalesced_tail = NULL;
+      baton->coalesced_no = 0;
+      baton->coalesced_size = 0;
+      baton->coalesced_flushed = 0;
+      baton->p_next = NULL;
+      baton->c = NULL;
+      baton->cursor_fetch = 0;
+
+      baton->p_mgxapi = p_mgxapi;
+      baton->p_mgxapi->p_arena = p_arena;
 
       baton->p_mgxapi->context = context;
+      baton->p_mgxapi->cursor = NULL;
+      baton->p_mgxapi->iterator = NULL;
       baton->p_mgxapi->output_integer = 0;
       baton->p_mgxapi->error_code = 0;
       baton->p_mgxapi->error[0] = '\0';
       baton->p_mgxapi->output = NULL;
 
       baton->p_mgxapi->options = 0;
+      baton->p_mgxapi->raw_bson = 0;
       baton->p_mgxapi->limit = 0;
       baton->p_mgxapi->skip = 0;
 
       baton->p_mgxapi->bobj_main_list_no = 0;
       baton->p_mgxapi->bobj_main_list = NULL;
       baton->p_mgxapi->jobj_main_list = NULL;
+      baton->p_mgxapi->bulk_ops = NULL;
+      baton->p_mgxapi->batch_sent = 0;
       baton->p_mgxapi->bobj_main = NULL;
       baton->p_mgxapi->bobj_ref = NULL;
       baton->p_mgxapi->bobj_fields = NULL;
@@ -851,12 +1490,12 @@ public:
       baton->p_mgxapi->curr_size = 0;
       baton->p_mgxapi->level = 0;
 
-      baton->p_mgxapi->p_mgxbson_head = NULL;
-      baton->p_mgxapi->p_mgxbson_tail = NULL;
+      baton->p_mgxapi->p_mgxreply_head = NULL;
+      baton->p_mgxapi->p_mgxreply_tail = NULL;
 
       baton->p_mgxapi->output_size = 1024;
       baton->p_mgxapi->output_curr_size = 0;
-      baton->p_mgxapi->output = (char *) mgx_malloc(sizeof(char) * baton->p_mgxapi->output_size, 103);
+      baton->p_mgxapi->output = (char *) mgx_arena_alloc(p_arena, sizeof(char) * baton->p_mgxapi->output_size);
       if (!baton->p_mgxapi->output) {
          mongox_destroy_baton(baton);
          return NULL;
@@ -866,7 +1505,7 @@ public:
       baton->p_mgxapi->file_name[0] = '\0';
       baton->p_mgxapi->index_name[0] = '\0';
 
-      if (context == MGX_METHOD_ABOUT || context == MGX_METHOD_VERSION || context == MGX_METHOD_CLOSE) {
+      if (context == MGX_METHOD_ABOUT || context == MGX_METHOD_VERSION || context == MGX_METHOD_CLOSE || context == MGX_METHOD_CURSOR_NEXT) {
          return baton;
       }
       else if (context == MGX_METHOD_OPEN) {
@@ -891,6 +1530,104 @@ public:
             mongox_write_char8(isolate, value, buffer, sizeof(buffer), 1);
             s->mongo_port = (int) strtol(buffer, NULL, 10);
          }
+
+         /* v1.5.17 */
+         pool_min = s->pool_min;
+         pool_max = s->pool_max;
+         pool_idle_timeout = s->pool_idle_timeout;
+         key = mongox_new_string8(isolate, (char *) "min_connections", 1);
+         if (MGX_GET(baton->jobj_main, key)->IsNumber()) {
+            pool_min = (int) MGX_TOINT32(MGX_GET(baton->jobj_main, key));
+         }
+         key = mongox_new_string8(isolate, (char *) "max_connections", 1);
+         if (MGX_GET(baton->jobj_main, key)->IsNumber()) {
+            pool_max = (int) MGX_TOINT32(MGX_GET(baton->jobj_main, key));
+         }
+         key = mongox_new_string8(isolate, (char *) "idle_timeout", 1);
+         if (MGX_GET(baton->jobj_main, key)->IsNumber()) {
+            pool_idle_timeout = (int) MGX_TOINT32(MGX_GET(baton->jobj_main, key));
+         }
+         if (pool_max < 1) {
+            strcpy(baton->p_mgxapi->error, "The maximum number of connections (max_connections) must be at least 1");
+            goto mongox_make_baton_exit;
+         }
+         if (pool_min < 0 || pool_min > pool_max) {
+            strcpy(baton->p_mgxapi->error, "The minimum number of connections (min_connections) must be between 0 and max_connections");
+            goto mongox_make_baton_exit;
+         }
+         transport = s->transport;
+         key = mongox_new_string8(isolate, (char *) "transport", 1);
+         if (MGX_GET(baton->jobj_main, key)->IsString()) {
+            value = MGX_TOSTRING(MGX_GET(baton->jobj_main, key));
+            mongox_write_char8(isolate, value, buffer, sizeof(buffer), 1);
+            if (!strcmp(buffer, "event_loop")) {
+               transport = MGX_TRANSPORT_EVENT_LOOP;
+            }
+            else if (!strcmp(buffer, "thread_pool")) {
+               transport = MGX_TRANSPORT_THREAD_POOL;
+            }
+            else {
+               strcpy(baton->p_mgxapi->error, "Invalid transport specified: use 'thread_pool' or 'event_loop'");
+               goto mongox_make_baton_exit;
+            }
+         }
+         compression_level = s->compression_level;
+         compression_threshold = s->compression_threshold;
+         key = mongox_new_string8(isolate, (char *) "compression", 1);
+         if (MGX_GET(baton->jobj_main, key)->IsString()) {
+            value = MGX_TOSTRING(MGX_GET(baton->jobj_main, key));
+            mongox_write_char8(isolate, value, buffer, sizeof(buffer), 1);
+            if (!strcmp(buffer, "zlib")) {
+               compression_level = MGX_COMPRESSION_DEFAULT;
+            }
+            else if (!strcmp(buffer, "none")) {
+               compression_level = 0;
+            }
+            else {
+               strcpy(baton->p_mgxapi->error, "Invalid compression specified: use 'zlib' or 'none'");
+               goto mongox_make_baton_exit;
+            }
+         }
+         key = mongox_new_string8(isolate, (char *) "compression_level", 1);
+         if (compression_level && MGX_GET(baton->jobj_main, key)->IsNumber()) {
+            compression_level = (int) MGX_TOINT32(MGX_GET(baton->jobj_main, key));
+            if (compression_level < 1 || compression_level > 9) {
+               strcpy(baton->p_mgxapi->error, "The compression level (compression_level) must be between 1 and 9");
+               goto mongox_make_baton_exit;
+            }
+         }
+         key = mongox_new_string8(isolate, (char *) "compression_threshold", 1);
+         if (MGX_GET(baton->jobj_main, key)->IsNumber()) {
+            compression_threshold = (int) MGX_TOINT32(MGX_GET(baton->jobj_main, key));
+         }
+         coalesce_window = s->coalesce_window;
+         coalesce_max_documents = s->coalesce_max_documents;
+         coalesce_max_bytes = s->coalesce_max_bytes;
+         key = mongox_new_string8(isolate, (char *) "coalesce_window", 1);
+         if (MGX_GET(baton->jobj_main, key)->IsNumber()) {
+            coalesce_window = (int) MGX_TOINT32(MGX_GET(baton->jobj_main, key));
+         }
+         key = mongox_new_string8(isolate, (char *) "coalesce_max_documents", 1);
+         if (MGX_GET(baton->jobj_main, key)->IsNumber()) {
+            coalesce_max_documents = (int) MGX_TOINT32(MGX_GET(baton->jobj_main, key));
+         }
+         key = mongox_new_string8(isolate, (char *) "coalesce_max_bytes", 1);
+         if (MGX_GET(baton->jobj_main, key)->IsNumber()) {
+            coalesce_max_bytes = (int) MGX_TOINT32(MGX_GET(baton->jobj_main, key));
+         }
+         if (coalesce_window > 0 && (coalesce_max_documents < 1 || coalesce_max_bytes < 1)) {
+            strcpy(baton->p_mgxapi->error, "The limits on coalesced inserts (coalesce_max_documents and coalesce_max_bytes) must be at least 1");
+            goto mongox_make_baton_exit;
+         }
+         s->pool_min = pool_min;
+         s->pool_max = pool_max;
+         s->pool_idle_timeout = pool_idle_timeout > 0 ? pool_idle_timeout : 0;
+         s->transport = transport;
+         s->compression_level = compression_level;
+         s->compression_threshold = compression_threshold > 0 ? compression_threshold : 0;
+         s->coalesce_window = coalesce_window > 0 ? coalesce_window : 0;
+         s->coalesce_max_documents = coalesce_max_documents;
+         s->coalesce_max_bytes = coalesce_max_bytes;
       }
       else if (context == MGX_METHOD_INSERT) {
          if (js_narg > 0) {
@@ -910,14 +1647,25 @@ public:
          if (!oid_name[0]) {
             strcpy(oid_name, MGX_DEFAULT_OID_NAME);
          }
-         if (js_narg > obj_argn) {
-            baton->jobj_main = Local<Object>::Cast(args[obj_argn]);
-
-            baton->p_mgxapi->jobj_main_list = (MGXJSON *) mgx_malloc(sizeof(MGXJSON), 10);
+         if (js_narg > obj_argn && node::Buffer::HasInstance(args[obj_argn])) { /* v1.5.17 */
+            baton->p_mgxapi->jobj_main_list = (MGXJSON *) mgx_arena_alloc(p_arena, sizeof(MGXJSON));
             strcpy(baton->p_mgxapi->jobj_main_list[0].oid_name, oid_name);
 
-            baton->p_mgxapi->level = 0;
-            bobj = mgx_bson_alloc(baton->p_mgxapi, 1, 0);
+            bobj = mongox_buffer_bson(baton, args[obj_argn], p_stack ? 0 : 1);
+            if (!bobj) {
+               strcpy(baton->p_mgxapi->error, "Invalid BSON Buffer supplied for Insert Method");
+               goto mongox_make_baton_exit;
+            }
+            baton->p_mgxapi->bobj_main = mongox_buffer_oid(baton, bobj, 0);
+         }
+         else if (js_narg > obj_argn) {
+            baton->jobj_main = Local<Object>::Cast(args[obj_argn]);
+
+            baton->p_mgxapi->jobj_main_list = (MGXJSON *) mgx_arena_alloc(p_arena, sizeof(MGXJSON));
+            strcpy(baton->p_mgxapi->jobj_main_list[0].oid_name, oid_name);
+
+            baton->p_mgxapi->level = 0;
+            bobj = mgx_bson_alloc(baton->p_mgxapi, 1, 0);
             baton->p_mgxapi->bobj_main = bobj;
             ret = mongox_parse_json_object(s, baton, baton->jobj_main, NULL, bobj, 0, MGX_JSON_OBJECT, 0);
             ret = bson_finish(bobj);
@@ -953,10 +1701,21 @@ public:
                goto mongox_make_baton_exit;
             }
 
-            baton->p_mgxapi->bobj_main_list = (bson **) mgx_malloc((sizeof(bson *) * baton->p_mgxapi->bobj_main_list_no), 10);
-            baton->p_mgxapi->jobj_main_list = (MGXJSON *) mgx_malloc((sizeof(MGXJSON) * baton->p_mgxapi->bobj_main_list_no), 10);
+            baton->p_mgxapi->bobj_main_list = (bson **) mgx_arena_alloc(p_arena, (sizeof(bson *) * baton->p_mgxapi->bobj_main_list_no));
+            baton->p_mgxapi->jobj_main_list = (MGXJSON *) mgx_arena_alloc(p_arena, (sizeof(MGXJSON) * baton->p_mgxapi->bobj_main_list_no));
 
             for (n = 0; n < baton->p_mgxapi->bobj_main_list_no; n ++) {
+               /* v1.5.17 */
+               if (node::Buffer::HasInstance(MGX_GET(jobj_array, n))) {
+                  strcpy(baton->p_mgxapi->jobj_main_list[n].oid_name, oid_name);
+                  bobj = mongox_buffer_bson(baton, MGX_GET(jobj_array, n), p_stack ? 0 : 1);
+                  if (!bobj) {
+                     sprintf(baton->p_mgxapi->error, "Mongo Object Array supplied for Insert Batch Method has an invalid BSON Buffer at position %d", n);
+                     break;
+                  }
+                  baton->p_mgxapi->bobj_main_list[n] = mongox_buffer_oid(baton, bobj, n);
+                  continue;
+               }
                if (!MGX_GET(jobj_array, n)->IsObject()) {
                   sprintf(baton->p_mgxapi->error, "Mongo Object Array supplied for Insert Batch Method has a bad record at postion %d", n);
                   break;
@@ -977,6 +1736,109 @@ public:
             strcpy(baton->p_mgxapi->error, "Mongo Object Array not specified for Insert Batch Method");
             goto mongox_make_baton_exit;
          }
+         /* v1.5.17 */
+         if (js_narg > (obj_argn + 1) && args[obj_argn + 1]->IsString()) {
+            value = MGX_TOSTRING(args[obj_argn + 1]);
+            mongox_write_char8(isolate, value, buffer, sizeof(buffer), 1);
+            ret = mongox_parse_options(s, baton, buffer, 0);
+            if (ret) {
+               goto mongox_make_baton_exit;
+            }
+         }
+      }
+      else if (context == MGX_METHOD_BULK_WRITE) { /* v1.5.17 */
+         if (js_narg > 0) {
+            file = Local<String>::Cast(args[0]);
+            mongox_write_char8(isolate, file, baton->p_mgxapi->file_name, sizeof(baton->p_mgxapi->file_name), 1);
+         }
+         else {
+            strcpy(baton->p_mgxapi->error, "Mongo Namespace not specified for Bulk Write Method");
+            goto mongox_make_baton_exit;
+         }
+         obj_argn = 1;
+         if (js_narg > 1 && args[1]->IsString()) {
+            value = MGX_TOSTRING(args[1]);
+            mongox_write_char8(isolate, value, oid_name, sizeof(oid_name), 1);
+            obj_argn = 2;
+         }
+         if (!oid_name[0]) {
+            strcpy(oid_name, MGX_DEFAULT_OID_NAME);
+         }
+         if (js_narg > obj_argn && args[obj_argn]->IsArray()) {
+            jobj_array = Local<Array>::Cast(args[obj_argn]);
+            baton->p_mgxapi->bobj_main_list_no = (int) jobj_array->Length();
+            if (baton->p_mgxapi->bobj_main_list_no == 0) {
+               strcpy(baton->p_mgxapi->error, "Operation Array supplied for Bulk Write Method is empty");
+               goto mongox_make_baton_exit;
+            }
+
+            baton->p_mgxapi->bulk_ops = (mongo_bulk_op *) mgx_arena_alloc(p_arena, (sizeof(mongo_bulk_op) * baton->p_mgxapi->bobj_main_list_no));
+            baton->p_mgxapi->jobj_main_list = (MGXJSON *) mgx_arena_alloc(p_arena, (sizeof(MGXJSON) * baton->p_mgxapi->bobj_main_list_no));
+            if (!baton->p_mgxapi->bulk_ops || !baton->p_mgxapi->jobj_main_list) {
+               baton->p_mgxapi->bulk_ops = NULL;
+               strcpy(baton->p_mgxapi->error, "Insufficient memory for Bulk Write Method");
+               goto mongox_make_baton_exit;
+            }
+            memset((void *) baton->p_mgxapi->bulk_ops, 0, sizeof(mongo_bulk_op) * baton->p_mgxapi->bobj_main_list_no);
+
+            for (n = 0; n < baton->p_mgxapi->bobj_main_list_no; n ++) {
+               mongo_bulk_op *op = &(baton->p_mgxapi->bulk_ops[n]);
+
+               strcpy(baton->p_mgxapi->jobj_main_list[n].oid_name, oid_name);
+               baton->p_mgxapi->jobj_main_list[n].oid_value[0] = '\0';
+               if (!MGX_GET(jobj_array, n)->IsObject()) {
+                  sprintf(baton->p_mgxapi->error, "Operation Array supplied for Bulk Write Method has a bad operation at position %d", n);
+                  break;
+               }
+               obj = Local<Object>::Cast(MGX_TOOBJECT(MGX_GET(jobj_array, n)));
+               key = mongox_new_string8(isolate, (char *) "insert", 1);
+               if (!MGX_GET(obj, key)->IsUndefined()) {
+                  op->type = MONGO_BULK_INSERT;
+                  op->doc = mongox_bulk_bson(s, baton, MGX_GET(obj, key), n, 1, p_stack);
+               }
+               else {
+                  key = mongox_new_string8(isolate, (char *) "update", 1);
+                  if (!MGX_GET(obj, key)->IsUndefined()) {
+                     op->type = MONGO_BULK_UPDATE;
+                     op->cond = mongox_bulk_bson(s, baton, MGX_GET(obj, key), n, 0, p_stack);
+                     key = mongox_new_string8(isolate, (char *) "object", 1);
+                     op->doc = mongox_bulk_bson(s, baton, MGX_GET(obj, key), n, 0, p_stack);
+                     key = mongox_new_string8(isolate, (char *) "upsert", 1);
+                     if (MGX_GET(obj, key)->IsTrue()) {
+                        op->flags |= MONGO_UPDATE_UPSERT;
+                     }
+                     key = mongox_new_string8(isolate, (char *) "multi", 1);
+                     if (MGX_GET(obj, key)->IsTrue()) {
+                        op->flags |= MONGO_UPDATE_MULTI;
+                     }
+                  }
+                  else {
+                     key = mongox_new_string8(isolate, (char *) "remove", 1);
+                     op->type = MONGO_BULK_REMOVE;
+                     op->cond = mongox_bulk_bson(s, baton, MGX_GET(obj, key), n, 0, p_stack);
+                  }
+               }
+               if ((op->type == MONGO_BULK_REMOVE ? !op->cond : (!op->doc || (op->type == MONGO_BULK_UPDATE && !op->cond)))) {
+                  sprintf(baton->p_mgxapi->error, "Operation Array supplied for Bulk Write Method has a bad operation at position %d", n);
+                  break;
+               }
+            }
+            if (baton->p_mgxapi->error[0]) {
+               goto mongox_make_baton_exit;
+            }
+         }
+         else {
+            strcpy(baton->p_mgxapi->error, "Operation Array not specified for Bulk Write Method");
+            goto mongox_make_baton_exit;
+         }
+         if (js_narg > (obj_argn + 1) && args[obj_argn + 1]->IsString()) {
+            value = MGX_TOSTRING(args[obj_argn + 1]);
+            mongox_write_char8(isolate, value, buffer, sizeof(buffer), 1);
+            ret = mongox_parse_options(s, baton, buffer, 0);
+            if (ret) {
+               goto mongox_make_baton_exit;
+            }
+         }
       }
       else if (context == MGX_METHOD_UPDATE) {
          if (js_narg > 0) {
@@ -996,10 +1858,20 @@ public:
          if (!oid_name[0]) {
             strcpy(oid_name, MGX_DEFAULT_OID_NAME);
          }
-         if (js_narg > obj_argn) {
+         if (js_narg > obj_argn && node::Buffer::HasInstance(args[obj_argn])) { /* v1.5.17 */
+            baton->p_mgxapi->jobj_main_list = (MGXJSON *) mgx_arena_alloc(p_arena, sizeof(MGXJSON));
+            strcpy(baton->p_mgxapi->jobj_main_list[0].oid_name, oid_name);
+
+            baton->p_mgxapi->bobj_ref = mongox_buffer_bson(baton, args[obj_argn], p_stack ? 0 : 1);
+            if (!baton->p_mgxapi->bobj_ref) {
+               strcpy(baton->p_mgxapi->error, "Invalid BSON Buffer supplied as the Reference Object for Update Method");
+               goto mongox_make_baton_exit;
+            }
+         }
+         else if (js_narg > obj_argn) {
             baton->jobj_ref = Local<Object>::Cast(args[obj_argn]);
 
-            baton->p_mgxapi->jobj_main_list = (MGXJSON *) mgx_malloc(sizeof(MGXJSON), 10);
+            baton->p_mgxapi->jobj_main_list = (MGXJSON *) mgx_arena_alloc(p_arena, sizeof(MGXJSON));
             strcpy(baton->p_mgxapi->jobj_main_list[0].oid_name, oid_name);
 
             baton->p_mgxapi->level = 0;
@@ -1012,7 +1884,14 @@ public:
             strcpy(baton->p_mgxapi->error, "Mongo Reference Object not specified for Update Method");
             goto mongox_make_baton_exit;
          }
-         if (js_narg > (obj_argn + 1)) {
+         if (js_narg > (obj_argn + 1) && node::Buffer::HasInstance(args[obj_argn + 1])) { /* v1.5.17 */
+            baton->p_mgxapi->bobj_main = mongox_buffer_bson(baton, args[obj_argn + 1], p_stack ? 0 : 1);
+            if (!baton->p_mgxapi->bobj_main) {
+               strcpy(baton->p_mgxapi->error, "Invalid BSON Buffer supplied as the Object for Update Method");
+               goto mongox_make_baton_exit;
+            }
+         }
+         else if (js_narg > (obj_argn + 1)) {
             baton->jobj_main = Local<Object>::Cast(args[obj_argn + 1]);
             baton->p_mgxapi->level = 0;
             bobj = mgx_bson_alloc(baton->p_mgxapi, 1, 0);
@@ -1025,7 +1904,7 @@ public:
             goto mongox_make_baton_exit;
          }
       }
-      else if (context == MGX_METHOD_RETRIEVE) {
+      else if (context == MGX_METHOD_RETRIEVE || context == MGX_METHOD_CURSOR) {
          if (js_narg > 0) {
             file = Local<String>::Cast(args[0]);
             mongox_write_char8(isolate, file, baton->p_mgxapi->file_name, sizeof(baton->p_mgxapi->file_name), 1);
@@ -1046,7 +1925,7 @@ public:
          if (js_narg > obj_argn) {
             baton->jobj_ref = Local<Object>::Cast(args[obj_argn]);
 
-            baton->p_mgxapi->jobj_main_list = (MGXJSON *) mgx_malloc(sizeof(MGXJSON), 10);
+            baton->p_mgxapi->jobj_main_list = (MGXJSON *) mgx_arena_alloc(p_arena, sizeof(MGXJSON));
             strcpy(baton->p_mgxapi->jobj_main_list[0].oid_name, oid_name);
 
             baton->p_mgxapi->level = 0;
@@ -1102,10 +1981,17 @@ public:
          if (!oid_name[0]) {
             strcpy(oid_name, MGX_DEFAULT_OID_NAME);
          }
-         if (js_narg > obj_argn) {
+         if (js_narg > obj_argn && node::Buffer::HasInstance(args[obj_argn])) { /* v1.5.17 */
+            baton->p_mgxapi->bobj_ref = mongox_buffer_bson(baton, args[obj_argn], p_stack ? 0 : 1);
+            if (!baton->p_mgxapi->bobj_ref) {
+               strcpy(baton->p_mgxapi->error, "Invalid BSON Buffer supplied as the Reference Object for Remove Method");
+               goto mongox_make_baton_exit;
+            }
+         }
+         else if (js_narg > obj_argn) {
             baton->jobj_ref = Local<Object>::Cast(args[obj_argn]);
 
-            baton->p_mgxapi->jobj_main_list = (MGXJSON *) mgx_malloc(sizeof(MGXJSON), 10);
+            baton->p_mgxapi->jobj_main_list = (MGXJSON *) mgx_arena_alloc(p_arena, sizeof(MGXJSON));
             strcpy(baton->p_mgxapi->jobj_main_list[0].oid_name, oid_name);
 
             baton->p_mgxapi->level = 0;
@@ -1141,7 +2027,7 @@ public:
          if (js_narg > obj_argn) {
             baton->jobj_ref = Local<Object>::Cast(args[obj_argn]);
 
-            baton->p_mgxapi->jobj_main_list = (MGXJSON *) mgx_malloc(sizeof(MGXJSON), 10);
+            baton->p_mgxapi->jobj_main_list = (MGXJSON *) mgx_arena_alloc(p_arena, sizeof(MGXJSON));
             strcpy(baton->p_mgxapi->jobj_main_list[0].oid_name, oid_name);
 
             baton->p_mgxapi->level = 0;
@@ -1155,6 +2041,16 @@ public:
             strcpy(baton->p_mgxapi->error, "Mongo Command Object not specified for Command Method");
             goto mongox_make_baton_exit;
          }
+         /* v1.5.17 */
+         if (js_narg > (obj_argn + 1) && args[obj_argn + 1]->IsString()) {
+            char buffer[256];
+            value = MGX_TOSTRING(args[obj_argn + 1]);
+            mongox_write_char8(isolate, value, buffer, sizeof(buffer), 1);
+            ret = mongox_parse_options(s, baton, buffer, 0);
+            if (ret) {
+               goto mongox_make_baton_exit;
+            }
+         }
       }
       else if (context == MGX_METHOD_CREATE_INDEX) {
 
@@ -1178,7 +2074,7 @@ public:
          if (js_narg > obj_argn) {
             baton->jobj_ref = Local<Object>::Cast(args[obj_argn]);
 
-            baton->p_mgxapi->jobj_main_list = (MGXJSON *) mgx_malloc(sizeof(MGXJSON), 10);
+            baton->p_mgxapi->jobj_main_list = (MGXJSON *) mgx_arena_alloc(p_arena, sizeof(MGXJSON));
             strcpy(baton->p_mgxapi->jobj_main_list[0].oid_name, oid_name);
 
             baton->p_mgxapi->level = 0;
@@ -1206,6 +2102,24 @@ public:
             }
          }
       }
+      else if (context == MGX_METHOD_ENCODE) { /* v1.5.17 */
+         if (js_narg > 0 && args[0]->IsObject() && !node::Buffer::HasInstance(args[0])) {
+            baton->jobj_main = Local<Object>::Cast(args[0]);
+
+            baton->p_mgxapi->jobj_main_list = (MGXJSON *) mgx_arena_alloc(p_arena, sizeof(MGXJSON));
+            strcpy(baton->p_mgxapi->jobj_main_list[0].oid_name, MGX_DEFAULT_OID_NAME);
+
+            baton->p_mgxapi->level = 0;
+            bobj = mgx_bson_alloc(baton->p_mgxapi, 1, 0);
+            baton->p_mgxapi->bobj_main = bobj;
+            ret = mongox_parse_json_object(s, baton, baton->jobj_main, NULL, bobj, 0, MGX_JSON_OBJECT, 0);
+            ret = bson_finish(bobj);
+         }
+         else {
+            strcpy(baton->p_mgxapi->error, "Mongo Object not specified for Encode Method");
+            goto mongox_make_baton_exit;
+         }
+      }
       else if (context == MGX_METHOD_OBJECT_ID_DATE) {
          if (js_narg > 0) {
             file = Local<String>::Cast(args[0]);
@@ -1226,883 +2140,3170 @@ mongox_make_baton_exit:
    /* v1.4.14 */
    static int mongox_queue_task(void *work_cb, void *after_work_cb, mongo_baton_t *baton, short context)
    {
-      uv_work_t *_req = new uv_work_t;
-      _req->data = baton;
+      /* v1.5.17 */
+      baton->work_cb = work_cb;
+      baton->after_work_cb = after_work_cb;
+      baton->p_conn = NULL;
+      baton->p_next = NULL;
+      baton->io_pending = 0;
+      if (!baton->queued) {
+         baton->queued = 1;
+         baton->s->work_pending ++;
+      }
 
-      /* v1.4.14 */
-#if MGX_NODE_VERSION >= 120000
-      uv_queue_work(GetCurrentEventLoop(baton->isolate), _req, (uv_work_cb) work_cb, (uv_after_work_cb) after_work_cb);
-#else
-      uv_queue_work(uv_default_loop(), _req, (uv_work_cb) work_cb, (uv_after_work_cb) after_work_cb);
-#endif
+      if (mongox_pool_required(baton->p_mgxapi->context)) {
+         mongox_pool_timer(baton);
+         baton->p_conn = mongox_pool_checkout(baton->s, baton->p_mgxapi->context);
+         if (!baton->p_conn) {
+            /* All connections are busy: wait for one to be returned to the pool */
+            if (baton->s->p_pending_tail) {
+               baton->s->p_pending_tail->p_next = baton;
+            }
+            else {
+               baton->s->p_pending_head = baton;
+            }
+            baton->s->p_pending_tail = baton;
+            return 0;
+         }
+      }
 
-      return 0;
+      return mongox_queue_work(baton);
    }
 
 
-   static int mongox_parse_options(server *s, mongo_baton_t * baton, char *options, int context)
+   /* v1.5.17 */
+   static int mongox_queue_work(mongo_baton_t *baton)
    {
-      int ret, eol, eot, len;
-      char *p, *pz;
+      uv_work_t *_req;
 
-      /* printf("\r\nALL Options: len=%d; =%s=\r\n", (int) strlen(options), options); */
+      if (baton->p_conn && !baton->p_mgxapi->error[0]) {
+         if (mongox_loop_supported(baton->s, baton->p_mgxapi->context)) {
+            return mongox_loop_start(baton);
+         }
+         if (baton->p_conn->p_io) {
+            mongox_io_detach(baton->p_conn); /* the worker thread uses blocking I/O */
+         }
+      }
 
-      baton->p_mgxapi->options = 0;
-      ret = 0;
-      eol = 0;
-      eot = 0;
-      p = options;
-      pz = p;
-      while (!eol) {
+      _req = new uv_work_t;
+      _req->data = baton;
 
-         if (!(*pz))
-            eol = 1;
-         else if (*pz != '_' && !isalpha((int) *pz) && !isdigit((int) *pz))
-            eot = 1;
+      /* v1.4.14 */
+      uv_queue_work(mongox_event_loop(baton), _req, (uv_work_cb) baton->work_cb, (uv_after_work_cb) baton->after_work_cb);
 
-         if (eol || eot) {
-            *pz = '\0';
-            len = (int) strlen(p);
-            if (len) {
-               /* printf("\r\nOption: len=%d; =%s=", (int) strlen(p), p); */
+      return 0;
+   }
 
-               if (baton->p_mgxapi->context == MGX_METHOD_INSERT) {
-                  if (!strcmp(p, "MONGO_CONTINUE_ON_ERROR")) {
-                     baton->p_mgxapi->options |= MONGO_CONTINUE_ON_ERROR;
-                  }
-                  else {
-                     sprintf(baton->p_mgxapi->error, "Invalid Option (%s) supplied to Update method", p);
-                     ret = -1;
-                     break;
-                  }
-               }
-               else if (baton->p_mgxapi->context == MGX_METHOD_UPDATE) {
-                  if (!strcmp(p, "MONGO_UPDATE_UPSERT")) {
-                     baton->p_mgxapi->options |= MONGO_UPDATE_UPSERT;
-                  }
-                  else if (!strcmp(p, "MONGO_UPDATE_MULTI")) {
-                     baton->p_mgxapi->options |= MONGO_UPDATE_MULTI;
-                  }
-                  else if (!strcmp(p, "MONGO_UPDATE_BASIC")) {
-                     baton->p_mgxapi->options |= MONGO_UPDATE_BASIC;
-                  }
-                  else {
-                     sprintf(baton->p_mgxapi->error, "Invalid Option (%s) supplied to Update method", p);
-                     ret = -1;
-                     break;
-                  }
-               }
-               else if (baton->p_mgxapi->context == MGX_METHOD_RETRIEVE) {
 
-                  if (!strcmp(p, "MONGO_TAILABLE")) {
-                     baton->p_mgxapi->options |= MONGO_TAILABLE;
-                  }
-                  else if (!strcmp(p, "MONGO_SLAVE_OK")) {
-                     baton->p_mgxapi->options |= MONGO_SLAVE_OK;
-                  }
-                  else if (!strcmp(p, "MONGO_NO_CURSOR_TIMEOUT")) {
-                     baton->p_mgxapi->options |= MONGO_NO_CURSOR_TIMEOUT;
-                  }
-                  else if (!strcmp(p, "MONGO_AWAIT_DATA")) {
-                     baton->p_mgxapi->options |= MONGO_AWAIT_DATA;
-                  }
-                  else if (!strcmp(p, "MONGO_EXHAUST")) {
-                     baton->p_mgxapi->options |= MONGO_EXHAUST;
-                  }
-                  else if (!strcmp(p, "MONGO_PARTIAL")) {
-                     baton->p_mgxapi->options |= MONGO_PARTIAL;
-                  }
-                  else {
-                     sprintf(baton->p_mgxapi->error, "Invalid Option (%s) supplied to Create_Index method", p);
-                     ret = -1;
-                     break;
-                  }
-               }
-               else if (baton->p_mgxapi->context == MGX_METHOD_CREATE_INDEX) {
+   /*
+      v1.5.17
+      Coalescing of asynchronous insert() calls (the coalesce_window property of open()).  Calls
+      to the same namespace made within the window are held back, each group headed by its first
+      call, and then written together as one unordered bulk write: either when the window closes
+      or as soon as the group reaches coalesce_max_documents or coalesce_max_bytes.  Each call's
+      callback is still fired with the outcome of its own document.  All of this runs in the main
+      (event loop) thread.
+   */
+   static int mongox_coalesce_add(server *s, mongo_baton_t *baton)
+   {
+      mongo_baton_t *p_group, *p_prev;
 
-                  if (!strcmp(p, "MONGO_INDEX_UNIQUE")) {
-                     baton->p_mgxapi->options |= MONGO_INDEX_UNIQUE;
-                  }
-                  else if (!strcmp(p, "MONGO_INDEX_DROP_DUPS")) {
-                     baton->p_mgxapi->options |= MONGO_INDEX_DROP_DUPS;
-                  }
-                  else if (!strcmp(p, "MONGO_INDEX_BACKGROUND")) {
-                     baton->p_mgxapi->options |= MONGO_INDEX_BACKGROUND;
-                  }
-                  else if (!strcmp(p, "MONGO_INDEX_SPARSE")) {
-                     baton->p_mgxapi->options |= MONGO_INDEX_SPARSE;
-                  }
-                  else {
-                     sprintf(baton->p_mgxapi->error, "Invalid Option (%s) supplied to Create_Index method", p);
-                     ret = -1;
-                     break;
-                  }
-               }
-            }
-            p = pz;
-            while (*(++ p)) {
-               if (isalpha((int) *p) || isdigit((int) *p)) {
-                  break;
-               }
-            }
-            pz = p;
-            eot = 0;
+      p_prev = NULL;
+      for (p_group = s->p_coalesce_head; p_group; p_group = p_group->p_next) {
+         if (!strcmp(p_group->p_mgxapi->file_name, baton->p_mgxapi->file_name)) {
+            break;
+         }
+         p_prev = p_group;
+      }
+
+      baton->p_next = NULL;
+      if (p_group) {
+         if (p_group->p_coalesced_tail) {
+            p_group->p_coalesced_tail->p_next = baton;
          }
          else {
-            pz ++;
+            p_group->p_coalesced = baton;
          }
-         if (eol) {
-            break;
+         p_group->p_coalesced_tail = baton;
+      }
+      else {
+         p_group = baton;
+         if (p_prev) {
+            p_prev->p_next = p_group;
+         }
+         else {
+            s->p_coalesce_head = p_group;
          }
       }
+      p_group->coalesced_no ++;
+      p_group->coalesced_size += bson_size(baton->p_mgxapi->bobj_main);
 
-      return ret;
+      if (p_group->coalesced_no >= s->coalesce_max_documents || p_group->coalesced_size >= s->coalesce_max_bytes) {
+         if (p_prev) {
+            p_prev->p_next = p_group->p_next;
+         }
+         else {
+            s->p_coalesce_head = p_group->p_next;
+         }
+         p_group->p_next = NULL;
+         mongox_coalesce_flush(s, p_group);
+         return 0;
+      }
+
+      if (!s->p_coalesce_timer) {
+         s->p_coalesce_timer = (uv_timer_t *) mgx_malloc(sizeof(uv_timer_t), 205);
+         if (!s->p_coalesce_timer) {
+            mongox_coalesce_flush_all(s);
+            return 0;
+         }
+         uv_timer_init(mongox_event_loop(baton), s->p_coalesce_timer);
+         s->p_coalesce_timer->data = (void *) s;
+      }
+      if (!uv_is_active((uv_handle_t *) s->p_coalesce_timer)) {
+         uv_timer_start(s->p_coalesce_timer, mongox_coalesce_timeout, (uint64_t) s->coalesce_window, 0);
+      }
+
+      return 0;
    }
 
 
-   static int mongox_parse_json_object(server *s, mongo_baton_t * baton, Local<Object> jobj, char *jobj_name, bson *bobj, int jobj_no, int type, int context)
+   /* Send a group of insert() calls: the first call of the group carries them all as a bulk write */
+   static int mongox_coalesce_flush(server *s, mongo_baton_t *baton)
    {
-      Isolate* isolate = Isolate::GetCurrent();
-#if MGX_NODE_VERSION >= 100000
-      Local<Context> icontext = isolate->GetCurrentContext();
-#endif
-      HandleScope scope(isolate);
-      int ret;
-      unsigned int n, name_len, value_len;
-      char *name, *value;
-      Local<Array> a;
-      Local<String> name_str;
-      Local<String> value_str;
-      Local<Object> jobj_next;
-      bson *bobj_next;
-
-#if MGX_NODE_VERSION >= 120000
-      a = jobj->GetPropertyNames(isolate->GetCurrentContext()).ToLocalChecked();
-#else
-      a = jobj->GetPropertyNames();
-#endif
-      for (n = 0; n < a->Length(); n ++) {
+      int n;
+      mongo_baton_t *p_next;
+      MGXAPI *p_mgxapi;
 
-         name_str = MGX_TOSTRING(MGX_GET(a, n));
-         name_len = mongox_string8_length(isolate, name_str, 1);
+      p_mgxapi = baton->p_mgxapi;
+      if (baton->coalesced_no > 1) {
+         p_mgxapi->bulk_ops = (mongo_bulk_op *) mgx_arena_alloc(p_mgxapi->p_arena, sizeof(mongo_bulk_op) * baton->coalesced_no);
+      }
+      if (!p_mgxapi->bulk_ops) {
+         /* Nothing to merge (or no memory to do so): each call is sent on its own */
+         p_next = baton->p_coalesced;
+         baton->p_coalesced = NULL;
+         while (baton) {
+            mongox_queue_task((void *) EIO_Insert, (void *) mongox_invoke_callback, baton, 0);
+            baton->coalesced_flushed = 1;
+            baton = p_next;
+            p_next = baton ? baton->p_next : NULL;
+         }
+         return 0;
+      }
 
-         name = (char *) mgx_malloc(sizeof(char) * (name_len + 2), 2001);
-         *name = '\0';
+      memset((void *) p_mgxapi->bulk_ops, 0, sizeof(mongo_bulk_op) * baton->coalesced_no);
+      p_next = baton;
+      for (n = 0; n < baton->coalesced_no; n ++) {
+         p_mgxapi->bulk_ops[n].type = MONGO_BULK_INSERT;
+         p_mgxapi->bulk_ops[n].doc = p_next->p_mgxapi->bobj_main;
+         p_next = n ? p_next->p_next : baton->p_coalesced;
+      }
+      p_mgxapi->bobj_main_list_no = baton->coalesced_no;
+      p_mgxapi->options = MONGO_CONTINUE_ON_ERROR;
+      p_mgxapi->context = MGX_METHOD_BULK_WRITE;
 
-         mongox_write_char8(isolate, name_str, name, name_len, 1);
+      mongox_queue_task((void *) EIO_Bulk_Write, (void *) mongox_invoke_coalesced, baton, 0);
+      baton->coalesced_flushed = 1;
 
-         if (n == 0 && (baton->p_mgxapi->context == MGX_METHOD_INSERT || baton->p_mgxapi->context == MGX_METHOD_INSERT_BATCH) && baton->p_mgxapi->level == 0) {
-            if (strcmp(name, baton->p_mgxapi->jobj_main_list[jobj_no].oid_name)) { /* no _id */
-               /* bson_append_new_oid(baton->p_mgxapi->bobj_main, baton->p_mgxapi->oid_name); */
-               bson_oid_gen(&(baton->p_mgxapi->jobj_main_list[jobj_no].oid));
-               bson_oid_to_string(&(baton->p_mgxapi->jobj_main_list[jobj_no].oid), baton->p_mgxapi->jobj_main_list[jobj_no].oid_value);
-               bson_append_oid(bobj, baton->p_mgxapi->jobj_main_list[jobj_no].oid_name, &(baton->p_mgxapi->jobj_main_list[jobj_no].oid));
-            }
-            if (!strcmp(name, baton->p_mgxapi->jobj_main_list[jobj_no].oid_name) && !MGX_GET(jobj, name_str)->IsString()) { /* _id but wrong type */
-               /* bson_append_new_oid(baton->p_mgxapi->bobj_main, baton->p_mgxapi->oid_name); */
-               bson_oid_gen(&(baton->p_mgxapi->jobj_main_list[jobj_no].oid));
-               bson_oid_to_string(&(baton->p_mgxapi->jobj_main_list[jobj_no].oid), baton->p_mgxapi->jobj_main_list[jobj_no].oid_value);
-               bson_append_oid(bobj, baton->p_mgxapi->jobj_main_list[jobj_no].oid_name, &(baton->p_mgxapi->jobj_main_list[jobj_no].oid));
+      return 0;
+   }
 
-               mgx_free((void *) name, 21);
-               name = NULL;
 
-               continue;
-            }
-         }
+   static int mongox_coalesce_flush_all(server *s)
+   {
+      mongo_baton_t *baton, *baton_next;
 
-         if (MGX_GET(jobj, name_str)->IsArray()) {
-            ret = bson_append_start_array(bobj, name);
-            Local<Array> a = Local<Array>::Cast(MGX_GET(jobj, name_str));
-            baton->p_mgxapi->level ++;
-            mongox_parse_json_array(s, (mongo_baton_t *) baton, a, name, bobj, jobj_no, MGX_JSON_ARRAY, context);
-            baton->p_mgxapi->level --;
+      if (s->p_coalesce_timer) {
+         uv_timer_stop(s->p_coalesce_timer);
+      }
+      baton = s->p_coalesce_head;
+      s->p_coalesce_head = NULL;
+      while (baton) {
+         baton_next = baton->p_next;
+         baton->p_next = NULL;
+         mongox_coalesce_flush(s, baton);
+         baton = baton_next;
+      }
 
-            bson_append_finish_array(bobj);
+      return 0;
+   }
 
-         }
-         else if (MGX_GET(jobj, name_str)->IsObject()) {
 
-            jobj_next = MGX_TOOBJECT(MGX_GET(jobj, name_str));
+   static void mongox_coalesce_timeout(uv_timer_t *timer)
+   {
+      mongox_coalesce_flush_all((server *) timer->data);
+   }
 
-            bobj_next = mgx_bson_alloc(baton->p_mgxapi, 1, 0);
 
-            baton->p_mgxapi->level ++;
-            mongox_parse_json_object(s, (mongo_baton_t *) baton, jobj_next, name, bobj_next, jobj_no, MGX_JSON_OBJECT, context);
-            baton->p_mgxapi->level --;
-            ret = bson_finish(bobj_next);
+   static void mongox_timer_closed(uv_handle_t *handle)
+   {
+      mgx_free((void *) handle, 205);
+   }
 
-            ret = bson_append_bson(bobj, name, bobj_next);
 
+   /* Complete each insert() call of a coalesced group with the outcome of its own document */
+   static void mongox_invoke_coalesced(uv_work_t *req, int status)
+   {
+      int n, failed_all;
+      mongo_baton_t *baton = static_cast<mongo_baton_t *>(req->data);
+      mongo_baton_t *p_next, *p_follow;
+      mongo_bulk_op *op;
+      MGXAPI *p_mgxapi;
+      uv_work_t *_req;
+
+      p_mgxapi = baton->p_mgxapi;
+      p_mgxapi->context = MGX_METHOD_INSERT;
+      p_mgxapi->output_integer = 0;
+      p_follow = baton->p_coalesced;
+      baton->p_coalesced = NULL;
+
+      /* Taken before the loop: the first call's own outcome is written to the same MGXAPI */
+      failed_all = (p_mgxapi->error[0] != '\0');
+      p_next = baton;
+      for (n = 0; n < p_mgxapi->bobj_main_list_no; n ++) {
+         op = &(p_mgxapi->bulk_ops[n]);
+         if (failed_all) { /* the write as a whole failed */
+            if (p_next != baton) {
+               strcpy(p_next->p_mgxapi->error, p_mgxapi->error);
+               p_next->p_mgxapi->error_code = p_mgxapi->error_code;
+            }
          }
-         else if (MGX_GET(jobj, name_str)->IsUint32()) {
-            uint32_t uint32 = MGX_TOUINT32(MGX_GET(jobj, name_str));
-            ret = bson_append_int(bobj, name, uint32);
-         }
-         else if (MGX_GET(jobj, name_str)->IsInt32()) {
-            int32_t int32 = MGX_TOINT32(MGX_GET(jobj, name_str));
-            ret = bson_append_int(bobj, name, int32);
+         else if (op->err) {
+            strcpy(p_next->p_mgxapi->error, op->err == MONGO_BULK_NOT_EXECUTED ? "Not executed" : op->errstr);
+            p_next->p_mgxapi->error_code = op->err;
          }
-         else if (MGX_GET(jobj, name_str)->IsNumber()) {
+         p_next = n ? p_next->p_next : p_follow;
+      }
 
-            double num = MGX_TONUMBER(MGX_GET(jobj, name_str));
+      mongox_invoke_callback(req, status);
 
-            ret = bson_append_double(bobj, name, num);
-         }
-         else {
+      while (p_follow) {
+         p_next = p_follow->p_next;
+         p_follow->p_next = NULL;
+         p_follow->s->m_count += p_follow->increment_by;
+         _req = new uv_work_t;
+         _req->data = p_follow;
+         mongox_invoke_callback(_req, 0);
+         p_follow = p_next;
+      }
+   }
 
-            value_str = MGX_TOSTRING(MGX_GET(jobj, name_str));
 
-            value_len = mongox_string8_length(isolate, value_str, 1);
+   /* v1.5.17 */
+   static uv_loop_t * mongox_event_loop(mongo_baton_t *baton)
+   {
+#if MGX_NODE_VERSION >= 120000
+      return GetCurrentEventLoop(baton->isolate);
+#else
+      return uv_default_loop();
+#endif
+   }
 
-            value = (char *) mgx_malloc(sizeof(char) * (value_len + 25), 2002);
-            *value = '\0';
 
-            mongox_write_char8(isolate, value_str, value, value_len, 1);
+   /*
+      v1.5.17
+      Connection pool for asynchronous operations.  The pool (and the queue of operations waiting
+      for a connection) is only ever manipulated in the main (event loop) thread.  A connection
+      checked out here is used exclusively by one operation in the thread pool and is returned
+      in mongox_invoke_callback once the result has been processed.  New connections are
+      established lazily in the worker thread (see mongox_pool_connect).
+   */
+   static int mongox_pool_required(int context)
+   {
+      switch (context) {
+         case MGX_METHOD_RETRIEVE:
+         case MGX_METHOD_INSERT:
+         case MGX_METHOD_INSERT_BATCH:
+         case MGX_METHOD_BULK_WRITE:
+         case MGX_METHOD_UPDATE:
+         case MGX_METHOD_REMOVE:
+         case MGX_METHOD_COMMAND:
+         case MGX_METHOD_CREATE_INDEX:
+         case MGX_METHOD_CURSOR_NEXT:
+            return 1;
+         default:
+            return 0;
+      }
+   }
 
-            if (!strcmp(name, baton->p_mgxapi->jobj_main_list[jobj_no].oid_name)) {
 
-               ret = s->mongox_is_object_id(s, baton, value, &(baton->p_mgxapi->jobj_main_list[jobj_no].oid));
-               if (ret) {
-                  if (n == 0 && (baton->p_mgxapi->context == MGX_METHOD_INSERT || baton->p_mgxapi->context == MGX_METHOD_INSERT_BATCH) && baton->p_mgxapi->level == 0) { /* bad _id passed to insert */
-                     /* bson_append_new_oid(baton->p_mgxapi->bobj_main, baton->p_mgxapi->oid_name); */
-                     bson_oid_gen(&(baton->p_mgxapi->jobj_main_list[jobj_no].oid));
-                     bson_oid_to_string(&(baton->p_mgxapi->jobj_main_list[jobj_no].oid), value);
-                  }
-               }
-               strcpy(baton->p_mgxapi->jobj_main_list[jobj_no].oid_value, value);
-               /* bson_oid_from_string(&(baton->p_mgxapi->oid), value); */
-               ret = bson_append_oid(bobj, name, &(baton->p_mgxapi->jobj_main_list[jobj_no].oid));
+   static MGXCONN * mongox_pool_checkout(server *s, int context)
+   {
+      MGXCONN *p_conn, *p_idle, *p_shared;
+
+      p_idle = NULL;
+      p_shared = NULL;
+      for (p_conn = s->p_pool; p_conn; p_conn = p_conn->p_next) {
+         if (!p_conn->in_use) {
+            if (p_conn->connected) {
+               p_idle = p_conn;
+               break;
             }
-            else {
-               ret = bson_append_string(bobj, name, value);
+            if (!p_idle) {
+               p_idle = p_conn;
             }
-
-            mgx_free((void *) value, 21);
-            value = NULL;
          }
+         else if (mongox_pool_shareable(s, p_conn, context) && (!p_shared || p_conn->in_use < p_shared->in_use)) {
+            p_shared = p_conn;
+         }
+      }
+      if (p_idle) {
+         p_idle->in_use = 1;
+         return p_idle;
+      }
 
-         mgx_free((void *) name, 21);
-         name = NULL;
+      if (s->pool_size >= s->pool_max) {
+         if (p_shared) {
+            /* Pipeline the request behind those already in flight on the least busy connection */
+            p_shared->in_use ++;
+         }
+         return p_shared;
+      }
 
+      p_conn = (MGXCONN *) mgx_malloc(sizeof(MGXCONN), 201);
+      if (!p_conn) {
+         return NULL;
       }
-      return 0;
+      memset((void *) p_conn, 0, sizeof(MGXCONN));
+      p_conn->in_use = 1;
+      p_conn->connected = 0;
+      p_conn->generation = s->pool_generation;
+      p_conn->last_used = time(NULL);
+      p_conn->p_next = s->p_pool;
+      s->p_pool = p_conn;
+      s->pool_size ++;
+
+      return p_conn;
    }
 
 
- static int mongox_parse_json_array(server *s, mongo_baton_t * baton, Local<Array> jarray, char *jobj_name, bson *bobj, int jobj_no, int type, int context)
+   /* v1.5.17 */
+   /* Event loop requests may share a connection (up to MGX_POOL_PIPELINE_DEPTH at a time) once it is connected and being polled */
+   static int mongox_pool_shareable(server *s, MGXCONN *p_conn, int context)
    {
-      Isolate* isolate = Isolate::GetCurrent();
-#if MGX_NODE_VERSION >= 100000
-      Local<Context> icontext = isolate->GetCurrentContext();
-#endif
-      HandleScope scope(isolate);
-      unsigned int n, value_len, an;
-      char *name, *value;
-      char subs[32];
-      Local<Array> a;
-      Local<String> name_str;
-      Local<String> value_str;
-      Local<Object> jobj_next;
-      bson *bobj_next;
+      return (p_conn->in_use < MGX_POOL_PIPELINE_DEPTH && p_conn->p_io && p_conn->mongo_connection.connected && mongox_loop_supported(s, context));
+   }
 
-      an = 0;
 
-      a = Local<Array>::Cast(jarray);
+   static int mongox_pool_release(server *s, MGXCONN *p_conn)
+   {
+      int err;
+      time_t now;
+      mongo_baton_t *baton;
+
+      /* v1.5.17 */
+      p_conn->in_use --;
+      if (p_conn->in_use > 0) {
+         /* Still in use by other (pipelined) requests: it may take on the next request waiting for a connection */
+         baton = s->p_pending_head;
+         if (baton && (s->open || baton->coalesced_flushed) && mongox_pool_shareable(s, p_conn, baton->p_mgxapi->context)) {
+            s->p_pending_head = baton->p_next;
+            if (!s->p_pending_head) {
+               s->p_pending_tail = NULL;
+            }
+            baton->p_next = NULL;
+            baton->p_conn = p_conn;
+            p_conn->in_use ++;
+            mongox_queue_work(baton);
+         }
+         return 0;
+      }
 
-      for (n = 0, an = 0; n < a->Length(); n ++, an ++) {
+      if (p_conn->connected) {
+         err = p_conn->mongo_connection.err;
+         if (!p_conn->mongo_connection.connected || err == MONGO_IO_ERROR || err == MONGO_SOCKET_ERROR || err == MONGO_READ_SIZE_ERROR || p_conn->generation != s->pool_generation) {
+            mongox_pool_disconnect(p_conn);
+         }
+      }
+      p_conn->generation = s->pool_generation;
 
-         name = subs;
-         sprintf(name, "%d", an);
+      now = time(NULL);
+      p_conn->last_used = now;
 
-         if (MGX_GET(jarray, n)->IsArray()) {
-            bson_append_start_array(bobj, name);
+      if (s->p_pending_head && (s->open || s->p_pending_head->coalesced_flushed)) {
+         /* Hand the connection straight to the next operation waiting for one */
+         baton = s->p_pending_head;
+         s->p_pending_head = baton->p_next;
+         if (!s->p_pending_head) {
+            s->p_pending_tail = NULL;
+         }
+         baton->p_next = NULL;
+         baton->p_conn = p_conn;
+         p_conn->in_use = 1;
+         mongox_queue_work(baton);
+         return 0;
+      }
 
-            Local<Array> a = Local<Array>::Cast(MGX_GET(jarray, n));
-            baton->p_mgxapi->level ++;
-            mongox_parse_json_object(s, (mongo_baton_t *) baton, a, name, bobj, jobj_no, MGX_JSON_ARRAY, context);
-            baton->p_mgxapi->level --;
+      if (!s->open) {
+         mongox_pool_close(s);
+         return 0;
+      }
 
-            bson_append_finish_array(bobj);
+      mongox_pool_prune(s, now);
 
-         }
-         else if (MGX_GET(jarray, n)->IsObject()) {
+      return 0;
+   }
 
-            jobj_next = MGX_TOOBJECT(MGX_GET(jarray, n));
 
-            bobj_next = mgx_bson_alloc(baton->p_mgxapi, 1, 0);
+   /* Close connections that have been idle for longer than idle_timeout, keeping at least min_connections */
+   static int mongox_pool_prune(server *s, time_t now)
+   {
+      MGXCONN *p_conn, *p_prev, *p_next;
+
+      if (s->pool_idle_timeout > 0) {
+         p_prev = NULL;
+         for (p_conn = s->p_pool; p_conn; p_conn = p_next) {
+            p_next = p_conn->p_next;
+            if (s->pool_size > s->pool_min && !p_conn->in_use && (now - p_conn->last_used) > s->pool_idle_timeout) {
+               if (p_conn->connected) {
+                  mongox_pool_disconnect(p_conn);
+               }
+               if (p_prev) {
+                  p_prev->p_next = p_next;
+               }
+               else {
+                  s->p_pool = p_next;
+               }
+               mgx_free((void *) p_conn, 201);
+               s->pool_size --;
+               continue;
+            }
+            p_prev = p_conn;
+         }
+      }
 
-            baton->p_mgxapi->level ++;
-            mongox_parse_json_object(s, (mongo_baton_t *) baton, jobj_next, name, bobj_next, jobj_no, MGX_JSON_OBJECT, context);
-            baton->p_mgxapi->level --;
-            bson_finish(bobj_next);
+      return 0;
+   }
 
-            bson_append_bson(bobj, name, bobj_next);
 
-         }
-         else if (MGX_GET(jarray, n)->IsUint32()) {
-            uint32_t uint32 = MGX_TOUINT32(MGX_GET(jarray, n));
+   /* Start (or re-time) the unreferenced timer that prunes idle connections once per idle_timeout period */
+   static int mongox_pool_timer(mongo_baton_t *baton)
+   {
+      uint64_t interval;
+      server *s = baton->s;
 
-            bson_append_int(bobj, name, uint32);
+      if (s->pool_idle_timeout <= 0) {
+         if (s->p_idle_timer) {
+            uv_timer_stop(s->p_idle_timer);
          }
-         else if (MGX_GET(jarray, n)->IsInt32()) {
-            int32_t int32 = MGX_TOINT32(MGX_GET(jarray, n));
+         return 0;
+      }
+      interval = (uint64_t) s->pool_idle_timeout * 1000;
 
-            bson_append_int(bobj, name, int32);
+      if (!s->p_idle_timer) {
+         s->p_idle_timer = (uv_timer_t *) mgx_malloc(sizeof(uv_timer_t), 205);
+         if (!s->p_idle_timer) {
+            return 0;
          }
-         else if (MGX_GET(jarray, n)->IsNumber()) {
-            double num = MGX_TONUMBER(MGX_GET(jarray, n));
+         uv_timer_init(mongox_event_loop(baton), s->p_idle_timer);
+         s->p_idle_timer->data = (void *) s;
+         uv_unref((uv_handle_t *) s->p_idle_timer);
+      }
+      if (!uv_is_active((uv_handle_t *) s->p_idle_timer) || uv_timer_get_repeat(s->p_idle_timer) != interval) {
+         uv_timer_start(s->p_idle_timer, mongox_pool_idle, interval, interval);
+      }
+
+      return 0;
+   }
 
-            bson_append_double(bobj, name, num);
-         }
-         else {
 
-            value_str = MGX_TOSTRING(MGX_GET(jarray, n));
+   static void mongox_pool_idle(uv_timer_t *timer)
+   {
+      server *s = (server *) timer->data;
 
-            value_len = mongox_string8_length(isolate, value_str, 1);
+      if (s->open) {
+         mongox_pool_prune(s, time(NULL));
+      }
+   }
 
-            value = (char *) mgx_malloc(sizeof(char) * (value_len + 1), 2002);
-            *value = '\0';
 
-            mongox_write_char8(isolate, value_str, value, value_len, 1);
+   static int mongox_pool_close(server *s)
+   {
+      mongo_baton_t *baton, *baton_next;
+      MGXCONN *p_conn, *p_prev, *p_next;
+
+      /*
+         Operations still waiting for a connection are completed with an error, except for coalesced
+         insert() calls (flushed by close() itself): these were accepted while the server was open,
+         so they keep their place and are written as the connections in use are returned.
+      */
+      baton = s->p_pending_head;
+      s->p_pending_head = NULL;
+      s->p_pending_tail = NULL;
+      while (baton) {
+         baton_next = baton->p_next;
+         baton->p_next = NULL;
+         if (baton->coalesced_flushed) {
+            if (s->p_pending_tail) {
+               s->p_pending_tail->p_next = baton;
+            }
+            else {
+               s->p_pending_head = baton;
+            }
+            s->p_pending_tail = baton;
+         }
+         else {
+            strcpy(baton->p_mgxapi->error, "Connection not established to Mongo Database");
+            mongox_queue_work(baton);
+         }
+         baton = baton_next;
+      }
 
-            bson_append_string(bobj, name, value);
+      /* Connections in use are closed when they are returned to the pool */
+      p_prev = NULL;
+      for (p_conn = s->p_pool; p_conn; p_conn = p_next) {
+         p_next = p_conn->p_next;
+         if (p_conn->in_use) {
+            p_prev = p_conn;
+            continue;
+         }
+         if (p_conn->connected) {
+            mongox_pool_disconnect(p_conn);
          }
+         if (p_prev) {
+            p_prev->p_next = p_next;
+         }
+         else {
+            s->p_pool = p_next;
+         }
+         mgx_free((void *) p_conn, 201);
+         s->pool_size --;
+      }
+      s->pool_generation ++;
+
+      /* No connection is left to be returned: take one for the first of them */
+      while (s->p_pending_head && !s->p_pool) {
+         baton = s->p_pending_head;
+         s->p_pending_head = baton->p_next;
+         if (!s->p_pending_head) {
+            s->p_pending_tail = NULL;
+         }
+         baton->p_next = NULL;
+         baton->p_conn = mongox_pool_checkout(s, baton->p_mgxapi->context);
+         if (!baton->p_conn) {
+            strcpy(baton->p_mgxapi->error, "Connection not established to Mongo Database");
+         }
+         mongox_queue_work(baton);
       }
+
       return 0;
    }
 
 
-
-   static int mongox_parse_bson_object(server *s, mongo_baton_t * baton, Local<Object> jobj, bson *bobj, bson_iterator *iterator, int context)
+   /* v1.5.17 */
+   static int mongox_pool_disconnect(MGXCONN *p_conn)
    {
-      Isolate* isolate = Isolate::GetCurrent();
-#if MGX_NODE_VERSION >= 100000
-      Local<Context> icontext = isolate->GetCurrentContext();
-#endif
-      EscapableHandleScope handle_scope(isolate);
-      int int32;
-      int64_t  int64;
-      char *value, *key;
-      char buffer[256];
-      Local<String> key_str;
-      Local<String> value_str;
-      Local<Object> jobj_next;
-      Local<Array> ja;
-      bson_iterator iterator_a;
-      bson_iterator iterator_o;
-      bson_type type;
+      if (p_conn->p_io) {
+         mongox_io_close(p_conn, NULL);
+      }
+      mongo_destroy(&(p_conn->mongo_connection));
+      p_conn->connected = 0;
 
-      if (bobj)
-         bson_iterator_init(iterator, bobj);
+      return 0;
+   }
 
-      while ((type = bson_iterator_next(iterator))) {
-         key = (char *) bson_iterator_key(iterator);
-         if (type == BSON_OID) {
 
-            bson_oid_to_string(bson_iterator_oid(iterator), buffer);
+#if MGX_NODE_VERSION >= 140800
+   /*
+      v1.5.17
+      The environment (main thread or worker) is being torn down, whether or not close() was called,
+      and its event loop is about to be closed: no handle of this server may be left open on it, and
+      the addon must stay loaded until operations still in the thread pool have come back.  The hook
+      is asynchronous so that Node keeps running the loop until all of that is done.  JavaScript can
+      no longer be called, so operations that can't complete now are dropped without their callbacks.
+   */
+   static void mongox_env_cleanup(void *arg, void (*done)(void *), void *done_arg)
+   {
+      int n;
+      server *s = (server *) arg;
+      mongo_baton_t *baton, *baton_next, *p_follow;
+      MGXCONN *p_conn;
 
-            key_str = mongox_new_string8(isolate, key, 1);
-            value_str = mongox_new_string8(isolate, buffer, 1);
-            MGX_SET(jobj, key_str, value_str);
+      s->open = 0;
+      s->env_teardown = 1;
+      s->env_done = done;
+      s->env_done_arg = done_arg;
+      s->env_closing = 1;
+
+      /* Coalesced insert() calls are dropped with the rest: whether still held back or flushed */
+      if (s->p_coalesce_timer) {
+         s->env_closing ++;
+         uv_close((uv_handle_t *) s->p_coalesce_timer, mongox_timer_env_closed);
+         s->p_coalesce_timer = NULL;
+      }
+      if (s->p_idle_timer) {
+         s->env_closing ++;
+         uv_close((uv_handle_t *) s->p_idle_timer, mongox_timer_env_closed);
+         s->p_idle_timer = NULL;
+      }
+      for (n = 0; n < 2; n ++) {
+         baton = (n == 0 ? s->p_coalesce_head : s->p_pending_head);
+         while (baton) {
+            baton_next = baton->p_next;
+            while ((p_follow = baton->p_coalesced)) {
+               baton->p_coalesced = p_follow->p_next;
+               mongox_discard_baton(p_follow);
+            }
+            mongox_discard_baton(baton);
+            baton = baton_next;
          }
-         else if (type == BSON_STRING) {
-            value = (char *) bson_iterator_string(iterator);
-
-            key_str = mongox_new_string8(isolate, key, 1);
-            value_str = mongox_new_string8(isolate, value, 1);
-            MGX_SET(jobj, key_str, value_str);
+      }
+      s->p_coalesce_head = NULL;
+      s->p_pending_head = NULL;
+      s->p_pending_tail = NULL;
+
+      /* Connections driven by the event loop are only ever used in this thread */
+      for (p_conn = s->p_pool; p_conn; p_conn = p_conn->p_next) {
+         if (p_conn->p_io) {
+            baton = NULL;
+            mongox_io_fail(p_conn, &baton);
+            s->env_closing ++;
+            mongox_io_close(p_conn, s);
+            mongo_destroy(&(p_conn->mongo_connection));
+            p_conn->connected = 0;
+            p_conn->in_use = 0;
+            while (baton) {
+               baton_next = baton->p_next;
+               mongox_discard_baton(baton);
+               baton = baton_next;
+            }
          }
-         else if (type == BSON_INT) {
-            int32 = (int) bson_iterator_int(iterator);
+      }
+      mongox_pool_close(s);
 
-            key_str = mongox_new_string8(isolate, key, 1);
+      if (s->work_pending > 0) {
+         s->env_closing ++;
+         s->env_work_wait = 1;
+      }
 
-            MGX_SET(jobj, key_str, MGX_INTEGER_NEW(int32));
-         }
-         else if (type == BSON_LONG) {
-            int64 = (int64_t) bson_iterator_long(iterator);
+      mongox_env_closed(s);
+      return;
+   }
 
-            key_str = mongox_new_string8(isolate, key, 1);
 
-            MGX_SET(jobj, key_str, MGX_NUMBER_NEW((double ) int64));
+   /* Release an operation that will never be completed (nothing is unreferenced: the environment is going) */
+   static int mongox_discard_baton(mongo_baton_t *baton)
+   {
+      baton->cb.Reset();
+      baton->resolver.Reset();
 
-         }
-         else if (type == BSON_DOUBLE) {
-            double num = (double) bson_iterator_double(iterator);
+      return mongox_destroy_baton(baton);
+   }
 
-            key_str = mongox_new_string8(isolate, key, 1);
 
-            MGX_SET(jobj, key_str, MGX_NUMBER_NEW(num));
-         }
-         else if (type == BSON_BOOL) {
-            bson_bool_t num = (bson_bool_t) bson_iterator_bool(iterator);
+   static void mongox_timer_env_closed(uv_handle_t *handle)
+   {
+      server *s = (server *) handle->data;
 
-            key_str = mongox_new_string8(isolate, key, 1);
+      mgx_free((void *) handle, 205);
+      mongox_env_closed(s);
+   }
 
-            MGX_SET(jobj, key_str, MGX_BOOLEAN_NEW(num ? true : false));
-         }
-         else if (type == BSON_NULL) {
-/*
-            bson_bool_t num = (bson_bool_t) bson_iterator_bool(iterator);
-*/
-            key_str = mongox_new_string8(isolate, key, 1);
 
-            MGX_SET(jobj, key_str, MGX_NULL());
-         }
-         else if (type == BSON_DATE) {
+   static void mongox_env_closed(server *s)
+   {
+      s->env_closing --;
+      if (s->env_closing == 0 && s->env_done) {
+         s->env_done(s->env_done_arg);
+         s->env_done = NULL;
+      }
+   }
+#endif
 
-            bson_date_t num = (bson_date_t) bson_iterator_date(iterator);
 
-            key_str = mongox_new_string8(isolate, key, 1);
+   /* An operation queued through mongox_queue_task has been completed (or dropped) */
+   static void mongox_work_done(server *s)
+   {
+      s->work_pending --;
+#if MGX_NODE_VERSION >= 140800
+      if (s->work_pending == 0 && s->env_work_wait) {
+         s->env_work_wait = 0;
+         mongox_env_closed(s);
+      }
+#endif
+   }
 
-            MGX_SET(jobj, key_str, MGX_DATE((double) num));
-         }
-         else if (type == BSON_ARRAY) {
-            ja = MGX_ARRAY_NEW(0);
 
-            key_str = mongox_new_string8(isolate, key, 1);
-            MGX_SET(jobj, key_str, ja);
+   /* JavaScript can no longer be called once the environment is being torn down (worker exit) */
+   static int mongox_env_stopping(Isolate *isolate, server *s)
+   {
+#if MGX_NODE_VERSION >= 140800
+      return (s->env_teardown || isolate->IsExecutionTerminating());
+#else
+      return 0;
+#endif
+   }
 
-            bson_iterator_subiterator(iterator, &iterator_a);
 
-            mongox_parse_bson_array(s, baton, ja, key, NULL, &iterator_a, context);
-         }
-         else if (type == BSON_OBJECT) {
-            bson_iterator_subiterator(iterator, &iterator_o);
-            jobj_next = MGX_OBJECT_NEW();
+   /*
+      v1.5.17
+      Event loop transport (open() option transport: "event_loop").  Pooled connections are switched
+      to non-blocking mode and driven by a uv_poll_t handle on the isolate's event loop, so operations
+      that only need a request/reply exchange with the server don't occupy a thread pool worker while
+      they wait for the network.  Outgoing messages are queued on the connection and written as the
+      socket accepts them; replies are parsed incrementally as bytes arrive.  Requests are completed
+      through their usual after-work callback once their last message has been written and their
+      last reply processed.  Everything here runs in the main (event loop) thread.
+      New connections are still established in the thread pool (mongo_client() blocks), as are
+      create_index() calls and the operations of the primary (synchronous) connection.
+   */
+   static int mongox_loop_supported(server *s, int context)
+   {
+      if (s->transport != MGX_TRANSPORT_EVENT_LOOP) {
+         return 0;
+      }
+      switch (context) {
+         case MGX_METHOD_RETRIEVE:
+         case MGX_METHOD_INSERT:
+         case MGX_METHOD_INSERT_BATCH:
+         case MGX_METHOD_UPDATE:
+         case MGX_METHOD_REMOVE:
+         case MGX_METHOD_COMMAND:
+         case MGX_METHOD_CURSOR_NEXT:
+            return 1;
+         default:
+            return 0;
+      }
+   }
 
-            key_str = mongox_new_string8(isolate, key, 1);
-            MGX_SET(jobj, key_str, jobj_next);
 
-            mongox_parse_bson_object(s, baton, jobj_next, (bson *) NULL, &iterator_o, 1);
-         }
-         else {
-            sprintf(buffer, "BSON Type: %d", type);
-            key_str = mongox_new_string8(isolate, key, 1);
-            value_str = mongox_new_string8(isolate, buffer, 1);
-            MGX_SET(jobj, key_str, value_str);
+   static int mongox_loop_start(mongo_baton_t *baton)
+   {
+      uv_work_t *_req;
 
-         }
+      if (!baton->p_conn->connected) {
+         _req = new uv_work_t;
+         _req->data = baton;
+         uv_queue_work(mongox_event_loop(baton), _req, EIO_Loop_Connect, mongox_loop_connected);
+         return 0;
       }
 
-      return 1;
+      return mongox_loop_begin(baton);
+   }
+
+
+   static void EIO_Loop_Connect(uv_work_t *req)
+   {
+      mongo_baton_t *baton = static_cast<mongo_baton_t *>(req->data);
+
+      baton->s->mongox_pool_connect(baton->s, baton);
 
+      return;
    }
 
 
-   static int mongox_parse_bson_array(server *s, mongo_baton_t * baton, Local<Array> jarray, char *jobj_name, bson *bobj, bson_iterator *iterator, int context)
+   static void EIO_Loop_Done(uv_work_t *req)
    {
-      Isolate* isolate = Isolate::GetCurrent();
-#if MGX_NODE_VERSION >= 100000
-      Local<Context> icontext = isolate->GetCurrentContext();
-#endif
-      EscapableHandleScope handle_scope(isolate);
-      int int32;
-      int64_t  int64;
-      unsigned int an;
-      char *value;
-      char buffer[256];
-      Local<String> key_str;
-      Local<String> value_str;
-      Local<Object> jobj_next;
-      Local<Array> ja;
-      bson_iterator iterator_a;
-      bson_iterator iterator_o;
-      bson_type type;
+      return;
+   }
 
-      an = 0;
-      while ((type = bson_iterator_next(iterator))) {
 
-         if (type == BSON_OID) {
-            bson_oid_to_string(bson_iterator_oid(iterator), buffer);
-            value_str = mongox_new_string8(isolate, buffer, 1);
-            MGX_SET(jarray, an, value_str);
-         }
-         else if (type == BSON_STRING) {
-            value = (char *) bson_iterator_string(iterator);
+   static void mongox_loop_connected(uv_work_t *req, int status)
+   {
+      mongo_baton_t *baton = static_cast<mongo_baton_t *>(req->data);
 
-            value_str = mongox_new_string8(isolate, value, 1);
-            MGX_SET(jarray, an, value_str);
-         }
-         else if (type == BSON_INT) {
-            int32 = (int) bson_iterator_int(iterator);
+      if (baton->p_mgxapi->error[0] || mongox_env_stopping(Isolate::GetCurrent(), baton->s)) {
+         ((uv_after_work_cb) baton->after_work_cb)(req, status);
+         return;
+      }
 
-            MGX_SET(jarray, an, MGX_INTEGER_NEW(int32));
-         }
-         else if (type == BSON_LONG) {
-            int64 = (int64_t) bson_iterator_long(iterator);
+      delete req;
+      mongox_loop_begin(baton);
 
-            MGX_SET(jarray, an, MGX_NUMBER_NEW((double) int64));
-         }
-         else if (type == BSON_DOUBLE) {
-            double num = (double) bson_iterator_double(iterator);
+      return;
+   }
 
-            MGX_SET(jarray, an, MGX_NUMBER_NEW(num));
-         }
-         else if (type == BSON_BOOL) {
-            bson_bool_t num = (bson_bool_t) bson_iterator_bool(iterator);
 
-            MGX_SET(jarray, an, MGX_BOOLEAN_NEW(num ? true : false));
-         }
-         else if (type == BSON_NULL) {
-/*
-            bson_bool_t num = (bson_bool_t) bson_iterator_bool(iterator);
-*/
-            MGX_SET(jarray, an, MGX_NULL());
-         }
-         else if (type == BSON_DATE) {
-            bson_date_t num = (bson_date_t) bson_iterator_date(iterator);
+   /* Build and queue the request's first message(s): never completes the request in line with the caller */
+   static int mongox_loop_begin(mongo_baton_t *baton)
+   {
+      int ret;
+      char ns[160];
+      server *s;
+      mongo *conn;
+      mongo_message_vec mv;
+      mongo_cursor *cursor;
+      MGXCONN *p_conn;
+      MGXAPI *p_mgxapi;
+      mongo_baton_t *p_done;
+      uv_work_t *_req;
+
+      s = baton->s;
+      p_conn = baton->p_conn;
+      p_mgxapi = baton->p_mgxapi;
+      conn = &(p_conn->mongo_connection);
+
+      if (mongox_io_attach(p_conn, baton) != MONGO_OK) {
+         s->mongox_error_message(s, baton);
+      }
+      else {
+         mongo_clear_errors(conn);
+
+         switch (p_mgxapi->context) {
+            case MGX_METHOD_RETRIEVE:
+            case MGX_METHOD_COMMAND:
+               cursor = mongo_cursor_alloc();
+               if (p_mgxapi->context == MGX_METHOD_COMMAND) {
+                  sprintf(ns, "%s.$cmd", p_mgxapi->file_name);
+                  mongo_cursor_init(cursor, conn, ns);
+                  mongo_cursor_set_query(cursor, p_mgxapi->bobj_ref);
+                  mongo_cursor_set_limit(cursor, 1);
+               }
+               else {
+                  mongo_cursor_init(cursor, conn, p_mgxapi->file_name);
+                  mongo_cursor_set_query(cursor, p_mgxapi->bobj_ref);
+                  mongo_cursor_set_fields(cursor, p_mgxapi->bobj_fields);
+                  mongo_cursor_set_limit(cursor, p_mgxapi->limit);
+                  mongo_cursor_set_skip(cursor, p_mgxapi->skip);
+                  mongo_cursor_set_options(cursor, p_mgxapi->options);
+               }
+               cursor->flags |= MONGO_CURSOR_MUST_FREE;
+               p_mgxapi->cursor = cursor;
+               mongox_loop_cursor_send(baton, cursor);
+               break;
+            case MGX_METHOD_CURSOR_NEXT:
+               cursor = p_mgxapi->cursor;
+               if (!cursor) {
+                  break;
+               }
+               /* The server-side cursor is not tied to a connection so each batch may be fetched through a different one */
+               cursor->conn = conn;
+               if (!mongox_loop_cursor_send(baton, cursor) && !p_mgxapi->error[0]) {
+                  mongox_io_kill_cursor(p_conn, cursor); /* exhausted */
+                  p_mgxapi->cursor = NULL;
+               }
+               break;
+            default:
+               if (p_mgxapi->context == MGX_METHOD_INSERT)
+                  ret = mongo_insert_message(conn, p_mgxapi->file_name, (const bson **) &(p_mgxapi->bobj_main), 1, 0, &mv);
+               else if (p_mgxapi->context == MGX_METHOD_INSERT_BATCH) {
+                  mongox_loop_insert_send(baton); /* v1.5.17 */
+                  break;
+               }
+               else if (p_mgxapi->context == MGX_METHOD_UPDATE)
+                  ret = mongo_update_message(conn, p_mgxapi->file_name, p_mgxapi->bobj_ref, p_mgxapi->bobj_main, MONGO_UPDATE_BASIC, &mv);
+               else
+                  ret = mongo_remove_message(conn, p_mgxapi->file_name, p_mgxapi->bobj_ref, &mv);
+               if (ret != MONGO_OK) {
+                  s->mongox_error_message(s, baton);
+                  break;
+               }
+               /* A write command (OP_MSG) is itself acknowledged: there is then no getlasterror query */
+               mongox_io_send(p_conn, &mv, baton, mv.reply);
 
-            MGX_SET(jarray, an, MGX_DATE((double) num));
+               ret = mongo_write_concern_message(conn, p_mgxapi->file_name, NULL, &mv);
+               if (ret != MONGO_OK) {
+                  s->mongox_error_message(s, baton);
+               }
+               else if (mv.len) {
+                  mongox_io_send(p_conn, &mv, baton, 1);
+               }
+               break;
          }
-         else if (type == BSON_ARRAY) {
-            ja = MGX_ARRAY_NEW(0);
-            MGX_SET(jarray, an, ja);
+         mongox_io_update(p_conn);
+      }
 
-            bson_iterator_subiterator(iterator, &iterator_a);
+      if (baton->io_pending == 0) {
+         /* Nothing to wait for (typically an error): complete through the thread pool so that the callback is not fired synchronously */
+         p_done = NULL;
+         mongox_loop_done(baton, &p_done);
+         baton->p_next = NULL;
+         _req = new uv_work_t;
+         _req->data = baton;
+         uv_queue_work(mongox_event_loop(baton), _req, EIO_Loop_Done, (uv_after_work_cb) baton->after_work_cb);
+      }
 
-            mongox_parse_bson_array(s, baton, ja, jobj_name, NULL, &iterator_a, context);
+      return 0;
+   }
 
-         }
-         else if (type == BSON_OBJECT) {
-            bson_iterator_subiterator(iterator, &iterator_o);
-            jobj_next = MGX_OBJECT_NEW();
 
-            MGX_SET(jarray, an, jobj_next);
+   /*
+      v1.5.17
+      Queue the messages for insert_batch(), split to suit the server's limits.  If the batch is
+      ordered and acknowledged, only the next message is queued: the one after it is queued when
+      its reply arrives (see mongox_loop_reply), so that the batch stops at the first failure.
+   */
+   static int mongox_loop_insert_send(mongo_baton_t *baton)
+   {
+      int n;
+      short reply;
+      mongo *conn;
+      mongo_message_vec mv;
+      MGXAPI *p_mgxapi;
+      const bson **bsons;
+
+      p_mgxapi = baton->p_mgxapi;
+      conn = &(baton->p_conn->mongo_connection);
+
+      while (p_mgxapi->batch_sent < p_mgxapi->bobj_main_list_no) {
+         bsons = (const bson **) p_mgxapi->bobj_main_list + p_mgxapi->batch_sent;
+         n = mongo_insert_batch_split(conn, bsons, p_mgxapi->bobj_main_list_no - p_mgxapi->batch_sent);
+         if (n == MONGO_ERROR || mongo_insert_message(conn, p_mgxapi->file_name, bsons, n, p_mgxapi->options, &mv) != MONGO_OK) {
+            baton->s->mongox_error_message(baton->s, baton);
+            return -1;
+         }
+         p_mgxapi->batch_sent += n;
+         reply = mv.reply;
+         mongox_io_send(baton->p_conn, &mv, baton, mv.reply);
 
-            mongox_parse_bson_object(s, baton, jobj_next, (bson *) NULL, &iterator_o, 1);
+         if (mongo_write_concern_message(conn, p_mgxapi->file_name, NULL, &mv) != MONGO_OK) {
+            baton->s->mongox_error_message(baton->s, baton);
+            return -1;
          }
-         else {
-            sprintf(buffer, "BSON Type: %d", type);
-            value_str = mongox_new_string8(isolate, buffer, 1);
-            MGX_SET(jarray, an, value_str);
+         if (mv.len) {
+            reply = 1;
+            mongox_io_send(baton->p_conn, &mv, baton, 1);
+         }
+         if (reply && !(p_mgxapi->options & MONGO_CONTINUE_ON_ERROR)) {
+            break;
          }
-         an ++;
       }
-      return 1;
+
+      return 0;
    }
 
 
-   static int mongox_destroy_baton(mongo_baton_t *baton)
+   /* Queue the message for the cursor's next batch: returns 0 if there is none (or on error) */
+   static int mongox_loop_cursor_send(mongo_baton_t *baton, mongo_cursor *cursor)
    {
+      mongo_message_vec mv;
 
-      mgx_bson_free(baton->p_mgxapi);
+      if (mongo_cursor_message(cursor, &mv) != MONGO_OK) {
+         if (cursor->conn->err != MONGO_CONN_SUCCESS) {
+            baton->s->mongox_error_message(baton->s, baton);
+         }
+         return 0;
+      }
+      mongox_io_send(baton->p_conn, &mv, baton, 1);
 
-      if (baton->p_mgxapi) {
+      return 1;
+   }
 
-         if (baton->p_mgxapi->output) {
-            mgx_free((void *) baton->p_mgxapi->output, 706);
-         }
-         if (baton->p_mgxapi->bobj_main_list) {
-            mgx_free((void *) baton->p_mgxapi->bobj_main_list, 706);
-         }
-         if (baton->p_mgxapi->jobj_main_list) {
-            mgx_free((void *) baton->p_mgxapi->jobj_main_list, 706);
-         }
 
-         mgx_free((void *) baton->p_mgxapi, 706);
+   /* Process the reply to the request's last message */
+   static int mongox_loop_reply(mongo_baton_t *baton, mongo_reply *reply)
+   {
+      int ret;
+      server *s;
+      mongo *conn;
+      mongo_cursor *cursor;
+      mongo_reply *batch;
+      MGXAPI *p_mgxapi;
+      bson temp;
+      bson_iterator it;
+
+      s = baton->s;
+      p_mgxapi = baton->p_mgxapi;
+      conn = &(baton->p_conn->mongo_connection);
+      /* Requests pipelined on the connection share its error state: don't let one reply see another's error */
+      mongo_clear_errors(conn);
+
+      switch (p_mgxapi->context) {
+         case MGX_METHOD_RETRIEVE:
+         case MGX_METHOD_COMMAND:
+         case MGX_METHOD_CURSOR_NEXT:
+            cursor = p_mgxapi->cursor;
+            ret = mongo_cursor_batch(cursor, reply, &batch);
+            if (ret != MONGO_OK) {
+               if (cursor->err == MONGO_CURSOR_QUERY_FAIL && !conn->lasterrstr[0]) { /* server gave no errmsg */
+                  conn->err = MONGO_COMMAND_FAILED;
+                  s->mongox_error_message(s, baton);
+               }
+               else if (cursor->err == MONGO_CURSOR_QUERY_FAIL) {
+                  strncpy(p_mgxapi->error, conn->lasterrstr, MGX_ERROR_SIZE - 1);
+                  p_mgxapi->error[MGX_ERROR_SIZE - 1] = '\0';
+                  p_mgxapi->error_code = conn->lasterrcode;
+               }
+               else {
+                  s->mongox_error_message(s, baton);
+               }
+               break;
+            }
+            if (p_mgxapi->context == MGX_METHOD_COMMAND) {
+               if (batch->fields.num == 0) {
+                  conn->err = MONGO_COMMAND_FAILED;
+               }
+               else {
+                  bson_init_finished_data(&temp, &(batch->objs), 0);
+                  if (!bson_find(&it, &temp, "ok") || !bson_iterator_bool(&it)) {
+                     conn->err = MONGO_COMMAND_FAILED;
+                  }
+                  else {
+                     p_mgxapi->bobj_main = mgx_bson_alloc(p_mgxapi, 0, 0);
+                     bson_copy(p_mgxapi->bobj_main, &temp);
+                  }
+               }
+               mongo_reply_free(batch);
+               if (conn->err != MONGO_CONN_SUCCESS) {
+                  s->mongox_error_message(s, baton);
+               }
+               break;
+            }
+            if (p_mgxapi->context == MGX_METHOD_CURSOR_NEXT) {
+               mgx_reply_add(p_mgxapi, batch, 0);
+               /* Release the server-side cursor as soon as it is exhausted */
+               if (!cursor->reply->fields.cursorID || (cursor->limit > 0 && cursor->seen >= cursor->limit)) {
+                  mongox_io_kill_cursor(baton->p_conn, cursor);
+                  p_mgxapi->cursor = NULL;
+               }
+               break;
+            }
+            if (batch->fields.num == 0) { /* tailable cursor with no more data available */
+               mongo_reply_free(batch);
+               break;
+            }
+            mgx_reply_add(p_mgxapi, batch, 0);
+            mongox_loop_cursor_send(baton, cursor);
+            break;
+         default: /* getlasterror following a write, or the reply to a write command */
+            if (mongo_check_last_error_reply(conn, reply) != MONGO_OK) {
+               if (!p_mgxapi->error[0]) { /* v1.5.17 */
+                  s->mongox_error_message(s, baton);
+               }
+            }
+            else if (p_mgxapi->context == MGX_METHOD_INSERT_BATCH && !p_mgxapi->error[0]) {
+               mongox_loop_insert_send(baton); /* v1.5.17 */
+            }
+            mongo_reply_free(reply);
+            break;
       }
 
-      delete baton;
-
       return 0;
    }
 
 
-   static int mongox_string8_length(Isolate * isolate, Local<String> str, int utf8)
+   /* All of the request's I/O is done: tidy up and add it to the list of requests to complete */
+   static int mongox_loop_done(mongo_baton_t *baton, mongo_baton_t **pp_done)
    {
-      if (utf8) {
-#if MGX_NODE_VERSION >= 240000
-         return str->Utf8LengthV2(isolate); /* v1.4.15 */
-#elif MGX_NODE_VERSION >= 120000
-         return str->Utf8Length(isolate);
-#else
-         return str->Utf8Length();
-#endif
-      }
-      else {
-         return str->Length();
+      MGXCONN *p_conn;
+
+      p_conn = baton->p_conn;
+      if (baton->p_mgxapi->context != MGX_METHOD_CURSOR_NEXT && baton->p_mgxapi->cursor) {
+         mongox_io_kill_cursor(p_conn, baton->p_mgxapi->cursor);
+         baton->p_mgxapi->cursor = NULL;
+         if (p_conn->p_io) {
+            mongox_io_update(p_conn);
+         }
       }
+
+      baton->p_next = *pp_done;
+      *pp_done = baton;
+
+      return 0;
    }
 
 
-   static Local<String> mongox_new_string8(Isolate * isolate, char * buffer, int utf8)
+   static int mongox_loop_complete(mongo_baton_t *baton)
    {
-      if (utf8) {
-#if MGX_NODE_VERSION >= 120000
-         return String::NewFromUtf8(isolate, buffer, NewStringType::kNormal).ToLocalChecked();
-#elif MGX_NODE_VERSION >= 1200
-         return String::NewFromUtf8(isolate, buffer);
-#else
-         return String::NewFromUtf8(buffer);
-#endif
-      }
-      else {
-#if MGX_NODE_VERSION >= 100000
-         return String::NewFromOneByte(isolate, (uint8_t *) buffer, NewStringType::kInternalized).ToLocalChecked();
-#elif MGX_NODE_VERSION >= 1200
-         return String::NewFromOneByte(isolate, (uint8_t *) buffer);
-#else
-         return String::New(buffer);
-#endif
+      mongo_baton_t *baton_next;
+      uv_work_t *_req;
+
+      while (baton) {
+         baton_next = baton->p_next;
+         baton->p_next = NULL;
+         _req = new uv_work_t;
+         _req->data = baton;
+         ((uv_after_work_cb) baton->after_work_cb)(_req, 0);
+         baton = baton_next;
       }
+
+      return 0;
    }
 
 
-   static Local<String> mongox_new_string8n(Isolate * isolate, char * buffer, unsigned long len, int utf8)
+   static int mongox_io_attach(MGXCONN *p_conn, mongo_baton_t *baton)
    {
-      if (utf8) {
-#if MGX_NODE_VERSION >= 120000
-         return String::NewFromUtf8(isolate, buffer, NewStringType::kNormal, len).ToLocalChecked();
-#elif MGX_NODE_VERSION >= 1200
-         return String::NewFromUtf8(isolate, buffer, String::kNormalString, len);
-#else
-         return String::NewFromUtf8(buffer, len);
-#endif
+      MGXIO *p_io;
+      mongo *conn;
+
+      conn = &(p_conn->mongo_connection);
+      if (p_conn->p_io) {
+         return MONGO_OK;
       }
-      else {
-#if MGX_NODE_VERSION >= 100000
-         return String::NewFromOneByte(isolate, (uint8_t *) buffer, NewStringType::kInternalized, len).ToLocalChecked();
-#elif MGX_NODE_VERSION >= 1200
-         return String::NewFromOneByte(isolate, (uint8_t *) buffer, String::kNormalString, len);
-#else
-         return String::New(buffer);
-#endif
+
+      p_io = (MGXIO *) mgx_malloc(sizeof(MGXIO), 202);
+      if (!p_io) {
+         __mongo_set_error(conn, MONGO_SOCKET_ERROR, "Unable to allocate memory for the connection's I/O state", 0);
+         return MONGO_ERROR;
+      }
+      memset((void *) p_io, 0, sizeof(MGXIO));
+      p_io->p_poll = (uv_poll_t *) mgx_malloc(sizeof(uv_poll_t), 203);
+      if (!p_io->p_poll || uv_poll_init_socket(mongox_event_loop(baton), p_io->p_poll, conn->sock) != 0) {
+         if (p_io->p_poll) {
+            mgx_free((void *) p_io->p_poll, 203);
+         }
+         mgx_free((void *) p_io, 202);
+         __mongo_set_error(conn, MONGO_SOCKET_ERROR, "Unable to poll the connection's socket from the event loop", 0);
+         return MONGO_ERROR;
       }
+      if (mongo_env_set_socket_blocking(conn, 0) != MONGO_OK) {
+         uv_close((uv_handle_t *) p_io->p_poll, mongox_io_closed);
+         mgx_free((void *) p_io, 202);
+         return MONGO_ERROR;
+      }
+      p_io->p_poll->data = (void *) p_conn;
+      p_conn->p_io = p_io;
+
+      return MONGO_OK;
    }
 
 
-   static int mongox_write_char8(v8::Isolate * isolate, Local<String> str, char * buffer, int buffer_size, int utf8)
+   /* Return the connection to blocking mode for use by a worker thread */
+   static int mongox_io_detach(MGXCONN *p_conn)
    {
-      if (utf8) {
-#if MGX_NODE_VERSION >= 240000
-         return str->WriteUtf8V2(isolate, buffer, buffer_size, v8::String::WriteFlags::kNullTerminate); /* v1.4.15 */
-#elif MGX_NODE_VERSION >= 120000
-         return str->WriteUtf8(isolate, buffer);
-#else
-         return str->WriteUtf8(buffer);
-#endif
-      }
-      else {
-#if MGX_NODE_VERSION >= 240000
-         str->WriteOneByteV2(isolate, 0, str->Length(), (uint8_t *) buffer, v8::String::WriteFlags::kNullTerminate); /* v1.4.15 */
-         return 0;
-#elif MGX_NODE_VERSION >= 120000
-         return str->WriteOneByte(isolate, (uint8_t *) buffer);
-#elif MGX_NODE_VERSION >= 1200
-         return str->WriteOneByte((uint8_t *) buffer);
-#else
-         return str->WriteAscii((char *) buffer);
-#endif
+      int n;
+      mongo_iovec iov[MONGO_IOV_MAX];
+      MGXIO *p_io;
+      MGXOUT *p_out;
+      mongo *conn;
+
+      p_io = p_conn->p_io;
+      conn = &(p_conn->mongo_connection);
+
+      uv_poll_stop(p_io->p_poll);
+      p_io->events = 0;
+      mongo_env_set_socket_blocking(conn, 1);
+
+      /* Finish writing any messages still queued (cursor kills) */
+      while ((p_out = p_io->p_out_head)) {
+         p_io->p_out_head = p_out->p_next;
+         while (conn->connected && p_out->done < p_out->mv.len) {
+            n = mongo_message_vec_iov(&(p_out->mv), p_out->done, iov, MONGO_IOV_MAX);
+            if (mongo_env_writev_socket(conn, iov, n) != MONGO_OK) {
+               break;
+            }
+            while (n --) {
+               p_out->done += (int) iov[n].len;
+            }
+         }
+         mongo_message_vec_destroy(&(p_out->mv));
+         mgx_free((void *) p_out, 204);
       }
+      p_io->p_out_tail = NULL;
+
+      return mongox_io_close(p_conn, NULL);
    }
 
 
-   static void mongox_invoke_callback(uv_work_t *req, int status)
+   /* s: the server to notify once the poll handle is closed (environment teardown only), otherwise NULL */
+   static int mongox_io_close(MGXCONN *p_conn, server *s)
    {
-      Isolate* isolate = Isolate::GetCurrent();
-      HandleScope scope(isolate);
-      mongo_baton_t *baton = static_cast<mongo_baton_t *>(req->data);
-      /* ev_unref(EV_DEFAULT_UC); */
-      baton->s->Unref();
+      MGXIO *p_io;
+      MGXOUT *p_out;
 
-      Local<Value> argv[2];
+      p_io = p_conn->p_io;
+      p_conn->p_io = NULL;
 
-      baton->json_result = mongox_result_object(baton, 1);
+      uv_poll_stop(p_io->p_poll);
+      p_io->p_poll->data = (void *) s;
+      uv_close((uv_handle_t *) p_io->p_poll, mongox_io_closed);
 
-      if (baton->result_iserror)
-         argv[0] = MGX_INTEGER_NEW(true);
-      else
-         argv[0] = MGX_INTEGER_NEW(false);
+      while ((p_out = p_io->p_out_head)) {
+         p_io->p_out_head = p_out->p_next;
+         mongo_message_vec_destroy(&(p_out->mv));
+         mgx_free((void *) p_out, 204);
+      }
+      while ((p_out = p_io->p_wait_head)) {
+         p_io->p_wait_head = p_out->p_next;
+         mgx_free((void *) p_out, 204);
+      }
+      mgx_free((void *) p_io, 202);
 
-      if (baton->result_isarray)
-         argv[1] = baton->array_result;
-      else
-         argv[1] = baton->json_result;
+      return 0;
+   }
 
-#if MGX_NODE_VERSION >= 40000
-      TryCatch try_catch(isolate);
-#else
-      TryCatch try_catch;
-#endif
 
-      Local<Function> cb = Local<Function>::New(isolate, baton->cb);
+   static void mongox_io_closed(uv_handle_t *handle)
+   {
+      server *s = (server *) handle->data;
 
-#if MGX_NODE_VERSION >= 120000
-      /* cb->Call(isolate->GetCurrentContext(), isolate->GetCurrentContext()->Global(), 2, argv); */
-      cb->Call(isolate->GetCurrentContext(), Null(isolate), 2, argv).ToLocalChecked();
-#else
-      cb->Call(isolate->GetCurrentContext()->Global(), 2, argv);
+      mgx_free((void *) handle, 203);
+#if MGX_NODE_VERSION >= 140800
+      if (s) {
+         mongox_env_closed(s);
+      }
 #endif
+   }
 
 
-#if MGX_NODE_VERSION >= 40000
-      if (try_catch.HasCaught()) {
-         FatalException(isolate, try_catch);
+   /* Queue a message on the connection: the request is notified when it has been written and, if expect_reply is set, when its reply arrives */
+   static int mongox_io_send(MGXCONN *p_conn, mongo_message_vec *mv, mongo_baton_t *baton, short expect_reply)
+   {
+      MGXIO *p_io;
+      MGXOUT *p_out;
+
+      p_io = p_conn->p_io;
+      p_out = (MGXOUT *) mgx_malloc(sizeof(MGXOUT), 204);
+      if (!p_out) {
+         mongo_message_vec_destroy(mv);
+         return -1;
       }
-#else
-      if (try_catch.HasCaught()) {
-         FatalException(isolate, try_catch);
+      if (expect_reply) {
+         baton->io_pending ++;
+      }
+      p_out->mv = *mv;
+      p_out->expect_reply = expect_reply;
+      p_out->done = 0;
+      p_out->baton = (void *) baton;
+      p_out->p_next = NULL;
+      if (baton) {
+         baton->io_pending ++;
       }
-#endif
 
-      baton->cb.Reset();
+      if (p_io->p_out_tail) {
+         p_io->p_out_tail->p_next = p_out;
+      }
+      else {
+         p_io->p_out_head = p_out;
+      }
+      p_io->p_out_tail = p_out;
 
-	   MGX_MONGOAPI_END();
+      return 0;
+   }
 
-      mongox_destroy_baton(baton);
 
-      delete req;
+   /* Release a cursor without blocking: the OP_KILL_CURSORS message (if any) is queued on the connection */
+   static int mongox_io_kill_cursor(MGXCONN *p_conn, mongo_cursor *cursor)
+   {
+      mongo_message_vec mv;
+
+      if (mongo_cursor_kill_message(cursor, &mv) == MONGO_OK) {
+         if (p_conn->p_io && p_conn->mongo_connection.connected)
+            mongox_io_send(p_conn, &mv, NULL, 0);
+         else
+            mongo_message_vec_destroy(&mv);
+      }
+      mongo_cursor_destroy(cursor);
+
+      return 0;
+   }
+
+
+   /* Poll for whatever the connection is waiting for: nothing at all once it is idle */
+   static int mongox_io_update(MGXCONN *p_conn)
+   {
+      int events;
+      MGXIO *p_io;
+
+      p_io = p_conn->p_io;
+      events = 0;
+      if (p_conn->mongo_connection.connected) {
+         if (p_io->p_out_head) {
+            events |= UV_WRITABLE;
+         }
+         if (p_io->p_wait_head) {
+            events |= UV_READABLE;
+         }
+      }
+      if (events == p_io->events) {
+         return 0;
+      }
+      p_io->events = events;
+      if (events) {
+         uv_poll_start(p_io->p_poll, events, mongox_io_poll);
+      }
+      else {
+         uv_poll_stop(p_io->p_poll);
+      }
+
+      return 0;
+   }
+
+
+   static void mongox_io_poll(uv_poll_t *handle, int status, int events)
+   {
+      int ret;
+      MGXCONN *p_conn;
+      mongo_baton_t *p_done;
+
+      p_conn = (MGXCONN *) handle->data;
+      if (!p_conn) {
+         return;
+      }
+      p_done = NULL;
+
+      if (status < 0) {
+         __mongo_set_error(&(p_conn->mongo_connection), MONGO_IO_ERROR, uv_strerror(status), status);
+         ret = MONGO_ERROR;
+      }
+      else {
+         ret = MONGO_OK;
+         if (events & UV_WRITABLE) {
+            ret = mongox_io_write(p_conn, &p_done);
+         }
+         if (ret == MONGO_OK && (events & UV_READABLE)) {
+            ret = mongox_io_read(p_conn, &p_done);
+            if (ret == MONGO_OK && p_conn->p_io->p_out_head) {
+               ret = mongox_io_write(p_conn, &p_done); /* follow-on messages (e.g. for the cursor's next batch) */
+            }
+         }
+      }
+      if (ret != MONGO_OK) {
+         mongox_io_fail(p_conn, &p_done);
+      }
+      mongox_io_update(p_conn);
+
+      /* Callbacks may release (and free) this connection so they are fired last */
+      mongox_loop_complete(p_done);
+
       return;
    }
 
- 
-   static Local<Object> mongox_result_object(mongo_baton_t * baton, int context)
+
+   static int mongox_io_write(MGXCONN *p_conn, mongo_baton_t **pp_done)
+   {
+      int n, sent;
+      mongo_iovec iov[MONGO_IOV_MAX];
+      MGXIO *p_io;
+      MGXOUT *p_out;
+      mongo_baton_t *baton;
+
+      p_io = p_conn->p_io;
+      sent = 0;
+      while ((p_out = p_io->p_out_head)) {
+         if (sent == 0) {
+            /* Gather the queued messages (for example a write and its getlasterror query) into a single send */
+            n = 0;
+            for (; p_out && n < MONGO_IOV_MAX; p_out = p_out->p_next) {
+               n += mongo_message_vec_iov(&(p_out->mv), p_out->done, iov + n, MONGO_IOV_MAX - n);
+            }
+            sent = mongo_env_sendv_socket(&(p_conn->mongo_connection), iov, n);
+            if (sent < 0) {
+               return MONGO_ERROR;
+            }
+            if (sent == 0) {
+               break; /* would block */
+            }
+            p_out = p_io->p_out_head;
+         }
+
+         /* Account for the bytes sent, message by message */
+         n = p_out->mv.len - p_out->done;
+         if (sent < n) {
+            p_out->done += sent;
+            sent = 0;
+            continue;
+         }
+         p_out->done += n;
+         sent -= n;
+
+         p_io->p_out_head = p_out->p_next;
+         if (!p_io->p_out_head) {
+            p_io->p_out_tail = NULL;
+         }
+         baton = (mongo_baton_t *) p_out->baton;
+         mongo_message_vec_destroy(&(p_out->mv));
+         if (p_out->expect_reply) {
+            p_out->p_next = NULL;
+            if (p_io->p_wait_tail) {
+               p_io->p_wait_tail->p_next = p_out;
+            }
+            else {
+               p_io->p_wait_head = p_out;
+            }
+            p_io->p_wait_tail = p_out;
+         }
+         else {
+            mgx_free((void *) p_out, 204);
+         }
+         if (baton && -- baton->io_pending == 0) {
+            mongox_loop_done(baton, pp_done);
+         }
+      }
+
+      return MONGO_OK;
+   }
+
+
+   static int mongox_io_read(MGXCONN *p_conn, mongo_baton_t **pp_done)
+   {
+      MGXIO *p_io;
+      MGXOUT *p_out, *p_prev;
+      mongo *conn;
+      mongo_reply *reply;
+      mongo_baton_t *baton;
+
+      p_io = p_conn->p_io;
+      conn = &(p_conn->mongo_connection);
+
+      /* Stop once nothing is awaiting a reply rather than polling the socket again */
+      while (p_io->p_wait_head) {
+         /* Replies are parsed out of the connection's read buffer: a partial reply stays with the connection until the rest arrives */
+         if (mongo_recv_reply(conn, &reply) != MONGO_OK) {
+            return MONGO_ERROR;
+         }
+         if (!reply) {
+            break; /* would block */
+         }
+
+         /* Route the reply to its request: replies normally arrive in the order that the requests were sent */
+         p_prev = NULL;
+         for (p_out = p_io->p_wait_head; p_out; p_out = p_out->p_next) {
+            if (p_out->mv.id == reply->head.responseTo) {
+               break;
+            }
+            p_prev = p_out;
+         }
+         if (!p_out) {
+            mongo_reply_free(reply); /* not a reply to anything outstanding */
+            continue;
+         }
+         if (p_prev) {
+            p_prev->p_next = p_out->p_next;
+         }
+         else {
+            p_io->p_wait_head = p_out->p_next;
+         }
+         if (p_io->p_wait_tail == p_out) {
+            p_io->p_wait_tail = p_prev;
+         }
+         baton = (mongo_baton_t *) p_out->baton;
+         mgx_free((void *) p_out, 204);
+
+         baton->io_pending --;
+         mongox_loop_reply(baton, reply);
+         if (baton->io_pending == 0) {
+            mongox_loop_done(baton, pp_done);
+         }
+      }
+
+      return MONGO_OK;
+   }
+
+
+   /* The connection is unusable: fail every request using it and drop everything queued */
+   static int mongox_io_fail(MGXCONN *p_conn, mongo_baton_t **pp_done)
+   {
+      int n;
+      MGXIO *p_io;
+      MGXOUT *p_out;
+      mongo *conn;
+      mongo_baton_t *baton;
+
+      p_io = p_conn->p_io;
+      conn = &(p_conn->mongo_connection);
+      conn->connected = 0;
+      if (conn->err == MONGO_CONN_SUCCESS) {
+         conn->err = MONGO_IO_ERROR;
+      }
+
+      for (n = 0; n < 2; n ++) {
+         while ((p_out = (n == 0 ? p_io->p_wait_head : p_io->p_out_head))) {
+            if (n == 0)
+               p_io->p_wait_head = p_out->p_next;
+            else
+               p_io->p_out_head = p_out->p_next;
+            baton = (mongo_baton_t *) p_out->baton;
+            mongo_message_vec_destroy(&(p_out->mv));
+            mgx_free((void *) p_out, 204);
+            if (baton && baton->io_pending > 0) {
+               if (!baton->p_mgxapi->error[0]) {
+                  baton->s->mongox_error_message(baton->s, baton);
+               }
+               baton->io_pending = 0;
+               mongox_loop_done(baton, pp_done);
+            }
+         }
+      }
+      p_io->p_wait_tail = NULL;
+      p_io->p_out_tail = NULL;
+
+      return 0;
+   }
+
+
+   static int mongox_parse_options(server *s, mongo_baton_t * baton, char *options, int context)
+   {
+      int ret, eol, eot, len;
+      char *p, *pz;
+
+      /* printf("\r\nALL Options: len=%d; =%s=\r\n", (int) strlen(options), options); */
+
+      baton->p_mgxapi->options = 0;
+      ret = 0;
+      eol = 0;
+      eot = 0;
+      p = options;
+      pz = p;
+      while (!eol) {
+
+         if (!(*pz))
+            eol = 1;
+         else if (*pz != '_' && !isalpha((int) *pz) && !isdigit((int) *pz))
+            eot = 1;
+
+         if (eol || eot) {
+            *pz = '\0';
+            len = (int) strlen(p);
+            if (len) {
+               /* printf("\r\nOption: len=%d; =%s=", (int) strlen(p), p); */
+
+               if (baton->p_mgxapi->context == MGX_METHOD_INSERT) {
+                  if (!strcmp(p, "MONGO_CONTINUE_ON_ERROR")) {
+                     baton->p_mgxapi->options |= MONGO_CONTINUE_ON_ERROR;
+                  }
+                  else {
+                     sprintf(baton->p_mgxapi->error, "Invalid Option (%s) supplied to Update method", p);
+                     ret = -1;
+                     break;
+                  }
+               }
+               else if (baton->p_mgxapi->context == MGX_METHOD_INSERT_BATCH || baton->p_mgxapi->context == MGX_METHOD_BULK_WRITE) { /* v1.5.17 */
+                  if (!strcmp(p, "MONGO_CONTINUE_ON_ERROR")) {
+                     baton->p_mgxapi->options |= MONGO_CONTINUE_ON_ERROR;
+                  }
+                  else {
+                     sprintf(baton->p_mgxapi->error, "Invalid Option (%s) supplied to %s method", p, baton->p_mgxapi->context == MGX_METHOD_BULK_WRITE ? "Bulk Write" : "Insert Batch");
+                     ret = -1;
+                     break;
+                  }
+               }
+               else if (baton->p_mgxapi->context == MGX_METHOD_UPDATE) {
+                  if (!strcmp(p, "MONGO_UPDATE_UPSERT")) {
+                     baton->p_mgxapi->options |= MONGO_UPDATE_UPSERT;
+                  }
+                  else if (!strcmp(p, "MONGO_UPDATE_MULTI")) {
+                     baton->p_mgxapi->options |= MONGO_UPDATE_MULTI;
+                  }
+                  else if (!strcmp(p, "MONGO_UPDATE_BASIC")) {
+                     baton->p_mgxapi->options |= MONGO_UPDATE_BASIC;
+                  }
+                  else {
+                     sprintf(baton->p_mgxapi->error, "Invalid Option (%s) supplied to Update method", p);
+                     ret = -1;
+                     break;
+                  }
+               }
+               else if (baton->p_mgxapi->context == MGX_METHOD_RETRIEVE || baton->p_mgxapi->context == MGX_METHOD_CURSOR) {
+
+                  if (!strcmp(p, "MONGO_TAILABLE")) {
+                     baton->p_mgxapi->options |= MONGO_TAILABLE;
+                  }
+                  else if (!strcmp(p, "MONGO_SLAVE_OK")) {
+                     baton->p_mgxapi->options |= MONGO_SLAVE_OK;
+                  }
+                  else if (!strcmp(p, "MONGO_NO_CURSOR_TIMEOUT")) {
+                     baton->p_mgxapi->options |= MONGO_NO_CURSOR_TIMEOUT;
+                  }
+                  else if (!strcmp(p, "MONGO_AWAIT_DATA")) {
+                     baton->p_mgxapi->options |= MONGO_AWAIT_DATA;
+                  }
+                  else if (!strcmp(p, "MONGO_EXHAUST")) {
+                     baton->p_mgxapi->options |= MONGO_EXHAUST;
+                  }
+                  else if (!strcmp(p, "MONGO_PARTIAL")) {
+                     baton->p_mgxapi->options |= MONGO_PARTIAL;
+                  }
+                  else if (!strcmp(p, "MGX_RAW_BSON") && baton->p_mgxapi->context == MGX_METHOD_RETRIEVE) { /* v1.5.17 */
+                     baton->p_mgxapi->raw_bson = 1;
+                  }
+                  else {
+                     sprintf(baton->p_mgxapi->error, "Invalid Option (%s) supplied to Create_Index method", p);
+                     ret = -1;
+                     break;
+                  }
+               }
+               else if (baton->p_mgxapi->context == MGX_METHOD_COMMAND) { /* v1.5.17 */
+
+                  if (!strcmp(p, "MGX_RAW_BSON")) {
+                     baton->p_mgxapi->raw_bson = 1;
+                  }
+                  else {
+                     sprintf(baton->p_mgxapi->error, "Invalid Option (%s) supplied to Command method", p);
+                     ret = -1;
+                     break;
+                  }
+               }
+               else if (baton->p_mgxapi->context == MGX_METHOD_CREATE_INDEX) {
+
+                  if (!strcmp(p, "MONGO_INDEX_UNIQUE")) {
+                     baton->p_mgxapi->options |= MONGO_INDEX_UNIQUE;
+                  }
+                  else if (!strcmp(p, "MONGO_INDEX_DROP_DUPS")) {
+                     baton->p_mgxapi->options |= MONGO_INDEX_DROP_DUPS;
+                  }
+                  else if (!strcmp(p, "MONGO_INDEX_BACKGROUND")) {
+                     baton->p_mgxapi->options |= MONGO_INDEX_BACKGROUND;
+                  }
+                  else if (!strcmp(p, "MONGO_INDEX_SPARSE")) {
+                     baton->p_mgxapi->options |= MONGO_INDEX_SPARSE;
+                  }
+                  else {
+                     sprintf(baton->p_mgxapi->error, "Invalid Option (%s) supplied to Create_Index method", p);
+                     ret = -1;
+                     break;
+                  }
+               }
+            }
+            p = pz;
+            while (*(++ p)) {
+               if (isalpha((int) *p) || isdigit((int) *p)) {
+                  break;
+               }
+            }
+            pz = p;
+            eot = 0;
+         }
+         else {
+            pz ++;
+         }
+         if (eol) {
+            break;
+         }
+      }
+
+      return ret;
+   }
+
+
+   /* v1.5.17 */
+   /* Single pass: each value is read once, strings are written straight into the BSON buffer and sub-documents are built in place */
+   static int mongox_parse_json_object(server *s, mongo_baton_t * baton, Local<Object> jobj, char *jobj_name, bson *bobj, int jobj_no, int type, int context)
    {
       Isolate* isolate = Isolate::GetCurrent();
 #if MGX_NODE_VERSION >= 100000
       Local<Context> icontext = isolate->GetCurrentContext();
 #endif
-      EscapableHandleScope handle_scope(isolate);
-      int ret, n;
-      Local<String> key;
-      Local<String> value;
-      Local<String> error;
-      Local<Object> jobj;
-      Local<Array> jobj_array;
+      HandleScope scope(isolate);
+      int is_insert;
+      unsigned int n, a_len;
+      char *name;
+      char name_buffer[MGX_NAME_BUFFER];
+      MGXJSON *p_mgxjson;
+      Local<Array> a;
+      Local<String> name_str;
+      Local<Value> value;
+
+#if MGX_NODE_VERSION >= 120000
+      a = jobj->GetPropertyNames(icontext).ToLocalChecked();
+#else
+      a = jobj->GetPropertyNames();
+#endif
+      if (!jobj_name) {
+         /* v1.5.17: names and strings are written by V8 as valid UTF-8 so they are not checked again */
+         bson_set_trusted_utf8(bobj, 1);
+      }
+      p_mgxjson = &(baton->p_mgxapi->jobj_main_list[jobj_no]);
+      is_insert = ((baton->p_mgxapi->context == MGX_METHOD_INSERT || baton->p_mgxapi->context == MGX_METHOD_INSERT_BATCH || context == MGX_METHOD_INSERT) && baton->p_mgxapi->level == 0);
+
+      a_len = a->Length();
+      for (n = 0; n < a_len; n ++) {
+
+         name_str = MGX_TOSTRING(MGX_GET(a, n));
+         name = mongox_write_name(isolate, baton->p_mgxapi->p_arena, name_str, name_buffer, sizeof(name_buffer));
+         if (!name) {
+            continue;
+         }
+         value = MGX_GET(jobj, name_str);
+
+         if (n == 0 && is_insert) {
+            if (strcmp(name, p_mgxjson->oid_name)) { /* no _id */
+               bson_oid_gen(&(p_mgxjson->oid));
+               bson_oid_to_string(&(p_mgxjson->oid), p_mgxjson->oid_value);
+               bson_append_oid(bobj, p_mgxjson->oid_name, &(p_mgxjson->oid));
+            }
+            else if (!value->IsString()) { /* _id but wrong type */
+               bson_oid_gen(&(p_mgxjson->oid));
+               bson_oid_to_string(&(p_mgxjson->oid), p_mgxjson->oid_value);
+               bson_append_oid(bobj, p_mgxjson->oid_name, &(p_mgxjson->oid));
+               continue;
+            }
+         }
+
+         if (value->IsArray()) {
+            bson_append_start_array(bobj, name);
+            baton->p_mgxapi->level ++;
+            mongox_parse_json_array(s, (mongo_baton_t *) baton, Local<Array>::Cast(value), name, bobj, jobj_no, MGX_JSON_ARRAY, context);
+            baton->p_mgxapi->level --;
+            bson_append_finish_array(bobj);
+         }
+         else if (value->IsObject()) {
+            bson_append_start_object(bobj, name);
+            baton->p_mgxapi->level ++;
+            mongox_parse_json_object(s, (mongo_baton_t *) baton, Local<Object>::Cast(value), name, bobj, jobj_no, MGX_JSON_OBJECT, context);
+            baton->p_mgxapi->level --;
+            bson_append_finish_object(bobj);
+         }
+         else if (value->IsUint32()) {
+            bson_append_int(bobj, name, (int) Local<Uint32>::Cast(value)->Value());
+         }
+         else if (value->IsInt32()) {
+            bson_append_int(bobj, name, (int) Local<Int32>::Cast(value)->Value());
+         }
+         else if (value->IsNumber()) {
+            bson_append_double(bobj, name, (double) Local<Number>::Cast(value)->Value());
+         }
+         else if (!strcmp(name, p_mgxjson->oid_name)) {
+            mongox_append_json_oid(s, baton, bobj, name, value->IsString() ? Local<String>::Cast(value) : MGX_TOSTRING(value), p_mgxjson, (n == 0 && is_insert));
+         }
+         else {
+            mongox_append_json_string(isolate, bobj, name, value->IsString() ? Local<String>::Cast(value) : MGX_TOSTRING(value));
+         }
+      }
+      return 0;
+   }
+
+
+   static int mongox_parse_json_array(server *s, mongo_baton_t * baton, Local<Array> jarray, char *jobj_name, bson *bobj, int jobj_no, int type, int context)
+   {
+      Isolate* isolate = Isolate::GetCurrent();
+#if MGX_NODE_VERSION >= 100000
+      Local<Context> icontext = isolate->GetCurrentContext();
+#endif
+      HandleScope scope(isolate);
+      unsigned int n, a_len;
+      char name[32];
+      Local<Value> value;
+
+      a_len = jarray->Length();
+      for (n = 0; n < a_len; n ++) {
+
+         mongox_index_name(name, n);
+         value = MGX_GET(jarray, n);
+
+         if (value->IsArray()) {
+            bson_append_start_array(bobj, name);
+            baton->p_mgxapi->level ++;
+            mongox_parse_json_object(s, (mongo_baton_t *) baton, Local<Object>::Cast(value), name, bobj, jobj_no, MGX_JSON_ARRAY, context);
+            baton->p_mgxapi->level --;
+            bson_append_finish_array(bobj);
+         }
+         else if (value->IsObject()) {
+            bson_append_start_object(bobj, name);
+            baton->p_mgxapi->level ++;
+            mongox_parse_json_object(s, (mongo_baton_t *) baton, Local<Object>::Cast(value), name, bobj, jobj_no, MGX_JSON_OBJECT, context);
+            baton->p_mgxapi->level --;
+            bson_append_finish_object(bobj);
+         }
+         else if (value->IsUint32()) {
+            bson_append_int(bobj, name, (int) Local<Uint32>::Cast(value)->Value());
+         }
+         else if (value->IsInt32()) {
+            bson_append_int(bobj, name, (int) Local<Int32>::Cast(value)->Value());
+         }
+         else if (value->IsNumber()) {
+            bson_append_double(bobj, name, (double) Local<Number>::Cast(value)->Value());
+         }
+         else {
+            mongox_append_json_string(isolate, bobj, name, value->IsString() ? Local<String>::Cast(value) : MGX_TOSTRING(value));
+         }
+      }
+      return 0;
+   }
+
+
+   /* v1.5.17 */
+   /* Return the UTF-8 form of a property name: in the supplied buffer if it fits, otherwise in memory drawn from the request's arena */
+   static char * mongox_write_name(Isolate * isolate, MGXARENA *p_arena, Local<String> name_str, char *buffer, size_t buffer_size)
+   {
+      size_t max, len;
+      char *name;
+
+      max = mongox_utf8_max_length(name_str);
+      if (max < buffer_size) {
+         name = buffer;
+      }
+      else {
+         name = (char *) mgx_arena_alloc(p_arena, sizeof(char) * (max + 1));
+         if (!name) {
+            return NULL;
+         }
+      }
+      len = mongox_write_utf8(isolate, name_str, name, max);
+      name[len] = '\0';
+
+      return name;
+   }
+
+
+   static int mongox_append_json_string(Isolate * isolate, bson *bobj, char *name, Local<String> value_str)
+   {
+      size_t max, len;
+      char *p;
+
+      max = mongox_utf8_max_length(value_str);
+      p = bson_append_string_reserve(bobj, name, max);
+      if (!p) {
+         return BSON_ERROR;
+      }
+      len = mongox_write_utf8(isolate, value_str, p, max);
+
+      return bson_append_string_finish(bobj, len);
+   }
+
+
+   /* A string value for the _id field is stored as an ObjectId */
+   static int mongox_append_json_oid(server *s, mongo_baton_t * baton, bson *bobj, char *name, Local<String> value_str, MGXJSON *p_mgxjson, int insert_id)
+   {
+      Isolate* isolate = Isolate::GetCurrent();
+      int ret;
+      size_t max, len;
+      char *value;
+      char value_buffer[64];
+
+      max = mongox_utf8_max_length(value_str);
+      if (max < sizeof(value_buffer)) {
+         value = value_buffer;
+      }
+      else {
+         value = (char *) mgx_arena_alloc(baton->p_mgxapi->p_arena, sizeof(char) * (max + 1));
+         if (!value) {
+            return BSON_ERROR;
+         }
+      }
+      len = mongox_write_utf8(isolate, value_str, value, max);
+      value[len] = '\0';
+
+      ret = mongox_is_object_id(s, baton, value, &(p_mgxjson->oid)); /* v1.5.17: s is NULL for encode() */
+      if (ret && insert_id) { /* bad _id passed to insert */
+         bson_oid_gen(&(p_mgxjson->oid));
+         bson_oid_to_string(&(p_mgxjson->oid), value);
+      }
+      strncpy(p_mgxjson->oid_value, value, sizeof(p_mgxjson->oid_value) - 1);
+      p_mgxjson->oid_value[sizeof(p_mgxjson->oid_value) - 1] = '\0';
+
+      if (ret && !insert_id) { /* not an ObjectId: keep the value as it was given */
+         return bson_append_string(bobj, name, value);
+      }
+
+      return bson_append_oid(bobj, name, &(p_mgxjson->oid));
+   }
+
+
+   static void mongox_index_name(char *buffer, unsigned int n)
+   {
+      char digits[16];
+      int len;
+
+      len = 0;
+      do {
+         digits[len ++] = (char) ('0' + (n % 10));
+         n /= 10;
+      } while (n);
+      while (len) {
+         *(buffer ++) = digits[-- len];
+      }
+      *buffer = '\0';
+   }
+
+
+   /* v1.5.17 */
+   /* A string value is created with the length stored in the BSON.  Large ASCII strings in a reply are not copied: */
+   /* they are exposed as external strings that keep a reference to the reply */
+   static Local<String> mongox_bson_string(Isolate * isolate, bson_iterator *iterator, mongo_reply *reply)
+   {
+      char *value;
+      int n;
+      size_t len;
+
+      value = (char *) bson_iterator_string(iterator);
+      n = bson_iterator_string_len(iterator); /* includes the terminator */
+      len = n > 0 ? (size_t) (n - 1) : 0;
+
+#if MGX_NODE_VERSION >= 120000
+      /* A string that is only a small part of its reply is copied rather than keeping the whole reply alive */
+      if (reply && len >= MGX_EXTERNAL_STRING_MIN && (len * MGX_EXTERNAL_STRING_SHARE) >= (size_t) reply->head.len && mgx_is_ascii(value, len)) {
+         Local<String> str;
+         mgx_reply_string *resource = new mgx_reply_string(isolate, reply, value, len);
+
+         if (String::NewExternalOneByte(isolate, resource).ToLocal(&str)) {
+            return str;
+         }
+         resource->Dispose();
+      }
+#endif
+
+      return mongox_new_string8n(isolate, value, (unsigned long) len, 1);
+   }
+
+
+   /* v1.5.17: reply is the reply holding the document, or NULL if the document is not held in a reply */
+   static int mongox_parse_bson_object(server *s, mongo_baton_t * baton, Local<Object> jobj, bson *bobj, bson_iterator *iterator, int context, mongo_reply *reply)
+   {
+      Isolate* isolate = Isolate::GetCurrent();
+#if MGX_NODE_VERSION >= 100000
+      Local<Context> icontext = isolate->GetCurrentContext();
+#endif
+      EscapableHandleScope handle_scope(isolate);
+      int int32;
+      int64_t  int64;
+      char *key;
+      char buffer[256];
+      Local<String> key_str;
+      Local<String> value_str;
+      Local<Object> jobj_next;
+      Local<Array> ja;
+      bson_iterator iterator_a;
+      bson_iterator iterator_o;
+      bson_type type;
+      MGXKEYS *p_keys = s ? s->p_keys : NULL; /* v1.5.17 */
+
+      if (bobj)
+         bson_iterator_init(iterator, bobj);
+
+      while ((type = bson_iterator_next(iterator))) {
+         key = (char *) bson_iterator_key(iterator);
+         if (type == BSON_OID) {
+
+            bson_oid_to_string(bson_iterator_oid(iterator), buffer);
+
+            key_str = mongox_key_string(isolate, p_keys, key);
+            value_str = mongox_new_string8n(isolate, buffer, 24, 1); /* v1.5.17 */
+            MGX_DATA_SET(jobj, key_str, value_str);
+         }
+         else if (type == BSON_STRING) {
+            key_str = mongox_key_string(isolate, p_keys, key);
+            value_str = mongox_bson_string(isolate, iterator, reply); /* v1.5.17 */
+            MGX_DATA_SET(jobj, key_str, value_str);
+         }
+         else if (type == BSON_INT) {
+            int32 = (int) bson_iterator_int(iterator);
+
+            key_str = mongox_key_string(isolate, p_keys, key);
+
+            MGX_DATA_SET(jobj, key_str, MGX_INTEGER_NEW(int32));
+         }
+         else if (type == BSON_LONG) {
+            int64 = (int64_t) bson_iterator_long(iterator);
+
+            key_str = mongox_key_string(isolate, p_keys, key);
+
+            MGX_DATA_SET(jobj, key_str, MGX_NUMBER_NEW((double ) int64));
+
+         }
+         else if (type == BSON_DOUBLE) {
+            double num = (double) bson_iterator_double(iterator);
+
+            key_str = mongox_key_string(isolate, p_keys, key);
+
+            MGX_DATA_SET(jobj, key_str, MGX_NUMBER_NEW(num));
+         }
+         else if (type == BSON_BOOL) {
+            bson_bool_t num = (bson_bool_t) bson_iterator_bool(iterator);
+
+            key_str = mongox_key_string(isolate, p_keys, key);
+
+            MGX_DATA_SET(jobj, key_str, MGX_BOOLEAN_NEW(num ? true : false));
+         }
+         else if (type == BSON_NULL) {
+/*
+            bson_bool_t num = (bson_bool_t) bson_iterator_bool(iterator);
+*/
+            key_str = mongox_key_string(isolate, p_keys, key);
+
+            MGX_DATA_SET(jobj, key_str, MGX_NULL());
+         }
+         else if (type == BSON_DATE) {
+
+            bson_date_t num = (bson_date_t) bson_iterator_date(iterator);
+
+            key_str = mongox_key_string(isolate, p_keys, key);
+
+            MGX_DATA_SET(jobj, key_str, MGX_DATE((double) num));
+         }
+         else if (type == BSON_ARRAY) {
+            bson_iterator_subiterator(iterator, &iterator_a);
+
+            ja = mongox_parse_bson_array(s, baton, key, NULL, &iterator_a, context, reply);
+
+            key_str = mongox_key_string(isolate, p_keys, key);
+            MGX_DATA_SET(jobj, key_str, ja);
+         }
+         else if (type == BSON_OBJECT) {
+            bson_iterator_subiterator(iterator, &iterator_o);
+            jobj_next = MGX_OBJECT_NEW();
+
+            key_str = mongox_key_string(isolate, p_keys, key);
+            MGX_DATA_SET(jobj, key_str, jobj_next);
+
+            mongox_parse_bson_object(s, baton, jobj_next, (bson *) NULL, &iterator_o, 1, reply);
+         }
+         else {
+            sprintf(buffer, "BSON Type: %d", type);
+            key_str = mongox_key_string(isolate, p_keys, key);
+            value_str = mongox_new_string8(isolate, buffer, 1);
+            MGX_DATA_SET(jobj, key_str, value_str);
+
+         }
+      }
+
+      return 1;
+
+   }
+
+
+   /* v1.5.17 */
+   /* The elements are gathered first so that the array can be created in one step with its final length */
+   static Local<Array> mongox_parse_bson_array(server *s, mongo_baton_t * baton, char *jobj_name, bson *bobj, bson_iterator *iterator, int context, mongo_reply *reply)
+   {
+      Isolate* isolate = Isolate::GetCurrent();
+#if MGX_NODE_VERSION >= 100000
+      Local<Context> icontext = isolate->GetCurrentContext();
+#endif
+      EscapableHandleScope handle_scope(isolate);
+      int int32;
+      int64_t  int64;
+      unsigned int an, asize, n;
+      char buffer[256];
+      Local<Value> elements_local[MGX_ARRAY_CHUNK];
+      Local<Value> *elements, *elements_new;
+      Local<Value> element;
+      Local<Object> jobj_next;
+      Local<Array> ja;
+      bson_iterator iterator_a;
+      bson_iterator iterator_o;
+      bson_type type;
+
+      elements = elements_local;
+      asize = MGX_ARRAY_CHUNK;
+
+      an = 0;
+      while ((type = bson_iterator_next(iterator))) {
+
+         if (type == BSON_OID) {
+            bson_oid_to_string(bson_iterator_oid(iterator), buffer);
+            element = mongox_new_string8n(isolate, buffer, 24, 1); /* v1.5.17 */
+         }
+         else if (type == BSON_STRING) {
+            element = mongox_bson_string(isolate, iterator, reply); /* v1.5.17 */
+         }
+         else if (type == BSON_INT) {
+            int32 = (int) bson_iterator_int(iterator);
+
+            element = MGX_INTEGER_NEW(int32);
+         }
+         else if (type == BSON_LONG) {
+            int64 = (int64_t) bson_iterator_long(iterator);
+
+            element = MGX_NUMBER_NEW((double) int64);
+         }
+         else if (type == BSON_DOUBLE) {
+            double num = (double) bson_iterator_double(iterator);
+
+            element = MGX_NUMBER_NEW(num);
+         }
+         else if (type == BSON_BOOL) {
+            bson_bool_t num = (bson_bool_t) bson_iterator_bool(iterator);
+
+            element = MGX_BOOLEAN_NEW(num ? true : false);
+         }
+         else if (type == BSON_NULL) {
+/*
+            bson_bool_t num = (bson_bool_t) bson_iterator_bool(iterator);
+*/
+            element = MGX_NULL();
+         }
+         else if (type == BSON_DATE) {
+            bson_date_t num = (bson_date_t) bson_iterator_date(iterator);
+
+            element = MGX_DATE((double) num);
+         }
+         else if (type == BSON_ARRAY) {
+            bson_iterator_subiterator(iterator, &iterator_a);
+
+            element = mongox_parse_bson_array(s, baton, jobj_name, NULL, &iterator_a, context, reply);
+         }
+         else if (type == BSON_OBJECT) {
+            bson_iterator_subiterator(iterator, &iterator_o);
+            jobj_next = MGX_OBJECT_NEW();
+
+            mongox_parse_bson_object(s, baton, jobj_next, (bson *) NULL, &iterator_o, 1, reply);
+
+            element = jobj_next;
+         }
+         else {
+            sprintf(buffer, "BSON Type: %d", type);
+            element = mongox_new_string8(isolate, buffer, 1);
+         }
+
+         if (an == asize) {
+            elements_new = new Local<Value>[asize * 2];
+            for (n = 0; n < an; n ++) {
+               elements_new[n] = elements[n];
+            }
+            if (elements != elements_local) {
+               delete [] elements;
+            }
+            elements = elements_new;
+            asize *= 2;
+         }
+         elements[an ++] = element;
+      }
+
+      ja = mongox_new_array(isolate, elements, an);
+
+      if (elements != elements_local) {
+         delete [] elements;
+      }
+
+      return handle_scope.Escape(ja);
+   }
+
+
+   static int mongox_destroy_baton(mongo_baton_t *baton)
+   {
+      MGXARENA *p_arena;
+
+      /* v1.5.17 */
+      if (baton->queued) {
+         mongox_work_done(baton->s);
+      }
+      p_arena = baton->p_mgxapi->p_arena;
+      mgx_reply_free(baton->p_mgxapi);
+      if (baton->p_mgxapi->bulk_ops) {
+         mongo_bulk_op_destroy(baton->p_mgxapi->bulk_ops, baton->p_mgxapi->bobj_main_list_no);
+      }
+
+      baton->~mongo_baton_t();
+      mgx_arena_release(p_arena);
+
+      return 0;
+   }
+
+
+   static int mongox_string8_length(Isolate * isolate, Local<String> str, int utf8)
+   {
+      if (utf8) {
+#if MGX_NODE_VERSION >= 240000
+         return str->Utf8LengthV2(isolate); /* v1.4.15 */
+#elif MGX_NODE_VERSION >= 120000
+         return str->Utf8Length(isolate);
+#else
+         return str->Utf8Length();
+#endif
+      }
+      else {
+         return str->Length();
+      }
+   }
+
+
+   static Local<String> mongox_new_string8(Isolate * isolate, char * buffer, int utf8)
+   {
+      if (utf8) {
+#if MGX_NODE_VERSION >= 120000
+         return String::NewFromUtf8(isolate, buffer, NewStringType::kNormal).ToLocalChecked();
+#elif MGX_NODE_VERSION >= 1200
+         return String::NewFromUtf8(isolate, buffer);
+#else
+         return String::NewFromUtf8(buffer);
+#endif
+      }
+      else {
+#if MGX_NODE_VERSION >= 100000
+         return String::NewFromOneByte(isolate, (uint8_t *) buffer, NewStringType::kInternalized).ToLocalChecked();
+#elif MGX_NODE_VERSION >= 1200
+         return String::NewFromOneByte(isolate, (uint8_t *) buffer);
+#else
+         return String::New(buffer);
+#endif
+      }
+   }
+
+
+   static Local<String> mongox_new_string8n(Isolate * isolate, char * buffer, unsigned long len, int utf8)
+   {
+      if (utf8) {
+#if MGX_NODE_VERSION >= 120000
+         return String::NewFromUtf8(isolate, buffer, NewStringType::kNormal, len).ToLocalChecked();
+#elif MGX_NODE_VERSION >= 1200
+         return String::NewFromUtf8(isolate, buffer, String::kNormalString, len);
+#else
+         return String::NewFromUtf8(buffer, len);
+#endif
+      }
+      else {
+#if MGX_NODE_VERSION >= 100000
+         return String::NewFromOneByte(isolate, (uint8_t *) buffer, NewStringType::kInternalized, len).ToLocalChecked();
+#elif MGX_NODE_VERSION >= 1200
+         return String::NewFromOneByte(isolate, (uint8_t *) buffer, String::kNormalString, len);
+#else
+         return String::New(buffer);
+#endif
+      }
+   }
+
+
+   /* v1.5.17 */
+   static MGXKEYS * mongox_keys_alloc()
+   {
+      MGXKEYS *p_keys;
+      int n;
+
+      p_keys = new MGXKEYS;
+      for (n = 0; n < MGX_KEY_CACHE_SIZE; n ++) {
+         p_keys->keys[n].len = -1;
+      }
+      return p_keys;
+   }
+
+
+   static int mongox_keys_free(MGXKEYS *p_keys)
+   {
+      int n;
+
+      if (!p_keys) {
+         return 0;
+      }
+      for (n = 0; n < MGX_KEY_CACHE_SIZE; n ++) {
+         p_keys->keys[n].str.Reset();
+      }
+      delete p_keys;
+      return 0;
+   }
+
+
+   /* Return the (internalized) V8 string for a BSON field name, creating it only on a cache miss */
+   static Local<String> mongox_key_string(Isolate * isolate, MGXKEYS *p_keys, char * key)
+   {
+      unsigned int hash;
+      int len;
+      MGXKEY *p_key;
+      Local<String> str;
+
+      hash = 2166136261u;
+      for (len = 0; key[len]; len ++) {
+         hash = (hash ^ (unsigned char) key[len]) * 16777619u;
+      }
+
+      if (!p_keys || len >= MGX_KEY_CACHE_MAX_KEY) {
+         return mongox_new_string8n(isolate, key, (unsigned long) len, 1);
+      }
+
+      p_key = &(p_keys->keys[hash & (MGX_KEY_CACHE_SIZE - 1)]);
+      if (p_key->len == len && !memcmp(p_key->key, key, len)) {
+         return Local<String>::New(isolate, p_key->str);
+      }
+
+#if MGX_NODE_VERSION >= 100000
+      str = String::NewFromUtf8(isolate, key, NewStringType::kInternalized, len).ToLocalChecked();
+#else
+      str = mongox_new_string8n(isolate, key, (unsigned long) len, 1);
+#endif
+      p_key->str.Reset(isolate, str);
+      memcpy(p_key->key, key, len);
+      p_key->len = len;
+
+      return str;
+   }
+
+
+   /* v1.5.17 */
+   static Local<Array> mongox_new_array(Isolate * isolate, Local<Value> *elements, unsigned int n)
+   {
+#if MGX_NODE_VERSION >= 120000
+      return Array::New(isolate, elements, (size_t) n);
+#else
+#if MGX_NODE_VERSION >= 100000
+      Local<Context> icontext = isolate->GetCurrentContext();
+#endif
+      unsigned int an;
+      Local<Array> ja = MGX_ARRAY_NEW(n);
+
+      for (an = 0; an < n; an ++) {
+         MGX_SET(ja, an, elements[an]);
+      }
+      return ja;
+#endif
+   }
+
+
+   /* v1.5.17 */
+   /* Upper bound on the length of a string in UTF-8, obtained without scanning it */
+   static size_t mongox_utf8_max_length(Local<String> str)
+   {
+#if MGX_NODE_VERSION >= 1200
+      return (size_t) str->Length() * (str->IsOneByte() ? 2 : 3);
+#else
+      return (size_t) str->Length() * 3;
+#endif
+   }
+
+
+   /* Write a string in UTF-8 (not null terminated) to a buffer of at least mongox_utf8_max_length() bytes and return its length */
+   /* One-byte strings are copied directly and only re-encoded if they turn out not to be ASCII */
+   static size_t mongox_write_utf8(v8::Isolate * isolate, Local<String> str, char * buffer, size_t buffer_size)
+   {
+#if MGX_NODE_VERSION >= 1200
+      int len;
+
+      if (str->IsOneByte()) {
+         len = str->Length();
+#if MGX_NODE_VERSION >= 240000
+         str->WriteOneByteV2(isolate, 0, len, (uint8_t *) buffer, v8::String::WriteFlags::kNone);
+#elif MGX_NODE_VERSION >= 120000
+         str->WriteOneByte(isolate, (uint8_t *) buffer, 0, len, String::NO_NULL_TERMINATION);
+#else
+         str->WriteOneByte((uint8_t *) buffer, 0, len, String::NO_NULL_TERMINATION);
+#endif
+         if (mgx_is_ascii(buffer, (size_t) len)) {
+            return (size_t) len;
+         }
+      }
+#endif
+
+#if MGX_NODE_VERSION >= 240000
+      return str->WriteUtf8V2(isolate, buffer, buffer_size, v8::String::WriteFlags::kNone);
+#elif MGX_NODE_VERSION >= 120000
+      return (size_t) str->WriteUtf8(isolate, buffer, (int) buffer_size, NULL, String::NO_NULL_TERMINATION);
+#else
+      return (size_t) str->WriteUtf8(buffer, (int) buffer_size, NULL, String::NO_NULL_TERMINATION);
+#endif
+   }
+
+
+   static int mongox_write_char8(v8::Isolate * isolate, Local<String> str, char * buffer, int buffer_size, int utf8)
+   {
+      if (utf8) {
+#if MGX_NODE_VERSION >= 240000
+         return str->WriteUtf8V2(isolate, buffer, buffer_size, v8::String::WriteFlags::kNullTerminate); /* v1.4.15 */
+#elif MGX_NODE_VERSION >= 120000
+         return str->WriteUtf8(isolate, buffer);
+#else
+         return str->WriteUtf8(buffer);
+#endif
+      }
+      else {
+#if MGX_NODE_VERSION >= 240000
+         str->WriteOneByteV2(isolate, 0, str->Length(), (uint8_t *) buffer, v8::String::WriteFlags::kNullTerminate); /* v1.4.15 */
+         return 0;
+#elif MGX_NODE_VERSION >= 120000
+         return str->WriteOneByte(isolate, (uint8_t *) buffer);
+#elif MGX_NODE_VERSION >= 1200
+         return str->WriteOneByte((uint8_t *) buffer);
+#else
+         return str->WriteAscii((char *) buffer);
+#endif
+      }
+   }
+
+
+   static void mongox_invoke_callback(uv_work_t *req, int status)
+   {
+      Isolate* isolate = Isolate::GetCurrent();
+      HandleScope scope(isolate);
+      mongo_baton_t *baton = static_cast<mongo_baton_t *>(req->data);
+      /* ev_unref(EV_DEFAULT_UC); */
+      baton->s->Unref();
+
+      Local<Value> argv[2];
+
+#if MGX_NODE_VERSION >= 140800
+      /* v1.5.17: the result can't be delivered (and the field name cache may already be gone) */
+      if (mongox_env_stopping(isolate, baton->s)) {
+         if (baton->p_conn) {
+            mongox_pool_release(baton->s, baton->p_conn);
+            baton->p_conn = NULL;
+         }
+         mongox_discard_baton(baton);
+         delete req;
+         return;
+      }
+#endif
+
+      baton->json_result = mongox_result_object(baton, 1);
+
+      /* v1.5.17 */
+      if (baton->p_mgxapi->context == MGX_METHOD_OPEN && !baton->result_iserror) {
+         baton->s->open = 1;
+      }
+      if (baton->p_conn) {
+         mongox_pool_release(baton->s, baton->p_conn);
+         baton->p_conn = NULL;
+      }
+
+      if (baton->result_iserror)
+         argv[0] = MGX_INTEGER_NEW(true);
+      else
+         argv[0] = MGX_INTEGER_NEW(false);
+
+      if (baton->result_isarray)
+         argv[1] = baton->array_result;
+      else
+         argv[1] = baton->json_result;
+
+#if MGX_NODE_VERSION >= 40000
+      TryCatch try_catch(isolate);
+#else
+      TryCatch try_catch;
+#endif
+
+      Local<Function> cb = Local<Function>::New(isolate, baton->cb);
+
+#if MGX_NODE_VERSION >= 120000
+      /* cb->Call(isolate->GetCurrentContext(), isolate->GetCurrentContext()->Global(), 2, argv); */
+      /* v1.5.17: empty if the callback threw (see try_catch) or if JavaScript can no longer run (environment teardown) */
+      cb->Call(isolate->GetCurrentContext(), Null(isolate), 2, argv).IsEmpty();
+#else
+      cb->Call(isolate->GetCurrentContext()->Global(), 2, argv);
+#endif
+
+
+#if MGX_NODE_VERSION >= 40000
+      if (try_catch.HasCaught() && !try_catch.HasTerminated()) { /* v1.5.17 */
+         FatalException(isolate, try_catch);
+      }
+#else
+      if (try_catch.HasCaught()) {
+         FatalException(isolate, try_catch);
+      }
+#endif
+
+      baton->cb.Reset();
+
+	   MGX_MONGOAPI_END();
+
+      mongox_destroy_baton(baton);
+
+      delete req;
+      return;
+   }
+
+ 
+   /* v1.5.17 */
+   static void mongox_free_buffer(char *data, void *hint)
+   {
+      bson_free(hint);
+   }
+
+
+   /* v1.5.17 */
+   static void mongox_free_reply(char *data, void *hint)
+   {
+      mongo_reply_free((mongo_reply *) hint);
+   }
+
+
+   static Local<Object> mongox_result_object(mongo_baton_t * baton, int context)
+   {
+      Isolate* isolate = Isolate::GetCurrent();
+#if MGX_NODE_VERSION >= 100000
+      Local<Context> icontext = isolate->GetCurrentContext();
+#endif
+      EscapableHandleScope handle_scope(isolate);
+      int n;
+      Local<String> key;
+      Local<String> value;
+      Local<String> error;
+      Local<Object> jobj;
+      Local<Array> jobj_array;
+
+      baton->result_iserror = 0;
+      baton->result_isarray = 0;
+
+      baton->json_result = MGX_OBJECT_NEW();
+
+      if (baton->p_mgxapi->error[0]) {
+
+         baton->result_iserror = 1;
+
+         error = mongox_new_string8(isolate, baton->p_mgxapi->error, 1);
+         key = mongox_new_string8(isolate, (char *) "ErrorMessage", 1);
+         MGX_SET(baton->json_result, key, error);
+
+         key = mongox_new_string8(isolate, (char *) "ErrorCode", 1);
+         MGX_SET(baton->json_result, key, MGX_INTEGER_NEW(baton->p_mgxapi->error_code));
+
+         key = mongox_new_string8(isolate, (char *) "ok", 1);
+         MGX_SET(baton->json_result, key, MGX_INTEGER_NEW(false));
+      }
+      else {
+         if (baton->p_mgxapi->context == MGX_METHOD_RETRIEVE) {
+            int an;
+            char *data;
+            bson bobj;
+            bson_iterator iterator;
+            MGXREPLY *p_mgxreply;
+            Local<Object> jobj;
+            Local<Value> *elements;
+            Local<Array> a_subs;
+
+            /* v1.5.17 */
+            /* Gather the documents (or raw batches) first so that the data array can be created in one step */
+            an = 0;
+            for (p_mgxreply = baton->p_mgxapi->p_mgxreply_head; p_mgxreply; p_mgxreply = p_mgxreply->p_next) {
+               an += baton->p_mgxapi->raw_bson ? 1 : p_mgxreply->reply->fields.num;
+            }
+            elements = an ? new Local<Value>[an] : NULL;
+
+            an = 0;
+
+            if (baton->p_mgxapi->raw_bson) {
+               /* One Buffer per batch: each takes ownership of its reply so the documents are not copied */
+               for (p_mgxreply = baton->p_mgxapi->p_mgxreply_head; p_mgxreply; p_mgxreply = p_mgxreply->p_next) {
+                  data = &(p_mgxreply->reply->objs);
+                  n = p_mgxreply->reply->head.len - (int) (sizeof(mongo_header) + sizeof(mongo_reply_fields));
+                  elements[an ++] = MGX_BUFFER_NEW(data, (size_t) n, mongox_free_reply, (void *) p_mgxreply->reply);
+                  p_mgxreply->reply = NULL;
+               }
+            }
+
+            for (p_mgxreply = baton->p_mgxapi->p_mgxreply_head; p_mgxreply && p_mgxreply->reply; p_mgxreply = p_mgxreply->p_next) {
+               data = &(p_mgxreply->reply->objs);
+               for (n = 0; n < p_mgxreply->reply->fields.num; n ++) {
+                  bson_init_finished_data(&bobj, data, 0);
+
+                  jobj = MGX_OBJECT_NEW();
+
+                  mongox_parse_bson_object(baton->s, baton, jobj, &bobj, &iterator, 0, p_mgxreply->reply);
+
+                  elements[an ++] = jobj;
+                  data += bson_size(&bobj);
+               }
+            }
+
+            a_subs = mongox_new_array(isolate, elements, an);
+            if (elements) {
+               delete [] elements;
+            }
+
+            key = mongox_new_string8(isolate, (char *) "ok", 1);
+            MGX_SET(baton->json_result, key, MGX_INTEGER_NEW(true));
+
+            key = mongox_new_string8(isolate, (char *) "data", 1);
+            MGX_SET(baton->json_result, key, a_subs);
+         }
+         else if (baton->p_mgxapi->context == MGX_METHOD_COMMAND || baton->p_mgxapi->context == MGX_METHOD_CREATE_INDEX) {
+            bson_iterator iterator;
+            Local<Object> jobj;
+
+            jobj = MGX_OBJECT_NEW();
+
+            key = mongox_new_string8(isolate, (char *) "ok", 1);
+            MGX_SET(baton->json_result, key, MGX_INTEGER_NEW(true));
+
+            key = mongox_new_string8(isolate, (char *) "data", 1);
+
+            /* v1.5.17 */
+            if (baton->p_mgxapi->raw_bson && baton->p_mgxapi->bobj_main->data) {
+               bson *bobj = baton->p_mgxapi->bobj_main;
+               MGX_SET(baton->json_result, key, MGX_BUFFER_NEW(bobj->data, (size_t) bson_size(bobj), mongox_free_buffer, (void *) bobj->data));
+               bobj->data = NULL;
+               bobj->ownsData = 0;
+            }
+            else {
+               mongox_parse_bson_object(baton->s, baton, jobj, baton->p_mgxapi->bobj_main, &iterator, 0, NULL);
+               MGX_SET(baton->json_result, key, jobj);
+            }
+         }
+         else {
+            key = mongox_new_string8(isolate, (char *) "ok", 1);
+            MGX_SET(baton->json_result, key, MGX_INTEGER_NEW(true));
+
+            if (baton->p_mgxapi->context == MGX_METHOD_VERSION || baton->p_mgxapi->context == MGX_METHOD_ABOUT || baton->p_mgxapi->context == MGX_METHOD_OBJECT_ID) {
+               key = mongox_new_string8(isolate, (char *) "result", 1);
+               if (baton->p_mgxapi->output)
+                  value = mongox_new_string8(isolate, baton->p_mgxapi->output, 1);
+               else
+                  value = mongox_new_string8(isolate, (char *) "", 1);
+               MGX_SET(baton->json_result, key, value);
+            }
+            else {
+               key = mongox_new_string8(isolate, (char *) "result", 1);
+               MGX_SET(baton->json_result, key, MGX_INTEGER_NEW(baton->p_mgxapi->output_integer));
+               if (baton->p_mgxapi->context == MGX_METHOD_INSERT) {
+                  key = mongox_new_string8(isolate, baton->p_mgxapi->jobj_main_list[0].oid_name, 1);
+                  value = mongox_new_string8(isolate, baton->p_mgxapi->jobj_main_list[0].oid_value, 1);
+                  MGX_SET(baton->json_result, key, value);
+               }
+               else if (baton->p_mgxapi->context == MGX_METHOD_INSERT_BATCH) {
+                  jobj_array = MGX_ARRAY_NEW(0);
+                  key = mongox_new_string8(isolate, (char *) "data", 1);
+                  MGX_SET(baton->json_result, key, jobj_array);
+                  for (n = 0; n < baton->p_mgxapi->bobj_main_list_no; n ++) {
+                     jobj = MGX_OBJECT_NEW();
+                     MGX_SET(jobj_array, n, jobj);
+                     key = mongox_new_string8(isolate, baton->p_mgxapi->jobj_main_list[n].oid_name, 1);
+                     value = mongox_new_string8(isolate, baton->p_mgxapi->jobj_main_list[n].oid_value, 1);
+                     MGX_SET(jobj, key, value);
+                  }
+               }
+               else if (baton->p_mgxapi->context == MGX_METHOD_BULK_WRITE) { /* v1.5.17 */
+                  mongo_bulk_result *result = &(baton->p_mgxapi->bulk_result);
+                  mongo_bulk_op *op;
+                  bson_iterator iterator;
+
+                  key = mongox_new_string8(isolate, (char *) "inserted", 1);
+                  MGX_SET(baton->json_result, key, MGX_INTEGER_NEW(result->inserted));
+                  key = mongox_new_string8(isolate, (char *) "matched", 1);
+                  MGX_SET(baton->json_result, key, MGX_INTEGER_NEW(result->matched));
+                  if (result->modified >= 0) {
+                     key = mongox_new_string8(isolate, (char *) "modified", 1);
+                     MGX_SET(baton->json_result, key, MGX_INTEGER_NEW(result->modified));
+                  }
+                  key = mongox_new_string8(isolate, (char *) "upserted", 1);
+                  MGX_SET(baton->json_result, key, MGX_INTEGER_NEW(result->upserted));
+                  key = mongox_new_string8(isolate, (char *) "removed", 1);
+                  MGX_SET(baton->json_result, key, MGX_INTEGER_NEW(result->removed));
+                  key = mongox_new_string8(isolate, (char *) "errors", 1);
+                  MGX_SET(baton->json_result, key, MGX_INTEGER_NEW(result->errors));
+
+                  jobj_array = MGX_ARRAY_NEW(0);
+                  key = mongox_new_string8(isolate, (char *) "data", 1);
+                  MGX_SET(baton->json_result, key, jobj_array);
+                  for (n = 0; n < baton->p_mgxapi->bobj_main_list_no; n ++) {
+                     op = &(baton->p_mgxapi->bulk_ops[n]);
+                     jobj = MGX_OBJECT_NEW();
+                     MGX_SET(jobj_array, n, jobj);
+                     key = mongox_new_string8(isolate, (char *) "ok", 1);
+                     MGX_SET(jobj, key, MGX_INTEGER_NEW(op->err == 0));
+                     if (op->type == MONGO_BULK_INSERT) {
+                        key = mongox_new_string8(isolate, baton->p_mgxapi->jobj_main_list[n].oid_name, 1);
+                        value = mongox_new_string8(isolate, baton->p_mgxapi->jobj_main_list[n].oid_value, 1);
+                        MGX_SET(jobj, key, value);
+                     }
+                     else if (op->upserted.data) {
+                        mongox_parse_bson_object(baton->s, baton, jobj, &(op->upserted), &iterator, 0, NULL);
+                     }
+                     if (op->err) {
+                        key = mongox_new_string8(isolate, (char *) "ErrorCode", 1);
+                        MGX_SET(jobj, key, MGX_INTEGER_NEW(op->err));
+                        key = mongox_new_string8(isolate, (char *) "ErrorMessage", 1);
+                        value = mongox_new_string8(isolate, op->err == MONGO_BULK_NOT_EXECUTED ? (char *) "Not executed" : op->errstr, 1);
+                        MGX_SET(jobj, key, value);
+                     }
+                  }
+               }
+               else if (baton->p_mgxapi->context == MGX_METHOD_OBJECT_ID_DATE) {
+                  key = mongox_new_string8(isolate, (char *) "DateText", 1);
+                  value = mongox_new_string8(isolate, baton->p_mgxapi->output, 1);
+                  MGX_SET(baton->json_result, key, value);
+               }
+            }
+         }
+      }
+
+      if (baton->result_isarray) {
+         return handle_scope.Escape(baton->array_result);
+      }
+      else {
+         return handle_scope.Escape(baton->json_result);
+      }
+   }
+
+
+   static void About(const FunctionCallbackInfo<Value>& args)
+   {
+      Isolate* isolate = args.GetIsolate();
+      HandleScope scope(isolate);
+      short async;
+      MGXARENASTACK arena_stack; /* v1.5.17 */
+      int js_narg;
+      server * s = ObjectWrap::Unwrap<server>(args.This());
+      s->m_count ++;
+
+      MGX_CALLBACK_FUN(js_narg, cb, async);
+
+      mongo_baton_t *baton = mongox_make_baton(s, js_narg, args, MGX_METHOD_ABOUT, async ? NULL : &arena_stack);
+      MGX_MONGOAPI_ERROR();
+
+      baton->s = s;
+
+      if (async) {
+
+         Local<Function> cb = Local<Function>::Cast(args[js_narg]);
+         baton->isolate = isolate;
+         baton->cb.Reset(isolate, cb);
+
+         s->Ref();
+
+         mongox_queue_task((void *) EIO_About, (void *) mongox_invoke_callback, baton, 0); /* v1.4.14 */
+
+         return;
+      }
+
+      s->mongox_mgx_version(s, baton);
+
+      Local<String> result = mongox_new_string8(isolate, baton->p_mgxapi->output, 1);
+      mongox_destroy_baton(baton);
+
+      MGX_RETURN_VALUE(result);
+   }
+
+
+   static void EIO_About(uv_work_t *req)
+   {
+      mongo_baton_t *baton = static_cast<mongo_baton_t *>(req->data);
+
+      baton->s->mongox_mgx_version(baton->s, baton);
+
+      baton->s->m_count += baton->increment_by;
+
+      return;
+   }
+
+
+   static void Version(const FunctionCallbackInfo<Value>& args)
+   {
+      Isolate* isolate = args.GetIsolate();
+      HandleScope scope(isolate);
+      short async;
+      MGXARENASTACK arena_stack; /* v1.5.17 */
+      int js_narg;
+      server *s = ObjectWrap::Unwrap<server>(args.This());
+      s->m_count ++;
+
+      MGX_CALLBACK_FUN(js_narg, cb, async);
+
+      mongo_baton_t *baton = mongox_make_baton(s, js_narg, args, MGX_METHOD_VERSION, async ? NULL : &arena_stack);
+      MGX_MONGOAPI_ERROR();
+
+      baton->s = s;
+
+      if (async) {
+
+         Local<Function> cb = Local<Function>::Cast(args[js_narg]);
+         baton->isolate = isolate;
+         baton->cb.Reset(isolate, cb);
+
+         s->Ref();
+
+         mongox_queue_task((void *) EIO_Version, (void *) mongox_invoke_callback, baton, 0); /* v1.4.14 */
+
+         return;
+      }
+
+      s->mongox_mgx_version(s, baton);
+
+      Local<String> result = mongox_new_string8(isolate, baton->p_mgxapi->output, 1);
+      mongox_destroy_baton(baton);
+
+      MGX_RETURN_VALUE(result);
+   }
+
+
+   static void EIO_Version(uv_work_t *req)
+   {
+      mongo_baton_t *baton = static_cast<mongo_baton_t *>(req->data);
+
+      baton->s->mongox_mgx_version(baton->s, baton);
+
+      baton->s->m_count += baton->increment_by;
+
+      return;
+   }
+
+
+   static void Open(const FunctionCallbackInfo<Value>& args)
+   {
+      Isolate* isolate = args.GetIsolate();
+      HandleScope scope(isolate);
+      short async;
+      MGXARENASTACK arena_stack; /* v1.5.17 */
+      int ret, js_narg;
+      Local<Object> json_result;
+      server *s = ObjectWrap::Unwrap<server>(args.This());
+      s->m_count ++;
+
+      MGX_CALLBACK_FUN(js_narg, cb, async);
+
+      mongo_baton_t *baton = mongox_make_baton(s, js_narg, args, MGX_METHOD_OPEN, async ? NULL : &arena_stack);
+      MGX_MONGOAPI_ERROR();
+
+      baton->s = s;
+
+      if (async) {
+
+         Local<Function> cb = Local<Function>::Cast(args[js_narg]);
+         baton->isolate = isolate;
+         baton->cb.Reset(isolate, cb);
+
+         s->Ref();
+
+         mongox_queue_task((void *) EIO_Open, (void *) mongox_invoke_callback, baton, 0); /* v1.4.14 */
+
+         return;
+      }
+
+      ret = s->mongox_open(s, baton);
+
+      if (ret == MONGO_OK) {
+         s->open = 1; 
+      }
+      baton->json_result = mongox_result_object(baton, 0);
+      json_result = baton->json_result;
+      mongox_destroy_baton(baton);
+
+      MGX_RETURN_VALUE(json_result);
+   }
+
+
+   static void EIO_Open(uv_work_t *req)
+   {
+      mongo_baton_t *baton = static_cast<mongo_baton_t *>(req->data);
+
+      baton->s->mongox_open(baton->s, baton);
+
+      baton->s->m_count += baton->increment_by;
+
+      return;
+   }
+
+
+   static void Close(const FunctionCallbackInfo<Value>& args)
+   {
+      Isolate* isolate = args.GetIsolate();
+      HandleScope scope(isolate);
+      short async;
+      MGXARENASTACK arena_stack; /* v1.5.17 */
+      int js_narg;
+      Local<Object> json_result;
+      server *s = ObjectWrap::Unwrap<server>(args.This());
+      s->m_count ++;
+
+      MGX_MONGOAPI_START();
+
+      /* v1.5.17 */
+      mongox_coalesce_flush_all(s);
+      if (s->p_coalesce_timer) {
+         uv_close((uv_handle_t *) s->p_coalesce_timer, mongox_timer_closed);
+         s->p_coalesce_timer = NULL;
+      }
+      if (s->p_idle_timer) {
+         uv_close((uv_handle_t *) s->p_idle_timer, mongox_timer_closed);
+         s->p_idle_timer = NULL;
+      }
+
+      s->open = 0;
+      mongox_pool_close(s); /* v1.5.17 */
+
+      MGX_CALLBACK_FUN(js_narg, cb, async);
+
+      mongo_baton_t *baton = mongox_make_baton(s, js_narg, args, MGX_METHOD_CLOSE, async ? NULL : &arena_stack);
+      MGX_MONGOAPI_ERROR();
+
+      baton->s = s;
+
+      if (async) {
+
+         Local<Function> cb = Local<Function>::Cast(args[js_narg]);
+         baton->isolate = isolate;
+         baton->cb.Reset(isolate, cb);
+
+         s->Ref();
+
+         mongox_queue_task((void *) EIO_Close, (void *) mongox_invoke_callback, baton, 0); /* v1.4.14 */
+
+         return;
+      }
+
+      s->mongox_close(s, baton);
+
+      MGX_MONGOAPI_END();
+
+      baton->json_result = mongox_result_object(baton, 0);
+      json_result = baton->json_result;
+      mongox_destroy_baton(baton);
+
+      MGX_RETURN_VALUE(json_result);
+   }
+
+
+   static void EIO_Close(uv_work_t *req)
+   {
+      mongo_baton_t *baton = static_cast<mongo_baton_t *>(req->data);
+
+      baton->s->mongox_close(baton->s, baton);
+
+      baton->s->m_count += baton->increment_by;
+
+      return;
+   }
+
+
+   static void Retrieve(const FunctionCallbackInfo<Value>& args)
+   {
+      Isolate* isolate = args.GetIsolate();
+      HandleScope scope(isolate);
+      short async;
+      MGXARENASTACK arena_stack; /* v1.5.17 */
+      int js_narg;
+      Local<Object> json_result;
+      server *s = ObjectWrap::Unwrap<server>(args.This());
+      s->m_count ++;
+
+      MGX_CALLBACK_FUN(js_narg, cb, async);
+
+      mongo_baton_t *baton = mongox_make_baton(s, js_narg, args, MGX_METHOD_RETRIEVE, async ? NULL : &arena_stack);
+      MGX_MONGOAPI_ERROR();
+
+      baton->s = s;
+
+      MGX_MONGOAPI_START();
+
+      if (async) {
+
+         Local<Function> cb = Local<Function>::Cast(args[js_narg]);
+         baton->isolate = isolate;
+         baton->cb.Reset(isolate, cb);
+
+         s->Ref();
+
+         mongox_queue_task((void *) EIO_Retrieve, (void *) mongox_invoke_callback, baton, 0); /* v1.4.14 */
+
+         return;
+      }
+
+      s->mongox_retrieve(s, baton);
+
+      MGX_MONGOAPI_END();
+
+      baton->json_result = mongox_result_object(baton, 0);
+      json_result = baton->json_result;
+      mongox_destroy_baton(baton);
+
+      MGX_RETURN_VALUE(json_result);
+   }
+
+
+   static void EIO_Retrieve(uv_work_t *req)
+   {
+      mongo_baton_t *baton = static_cast<mongo_baton_t *>(req->data);
+
+      baton->s->mongox_retrieve(baton->s, baton);
+
+      baton->s->m_count += baton->increment_by;
+
+      return;
+   }
+
+
+   /* v1.5.17 */
+   static Local<Value> mongox_cursor_constructor(Isolate *isolate);
+   static int mongox_cursor_init(Isolate *isolate, Local<Object> cobj, server *s, Local<Object> sobj, mongo_baton_t *baton);
+
+   static void Cursor(const FunctionCallbackInfo<Value>& args)
+   {
+      Isolate* isolate = args.GetIsolate();
+#if MGX_NODE_VERSION >= 100000
+      Local<Context> icontext = isolate->GetCurrentContext();
+#endif
+      HandleScope scope(isolate);
+      int js_narg;
+      MGXARENASTACK arena_stack; /* v1.5.17 */
+      Local<Object> cobj;
+      server * s = ObjectWrap::Unwrap<server>(args.This());
+      s->m_count ++;
+
+      js_narg = args.Length();
+
+      mongo_baton_t *baton = mongox_make_baton(s, js_narg, args, MGX_METHOD_CURSOR, &arena_stack);
+      MGX_MONGOAPI_ERROR();
+
+      baton->s = s;
+
+      MGX_MONGOAPI_START();
+
+      /* No I/O takes place until the first batch is requested */
+      Local<Function> cons = Local<Function>::Cast(args.Data());
+#if MGX_NODE_VERSION >= 100000
+      cobj = cons->NewInstance(icontext, 0, NULL).ToLocalChecked();
+#else
+      cobj = cons->NewInstance();
+#endif
+      mongox_cursor_init(isolate, cobj, s, args.This(), baton);
+      mongox_destroy_baton(baton);
+
+      MGX_RETURN_VALUE(cobj);
+   }
+
+
+   static void Insert(const FunctionCallbackInfo<Value>& args)
+   {
+      Isolate* isolate = args.GetIsolate();
+      HandleScope scope(isolate);
+      short async;
+      MGXARENASTACK arena_stack; /* v1.5.17 */
+      int js_narg;
+      Local<Object> json_result;
+      server * s = ObjectWrap::Unwrap<server>(args.This());
+      s->m_count ++;
+
+      MGX_CALLBACK_FUN(js_narg, cb, async);
+
+      mongo_baton_t *baton = mongox_make_baton(s, js_narg, args, MGX_METHOD_INSERT, async ? NULL : &arena_stack);
+      MGX_MONGOAPI_ERROR();
+
+      baton->s = s;
+
+      MGX_MONGOAPI_START();
+
+      if (async) {
+
+         Local<Function> cb = Local<Function>::Cast(args[js_narg]);
+         baton->isolate = isolate;
+         baton->cb.Reset(isolate, cb);
+
+         s->Ref();
+
+         /* v1.5.17 */
+         if (s->coalesce_window) {
+            mongox_coalesce_add(s, baton);
+            return;
+         }
+
+         mongox_queue_task((void *) EIO_Insert, (void *) mongox_invoke_callback, baton, 0); /* v1.4.14 */
+
+         return;
+      }
+
+      s->mongox_insert(s, baton);
+
+      MGX_MONGOAPI_END();
+
+      baton->json_result = mongox_result_object(baton, 0);
+      json_result = baton->json_result;
+      mongox_destroy_baton(baton);
+
+      MGX_RETURN_VALUE(json_result);
+   }
+
+
+   static void EIO_Insert(uv_work_t *req)
+   {
+      mongo_baton_t *baton = static_cast<mongo_baton_t *>(req->data);
+
+      baton->s->mongox_insert(baton->s, baton);
+
+      baton->s->m_count += baton->increment_by;
+
+      return;
+   }
+
+
+   static void Insert_Batch(const FunctionCallbackInfo<Value>& args)
+   {
+      Isolate* isolate = args.GetIsolate();
+      HandleScope scope(isolate);
+      short async;
+      MGXARENASTACK arena_stack; /* v1.5.17 */
+      int js_narg;
+      Local<Object> json_result;
+      server * s = ObjectWrap::Unwrap<server>(args.This());
+      s->m_count ++;
+
+      MGX_CALLBACK_FUN(js_narg, cb, async);
+
+      mongo_baton_t *baton = mongox_make_baton(s, js_narg, args, MGX_METHOD_INSERT_BATCH, async ? NULL : &arena_stack);
+      MGX_MONGOAPI_ERROR();
+
+      baton->s = s;
+
+      MGX_MONGOAPI_START();
+
+      if (async) {
+
+         Local<Function> cb = Local<Function>::Cast(args[js_narg]);
+         baton->isolate = isolate;
+         baton->cb.Reset(isolate, cb);
+
+         s->Ref();
+
+         mongox_queue_task((void *) EIO_Insert_Batch, (void *) mongox_invoke_callback, baton, 0); /* v1.4.14 */
+
+         return;
+      }
 
-      baton->result_iserror = 0;
-      baton->result_isarray = 0;
+      s->mongox_insert_batch(s, baton);
 
-      baton->json_result = MGX_OBJECT_NEW();
+      MGX_MONGOAPI_END();
 
-      if (baton->p_mgxapi->error[0]) {
+      baton->json_result = mongox_result_object(baton, 0);
+      json_result = baton->json_result;
+      mongox_destroy_baton(baton);
 
-         baton->result_iserror = 1;
+      MGX_RETURN_VALUE(json_result);
+   }
 
-         error = mongox_new_string8(isolate, baton->p_mgxapi->error, 1);
-         key = mongox_new_string8(isolate, (char *) "ErrorMessage", 1);
-         MGX_SET(baton->json_result, key, error);
+   static void EIO_Insert_Batch(uv_work_t *req)
+   {
+      mongo_baton_t *baton = static_cast<mongo_baton_t *>(req->data);
 
-         key = mongox_new_string8(isolate, (char *) "ErrorCode", 1);
-         MGX_SET(baton->json_result, key, MGX_INTEGER_NEW(baton->p_mgxapi->error_code));
+      baton->s->mongox_insert_batch(baton->s, baton);
 
-         key = mongox_new_string8(isolate, (char *) "ok", 1);
-         MGX_SET(baton->json_result, key, MGX_INTEGER_NEW(false));
-      }
-      else {
-         if (baton->p_mgxapi->context == MGX_METHOD_RETRIEVE) {
-            int an;
-            bson *bobj;
-            bson_iterator iterator;
-            Local<Object> jobj;
-            Local<Array> a_subs = MGX_ARRAY_NEW(0);
+      baton->s->m_count += baton->increment_by;
 
-            key = mongox_new_string8(isolate, (char *) "ok", 1);
-            MGX_SET(baton->json_result, key, MGX_INTEGER_NEW(true));
+      return;
+   }
 
-            key = mongox_new_string8(isolate, (char *) "data", 1);
-            MGX_SET(baton->json_result, key, a_subs);
 
-            an = 0;
+   /* v1.5.17 */
+   static void Bulk_Write(const FunctionCallbackInfo<Value>& args)
+   {
+      Isolate* isolate = args.GetIsolate();
+      HandleScope scope(isolate);
+      short async;
+      MGXARENASTACK arena_stack;
+      int js_narg;
+      Local<Object> json_result;
+      server * s = ObjectWrap::Unwrap<server>(args.This());
+      s->m_count ++;
 
-            while ((ret = mongo_cursor_next(baton->p_mgxapi->cursor)) == MONGO_OK ) {
-               /* bson_print(&(cursor->current)); */
+      MGX_CALLBACK_FUN(js_narg, cb, async);
 
-               bobj = (bson *) mongo_cursor_bson(baton->p_mgxapi->cursor);
+      mongo_baton_t *baton = mongox_make_baton(s, js_narg, args, MGX_METHOD_BULK_WRITE, async ? NULL : &arena_stack);
+      MGX_MONGOAPI_ERROR();
 
-               jobj = MGX_OBJECT_NEW();
+      baton->s = s;
 
-               ret = mongox_parse_bson_object(baton->s, baton, jobj, bobj, &iterator, 0);
+      MGX_MONGOAPI_START();
 
-               MGX_SET(a_subs, an, jobj);
+      if (async) {
 
-               an ++;
+         Local<Function> cb = Local<Function>::Cast(args[js_narg]);
+         baton->isolate = isolate;
+         baton->cb.Reset(isolate, cb);
 
-            }
-            mongo_cursor_destroy(baton->p_mgxapi->cursor);
-         }
-         else if (baton->p_mgxapi->context == MGX_METHOD_COMMAND || baton->p_mgxapi->context == MGX_METHOD_CREATE_INDEX) {
-            bson_iterator iterator;
-            Local<Object> jobj;
+         s->Ref();
 
-            jobj = MGX_OBJECT_NEW();
+         mongox_queue_task((void *) EIO_Bulk_Write, (void *) mongox_invoke_callback, baton, 0);
 
-            key = mongox_new_string8(isolate, (char *) "ok", 1);
-            MGX_SET(baton->json_result, key, MGX_INTEGER_NEW(true));
+         return;
+      }
 
-            key = mongox_new_string8(isolate, (char *) "data", 1);
+      s->mongox_bulk_write(s, baton);
 
-            ret = mongox_parse_bson_object(baton->s, baton, jobj, baton->p_mgxapi->bobj_main, &iterator, 0);
-            MGX_SET(baton->json_result, key, jobj);
-         }
-         else {
-            key = mongox_new_string8(isolate, (char *) "ok", 1);
-            MGX_SET(baton->json_result, key, MGX_INTEGER_NEW(true));
+      MGX_MONGOAPI_END();
 
-            if (baton->p_mgxapi->context == MGX_METHOD_VERSION || baton->p_mgxapi->context == MGX_METHOD_ABOUT || baton->p_mgxapi->context == MGX_METHOD_OBJECT_ID) {
-               key = mongox_new_string8(isolate, (char *) "result", 1);
-               if (baton->p_mgxapi->output)
-                  value = mongox_new_string8(isolate, baton->p_mgxapi->output, 1);
-               else
-                  value = mongox_new_string8(isolate, (char *) "", 1);
-               MGX_SET(baton->json_result, key, value);
-            }
-            else {
-               key = mongox_new_string8(isolate, (char *) "result", 1);
-               MGX_SET(baton->json_result, key, MGX_INTEGER_NEW(baton->p_mgxapi->output_integer));
-               if (baton->p_mgxapi->context == MGX_METHOD_INSERT) {
-                  key = mongox_new_string8(isolate, baton->p_mgxapi->jobj_main_list[0].oid_name, 1);
-                  value = mongox_new_string8(isolate, baton->p_mgxapi->jobj_main_list[0].oid_value, 1);
-                  MGX_SET(baton->json_result, key, value);
-               }
-               else if (baton->p_mgxapi->context == MGX_METHOD_INSERT_BATCH) {
-                  jobj_array = MGX_ARRAY_NEW(0);
-                  key = mongox_new_string8(isolate, (char *) "data", 1);
-                  MGX_SET(baton->json_result, key, jobj_array);
-                  for (n = 0; n < baton->p_mgxapi->bobj_main_list_no; n ++) {
-                     jobj = MGX_OBJECT_NEW();
-                     MGX_SET(jobj_array, n, jobj);
-                     key = mongox_new_string8(isolate, baton->p_mgxapi->jobj_main_list[n].oid_name, 1);
-                     value = mongox_new_string8(isolate, baton->p_mgxapi->jobj_main_list[n].oid_value, 1);
-                     MGX_SET(jobj, key, value);
-                  }
-               }
-               else if (baton->p_mgxapi->context == MGX_METHOD_OBJECT_ID_DATE) {
-                  key = mongox_new_string8(isolate, (char *) "DateText", 1);
-                  value = mongox_new_string8(isolate, baton->p_mgxapi->output, 1);
-                  MGX_SET(baton->json_result, key, value);
-               }
-            }
-         }
-      }
+      baton->json_result = mongox_result_object(baton, 0);
+      json_result = baton->json_result;
+      mongox_destroy_baton(baton);
 
-      if (baton->result_isarray) {
-         return handle_scope.Escape(baton->array_result);
-      }
-      else {
-         return handle_scope.Escape(baton->json_result);
-      }
+      MGX_RETURN_VALUE(json_result);
    }
 
+   static void EIO_Bulk_Write(uv_work_t *req)
+   {
+      mongo_baton_t *baton = static_cast<mongo_baton_t *>(req->data);
 
-   static void About(const FunctionCallbackInfo<Value>& args)
+      baton->s->mongox_bulk_write(baton->s, baton);
+
+      baton->s->m_count += baton->increment_by;
+
+      return;
+   }
+
+
+   static void Update(const FunctionCallbackInfo<Value>& args)
    {
       Isolate* isolate = args.GetIsolate();
       HandleScope scope(isolate);
       short async;
+      MGXARENASTACK arena_stack; /* v1.5.17 */
       int js_narg;
+      Local<Object> json_result;
       server * s = ObjectWrap::Unwrap<server>(args.This());
       s->m_count ++;
 
       MGX_CALLBACK_FUN(js_narg, cb, async);
 
-      mongo_baton_t *baton = mongox_make_baton(s, js_narg, args, MGX_METHOD_ABOUT);
+      mongo_baton_t *baton = mongox_make_baton(s, js_narg, args, MGX_METHOD_UPDATE, async ? NULL : &arena_stack);
       MGX_MONGOAPI_ERROR();
 
       baton->s = s;
 
+      MGX_MONGOAPI_START();
+
       if (async) {
 
          Local<Function> cb = Local<Function>::Cast(args[js_narg]);
@@ -2111,25 +5312,28 @@ mongox_make_baton_exit:
 
          s->Ref();
 
-         mongox_queue_task((void *) EIO_About, (void *) mongox_invoke_callback, baton, 0); /* v1.4.14 */
+         mongox_queue_task((void *) EIO_Update, (void *) mongox_invoke_callback, baton, 0); /* v1.4.14 */
 
          return;
       }
 
-      s->mongox_mgx_version(s, baton);
+      s->mongox_update(s, baton);
 
-      Local<String> result = mongox_new_string8(isolate, baton->p_mgxapi->output, 1);
+      MGX_MONGOAPI_END();
+
+      baton->json_result = mongox_result_object(baton, 0);
+      json_result = baton->json_result;
       mongox_destroy_baton(baton);
 
-      MGX_RETURN_VALUE(result);
+      MGX_RETURN_VALUE(json_result);
    }
 
 
-   static void EIO_About(uv_work_t *req)
+   static void EIO_Update(uv_work_t *req)
    {
       mongo_baton_t *baton = static_cast<mongo_baton_t *>(req->data);
 
-      baton->s->mongox_mgx_version(baton->s, baton);
+      baton->s->mongox_update(baton->s, baton);
 
       baton->s->m_count += baton->increment_by;
 
@@ -2137,22 +5341,26 @@ mongox_make_baton_exit:
    }
 
 
-   static void Version(const FunctionCallbackInfo<Value>& args)
+   static void Remove(const FunctionCallbackInfo<Value>& args)
    {
       Isolate* isolate = args.GetIsolate();
       HandleScope scope(isolate);
       short async;
+      MGXARENASTACK arena_stack; /* v1.5.17 */
       int js_narg;
-      server *s = ObjectWrap::Unwrap<server>(args.This());
+      Local<Object> json_result;
+      server * s = ObjectWrap::Unwrap<server>(args.This());
       s->m_count ++;
 
       MGX_CALLBACK_FUN(js_narg, cb, async);
 
-      mongo_baton_t *baton = mongox_make_baton(s, js_narg, args, MGX_METHOD_VERSION);
+      mongo_baton_t *baton = mongox_make_baton(s, js_narg, args, MGX_METHOD_REMOVE, async ? NULL : &arena_stack);
       MGX_MONGOAPI_ERROR();
 
       baton->s = s;
 
+      MGX_MONGOAPI_START();
+
       if (async) {
 
          Local<Function> cb = Local<Function>::Cast(args[js_narg]);
@@ -2161,25 +5369,28 @@ mongox_make_baton_exit:
 
          s->Ref();
 
-         mongox_queue_task((void *) EIO_Version, (void *) mongox_invoke_callback, baton, 0); /* v1.4.14 */
+         mongox_queue_task((void *) EIO_Remove, (void *) mongox_invoke_callback, baton, 0); /* v1.4.14 */
 
          return;
       }
 
-      s->mongox_mgx_version(s, baton);
+      s->mongox_remove(s, baton);
 
-      Local<String> result = mongox_new_string8(isolate, baton->p_mgxapi->output, 1);
+      MGX_MONGOAPI_END();
+
+      baton->json_result = mongox_result_object(baton, 0);
+      json_result = baton->json_result;
       mongox_destroy_baton(baton);
 
-      MGX_RETURN_VALUE(result);
+      MGX_RETURN_VALUE(json_result);
    }
 
 
-   static void EIO_Version(uv_work_t *req)
+   static void EIO_Remove(uv_work_t *req)
    {
       mongo_baton_t *baton = static_cast<mongo_baton_t *>(req->data);
 
-      baton->s->mongox_mgx_version(baton->s, baton);
+      baton->s->mongox_remove(baton->s, baton);
 
       baton->s->m_count += baton->increment_by;
 
@@ -2187,23 +5398,26 @@ mongox_make_baton_exit:
    }
 
 
-   static void Open(const FunctionCallbackInfo<Value>& args)
+   static void Command(const FunctionCallbackInfo<Value>& args)
    {
       Isolate* isolate = args.GetIsolate();
       HandleScope scope(isolate);
       short async;
-      int ret, js_narg;
+      MGXARENASTACK arena_stack; /* v1.5.17 */
+      int js_narg;
       Local<Object> json_result;
-      server *s = ObjectWrap::Unwrap<server>(args.This());
+      server * s = ObjectWrap::Unwrap<server>(args.This());
       s->m_count ++;
 
       MGX_CALLBACK_FUN(js_narg, cb, async);
 
-      mongo_baton_t *baton = mongox_make_baton(s, js_narg, args, MGX_METHOD_OPEN);
+      mongo_baton_t *baton = mongox_make_baton(s, js_narg, args, MGX_METHOD_COMMAND, async ? NULL : &arena_stack);
       MGX_MONGOAPI_ERROR();
 
       baton->s = s;
 
+      MGX_MONGOAPI_START();
+
       if (async) {
 
          Local<Function> cb = Local<Function>::Cast(args[js_narg]);
@@ -2212,16 +5426,13 @@ mongox_make_baton_exit:
 
          s->Ref();
 
-         mongox_queue_task((void *) EIO_Open, (void *) mongox_invoke_callback, baton, 0); /* v1.4.14 */
+         mongox_queue_task((void *) EIO_Command, (void *) mongox_invoke_callback, baton, 0); /* v1.4.14 */
 
          return;
       }
 
-      ret = s->mongox_open(s, baton);
+      s->mongox_command(s, baton);
 
-      if (ret == MONGO_OK) {
-         s->open = 1; 
-      }
       baton->json_result = mongox_result_object(baton, 0);
       json_result = baton->json_result;
       mongox_destroy_baton(baton);
@@ -2230,11 +5441,11 @@ mongox_make_baton_exit:
    }
 
 
-   static void EIO_Open(uv_work_t *req)
+   static void EIO_Command(uv_work_t *req)
    {
       mongo_baton_t *baton = static_cast<mongo_baton_t *>(req->data);
 
-      baton->s->mongox_open(baton->s, baton);
+      baton->s->mongox_command(baton->s, baton);
 
       baton->s->m_count += baton->increment_by;
 
@@ -2242,27 +5453,26 @@ mongox_make_baton_exit:
    }
 
 
-   static void Close(const FunctionCallbackInfo<Value>& args)
+   static void Create_Index(const FunctionCallbackInfo<Value>& args)
    {
       Isolate* isolate = args.GetIsolate();
       HandleScope scope(isolate);
       short async;
+      MGXARENASTACK arena_stack; /* v1.5.17 */
       int js_narg;
       Local<Object> json_result;
-      server *s = ObjectWrap::Unwrap<server>(args.This());
+      server * s = ObjectWrap::Unwrap<server>(args.This());
       s->m_count ++;
 
-      MGX_MONGOAPI_START();
-
-      s->open = 0;
-
       MGX_CALLBACK_FUN(js_narg, cb, async);
 
-      mongo_baton_t *baton = mongox_make_baton(s, js_narg, args, MGX_METHOD_CLOSE);
+      mongo_baton_t *baton = mongox_make_baton(s, js_narg, args, MGX_METHOD_CREATE_INDEX, async ? NULL : &arena_stack);
       MGX_MONGOAPI_ERROR();
 
       baton->s = s;
 
+      MGX_MONGOAPI_START();
+
       if (async) {
 
          Local<Function> cb = Local<Function>::Cast(args[js_narg]);
@@ -2271,14 +5481,12 @@ mongox_make_baton_exit:
 
          s->Ref();
 
-         mongox_queue_task((void *) EIO_Close, (void *) mongox_invoke_callback, baton, 0); /* v1.4.14 */
+         mongox_queue_task((void *) EIO_Create_Index, (void *) mongox_invoke_callback, baton, 0); /* v1.4.14 */
 
          return;
       }
 
-      s->mongox_close(s, baton);
-
-      MGX_MONGOAPI_END();
+      s->mongox_create_index(s, baton);
 
       baton->json_result = mongox_result_object(baton, 0);
       json_result = baton->json_result;
@@ -2288,11 +5496,11 @@ mongox_make_baton_exit:
    }
 
 
-   static void EIO_Close(uv_work_t *req)
+   static void EIO_Create_Index(uv_work_t *req)
    {
       mongo_baton_t *baton = static_cast<mongo_baton_t *>(req->data);
 
-      baton->s->mongox_close(baton->s, baton);
+      baton->s->mongox_create_index(baton->s, baton);
 
       baton->s->m_count += baton->increment_by;
 
@@ -2300,19 +5508,20 @@ mongox_make_baton_exit:
    }
 
 
-   static void Retrieve(const FunctionCallbackInfo<Value>& args)
+   static void Object_ID(const FunctionCallbackInfo<Value>& args)
    {
       Isolate* isolate = args.GetIsolate();
       HandleScope scope(isolate);
       short async;
+      MGXARENASTACK arena_stack; /* v1.5.17 */
       int js_narg;
       Local<Object> json_result;
-      server *s = ObjectWrap::Unwrap<server>(args.This());
+      server * s = ObjectWrap::Unwrap<server>(args.This());
       s->m_count ++;
 
       MGX_CALLBACK_FUN(js_narg, cb, async);
 
-      mongo_baton_t *baton = mongox_make_baton(s, js_narg, args, MGX_METHOD_RETRIEVE);
+      mongo_baton_t *baton = mongox_make_baton(s, js_narg, args, MGX_METHOD_OBJECT_ID, async ? NULL : &arena_stack);
       MGX_MONGOAPI_ERROR();
 
       baton->s = s;
@@ -2327,28 +5536,34 @@ mongox_make_baton_exit:
 
          s->Ref();
 
-         mongox_queue_task((void *) EIO_Retrieve, (void *) mongox_invoke_callback, baton, 0); /* v1.4.14 */
+         mongox_queue_task((void *) EIO_Object_ID, (void *) mongox_invoke_callback, baton, 0); /* v1.4.14 */
 
          return;
       }
 
-      s->mongox_retrieve(s, baton);
+      s->mongox_object_id(s, baton);
 
       MGX_MONGOAPI_END();
 
+      Local<String> result = mongox_new_string8(isolate, baton->p_mgxapi->output, 1);
+      mongox_destroy_baton(baton);
+
+      MGX_RETURN_VALUE(result);
+/*
       baton->json_result = mongox_result_object(baton, 0);
       json_result = baton->json_result;
       mongox_destroy_baton(baton);
 
       MGX_RETURN_VALUE(json_result);
+*/
    }
 
 
-   static void EIO_Retrieve(uv_work_t *req)
+   static void EIO_Object_ID(uv_work_t *req)
    {
       mongo_baton_t *baton = static_cast<mongo_baton_t *>(req->data);
 
-      baton->s->mongox_retrieve(baton->s, baton);
+      baton->s->mongox_object_id(baton->s, baton);
 
       baton->s->m_count += baton->increment_by;
 
@@ -2356,11 +5571,12 @@ mongox_make_baton_exit:
    }
 
 
-   static void Insert(const FunctionCallbackInfo<Value>& args)
+   static void Object_ID_Date(const FunctionCallbackInfo<Value>& args)
    {
       Isolate* isolate = args.GetIsolate();
       HandleScope scope(isolate);
       short async;
+      MGXARENASTACK arena_stack; /* v1.5.17 */
       int js_narg;
       Local<Object> json_result;
       server * s = ObjectWrap::Unwrap<server>(args.This());
@@ -2368,7 +5584,7 @@ mongox_make_baton_exit:
 
       MGX_CALLBACK_FUN(js_narg, cb, async);
 
-      mongo_baton_t *baton = mongox_make_baton(s, js_narg, args, MGX_METHOD_INSERT);
+      mongo_baton_t *baton = mongox_make_baton(s, js_narg, args, MGX_METHOD_OBJECT_ID_DATE, async ? NULL : &arena_stack);
       MGX_MONGOAPI_ERROR();
 
       baton->s = s;
@@ -2383,12 +5599,12 @@ mongox_make_baton_exit:
 
          s->Ref();
 
-         mongox_queue_task((void *) EIO_Insert, (void *) mongox_invoke_callback, baton, 0); /* v1.4.14 */
+         mongox_queue_task((void *) EIO_Object_ID_Date, (void *) mongox_invoke_callback, baton, 0); /* v1.4.14 */
 
          return;
       }
 
-      s->mongox_insert(s, baton);
+      s->mongox_object_id_date(s, baton);
 
       MGX_MONGOAPI_END();
 
@@ -2400,11 +5616,11 @@ mongox_make_baton_exit:
    }
 
 
-   static void EIO_Insert(uv_work_t *req)
+   static void EIO_Object_ID_Date(uv_work_t *req)
    {
       mongo_baton_t *baton = static_cast<mongo_baton_t *>(req->data);
 
-      baton->s->mongox_insert(baton->s, baton);
+      baton->s->mongox_object_id_date(baton->s, baton);
 
       baton->s->m_count += baton->increment_by;
 
@@ -2412,401 +5628,662 @@ mongox_make_baton_exit:
    }
 
 
-   static void Insert_Batch(const FunctionCallbackInfo<Value>& args)
+   /* v1.5.17 */
+   /* Generate a set of Object IDs in one call: the ids are reserved from the generator together */
+   static void Object_IDs(const FunctionCallbackInfo<Value>& args)
+   {
+      Isolate* isolate = args.GetIsolate();
+#if MGX_NODE_VERSION >= 100000
+      Local<Context> icontext = isolate->GetCurrentContext();
+#endif
+      HandleScope scope(isolate);
+      int n, an;
+      char *oid_str;
+      char buffer[256];
+      bson_oid_t *oids;
+      Local<Value> *elements;
+      Local<Array> result;
+      server * s = ObjectWrap::Unwrap<server>(args.This());
+      s->m_count ++;
+
+      if (args.Length() < 1 || !args[0]->IsNumber()) {
+         MGX_THROW_EXCEPTION((char *) "The number of Object IDs must be supplied to the Object IDs method");
+      }
+      n = (int) MGX_TOINT32(args[0]);
+      if (n < 1 || n > MGX_OBJECT_IDS_MAX) {
+         sprintf(buffer, "The number of Object IDs requested from the Object IDs method must be between 1 and %d", MGX_OBJECT_IDS_MAX);
+         MGX_THROW_EXCEPTION(buffer);
+      }
+
+      oids = (bson_oid_t *) mgx_malloc((sizeof(bson_oid_t) + 25) * n, 206);
+      if (!oids) {
+         MGX_THROW_EXCEPTION((char *) "Insufficient memory for Object IDs Method");
+      }
+      oid_str = (char *) (oids + n);
+      bson_oid_gen_n(oids, n);
+      bson_oid_to_string_n(oids, oid_str, n);
+
+      elements = new Local<Value>[n];
+      for (an = 0; an < n; an ++) {
+         elements[an] = mongox_new_string8n(isolate, oid_str + (an * 25), 24, 1);
+      }
+      mgx_free((void *) oids, 206);
+
+      result = mongox_new_array(isolate, elements, (unsigned int) n);
+      delete [] elements;
+
+      MGX_RETURN_VALUE(result);
+   }
+
+
+   /* v1.5.17 */
+   /* Module function (no server object) so that documents can be converted to BSON in any worker thread */
+   static void Encode(const FunctionCallbackInfo<Value>& args)
    {
       Isolate* isolate = args.GetIsolate();
       HandleScope scope(isolate);
-      short async;
+      MGXARENASTACK arena_stack;
       int js_narg;
-      Local<Object> json_result;
-      server * s = ObjectWrap::Unwrap<server>(args.This());
-      s->m_count ++;
+      bson *bobj;
+      Local<Object> result;
 
-      MGX_CALLBACK_FUN(js_narg, cb, async);
+      js_narg = args.Length();
 
-      mongo_baton_t *baton = mongox_make_baton(s, js_narg, args, MGX_METHOD_INSERT_BATCH);
+      mongo_baton_t *baton = mongox_make_baton(NULL, js_narg, args, MGX_METHOD_ENCODE, &arena_stack);
       MGX_MONGOAPI_ERROR();
 
-      baton->s = s;
+      bobj = baton->p_mgxapi->bobj_main;
+      if (bobj->err & BSON_NOT_UTF8) {
+         mongox_destroy_baton(baton);
+         MGX_THROW_EXCEPTION((char *) "Invalid UTF-8 string supplied to Encode Method");
+      }
 
-      MGX_MONGOAPI_START();
+      if (bobj->ownsData) {
+         /* The document outgrew its arena buffer: hand the heap block over to the Buffer */
+         result = MGX_BUFFER_NEW(bobj->data, (size_t) bson_size(bobj), mongox_free_buffer, (void *) bobj->data);
+         bobj->data = NULL;
+         bobj->ownsData = 0;
+      }
+      else {
+         result = MGX_BUFFER_COPY(bobj->data, (size_t) bson_size(bobj));
+      }
+      mongox_destroy_baton(baton);
 
-      if (async) {
+      MGX_RETURN_VALUE(result);
+   }
 
-         Local<Function> cb = Local<Function>::Cast(args[js_narg]);
-         baton->isolate = isolate;
-         baton->cb.Reset(isolate, cb);
+};
 
-         s->Ref();
 
-         mongox_queue_task((void *) EIO_Insert_Batch, (void *) mongox_invoke_callback, baton, 0); /* v1.4.14 */
+/*
+   v1.5.17
+   Cursor object returned by server.cursor().  The result set is fetched from the server one batch
+   at a time so that only the current batch is held in memory.  The server-side cursor is closed
+   when the result set is exhausted, when close() is called or when the cursor object is garbage
+   collected.
+*/
+class cursor : public node::ObjectWrap
+{
 
-         return;
-      }
+friend class server;
 
-      s->mongox_insert_batch(s, baton);
+typedef server::mongo_baton_t mongo_baton_t;
 
-      MGX_MONGOAPI_END();
+private:
 
-      baton->json_result = mongox_result_object(baton, 0);
-      json_result = baton->json_result;
-      mongox_destroy_baton(baton);
+   server               *s;
+   Persistent<Object>   server_obj;
+   mongo_cursor         *p_cursor;
+   bson                 *query;
+   bson                 *fields;
+   int                  batch_size;
+   mongo_reply          *reply;
+   char                 *next_doc;
+   int                  docs_left;
+   short                busy;
 
-      MGX_RETURN_VALUE(json_result);
+public:
+
+   static Local<String> mongox_new_string8(Isolate * isolate, char * buffer, int utf8)
+   {
+      return server::mongox_new_string8(isolate, buffer, utf8);
    }
 
-   static void EIO_Insert_Batch(uv_work_t *req)
+
+   static Local<Function> Init(Isolate *isolate)
    {
-      mongo_baton_t *baton = static_cast<mongo_baton_t *>(req->data);
+#if MGX_NODE_VERSION >= 100000
+      Local<Context> icontext = isolate->GetCurrentContext();
+#endif
+      Local<FunctionTemplate> t = FunctionTemplate::New(isolate, New);
+      t->InstanceTemplate()->SetInternalFieldCount(1);
+      t->SetClassName(mongox_new_string8(isolate, (char *) "cursor", 1));
 
-      baton->s->mongox_insert_batch(baton->s, baton);
+      MGX_NODE_SET_PROTOTYPE_METHOD("next", Next);
+      MGX_NODE_SET_PROTOTYPE_METHOD("close", Close);
 
-      baton->s->m_count += baton->increment_by;
+#if MGX_NODE_VERSION >= 120000
+      t->PrototypeTemplate()->Set(Symbol::GetAsyncIterator(isolate), FunctionTemplate::New(isolate, Async_Iterator));
+#endif
 
-      return;
+#if MGX_NODE_VERSION >= 100000
+      return t->GetFunction(icontext).ToLocalChecked();
+#else
+      return t->GetFunction();
+#endif
    }
 
 
-   static void Update(const FunctionCallbackInfo<Value>& args)
+   cursor() :
+      s(NULL), p_cursor(NULL), query(NULL), fields(NULL), batch_size(0), reply(NULL), next_doc(NULL), docs_left(0), busy(0)
    {
-      Isolate* isolate = args.GetIsolate();
-      HandleScope scope(isolate);
-      short async;
-      int js_narg;
-      Local<Object> json_result;
-      server * s = ObjectWrap::Unwrap<server>(args.This());
-      s->m_count ++;
-
-      MGX_CALLBACK_FUN(js_narg, cb, async);
-
-      mongo_baton_t *baton = mongox_make_baton(s, js_narg, args, MGX_METHOD_UPDATE);
-      MGX_MONGOAPI_ERROR();
+   }
 
-      baton->s = s;
 
-      MGX_MONGOAPI_START();
+   ~cursor()
+   {
+      mongox_cursor_close(this);
+      server_obj.Reset();
+   }
 
-      if (async) {
 
-         Local<Function> cb = Local<Function>::Cast(args[js_narg]);
-         baton->isolate = isolate;
-         baton->cb.Reset(isolate, cb);
+   static void New(const FunctionCallbackInfo<Value>& args)
+   {
+      Isolate* isolate = args.GetIsolate();
+      HandleScope scope(isolate);
+      cursor *c = new cursor();
+      c->Wrap(args.This());
 
-         s->Ref();
+      args.GetReturnValue().Set(args.This());
+      return;
+   }
 
-         mongox_queue_task((void *) EIO_Update, (void *) mongox_invoke_callback, baton, 0); /* v1.4.14 */
 
-         return;
+   static int mongox_cursor_close(cursor *c)
+   {
+      if (c->p_cursor) {
+         if (c->s && c->s->open) {
+            c->p_cursor->conn = &(c->s->mongo_connection);
+         }
+         else if (c->p_cursor->reply) {
+            c->p_cursor->reply->fields.cursorID = 0; /* no connection through which to kill it */
+         }
+         mongo_cursor_destroy(c->p_cursor);
+         c->p_cursor = NULL;
       }
+      if (c->reply) {
+         mongo_reply_free(c->reply);
+         c->reply = NULL;
+      }
+      c->next_doc = NULL;
+      c->docs_left = 0;
 
-      s->mongox_update(s, baton);
-
-      MGX_MONGOAPI_END();
-
-      baton->json_result = mongox_result_object(baton, 0);
-      json_result = baton->json_result;
-      mongox_destroy_baton(baton);
+      if (c->query) {
+         bson_destroy(c->query);
+         bson_free((void *) c->query);
+         c->query = NULL;
+      }
+      if (c->fields) {
+         bson_destroy(c->fields);
+         bson_free((void *) c->fields);
+         c->fields = NULL;
+      }
 
-      MGX_RETURN_VALUE(json_result);
+      return 0;
    }
 
 
-   static void EIO_Update(uv_work_t *req)
+   /* Take ownership of the batch fetched by server::mongox_cursor_next() */
+   static int mongox_cursor_update(cursor *c, mongo_baton_t *baton)
    {
-      mongo_baton_t *baton = static_cast<mongo_baton_t *>(req->data);
+      MGXREPLY *p_mgxreply;
 
-      baton->s->mongox_update(baton->s, baton);
+      if (!baton->cursor_fetch || baton->p_mgxapi->error[0]) {
+         return 0;
+      }
 
-      baton->s->m_count += baton->increment_by;
+      if (!baton->p_mgxapi->cursor) {
+         c->p_cursor = NULL; /* exhausted and destroyed in mongox_cursor_next() */
+      }
 
-      return;
+      p_mgxreply = baton->p_mgxapi->p_mgxreply_head;
+      if (p_mgxreply && p_mgxreply->reply) {
+         if (c->reply) {
+            mongo_reply_free(c->reply);
+         }
+         c->reply = p_mgxreply->reply;
+         p_mgxreply->reply = NULL;
+         c->next_doc = &(c->reply->objs);
+         c->docs_left = c->reply->fields.num;
+      }
+
+      return 0;
    }
 
 
-   static void Remove(const FunctionCallbackInfo<Value>& args)
+   static Local<Object> mongox_cursor_document(cursor *c)
    {
-      Isolate* isolate = args.GetIsolate();
-      HandleScope scope(isolate);
-      short async;
-      int js_narg;
-      Local<Object> json_result;
-      server * s = ObjectWrap::Unwrap<server>(args.This());
-      s->m_count ++;
+      Isolate* isolate = Isolate::GetCurrent();
+      EscapableHandleScope handle_scope(isolate);
+      bson bobj;
+      bson_iterator iterator;
+      Local<Object> jobj;
 
-      MGX_CALLBACK_FUN(js_narg, cb, async);
+      jobj = MGX_OBJECT_NEW();
 
-      mongo_baton_t *baton = mongox_make_baton(s, js_narg, args, MGX_METHOD_REMOVE);
-      MGX_MONGOAPI_ERROR();
+      bson_init_finished_data(&bobj, c->next_doc, 0);
+      server::mongox_parse_bson_object(c->s, NULL, jobj, &bobj, &iterator, 0, c->reply);
 
-      baton->s = s;
+      c->next_doc += bson_size(&bobj);
+      c->docs_left --;
+      if (c->docs_left <= 0) {
+         mongo_reply_free(c->reply);
+         c->reply = NULL;
+         c->next_doc = NULL;
+         c->docs_left = 0;
+      }
 
-      MGX_MONGOAPI_START();
+      return handle_scope.Escape(jobj);
+   }
 
-      if (async) {
 
-         Local<Function> cb = Local<Function>::Cast(args[js_narg]);
-         baton->isolate = isolate;
-         baton->cb.Reset(isolate, cb);
+   static Local<Object> mongox_cursor_result(cursor *c, mongo_baton_t *baton)
+   {
+      Isolate* isolate = Isolate::GetCurrent();
+#if MGX_NODE_VERSION >= 100000
+      Local<Context> icontext = isolate->GetCurrentContext();
+#endif
+      EscapableHandleScope handle_scope(isolate);
+      int an, n;
+      Local<String> key;
+      Local<Value> *elements;
+      Local<Array> a_subs;
 
-         s->Ref();
+      if (baton->p_mgxapi->error[0]) {
+         return handle_scope.Escape(server::mongox_result_object(baton, 0));
+      }
 
-         mongox_queue_task((void *) EIO_Remove, (void *) mongox_invoke_callback, baton, 0); /* v1.4.14 */
+      baton->result_iserror = 0;
+      baton->result_isarray = 0;
+      baton->json_result = MGX_OBJECT_NEW();
 
-         return;
-      }
+      key = mongox_new_string8(isolate, (char *) "ok", 1);
+      MGX_SET(baton->json_result, key, MGX_INTEGER_NEW(true));
 
-      s->mongox_remove(s, baton);
+      n = c->docs_left;
+      elements = n ? new Local<Value>[n] : NULL;
+      for (an = 0; an < n; an ++) {
+         elements[an] = mongox_cursor_document(c);
+      }
+      a_subs = server::mongox_new_array(isolate, elements, (unsigned int) n);
+      if (elements) {
+         delete [] elements;
+      }
 
-      MGX_MONGOAPI_END();
+      key = mongox_new_string8(isolate, (char *) "data", 1);
+      MGX_SET(baton->json_result, key, a_subs);
 
-      baton->json_result = mongox_result_object(baton, 0);
-      json_result = baton->json_result;
-      mongox_destroy_baton(baton);
+      key = mongox_new_string8(isolate, (char *) "more", 1);
+      MGX_SET(baton->json_result, key, MGX_BOOLEAN_NEW(c->p_cursor ? true : false));
 
-      MGX_RETURN_VALUE(json_result);
+      return handle_scope.Escape(baton->json_result);
    }
 
 
-   static void EIO_Remove(uv_work_t *req)
+   static mongo_baton_t * mongox_cursor_baton(cursor *c, const FunctionCallbackInfo<Value>& args, MGXARENASTACK *p_stack)
    {
-      mongo_baton_t *baton = static_cast<mongo_baton_t *>(req->data);
-
-      baton->s->mongox_remove(baton->s, baton);
+      mongo_baton_t *baton;
 
-      baton->s->m_count += baton->increment_by;
+      baton = server::mongox_make_baton(c->s, 0, args, MGX_METHOD_CURSOR_NEXT, p_stack);
+      if (!baton) {
+         return NULL;
+      }
+      baton->s = c->s;
+      baton->c = c;
+      baton->isolate = args.GetIsolate();
+
+      /* Only go to the server once the current batch has been consumed */
+      if (c->docs_left == 0 && c->p_cursor) {
+         baton->cursor_fetch = 1;
+         baton->p_mgxapi->cursor = c->p_cursor;
+         mongo_cursor_set_batch_size(c->p_cursor, c->batch_size);
+      }
 
-      return;
+      return baton;
    }
 
 
-   static void Command(const FunctionCallbackInfo<Value>& args)
+   static void Next(const FunctionCallbackInfo<Value>& args)
    {
       Isolate* isolate = args.GetIsolate();
+#if MGX_NODE_VERSION >= 100000
+      Local<Context> icontext = isolate->GetCurrentContext();
+#endif
       HandleScope scope(isolate);
       short async;
+      MGXARENASTACK arena_stack; /* v1.5.17 */
       int js_narg;
       Local<Object> json_result;
-      server * s = ObjectWrap::Unwrap<server>(args.This());
-      s->m_count ++;
+      cursor *c = ObjectWrap::Unwrap<cursor>(args.This());
+      server *s = c->s;
 
       MGX_CALLBACK_FUN(js_narg, cb, async);
 
-      mongo_baton_t *baton = mongox_make_baton(s, js_narg, args, MGX_METHOD_COMMAND);
-      MGX_MONGOAPI_ERROR();
+      MGX_MONGOAPI_START();
 
-      baton->s = s;
+      if (c->busy) {
+         MGX_THROW_EXCEPTION((char *) "A request for the next batch is already in progress for this cursor");
+      }
 
-      MGX_MONGOAPI_START();
+      if (js_narg > 0 && args[0]->IsNumber()) {
+         c->batch_size = (int) MGX_TOINT32(args[0]);
+      }
+
+      mongo_baton_t *baton = mongox_cursor_baton(c, args, async ? NULL : &arena_stack);
+      MGX_MONGOAPI_ERROR();
 
       if (async) {
 
          Local<Function> cb = Local<Function>::Cast(args[js_narg]);
-         baton->isolate = isolate;
          baton->cb.Reset(isolate, cb);
 
-         s->Ref();
+         c->busy = 1;
+         c->Ref();
 
-         mongox_queue_task((void *) EIO_Command, (void *) mongox_invoke_callback, baton, 0); /* v1.4.14 */
+#if MGX_NODE_VERSION >= 120000
+         if (!baton->cursor_fetch) {
+            /* The rest of the batch is already held (or the cursor is exhausted): no need for a worker or a connection */
+            isolate->EnqueueMicrotask(mongox_cursor_buffered, (void *) baton);
+            return;
+         }
+#endif
+
+         server::mongox_queue_task((void *) EIO_Next, (void *) mongox_cursor_callback, baton, 0);
 
          return;
       }
 
-      s->mongox_command(s, baton);
+      s->mongox_cursor_next(s, baton);
+      mongox_cursor_update(c, baton);
 
-      baton->json_result = mongox_result_object(baton, 0);
-      json_result = baton->json_result;
-      mongox_destroy_baton(baton);
+      json_result = mongox_cursor_result(c, baton);
+      server::mongox_destroy_baton(baton);
 
       MGX_RETURN_VALUE(json_result);
    }
 
 
-   static void EIO_Command(uv_work_t *req)
+#if MGX_NODE_VERSION >= 120000
+   static void mongox_cursor_buffered(void *data)
    {
-      mongo_baton_t *baton = static_cast<mongo_baton_t *>(req->data);
-
-      baton->s->mongox_command(baton->s, baton);
+      uv_work_t *req = new uv_work_t;
 
-      baton->s->m_count += baton->increment_by;
+      req->data = data;
+      mongox_cursor_callback(req, 0);
 
       return;
    }
+#endif
 
 
-   static void Create_Index(const FunctionCallbackInfo<Value>& args)
+   static void EIO_Next(uv_work_t *req)
    {
-      Isolate* isolate = args.GetIsolate();
-      HandleScope scope(isolate);
-      short async;
-      int js_narg;
-      Local<Object> json_result;
-      server * s = ObjectWrap::Unwrap<server>(args.This());
-      s->m_count ++;
+      mongo_baton_t *baton = static_cast<mongo_baton_t *>(req->data);
 
-      MGX_CALLBACK_FUN(js_narg, cb, async);
+      baton->s->mongox_cursor_next(baton->s, baton);
 
-      mongo_baton_t *baton = mongox_make_baton(s, js_narg, args, MGX_METHOD_CREATE_INDEX);
-      MGX_MONGOAPI_ERROR();
+      return;
+   }
 
-      baton->s = s;
 
-      MGX_MONGOAPI_START();
+   static void mongox_cursor_callback(uv_work_t *req, int status)
+   {
+      Isolate* isolate = Isolate::GetCurrent();
+      HandleScope scope(isolate);
+#if MGX_NODE_VERSION >= 100000
+      Local<Context> icontext = isolate->GetCurrentContext();
+#endif
+      mongo_baton_t *baton = static_cast<mongo_baton_t *>(req->data);
+      cursor *c = baton->c;
+      Local<Value> argv[2];
 
-      if (async) {
+      delete req;
 
-         Local<Function> cb = Local<Function>::Cast(args[js_narg]);
-         baton->isolate = isolate;
-         baton->cb.Reset(isolate, cb);
+      c->busy = 0;
 
-         s->Ref();
+      if (baton->p_conn) {
+         server::mongox_pool_release(baton->s, baton->p_conn);
+         baton->p_conn = NULL;
+      }
+#if MGX_NODE_VERSION >= 140800
+      if (server::mongox_env_stopping(isolate, baton->s)) {
+         server::mongox_discard_baton(baton);
+         return;
+      }
+#endif
 
-         mongox_queue_task((void *) EIO_Create_Index, (void *) mongox_invoke_callback, baton, 0); /* v1.4.14 */
+      mongox_cursor_update(c, baton);
 
-         return;
+#if MGX_NODE_VERSION >= 120000
+      if (!baton->resolver.IsEmpty()) {
+         if (!baton->p_mgxapi->error[0] && c->docs_left == 0 && c->p_cursor && (c->p_cursor->options & MONGO_AWAIT_DATA) && c->s->open) {
+            /* Empty batch from a cursor that is still open: try again, but only where the server waits for data before replying */
+            mgx_reply_free(baton->p_mgxapi);
+            baton->p_mgxapi->cursor = c->p_cursor;
+            c->busy = 1;
+            server::mongox_queue_task((void *) EIO_Next, (void *) mongox_cursor_callback, baton, 0);
+            return;
+         }
+
+         Local<Object> resource = MGX_OBJECT_NEW();
+         node::CallbackScope callback_scope(isolate, resource, node::async_context{0, 0});
+         Local<Promise::Resolver> resolver = Local<Promise::Resolver>::New(isolate, baton->resolver);
+
+         if (baton->p_mgxapi->error[0]) {
+            resolver->Reject(icontext, Exception::Error(mongox_new_string8(isolate, baton->p_mgxapi->error, 1))).FromJust();
+         }
+         else if (c->docs_left > 0) {
+            resolver->Resolve(icontext, mongox_iterator_result(isolate, mongox_cursor_document(c), false)).FromJust();
+         }
+         else {
+            resolver->Resolve(icontext, mongox_iterator_result(isolate, Undefined(isolate), true)).FromJust();
+         }
+         baton->resolver.Reset();
       }
+      else
+#endif
+      {
+         baton->json_result = mongox_cursor_result(c, baton);
 
-      s->mongox_create_index(s, baton);
+         argv[0] = MGX_INTEGER_NEW(baton->result_iserror ? true : false);
+         argv[1] = baton->json_result;
 
-      baton->json_result = mongox_result_object(baton, 0);
-      json_result = baton->json_result;
-      mongox_destroy_baton(baton);
+#if MGX_NODE_VERSION >= 40000
+         TryCatch try_catch(isolate);
+#else
+         TryCatch try_catch;
+#endif
+
+         Local<Function> cb = Local<Function>::New(isolate, baton->cb);
 
-      MGX_RETURN_VALUE(json_result);
-   }
+#if MGX_NODE_VERSION >= 120000
+         cb->Call(isolate->GetCurrentContext(), Null(isolate), 2, argv).IsEmpty(); /* v1.5.17: as in mongox_invoke_callback */
+#else
+         cb->Call(isolate->GetCurrentContext()->Global(), 2, argv);
+#endif
 
+         if (try_catch.HasCaught() && !try_catch.HasTerminated()) {
+            FatalException(isolate, try_catch);
+         }
 
-   static void EIO_Create_Index(uv_work_t *req)
-   {
-      mongo_baton_t *baton = static_cast<mongo_baton_t *>(req->data);
+         baton->cb.Reset();
+      }
 
-      baton->s->mongox_create_index(baton->s, baton);
+      server::mongox_destroy_baton(baton);
 
-      baton->s->m_count += baton->increment_by;
+      c->Unref();
 
       return;
    }
 
 
-   static void Object_ID(const FunctionCallbackInfo<Value>& args)
+   static void Close(const FunctionCallbackInfo<Value>& args)
    {
       Isolate* isolate = args.GetIsolate();
+#if MGX_NODE_VERSION >= 100000
+      Local<Context> icontext = isolate->GetCurrentContext();
+#endif
       HandleScope scope(isolate);
-      short async;
-      int js_narg;
+      Local<String> key;
       Local<Object> json_result;
-      server * s = ObjectWrap::Unwrap<server>(args.This());
-      s->m_count ++;
-
-      MGX_CALLBACK_FUN(js_narg, cb, async);
-
-      mongo_baton_t *baton = mongox_make_baton(s, js_narg, args, MGX_METHOD_OBJECT_ID);
-      MGX_MONGOAPI_ERROR();
-
-      baton->s = s;
-
-      MGX_MONGOAPI_START();
-
-      if (async) {
+      cursor *c = ObjectWrap::Unwrap<cursor>(args.This());
 
-         Local<Function> cb = Local<Function>::Cast(args[js_narg]);
-         baton->isolate = isolate;
-         baton->cb.Reset(isolate, cb);
-
-         s->Ref();
-
-         mongox_queue_task((void *) EIO_Object_ID, (void *) mongox_invoke_callback, baton, 0); /* v1.4.14 */
-
-         return;
+      if (c->busy) {
+         MGX_THROW_EXCEPTION((char *) "A request for the next batch is in progress for this cursor");
       }
 
-      s->mongox_object_id(s, baton);
-
-      MGX_MONGOAPI_END();
-
-      Local<String> result = mongox_new_string8(isolate, baton->p_mgxapi->output, 1);
-      mongox_destroy_baton(baton);
+      mongox_cursor_close(c);
 
-      MGX_RETURN_VALUE(result);
-/*
-      baton->json_result = mongox_result_object(baton, 0);
-      json_result = baton->json_result;
-      mongox_destroy_baton(baton);
+      json_result = MGX_OBJECT_NEW();
+      key = mongox_new_string8(isolate, (char *) "ok", 1);
+      MGX_SET(json_result, key, MGX_INTEGER_NEW(true));
 
       MGX_RETURN_VALUE(json_result);
-*/
    }
 
 
-   static void EIO_Object_ID(uv_work_t *req)
+#if MGX_NODE_VERSION >= 120000
+   static Local<Object> mongox_iterator_result(Isolate *isolate, Local<Value> value, bool done)
    {
-      mongo_baton_t *baton = static_cast<mongo_baton_t *>(req->data);
-
-      baton->s->mongox_object_id(baton->s, baton);
+      Local<Context> icontext = isolate->GetCurrentContext();
+      EscapableHandleScope handle_scope(isolate);
+      Local<Object> result;
 
-      baton->s->m_count += baton->increment_by;
+      result = MGX_OBJECT_NEW();
+      MGX_SET(result, mongox_new_string8(isolate, (char *) "value", 1), value);
+      MGX_SET(result, mongox_new_string8(isolate, (char *) "done", 1), MGX_BOOLEAN_NEW(done));
 
-      return;
+      return handle_scope.Escape(result);
    }
 
 
-   static void Object_ID_Date(const FunctionCallbackInfo<Value>& args)
+   static void Async_Iterator(const FunctionCallbackInfo<Value>& args)
    {
       Isolate* isolate = args.GetIsolate();
+      Local<Context> icontext = isolate->GetCurrentContext();
       HandleScope scope(isolate);
-      short async;
-      int js_narg;
-      Local<Object> json_result;
-      server * s = ObjectWrap::Unwrap<server>(args.This());
-      s->m_count ++;
-
-      MGX_CALLBACK_FUN(js_narg, cb, async);
-
-      mongo_baton_t *baton = mongox_make_baton(s, js_narg, args, MGX_METHOD_OBJECT_ID_DATE);
-      MGX_MONGOAPI_ERROR();
-
-      baton->s = s;
+      Local<Object> iterator;
 
-      MGX_MONGOAPI_START();
+      /* The iterator functions hold a reference to the cursor object through their data */
+      iterator = MGX_OBJECT_NEW();
+      MGX_SET(iterator, mongox_new_string8(isolate, (char *) "next", 1), Function::New(icontext, Iterator_Next, args.This()).ToLocalChecked());
+      MGX_SET(iterator, mongox_new_string8(isolate, (char *) "return", 1), Function::New(icontext, Iterator_Return, args.This()).ToLocalChecked());
 
-      if (async) {
+      MGX_RETURN_VALUE(iterator);
+   }
 
-         Local<Function> cb = Local<Function>::Cast(args[js_narg]);
-         baton->isolate = isolate;
-         baton->cb.Reset(isolate, cb);
 
-         s->Ref();
+   static void Iterator_Next(const FunctionCallbackInfo<Value>& args)
+   {
+      Isolate* isolate = args.GetIsolate();
+      Local<Context> icontext = isolate->GetCurrentContext();
+      HandleScope scope(isolate);
+      Local<Object> cobj = Local<Object>::Cast(args.Data());
+      cursor *c = ObjectWrap::Unwrap<cursor>(cobj);
+      Local<Promise::Resolver> resolver = Promise::Resolver::New(icontext).ToLocalChecked();
 
-         mongox_queue_task((void *) EIO_Object_ID_Date, (void *) mongox_invoke_callback, baton, 0); /* v1.4.14 */
+      args.GetReturnValue().Set(resolver->GetPromise());
 
+      if (c->docs_left > 0) {
+         resolver->Resolve(icontext, mongox_iterator_result(isolate, mongox_cursor_document(c), false)).FromJust();
+         return;
+      }
+      if (!c->p_cursor) {
+         resolver->Resolve(icontext, mongox_iterator_result(isolate, Undefined(isolate), true)).FromJust();
+         return;
+      }
+      if (!c->s->open) {
+         resolver->Reject(icontext, Exception::Error(mongox_new_string8(isolate, (char *) "Connection not established to Mongo Database", 1))).FromJust();
+         return;
+      }
+      if (c->busy) {
+         resolver->Reject(icontext, Exception::Error(mongox_new_string8(isolate, (char *) "A request for the next batch is already in progress for this cursor", 1))).FromJust();
          return;
       }
 
-      s->mongox_object_id_date(s, baton);
+      mongo_baton_t *baton = mongox_cursor_baton(c, args, NULL);
+      if (!baton) {
+         resolver->Reject(icontext, Exception::Error(mongox_new_string8(isolate, (char *) "Unable to process arguments", 1))).FromJust();
+         return;
+      }
+      baton->resolver.Reset(isolate, resolver);
 
-      MGX_MONGOAPI_END();
+      c->busy = 1;
+      c->Ref();
 
-      baton->json_result = mongox_result_object(baton, 0);
-      json_result = baton->json_result;
-      mongox_destroy_baton(baton);
+      server::mongox_queue_task((void *) EIO_Next, (void *) mongox_cursor_callback, baton, 0);
 
-      MGX_RETURN_VALUE(json_result);
+      return;
    }
 
 
-   static void EIO_Object_ID_Date(uv_work_t *req)
+   static void Iterator_Return(const FunctionCallbackInfo<Value>& args)
    {
-      mongo_baton_t *baton = static_cast<mongo_baton_t *>(req->data);
+      Isolate* isolate = args.GetIsolate();
+      Local<Context> icontext = isolate->GetCurrentContext();
+      HandleScope scope(isolate);
+      Local<Object> cobj = Local<Object>::Cast(args.Data());
+      cursor *c = ObjectWrap::Unwrap<cursor>(cobj);
+      Local<Promise::Resolver> resolver = Promise::Resolver::New(icontext).ToLocalChecked();
 
-      baton->s->mongox_object_id_date(baton->s, baton);
+      args.GetReturnValue().Set(resolver->GetPromise());
 
-      baton->s->m_count += baton->increment_by;
+      /* Called when a for await...of loop is exited early: release the server-side cursor */
+      if (!c->busy) {
+         mongox_cursor_close(c);
+      }
+      resolver->Resolve(icontext, mongox_iterator_result(isolate, Undefined(isolate), true)).FromJust();
 
       return;
    }
+#endif
 
 };
 
 
+Local<Value> server::mongox_cursor_constructor(Isolate *isolate)
+{
+   return cursor::Init(isolate);
+}
+
+
+int server::mongox_cursor_init(Isolate *isolate, Local<Object> cobj, server *s, Local<Object> sobj, mongo_baton_t *baton)
+{
+   cursor *c = ObjectWrap::Unwrap<cursor>(cobj);
+
+   c->s = s;
+   c->server_obj.Reset(isolate, sobj);
+
+   c->query = bson_alloc();
+   bson_copy(c->query, baton->p_mgxapi->bobj_ref);
+   if (baton->p_mgxapi->bobj_fields) {
+      c->fields = bson_alloc();
+      bson_copy(c->fields, baton->p_mgxapi->bobj_fields);
+   }
+
+   c->p_cursor = mongo_cursor_alloc();
+   mongo_cursor_init(c->p_cursor, &(s->mongo_connection), baton->p_mgxapi->file_name);
+   c->p_cursor->flags |= MONGO_CURSOR_MUST_FREE;
+   mongo_cursor_set_query(c->p_cursor, c->query);
+   mongo_cursor_set_fields(c->p_cursor, c->fields);
+   mongo_cursor_set_limit(c->p_cursor, baton->p_mgxapi->limit);
+   mongo_cursor_set_skip(c->p_cursor, baton->p_mgxapi->skip);
+   mongo_cursor_set_options(c->p_cursor, baton->p_mgxapi->options);
+
+   return 0;
+}
+
+
 /* v1.4.13 */
 #if MGX_NODE_VERSION >= 120000
 class mgx_addon_data
@@ -2816,34 +6293,31 @@ public:
 
    mgx_addon_data(Isolate* isolate, Local<Object> exports):
       call_count(0) {
-         /* Link the existence of this object instance to the existence of exports. */
-         exports_.Reset(isolate, exports);
-         exports_.SetWeak(this, DeleteMe, WeakCallbackType::kParameter);
+         /* v1.5.17 */
+         /*
+         Server objects hold a pointer to the field name cache and can outlive
+         "exports", so this object is destroyed with the environment (main
+         thread or worker) rather than with "exports".
+         */
+         p_keys = server::mongox_keys_alloc();
+         node::AddEnvironmentCleanupHook(isolate, DeleteMe, this);
       }
 
    ~mgx_addon_data() {
-      if (!exports_.IsEmpty()) {
-         /* Reset the reference to avoid leaking data. */
-         exports_.ClearWeak();
-         exports_.Reset();
-      }
+      server::mongox_keys_free(p_keys);
+      p_keys = NULL;
    }
 
    /* Per-addon data. */
    int call_count;
+   MGXKEYS *p_keys; /* v1.5.17 */
 
 private:
 
-   /* Method to call when "exports" is about to be garbage-collected. */
-   static void DeleteMe(const WeakCallbackInfo<mgx_addon_data>& info) {
-      delete info.GetParameter();
+   /* Method to call when the environment is torn down. */
+   static void DeleteMe(void *arg) {
+      delete static_cast<mgx_addon_data *>(arg);
    }
-
-   /*
-   Weak handle to the "exports" object. An instance of this class will be
-   destroyed along with the exports object to which it is weakly bound.
-   */
-   v8::Persistent<v8::Object> exports_;
 };
 #endif
 
@@ -2852,23 +6326,6 @@ Persistent<Function> server::s_ct;
 
 
 extern "C" {
-#if defined(_WIN32)
-#if MGX_NODE_VERSION >= 100000
-void __declspec(dllexport) init (Local<Object> exports)
-#else
-void __declspec(dllexport) init (Handle<Object> exports)
-#endif
-#else
-#if MGX_NODE_VERSION >= 100000
-static void init (Local<Object> exports)
-#else
-static void init (Handle<Object> exports)
-#endif
-#endif
-{
-   server::Init(exports);
-}
-
 #if MGX_NODE_VERSION >= 120000
 
 /* exports, module, context */
@@ -2889,7 +6346,7 @@ NODE_MODULE_INITIALIZER(Local<Object> exports,
    /* Local<External> external = External::New(isolate, data); */
    External::New(isolate, data);
 
-   init(exports);
+   server::Init(exports, data->p_keys); /* v1.5.17 */
 
    /*
    Expose the method "Method" to JavaScript, and make sure it receives the
@@ -2902,6 +6359,23 @@ NODE_MODULE_INITIALIZER(Local<Object> exports,
 
 #else
 
+#if defined(_WIN32)
+#if MGX_NODE_VERSION >= 100000
+void __declspec(dllexport) init (Local<Object> exports)
+#else
+void __declspec(dllexport) init (Handle<Object> exports)
+#endif
+#else
+#if MGX_NODE_VERSION >= 100000
+static void init (Local<Object> exports)
+#else
+static void init (Handle<Object> exports)
+#endif
+#endif
+{
+   server::Init(exports, NULL);
+}
+
    NODE_MODULE(server, init);
 
 #endif
@@ -2930,66 +6404,256 @@ int mgx_free(void *p, short id)
 }
 
 
-bson * mgx_bson_alloc(MGXAPI * p_mgxapi, int init, short id)
+/* v1.5.17 */
+int mgx_mutex_lock(void)
 {
-   bson *bson;
-   MGXBSON *p_mgxbson;
+#if defined(_WIN32)
+   EnterCriticalSection(&mgx_async_mutex);
+#else
+   pthread_mutex_lock(&mgx_async_mutex);
+#endif
+   return 0;
+}
 
-   bson = NULL;
-   p_mgxbson = (MGXBSON *) mgx_malloc(sizeof(MGXBSON), id);
 
-   if (p_mgxbson) {
-      p_mgxbson->bobj = bson_alloc();
+int mgx_mutex_unlock(void)
+{
+#if defined(_WIN32)
+   LeaveCriticalSection(&mgx_async_mutex);
+#else
+   pthread_mutex_unlock(&mgx_async_mutex);
+#endif
+   return 0;
+}
 
-      /* printf("\r\n +++++++ mgx_bson_alloc: p_mgxbson=%p; p_mgxbson->bson=%p;", p_mgxbson, p_mgxbson->bson); */
 
-      if (p_mgxbson->bobj) {
-         if (init) {
-            bson_init(p_mgxbson->bobj);
-         }
-         p_mgxbson->id = id;
-         p_mgxbson->p_next = NULL;
-         if (p_mgxapi->p_mgxbson_tail) {
-            p_mgxapi->p_mgxbson_tail->p_next = p_mgxbson;
-            p_mgxapi->p_mgxbson_tail = p_mgxbson;
-         }
-         else {
-            p_mgxapi->p_mgxbson_head = p_mgxbson;
-            p_mgxapi->p_mgxbson_tail = p_mgxbson;
+/* v1.5.17 */
+MGXARENA * mgx_arena_get(void)
+{
+   MGXARENA *p_arena;
+
+   mgx_mutex_lock();
+   p_arena = mgx_arena_free_list;
+   if (p_arena) {
+      mgx_arena_free_list = p_arena->p_next;
+      mgx_arena_free_no --;
+   }
+   mgx_mutex_unlock();
+
+   if (!p_arena) {
+      p_arena = (MGXARENA *) mgx_malloc((int) (sizeof(MGXARENA) + MGX_ARENA_SIZE), 301);
+      if (!p_arena) {
+         return NULL;
+      }
+      p_arena->size = MGX_ARENA_SIZE;
+   }
+
+   p_arena->p_cur = (char *) (p_arena + 1);
+   p_arena->p_end = p_arena->p_cur + p_arena->size;
+   p_arena->p_blocks = NULL;
+   p_arena->p_mgxbson = NULL;
+   p_arena->p_next = NULL;
+   p_arena->recycle = 1;
+
+   return p_arena;
+}
+
+
+/* v1.5.17 */
+MGXARENA * mgx_arena_stack(MGXARENASTACK *p_stack)
+{
+   MGXARENA *p_arena;
+
+   p_arena = &(p_stack->arena);
+   p_arena->size = sizeof(p_stack->buffer);
+   p_arena->p_cur = (char *) p_stack->buffer;
+   p_arena->p_cur += (16 - ((size_t) p_arena->p_cur & 15)) & 15;
+   p_arena->p_end = (char *) p_stack->buffer + p_arena->size;
+   p_arena->p_blocks = NULL;
+   p_arena->p_mgxbson = NULL;
+   p_arena->p_next = NULL;
+   p_arena->recycle = 0;
+
+   return p_arena;
+}
+
+
+void * mgx_arena_alloc(MGXARENA *p_arena, size_t size)
+{
+   void *p;
+   MGXARENABLOCK *p_block;
+
+   size = (size + 15) & ~((size_t) 15);
+
+   if (size > (size_t) (p_arena->p_end - p_arena->p_cur)) {
+      if (size > (MGX_ARENA_SIZE / 4)) {
+         /* Large allocations get a block of their own so that the current block can continue to be used */
+         p_block = (MGXARENABLOCK *) mgx_malloc((int) (sizeof(MGXARENABLOCK) + size), 302);
+         if (!p_block) {
+            return NULL;
          }
-         bson = p_mgxbson->bobj;
+         p_block->size = size;
+         p_block->p_next = p_arena->p_blocks;
+         p_arena->p_blocks = p_block;
+         return (void *) (p_block + 1);
+      }
+      p_block = (MGXARENABLOCK *) mgx_malloc((int) (sizeof(MGXARENABLOCK) + MGX_ARENA_SIZE), 302);
+      if (!p_block) {
+         return NULL;
+      }
+      p_block->size = MGX_ARENA_SIZE;
+      p_block->p_next = p_arena->p_blocks;
+      p_arena->p_blocks = p_block;
+      p_arena->p_cur = (char *) (p_block + 1);
+      p_arena->p_end = p_arena->p_cur + MGX_ARENA_SIZE;
+   }
+
+   p = (void *) p_arena->p_cur;
+   p_arena->p_cur += size;
+
+   return p;
+}
+
+
+int mgx_arena_release(MGXARENA *p_arena)
+{
+   MGXBSON *p_mgxbson;
+   MGXARENABLOCK *p_block, *p_block_next;
+
+   if (!p_arena) {
+      return 0;
+   }
+
+   /* Only bson objects that outgrew their arena buffer own any memory */
+   for (p_mgxbson = p_arena->p_mgxbson; p_mgxbson; p_mgxbson = p_mgxbson->p_next) {
+      bson_destroy(&(p_mgxbson->bobj));
+   }
+   p_arena->p_mgxbson = NULL;
+
+   for (p_block = p_arena->p_blocks; p_block; p_block = p_block_next) {
+      p_block_next = p_block->p_next;
+      mgx_free((void *) p_block, 302);
+   }
+   p_arena->p_blocks = NULL;
+
+   if (!p_arena->recycle) {
+      return 0; /* on the caller's stack */
+   }
+
+   mgx_mutex_lock();
+   if (mgx_arena_free_no < MGX_ARENA_FREE_MAX) {
+      p_arena->p_next = mgx_arena_free_list;
+      mgx_arena_free_list = p_arena;
+      mgx_arena_free_no ++;
+      p_arena = NULL;
+   }
+   mgx_mutex_unlock();
+
+   if (p_arena) {
+      mgx_free((void *) p_arena, 301);
+   }
+
+   return 0;
+}
+
+
+bson * mgx_bson_alloc(MGXAPI * p_mgxapi, int init, short id)
+{
+   MGXARENA *p_arena;
+   MGXBSON *p_mgxbson;
+   char *buffer;
+
+   /* v1.5.17 */
+   p_arena = p_mgxapi->p_arena;
+   p_mgxbson = (MGXBSON *) mgx_arena_alloc(p_arena, sizeof(MGXBSON));
+   if (!p_mgxbson) {
+      return NULL;
+   }
+
+   bson_init_zero(&(p_mgxbson->bobj));
+   if (init) {
+      buffer = (char *) mgx_arena_alloc(p_arena, MGX_ARENA_BSON_SIZE);
+      if (buffer) {
+         bson_init_buffer(&(p_mgxbson->bobj), buffer, MGX_ARENA_BSON_SIZE);
       }
       else {
-         mgx_free((void *) p_mgxbson, id);
+         bson_init(&(p_mgxbson->bobj));
       }
    }
-   return bson;
+
+   p_mgxbson->p_next = p_arena->p_mgxbson;
+   p_arena->p_mgxbson = p_mgxbson;
+
+   return &(p_mgxbson->bobj);
 }
 
 
-int mgx_bson_free(MGXAPI * p_mgxapi)
+/* v1.5.17 */
+int mgx_reply_add(MGXAPI * p_mgxapi, mongo_reply *reply, short id)
 {
-   MGXBSON *p_mgxbson, *p_mgxbson_next;
+   MGXREPLY *p_mgxreply;
+
+   p_mgxreply = (MGXREPLY *) mgx_arena_alloc(p_mgxapi->p_arena, sizeof(MGXREPLY));
+   if (!p_mgxreply) {
+      mongo_reply_free(reply);
+      return -1;
+   }
+
+   p_mgxreply->id = id;
+   p_mgxreply->reply = reply;
+   p_mgxreply->p_next = NULL;
+   if (p_mgxapi->p_mgxreply_tail) {
+      p_mgxapi->p_mgxreply_tail->p_next = p_mgxreply;
+      p_mgxapi->p_mgxreply_tail = p_mgxreply;
+   }
+   else {
+      p_mgxapi->p_mgxreply_head = p_mgxreply;
+      p_mgxapi->p_mgxreply_tail = p_mgxreply;
+   }
 
-   p_mgxbson = p_mgxapi->p_mgxbson_head;
-   while (p_mgxbson) {
+   return 0;
+}
 
-      /* printf("\r\n ------- mgx_bson_free : p_mgxbson=%p; p_mgxbson->bson=%p;", p_mgxbson, p_mgxbson->bson); */
 
-      p_mgxbson_next = p_mgxbson->p_next;
-      bson_destroy(p_mgxbson->bobj);
-      bson_free((void *) p_mgxbson->bobj);
-      mgx_free((void *) p_mgxbson, p_mgxbson->id);
-      p_mgxbson = p_mgxbson_next;
+int mgx_reply_free(MGXAPI * p_mgxapi)
+{
+   MGXREPLY *p_mgxreply, *p_mgxreply_next;
+
+   p_mgxreply = p_mgxapi->p_mgxreply_head;
+   while (p_mgxreply) {
+      p_mgxreply_next = p_mgxreply->p_next;
+      mongo_reply_free(p_mgxreply->reply);
+      p_mgxreply = p_mgxreply_next;
    }
 
-   p_mgxapi->p_mgxbson_head = NULL;
-   p_mgxapi->p_mgxbson_tail = NULL;
+   p_mgxapi->p_mgxreply_head = NULL;
+   p_mgxapi->p_mgxreply_tail = NULL;
 
    return 0;
 }
 
 
+/* v1.5.17 */
+int mgx_is_ascii(const char *buffer, size_t len)
+{
+   size_t n;
+   uint64_t word;
+
+   for (n = 0; (n + 8) <= len; n += 8) {
+      memcpy((void *) &word, (void *) (buffer + n), 8);
+      if (word & 0x8080808080808080ULL) {
+         return 0;
+      }
+   }
+   for (; n < len; n ++) {
+      if (((unsigned char) buffer[n]) & 0x80) {
+         return 0;
+      }
+   }
+   return 1;
+}
+
+
 int mgx_ucase(char *string)
 {
 #ifdef _UNICODE